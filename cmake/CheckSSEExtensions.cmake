@@ -129,6 +129,26 @@ CHECK_CXX_SOURCE_RUNS("
         }"
         HAS_AVX_EXTENSION)
 
+################################################################################
+# AVX2
+################################################################################
+
+if(IS_GNU OR IS_CLANG)
+    set(CMAKE_REQUIRED_FLAGS "-mavx2")
+endif()
+
+CHECK_CXX_SOURCE_RUNS("
+        #include <immintrin.h>
+        #include <stdio.h>
+        int main() {
+          __m256i a = _mm256_set1_epi16(2);
+          __m256i b = _mm256_set1_epi16(3);
+          __m256i c = _mm256_madd_epi16(a, b);
+          int* i = (int*)&c;
+          return 0;
+        }"
+        HAS_AVX2_EXTENSION)
+
 ################################################################################
 # Setup the compile flags
 ################################################################################
@@ -163,6 +183,10 @@ if(IS_GNU OR IS_CLANG)
     if(HAS_AVX_EXTENSION)
         set(SSE_FLAGS "${SSE_FLAGS} -mavx")
     endif()
+
+    if(HAS_AVX2_EXTENSION)
+        set(SSE_FLAGS "${SSE_FLAGS} -mavx2")
+    endif()
 endif()
 
 set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${SSE_FLAGS}")
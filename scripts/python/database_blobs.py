@@ -0,0 +1,87 @@
+# COLMAP - Structure-from-Motion and Multi-View Stereo.
+# Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# This module decodes the keypoint and match blobs of a COLMAP database. Since
+# schema version 2, the blobs are stored in different encodings, as indicated
+# by the `encoding` column of the `keypoints`, `matches`, and `inlier_matches`
+# tables. Select the columns `rows, data, encoding` to decode the blobs.
+
+import math
+import numpy as np
+
+
+ENCODING_RAW = 0
+ENCODING_COMPACT = 1
+ENCODING_QUANTIZED = 2
+
+COMPACT_MATCHES_VARINT = 0
+COMPACT_MATCHES_UINT16 = 1
+
+SCALE_LOG2_OFFSET = 16.0
+SCALE_LOG2_RESOLUTION = 2047.0
+
+
+def blob_to_keypoints(rows, data, encoding=ENCODING_RAW):
+    if encoding == ENCODING_RAW:
+        return np.frombuffer(data, dtype=np.float32).reshape(-1, 4)
+    assert encoding == ENCODING_QUANTIZED
+    dtype = np.dtype([("x", "<f4"), ("y", "<f4"),
+                      ("scale", "<u2"), ("orientation", "<u2")])
+    quantized = np.frombuffer(data, dtype=dtype, count=rows)
+    keypoints = np.zeros((rows, 4), dtype=np.float32)
+    keypoints[:, 0] = quantized["x"]
+    keypoints[:, 1] = quantized["y"]
+    scale = quantized["scale"].astype(np.float64)
+    keypoints[:, 2] = np.where(
+        scale == 0, 0, np.exp2((scale - 1) / SCALE_LOG2_RESOLUTION
+                               - SCALE_LOG2_OFFSET))
+    keypoints[:, 3] = \
+        quantized["orientation"] / 65536.0 * 2 * math.pi - math.pi
+    return keypoints
+
+
+def read_varint(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if byte & 0x80 == 0:
+            return value, offset
+        shift += 7
+
+
+def blob_to_matches(rows, data, encoding=ENCODING_RAW):
+    if encoding == ENCODING_RAW:
+        return np.frombuffer(data, dtype=np.uint32).reshape(-1, 2)
+    assert encoding == ENCODING_COMPACT
+    matches = np.zeros((rows, 2), dtype=np.uint32)
+    if rows == 0:
+        return matches
+    data = bytearray(data)
+    if data[0] == COMPACT_MATCHES_UINT16:
+        matches[:] = np.frombuffer(bytes(data[1:]), dtype="<u2").reshape(-1, 2)
+        return matches
+    assert data[0] == COMPACT_MATCHES_VARINT
+    offset = 1
+    idx1 = 0
+    for i in range(rows):
+        delta, offset = read_varint(data, offset)
+        idx1 += (delta >> 1) ^ -(delta & 1)
+        idx2, offset = read_varint(data, offset)
+        matches[i] = (idx1, idx2)
+    return matches
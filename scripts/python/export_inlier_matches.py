@@ -19,7 +19,8 @@
 import os
 import argparse
 import sqlite3
-import numpy as np
+
+from database_blobs import blob_to_matches
 
 
 def parse_args():
@@ -51,12 +52,12 @@ def main():
         images[image_id] = image_name
 
     with open(os.path.join(args.output_path), "w") as fid:
-        cursor.execute("SELECT pair_id, data FROM inlier_matches WHERE rows>=?;",
+        cursor.execute("SELECT pair_id, rows, data, encoding FROM "
+                       "inlier_matches WHERE rows>=?;",
                        (args.min_num_matches,))
         for row in cursor:
             pair_id = row[0]
-            inlier_matches = np.fromstring(row[1],
-                                           dtype=np.uint32).reshape(-1, 2)
+            inlier_matches = blob_to_matches(*row[1:])
             image_id1, image_id2 = pair_id_to_image_ids(pair_id)
             image_name1 = images[image_id1]
             image_name2 = images[image_id2]
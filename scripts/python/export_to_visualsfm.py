@@ -24,6 +24,8 @@ import shutil
 import gzip
 import numpy as np
 
+from database_blobs import blob_to_keypoints, blob_to_matches
+
 
 def parse_args():
     parser = argparse.ArgumentParser()
@@ -80,14 +82,14 @@ def main():
         if os.path.exists(key_file_name):
             continue
 
-        cursor.execute("SELECT data FROM keypoints WHERE image_id=?;",
-                       (image_id,))
+        cursor.execute("SELECT rows, data, encoding FROM keypoints "
+                       "WHERE image_id=?;", (image_id,))
         row = next(cursor)
-        if row[0] is None:
+        if row[1] is None:
             keypoints = np.zeros((0, 4), dtype=np.float32)
             descriptors = np.zeros((0, 128), dtype=np.uint8)
         else:
-            keypoints = np.fromstring(row[0], dtype=np.float32).reshape(-1, 4)
+            keypoints = blob_to_keypoints(*row)
             cursor.execute("SELECT data FROM descriptors WHERE image_id=?;",
                            (image_id,))
             row = next(cursor)
@@ -102,12 +104,12 @@ def main():
                 fid.write("\n")
 
     with open(os.path.join(args.output_path, "matches.txt"), "w") as fid:
-        cursor.execute("SELECT pair_id, data FROM inlier_matches "
-                       "WHERE rows>=?;", (args.min_num_matches,))
+        cursor.execute("SELECT pair_id, rows, data, encoding FROM "
+                       "inlier_matches WHERE rows>=?;",
+                       (args.min_num_matches,))
         for row in cursor:
             pair_id = row[0]
-            inlier_matches = np.fromstring(row[1],
-                                           dtype=np.uint32).reshape(-1, 2)
+            inlier_matches = blob_to_matches(*row[1:])
             image_id1, image_id2 = pair_id_to_image_ids(pair_id)
             image_name1 = images[image_id1][1]
             image_name2 = images[image_id2][1]
@@ -16,15 +16,23 @@
 
 #include "base/database.h"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <iostream>
+#include <limits>
 
 #include <boost/lexical_cast.hpp>
 
+#include "util/math.h"
 #include "util/string.h"
 
 namespace colmap {
 namespace {
 
+// Maximum time in milliseconds to wait for a locked database.
+const int kBusyTimeoutMs = 60000;
+
 typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
     FeatureKeypointsBlob;
 typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
@@ -32,8 +40,31 @@ typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
 typedef Eigen::Matrix<point2D_t, Eigen::Dynamic, 2, Eigen::RowMajor>
     FeatureMatchesBlob;
 
-void SwapFeatureMatchesBlob(FeatureMatchesBlob* matches) {
-  matches->col(0).swap(matches->col(1));
+// Encoding of the keypoint and match blobs, as stored in the `encoding`
+// column. Blobs written before schema version 2 use the raw encoding.
+enum class BlobEncoding {
+  // Row-major matrix with 4 float (keypoints) or 2 uint32 (matches) columns.
+  RAW = 0,
+  // Matches with zig-zag delta varints of the first and varints of the second
+  // indices or with 2 uint16 columns, whichever representation is smaller.
+  COMPACT = 1,
+  // Keypoints with float locations and quantized uint16 scale/orientation.
+  QUANTIZED = 2,
+};
+
+// Layout of the compact match blobs, as indicated by their first byte.
+const uint8_t kCompactMatchesVarint = 0;
+const uint8_t kCompactMatchesUInt16 = 1;
+
+// Quantization of the keypoint scale on a log2-scale in the range
+// [2^-kScaleLog2Offset, 2^kScaleLog2Offset], where zero scales are preserved.
+const double kScaleLog2Offset = 16.0;
+const double kScaleLog2Resolution = 2047.0;
+
+void SwapFeatureMatches(FeatureMatches* matches) {
+  for (auto& match : *matches) {
+    std::swap(match.point2D_idx1, match.point2D_idx2);
+  }
 }
 
 FeatureKeypointsBlob FeatureKeypointsToBlob(const FeatureKeypoints& keypoints) {
@@ -60,16 +91,6 @@ FeatureKeypoints FeatureKeypointsFromBlob(const FeatureKeypointsBlob& blob) {
   return keypoints;
 }
 
-FeatureMatchesBlob FeatureMatchesToBlob(const FeatureMatches& matches) {
-  const FeatureMatchesBlob::Index kNumCols = 2;
-  FeatureMatchesBlob blob(matches.size(), kNumCols);
-  for (size_t i = 0; i < matches.size(); ++i) {
-    blob(i, 0) = matches[i].point2D_idx1;
-    blob(i, 1) = matches[i].point2D_idx2;
-  }
-  return blob;
-}
-
 FeatureMatches FeatureMatchesFromBlob(const FeatureMatchesBlob& blob) {
   CHECK_EQ(blob.cols(), 2);
   FeatureMatches matches(static_cast<size_t>(blob.rows()));
@@ -80,6 +101,179 @@ FeatureMatches FeatureMatchesFromBlob(const FeatureMatchesBlob& blob) {
   return matches;
 }
 
+void WriteVarint(uint64_t value, std::vector<uint8_t>* data) {
+  while (value >= 0x80) {
+    data->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  data->push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t ReadVarint(const uint8_t** data, const uint8_t* data_end) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    CHECK_LT(*data, data_end) << "Corrupt varint in blob";
+    const uint8_t byte = **data;
+    *data += 1;
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  LOG(FATAL) << "Corrupt varint in blob";
+  return value;
+}
+
+uint64_t ZigZagEncode(const int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t ZigZagDecode(const uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+std::vector<uint8_t> FeatureMatchesToCompactBlob(
+    const FeatureMatches& matches) {
+  // Matches are typically sorted by their first index, so that the deltas of
+  // the first index are small, while the second index is in random order.
+  std::vector<uint8_t> varint_data;
+  varint_data.reserve(1 + 3 * matches.size());
+  varint_data.push_back(kCompactMatchesVarint);
+  int64_t prev_point2D_idx1 = 0;
+  point2D_t max_point2D_idx = 0;
+  for (const auto& match : matches) {
+    WriteVarint(ZigZagEncode(static_cast<int64_t>(match.point2D_idx1) -
+                             prev_point2D_idx1),
+                &varint_data);
+    WriteVarint(match.point2D_idx2, &varint_data);
+    prev_point2D_idx1 = match.point2D_idx1;
+    max_point2D_idx = std::max(
+        max_point2D_idx, std::max(match.point2D_idx1, match.point2D_idx2));
+  }
+
+  const size_t num_uint16_bytes = 1 + 2 * sizeof(uint16_t) * matches.size();
+  if (max_point2D_idx > std::numeric_limits<uint16_t>::max() ||
+      varint_data.size() <= num_uint16_bytes) {
+    return varint_data;
+  }
+
+  std::vector<uint8_t> uint16_data(num_uint16_bytes);
+  uint16_data[0] = kCompactMatchesUInt16;
+  // The indices start at an odd offset, so they are copied instead of stored
+  // through a misaligned pointer.
+  uint8_t* uint16_ptr = uint16_data.data() + 1;
+  for (const auto& match : matches) {
+    const uint16_t point2D_idxs[2] = {
+        static_cast<uint16_t>(match.point2D_idx1),
+        static_cast<uint16_t>(match.point2D_idx2)};
+    memcpy(uint16_ptr, point2D_idxs, sizeof(point2D_idxs));
+    uint16_ptr += sizeof(point2D_idxs);
+  }
+  return uint16_data;
+}
+
+FeatureMatches FeatureMatchesFromCompactBlob(const uint8_t* data,
+                                             const size_t num_bytes,
+                                             const size_t num_matches) {
+  FeatureMatches matches(num_matches);
+  if (num_matches == 0) {
+    return matches;
+  }
+
+  CHECK_GT(num_bytes, 0);
+  const uint8_t* data_end = data + num_bytes;
+  const uint8_t layout = *data;
+  data += 1;
+
+  if (layout == kCompactMatchesUInt16) {
+    CHECK_EQ(num_bytes, 1 + 2 * sizeof(uint16_t) * num_matches);
+    for (auto& match : matches) {
+      uint16_t point2D_idxs[2];
+      memcpy(point2D_idxs, data, sizeof(point2D_idxs));
+      match.point2D_idx1 = point2D_idxs[0];
+      match.point2D_idx2 = point2D_idxs[1];
+      data += sizeof(point2D_idxs);
+    }
+  } else {
+    CHECK_EQ(layout, kCompactMatchesVarint);
+    int64_t point2D_idx1 = 0;
+    for (auto& match : matches) {
+      point2D_idx1 += ZigZagDecode(ReadVarint(&data, data_end));
+      match.point2D_idx1 = static_cast<point2D_t>(point2D_idx1);
+      match.point2D_idx2 =
+          static_cast<point2D_t>(ReadVarint(&data, data_end));
+    }
+    CHECK_EQ(data, data_end);
+  }
+
+  return matches;
+}
+
+std::vector<uint8_t> FeatureKeypointsToQuantizedBlob(
+    const FeatureKeypoints& keypoints) {
+  const size_t kNumBytesPerKeypoint = 2 * sizeof(float) + 2 * sizeof(uint16_t);
+  std::vector<uint8_t> data(kNumBytesPerKeypoint * keypoints.size());
+  uint8_t* data_ptr = data.data();
+  for (const auto& keypoint : keypoints) {
+    uint16_t quantized_scale = 0;
+    if (keypoint.scale > 0) {
+      const double log2_scale =
+          std::log2(static_cast<double>(keypoint.scale)) + kScaleLog2Offset;
+      quantized_scale = static_cast<uint16_t>(
+          1 + std::min(std::max(std::round(log2_scale * kScaleLog2Resolution),
+                                0.0),
+                       65534.0));
+    }
+
+    // Map the orientation to [-pi, pi) and quantize it to the int16 range.
+    double orientation =
+        std::fmod(static_cast<double>(keypoint.orientation) + M_PI, 2 * M_PI);
+    if (orientation < 0) {
+      orientation += 2 * M_PI;
+    }
+    const uint16_t quantized_orientation = static_cast<uint16_t>(
+        static_cast<int64_t>(std::round(orientation / (2 * M_PI) * 65536.0)) &
+        0xFFFF);
+
+    memcpy(data_ptr, &keypoint.x, sizeof(float));
+    memcpy(data_ptr + sizeof(float), &keypoint.y, sizeof(float));
+    memcpy(data_ptr + 2 * sizeof(float), &quantized_scale, sizeof(uint16_t));
+    memcpy(data_ptr + 2 * sizeof(float) + sizeof(uint16_t),
+           &quantized_orientation, sizeof(uint16_t));
+    data_ptr += kNumBytesPerKeypoint;
+  }
+  return data;
+}
+
+FeatureKeypoints FeatureKeypointsFromQuantizedBlob(const uint8_t* data,
+                                                   const size_t num_bytes,
+                                                   const size_t num_keypoints) {
+  const size_t kNumBytesPerKeypoint = 2 * sizeof(float) + 2 * sizeof(uint16_t);
+  CHECK_EQ(num_bytes, kNumBytesPerKeypoint * num_keypoints);
+  FeatureKeypoints keypoints(num_keypoints);
+  for (auto& keypoint : keypoints) {
+    uint16_t quantized_scale;
+    uint16_t quantized_orientation;
+    memcpy(&keypoint.x, data, sizeof(float));
+    memcpy(&keypoint.y, data + sizeof(float), sizeof(float));
+    memcpy(&quantized_scale, data + 2 * sizeof(float), sizeof(uint16_t));
+    memcpy(&quantized_orientation, data + 2 * sizeof(float) + sizeof(uint16_t),
+           sizeof(uint16_t));
+    data += kNumBytesPerKeypoint;
+
+    if (quantized_scale == 0) {
+      keypoint.scale = 0.0f;
+    } else {
+      keypoint.scale = static_cast<float>(std::exp2(
+          (quantized_scale - 1) / kScaleLog2Resolution - kScaleLog2Offset));
+    }
+    keypoint.orientation = static_cast<float>(
+        quantized_orientation / 65536.0 * 2 * M_PI - M_PI);
+  }
+  return keypoints;
+}
+
 template <typename MatrixType>
 MatrixType ReadMatrixBlob(sqlite3_stmt* sql_stmt, const int rc, const int col) {
   CHECK_GE(col, 0);
@@ -132,6 +326,83 @@ void WriteMatrixBlob(sqlite3_stmt* sql_stmt, const MatrixType& matrix,
                                  static_cast<int>(num_bytes), SQLITE_STATIC));
 }
 
+// Read the keypoints from the `rows`, `cols`, `data`, and `encoding` columns
+// starting at the given column index.
+FeatureKeypoints ReadKeypointsBlob(sqlite3_stmt* sql_stmt, const int rc,
+                                   const int col) {
+  if (rc != SQLITE_ROW) {
+    return FeatureKeypoints();
+  }
+
+  const BlobEncoding encoding =
+      static_cast<BlobEncoding>(sqlite3_column_int(sql_stmt, col + 3));
+  if (encoding == BlobEncoding::RAW) {
+    return FeatureKeypointsFromBlob(
+        ReadMatrixBlob<FeatureKeypointsBlob>(sql_stmt, rc, col));
+  }
+
+  CHECK(encoding == BlobEncoding::QUANTIZED) << "Unknown keypoints encoding";
+  return FeatureKeypointsFromQuantizedBlob(
+      static_cast<const uint8_t*>(sqlite3_column_blob(sql_stmt, col + 2)),
+      static_cast<size_t>(sqlite3_column_bytes(sql_stmt, col + 2)),
+      static_cast<size_t>(sqlite3_column_int64(sql_stmt, col + 0)));
+}
+
+// Read the matches from the `rows`, `cols`, `data`, and `encoding` columns
+// starting at the given column index.
+FeatureMatches ReadMatchesBlob(sqlite3_stmt* sql_stmt, const int rc,
+                               const int col) {
+  if (rc != SQLITE_ROW) {
+    return FeatureMatches();
+  }
+
+  const BlobEncoding encoding =
+      static_cast<BlobEncoding>(sqlite3_column_int(sql_stmt, col + 3));
+  if (encoding == BlobEncoding::RAW) {
+    return FeatureMatchesFromBlob(
+        ReadMatrixBlob<FeatureMatchesBlob>(sql_stmt, rc, col));
+  }
+
+  CHECK(encoding == BlobEncoding::COMPACT) << "Unknown matches encoding";
+  return FeatureMatchesFromCompactBlob(
+      static_cast<const uint8_t*>(sqlite3_column_blob(sql_stmt, col + 2)),
+      static_cast<size_t>(sqlite3_column_bytes(sql_stmt, col + 2)),
+      static_cast<size_t>(sqlite3_column_int64(sql_stmt, col + 0)));
+}
+
+// Bind the encoded data to the `rows`, `cols`, `data`, and `encoding` columns
+// starting at the given column index. Important: the data must live until the
+// query is executed.
+void WriteEncodedBlob(sqlite3_stmt* sql_stmt, const size_t rows,
+                      const size_t cols, const std::vector<uint8_t>& data,
+                      const BlobEncoding encoding, const int col) {
+  CHECK_GE(col, 0);
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, col + 0, rows));
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, col + 1, cols));
+  SQLITE3_CALL(sqlite3_bind_blob(sql_stmt, col + 2,
+                                 reinterpret_cast<const char*>(data.data()),
+                                 static_cast<int>(data.size()), SQLITE_STATIC));
+  SQLITE3_CALL(
+      sqlite3_bind_int64(sql_stmt, col + 3, static_cast<int>(encoding)));
+}
+
+// Bind the filter to the parameters of a statement with the conditions
+// `rows >= ? AND config != ? AND pair_id >= ? AND pair_id < ?`.
+void BindInlierMatchesFilter(sqlite3_stmt* sql_stmt,
+                             const Database::InlierMatchesFilter& filter) {
+  const sqlite3_int64 min_num_matches =
+      std::max<sqlite3_int64>(1, filter.min_num_matches);
+  // No valid configuration is negative, so -1 does not exclude any pair.
+  const int excluded_config =
+      filter.ignore_watermarks ? TwoViewGeometry::WATERMARK : -1;
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1, min_num_matches));
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 2, excluded_config));
+  SQLITE3_CALL(sqlite3_bind_int64(
+      sql_stmt, 3, static_cast<sqlite3_int64>(filter.min_pair_id)));
+  SQLITE3_CALL(sqlite3_bind_int64(
+      sql_stmt, 4, static_cast<sqlite3_int64>(filter.max_pair_id)));
+}
+
 Camera ReadCameraRow(sqlite3_stmt* sql_stmt) {
   Camera camera;
 
@@ -167,12 +438,38 @@ Image ReadImageRow(sqlite3_stmt* sql_stmt) {
   return image;
 }
 
+// FNV-1a hash of the given bytes, consumed in 64-bit words where possible.
+uint64_t HashBytes(uint64_t hash, const void* data, const size_t num_bytes) {
+  const uint64_t kPrime = 0x100000001b3ULL;
+  const char* bytes = static_cast<const char*>(data);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= num_bytes; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(uint64_t));
+    hash = (hash ^ word) * kPrime;
+  }
+  for (; i < num_bytes; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(bytes[i])) * kPrime;
+  }
+  return hash;
+}
+
+uint64_t HashValue(const uint64_t hash, const sqlite3_int64 value) {
+  return HashBytes(hash, &value, sizeof(value));
+}
+
 }  // namespace
 
 const size_t Database::kMaxNumImages =
     static_cast<size_t>(std::numeric_limits<int32_t>::max());
 
-Database::Database() : database_(nullptr) {}
+std::atomic<bool> Database::default_collect_stats_(false);
+std::atomic<bool> Database::default_quantize_keypoints_(false);
+
+Database::Database()
+    : database_(nullptr),
+      collect_stats_(false),
+      quantize_keypoints_(default_quantize_keypoints_) {}
 
 Database::Database(const std::string& path) : Database() { Open(path); }
 
@@ -202,20 +499,171 @@ void Database::Open(const std::string& path) {
   // Disabled by default
   SQLITE3_EXEC(database_, "PRAGMA foreign_keys=ON", nullptr);
 
+  // Wait for concurrent writers on other connections to the same database,
+  // e.g. an asynchronous `DatabaseWriter`, instead of failing immediately.
+  SQLITE3_CALL(sqlite3_busy_timeout(database_, kBusyTimeoutMs));
+
   CreateTables();
   UpdateSchema();
 
   PrepareSQLStatements();
+
+  if (default_collect_stats_) {
+    SetCollectStats(true);
+  }
+}
+
+void Database::OpenReadOnly(const std::string& path) {
+  Close();
+
+  SQLITE3_CALL(sqlite3_open_v2(path.c_str(), &database_,
+                               SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                               nullptr));
+
+  // Store temporary tables and indices in memory
+  SQLITE3_EXEC(database_, "PRAGMA temp_store=MEMORY", nullptr);
+
+  // Wait for concurrent writers on other connections to the same database.
+  SQLITE3_CALL(sqlite3_busy_timeout(database_, kBusyTimeoutMs));
+
+  PrepareSQLStatements();
+
+  if (default_collect_stats_) {
+    SetCollectStats(true);
+  }
+}
+
+std::string Database::Path() const {
+  const char* path = sqlite3_db_filename(database_, "main");
+  return path == nullptr ? "" : std::string(path);
 }
 
 void Database::Close() {
   if (database_ != nullptr) {
+    if (collect_stats_) {
+      PrintStats();
+      SetCollectStats(false);
+    }
     FinalizeSQLStatements();
     sqlite3_close_v2(database_);
     database_ = nullptr;
   }
 }
 
+void Database::SetCollectStats(const bool collect_stats) {
+  CHECK_NOTNULL(database_);
+  collect_stats_ = collect_stats;
+  if (collect_stats_) {
+    SQLITE3_CALL(sqlite3_trace_v2(database_, SQLITE_TRACE_PROFILE,
+                                  &Database::TraceCallback, this));
+    ResetStats();
+  } else {
+    SQLITE3_CALL(sqlite3_trace_v2(database_, 0, nullptr, nullptr));
+  }
+}
+
+void Database::SetDefaultCollectStats(const bool collect_stats) {
+  default_collect_stats_ = collect_stats;
+}
+
+struct Database::Stats Database::Stats() const {
+  struct Stats stats;
+  {
+    std::unique_lock<std::mutex> lock(stats_mutex_);
+    stats = stats_;
+  }
+
+  int current = 0;
+  int highwater = 0;
+  SQLITE3_CALL(sqlite3_db_status(database_, SQLITE_DBSTATUS_CACHE_HIT,
+                                 &current, &highwater, 0));
+  stats.num_cache_hits = static_cast<size_t>(current);
+  SQLITE3_CALL(sqlite3_db_status(database_, SQLITE_DBSTATUS_CACHE_MISS,
+                                 &current, &highwater, 0));
+  stats.num_cache_misses = static_cast<size_t>(current);
+  SQLITE3_CALL(sqlite3_db_status(database_, SQLITE_DBSTATUS_CACHE_WRITE,
+                                 &current, &highwater, 0));
+  stats.num_cache_writes = static_cast<size_t>(current);
+
+  return stats;
+}
+
+void Database::ResetStats() {
+  CHECK_NOTNULL(database_);
+
+  int current = 0;
+  int highwater = 0;
+  for (const int op : {SQLITE_DBSTATUS_CACHE_HIT, SQLITE_DBSTATUS_CACHE_MISS,
+                       SQLITE_DBSTATUS_CACHE_WRITE}) {
+    SQLITE3_CALL(sqlite3_db_status(database_, op, &current, &highwater, 1));
+  }
+
+  sqlite3_stmt* sql_stmt;
+  SQLITE3_CALL(
+      sqlite3_prepare_v2(database_, "PRAGMA page_size;", -1, &sql_stmt, 0));
+  size_t page_size = 0;
+  if (SQLITE3_CALL(sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+    page_size = static_cast<size_t>(sqlite3_column_int64(sql_stmt, 0));
+  }
+  SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+
+  struct Stats stats;
+  stats.page_size = page_size;
+
+  std::unique_lock<std::mutex> lock(stats_mutex_);
+  stats_ = stats;
+}
+
+void Database::PrintStats() const {
+  const struct Stats stats = Stats();
+
+  std::cout << StringPrintf("Database statistics for %s", Path().c_str())
+            << std::endl;
+
+  std::vector<std::pair<std::string, Stats::Statement>> statements(
+      stats.statements.begin(), stats.statements.end());
+  std::sort(statements.begin(), statements.end(),
+            [](const std::pair<std::string, Stats::Statement>& statement1,
+               const std::pair<std::string, Stats::Statement>& statement2) {
+              return statement1.second.elapsed_time >
+                     statement2.second.elapsed_time;
+            });
+  std::cout << "  Statements:" << std::endl;
+  for (const auto& statement : statements) {
+    std::cout << StringPrintf("    %10d calls %10.3fs  %s",
+                              statement.second.num_calls,
+                              statement.second.elapsed_time,
+                              statement.first.c_str())
+              << std::endl;
+  }
+
+  std::cout << "  Tables:" << std::endl;
+  for (const auto& table : stats.tables) {
+    std::cout << StringPrintf(
+                     "    %-16s read %d rows / %.3fMB, "
+                     "written %d rows / %.3fMB",
+                     table.first.c_str(), table.second.num_rows_read,
+                     table.second.num_bytes_read / 1024.0 / 1024.0,
+                     table.second.num_rows_written,
+                     table.second.num_bytes_written / 1024.0 / 1024.0)
+              << std::endl;
+  }
+
+  std::cout << StringPrintf("  Transactions: %d in %.3fs (max %.3fs)",
+                            stats.num_transactions, stats.transaction_time,
+                            stats.max_transaction_time)
+            << std::endl;
+
+  const double kPagesToMB = stats.page_size / 1024.0 / 1024.0;
+  std::cout << StringPrintf(
+                   "  Page cache: %d hits, %d misses (%.3fMB read), "
+                   "%d writes (%.3fMB written)",
+                   stats.num_cache_hits, stats.num_cache_misses,
+                   stats.num_cache_misses * kPagesToMB, stats.num_cache_writes,
+                   stats.num_cache_writes * kPagesToMB)
+            << std::endl;
+}
+
 bool Database::ExistsCamera(const camera_t camera_id) const {
   return ExistsRowId(sql_stmt_exists_camera_, camera_id);
 }
@@ -349,16 +797,33 @@ std::vector<Image> Database::ReadAllImages() const {
   return images;
 }
 
+std::unordered_set<std::string> Database::ReadImageNamesWithFeatures() const {
+  std::unordered_set<std::string> image_names;
+
+  while (SQLITE3_CALL(sqlite3_step(
+             sql_stmt_read_image_names_with_features_)) == SQLITE_ROW) {
+    image_names.emplace(reinterpret_cast<const char*>(sqlite3_column_text(
+        sql_stmt_read_image_names_with_features_, 0)));
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_image_names_with_features_));
+
+  return image_names;
+}
+
 FeatureKeypoints Database::ReadKeypoints(const image_t image_id) const {
   SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_keypoints_, 1, image_id));
 
   const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_keypoints_));
-  const FeatureKeypointsBlob blob =
-      ReadMatrixBlob<FeatureKeypointsBlob>(sql_stmt_read_keypoints_, rc, 0);
+  const FeatureKeypoints keypoints =
+      ReadKeypointsBlob(sql_stmt_read_keypoints_, rc, 0);
+  if (rc == SQLITE_ROW) {
+    RecordBlobRead("keypoints", sql_stmt_read_keypoints_, 2);
+  }
 
   SQLITE3_CALL(sqlite3_reset(sql_stmt_read_keypoints_));
 
-  return FeatureKeypointsFromBlob(blob);
+  return keypoints;
 }
 
 FeatureDescriptors Database::ReadDescriptors(const image_t image_id) const {
@@ -367,6 +832,9 @@ FeatureDescriptors Database::ReadDescriptors(const image_t image_id) const {
   const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_descriptors_));
   const FeatureDescriptors descriptors =
       ReadMatrixBlob<FeatureDescriptors>(sql_stmt_read_descriptors_, rc, 0);
+  if (rc == SQLITE_ROW) {
+    RecordBlobRead("descriptors", sql_stmt_read_descriptors_, 2);
+  }
 
   SQLITE3_CALL(sqlite3_reset(sql_stmt_read_descriptors_));
 
@@ -379,34 +847,27 @@ FeatureMatches Database::ReadMatches(image_t image_id1,
   SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_matches_, 1, pair_id));
 
   const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_matches_));
-  FeatureMatchesBlob blob =
-      ReadMatrixBlob<FeatureMatchesBlob>(sql_stmt_read_matches_, rc, 0);
+  FeatureMatches matches = ReadMatchesBlob(sql_stmt_read_matches_, rc, 0);
+  if (rc == SQLITE_ROW) {
+    RecordBlobRead("matches", sql_stmt_read_matches_, 2);
+  }
 
   SQLITE3_CALL(sqlite3_reset(sql_stmt_read_matches_));
 
   if (SwapImagePair(image_id1, image_id2)) {
-    SwapFeatureMatchesBlob(&blob);
+    SwapFeatureMatches(&matches);
   }
 
-  return FeatureMatchesFromBlob(blob);
+  return matches;
 }
 
 std::vector<std::pair<image_pair_t, FeatureMatches>> Database::ReadAllMatches()
     const {
   std::vector<std::pair<image_pair_t, FeatureMatches>> all_matches;
-
-  int rc;
-  while ((rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_matches_all_))) ==
-         SQLITE_ROW) {
-    const image_pair_t pair_id = static_cast<image_pair_t>(
-        sqlite3_column_int64(sql_stmt_read_matches_all_, 0));
-    const FeatureMatchesBlob blob =
-        ReadMatrixBlob<FeatureMatchesBlob>(sql_stmt_read_matches_all_, rc, 1);
-    all_matches.emplace_back(pair_id, FeatureMatchesFromBlob(blob));
-  }
-
-  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_matches_all_));
-
+  ForEachMatches(
+      [&all_matches](const image_pair_t pair_id, const FeatureMatches& matches) {
+        all_matches.emplace_back(pair_id, matches);
+      });
   return all_matches;
 }
 
@@ -419,43 +880,65 @@ TwoViewGeometry Database::ReadInlierMatches(const image_t image_id1,
 
   TwoViewGeometry two_view_geometry;
 
-  FeatureMatchesBlob blob =
-      ReadMatrixBlob<FeatureMatchesBlob>(sql_stmt_read_inlier_matches_, rc, 0);
+  two_view_geometry.inlier_matches =
+      ReadMatchesBlob(sql_stmt_read_inlier_matches_, rc, 0);
+  if (rc == SQLITE_ROW) {
+    RecordBlobRead("inlier_matches", sql_stmt_read_inlier_matches_, 2);
+  }
 
   two_view_geometry.config =
-      static_cast<int>(sqlite3_column_int64(sql_stmt_read_inlier_matches_, 3));
+      static_cast<int>(sqlite3_column_int64(sql_stmt_read_inlier_matches_, 4));
 
   SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_));
 
   if (SwapImagePair(image_id1, image_id2)) {
-    SwapFeatureMatchesBlob(&blob);
+    SwapFeatureMatches(&two_view_geometry.inlier_matches);
   }
 
-  two_view_geometry.inlier_matches = FeatureMatchesFromBlob(blob);
-
   return two_view_geometry;
 }
 
 void Database::ReadAllInlierMatches(
     std::vector<image_pair_t>* image_pair_ids,
     std::vector<TwoViewGeometry>* two_view_geometries) const {
-  int rc;
-  while ((rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_inlier_matches_all_))) ==
-         SQLITE_ROW) {
-    const image_pair_t pair_id = static_cast<image_pair_t>(
-        sqlite3_column_int64(sql_stmt_read_inlier_matches_all_, 0));
-    image_pair_ids->push_back(pair_id);
+  ReadInlierMatchesInRange(0, InlierMatchesFilter().max_pair_id,
+                           image_pair_ids, two_view_geometries);
+}
 
-    TwoViewGeometry two_view_geometry;
-    const FeatureMatchesBlob blob = ReadMatrixBlob<FeatureMatchesBlob>(
-        sql_stmt_read_inlier_matches_all_, rc, 1);
-    two_view_geometry.config = static_cast<int>(
-        sqlite3_column_int64(sql_stmt_read_inlier_matches_all_, 4));
-    two_view_geometry.inlier_matches = FeatureMatchesFromBlob(blob);
+void Database::ReadInlierMatchesInRange(
+    const image_pair_t min_pair_id, const image_pair_t max_pair_id,
+    std::vector<image_pair_t>* image_pair_ids,
+    std::vector<TwoViewGeometry>* two_view_geometries) const {
+  InlierMatchesFilter filter;
+  filter.min_pair_id = min_pair_id;
+  filter.max_pair_id = max_pair_id;
+  ForEachInlierMatches(filter, [&](const image_pair_t pair_id,
+                                   const TwoViewGeometry& two_view_geometry) {
+    image_pair_ids->push_back(pair_id);
     two_view_geometries->push_back(two_view_geometry);
+  });
+}
+
+void Database::ForEachMatchesPairId(
+    const std::function<void(const image_pair_t)>& callback) const {
+  while (SQLITE3_CALL(sqlite3_step(sql_stmt_read_matches_pair_ids_)) ==
+         SQLITE_ROW) {
+    callback(static_cast<image_pair_t>(
+        sqlite3_column_int64(sql_stmt_read_matches_pair_ids_, 0)));
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_matches_pair_ids_));
+}
+
+void Database::ForEachInlierMatchesPairId(
+    const std::function<void(const image_pair_t)>& callback) const {
+  while (SQLITE3_CALL(sqlite3_step(sql_stmt_read_inlier_matches_pair_ids_)) ==
+         SQLITE_ROW) {
+    callback(static_cast<image_pair_t>(
+        sqlite3_column_int64(sql_stmt_read_inlier_matches_pair_ids_, 0)));
   }
 
-  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_all_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_pair_ids_));
 }
 
 void Database::ReadInlierMatchesGraph(
@@ -465,22 +948,109 @@ void Database::ReadInlierMatchesGraph(
   image_pairs->reserve(num_inlier_matches);
   num_inliers->reserve(num_inlier_matches);
 
+  ForEachInlierMatchesGraph(
+      InlierMatchesFilter(),
+      [&](const image_pair_t pair_id, const int num_pair_inliers) {
+        image_t image_id1;
+        image_t image_id2;
+        PairIdToImagePair(pair_id, &image_id1, &image_id2);
+        image_pairs->emplace_back(image_id1, image_id2);
+        num_inliers->push_back(num_pair_inliers);
+      });
+}
+
+void Database::ForEachMatches(
+    const std::function<void(const image_pair_t, const FeatureMatches&)>&
+        callback) const {
+  int rc;
+  while ((rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_matches_all_))) ==
+         SQLITE_ROW) {
+    const image_pair_t pair_id = static_cast<image_pair_t>(
+        sqlite3_column_int64(sql_stmt_read_matches_all_, 0));
+    RecordBlobRead("matches", sql_stmt_read_matches_all_, 3);
+    callback(pair_id, ReadMatchesBlob(sql_stmt_read_matches_all_, rc, 1));
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_matches_all_));
+}
+
+void Database::ForEachInlierMatches(
+    const InlierMatchesFilter& filter,
+    const std::function<void(const image_pair_t, const TwoViewGeometry&)>&
+        callback) const {
+  BindInlierMatchesFilter(sql_stmt_read_inlier_matches_filtered_, filter);
+
   int rc;
   while ((rc = SQLITE3_CALL(sqlite3_step(
-              sql_stmt_read_inlier_matches_graph_))) == SQLITE_ROW) {
-    image_t image_id1;
-    image_t image_id2;
+              sql_stmt_read_inlier_matches_filtered_))) == SQLITE_ROW) {
     const image_pair_t pair_id = static_cast<image_pair_t>(
-        sqlite3_column_int64(sql_stmt_read_inlier_matches_graph_, 0));
-    PairIdToImagePair(pair_id, &image_id1, &image_id2);
-    image_pairs->emplace_back(image_id1, image_id2);
+        sqlite3_column_int64(sql_stmt_read_inlier_matches_filtered_, 0));
+    TwoViewGeometry two_view_geometry;
+    two_view_geometry.inlier_matches =
+        ReadMatchesBlob(sql_stmt_read_inlier_matches_filtered_, rc, 1);
+    two_view_geometry.config = static_cast<int>(
+        sqlite3_column_int64(sql_stmt_read_inlier_matches_filtered_, 5));
+    RecordBlobRead("inlier_matches", sql_stmt_read_inlier_matches_filtered_,
+                   3);
+    callback(pair_id, two_view_geometry);
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_filtered_));
+}
+
+void Database::ForEachInlierMatchesGraph(
+    const InlierMatchesFilter& filter,
+    const std::function<void(const image_pair_t, const int)>& callback) const {
+  BindInlierMatchesFilter(sql_stmt_read_inlier_matches_graph_filtered_,
+                          filter);
 
+  while (SQLITE3_CALL(sqlite3_step(
+             sql_stmt_read_inlier_matches_graph_filtered_)) == SQLITE_ROW) {
+    const image_pair_t pair_id = static_cast<image_pair_t>(
+        sqlite3_column_int64(sql_stmt_read_inlier_matches_graph_filtered_, 0));
     const int rows = static_cast<int>(
-        sqlite3_column_int64(sql_stmt_read_inlier_matches_graph_, 1));
-    num_inliers->push_back(rows);
+        sqlite3_column_int64(sql_stmt_read_inlier_matches_graph_filtered_, 1));
+    callback(pair_id, rows);
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_graph_filtered_));
+}
+
+uint64_t Database::Identifier() const { return ReadGeneration("database"); }
+
+uint64_t Database::FeaturesGeneration() const {
+  return ReadGeneration("keypoints") + ReadGeneration("descriptors");
+}
+
+uint64_t Database::InlierMatchesGeneration() const {
+  return ReadGeneration("inlier_matches");
+}
+
+uint64_t Database::FeatureShapesChecksum() const {
+  const std::vector<std::string> sqls = {
+      "SELECT image_id, rows, cols, length(data) FROM keypoints "
+      "ORDER BY image_id;",
+      "SELECT image_id, rows, cols, length(data) FROM descriptors "
+      "ORDER BY image_id;"};
+
+  uint64_t checksum = 0xcbf29ce484222325ULL;
+  for (const auto& sql : sqls) {
+    sqlite3_stmt* sql_stmt;
+    SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1, &sql_stmt, 0));
+
+    sqlite3_int64 num_rows = 0;
+    while (SQLITE3_CALL(sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+      for (int col = 0; col < 4; ++col) {
+        checksum = HashValue(checksum, sqlite3_column_int64(sql_stmt, col));
+      }
+      num_rows += 1;
+    }
+    checksum = HashValue(checksum, num_rows);
+
+    SQLITE3_CALL(sqlite3_finalize(sql_stmt));
   }
 
-  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_graph_));
+  return checksum;
 }
 
 camera_t Database::WriteCamera(const Camera& camera,
@@ -543,10 +1113,23 @@ image_t Database::WriteImage(const Image& image,
 
 void Database::WriteKeypoints(const image_t image_id,
                               const FeatureKeypoints& keypoints) const {
-  const FeatureKeypointsBlob blob = FeatureKeypointsToBlob(keypoints);
+  const size_t kNumCols = 4;
+  std::vector<uint8_t> data;
+  BlobEncoding encoding;
+  if (quantize_keypoints_) {
+    data = FeatureKeypointsToQuantizedBlob(keypoints);
+    encoding = BlobEncoding::QUANTIZED;
+  } else {
+    const FeatureKeypointsBlob blob = FeatureKeypointsToBlob(keypoints);
+    const uint8_t* blob_data = reinterpret_cast<const uint8_t*>(blob.data());
+    data.assign(blob_data, blob_data + blob.size() * sizeof(float));
+    encoding = BlobEncoding::RAW;
+  }
 
   SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_keypoints_, 1, image_id));
-  WriteMatrixBlob(sql_stmt_write_keypoints_, blob, 2);
+  WriteEncodedBlob(sql_stmt_write_keypoints_, keypoints.size(), kNumCols, data,
+                   encoding, 2);
+  RecordBlobWrite("keypoints", data.size());
 
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_keypoints_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_keypoints_));
@@ -556,6 +1139,7 @@ void Database::WriteDescriptors(const image_t image_id,
                                 const FeatureDescriptors& descriptors) const {
   SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_descriptors_, 1, image_id));
   WriteMatrixBlob(sql_stmt_write_descriptors_, descriptors, 2);
+  RecordBlobWrite("descriptors", descriptors.size());
 
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_descriptors_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_descriptors_));
@@ -566,15 +1150,21 @@ void Database::WriteMatches(const image_t image_id1, const image_t image_id2,
   const image_pair_t pair_id = ImagePairToPairId(image_id1, image_id2);
   SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_matches_, 1, pair_id));
 
-  // Important: the swapped data must live until the query is executed.
-  FeatureMatchesBlob blob = FeatureMatchesToBlob(matches);
+  // Important: the encoded data must live until the query is executed.
+  const size_t kNumCols = 2;
+  std::vector<uint8_t> data;
   if (SwapImagePair(image_id1, image_id2)) {
-    SwapFeatureMatchesBlob(&blob);
-    WriteMatrixBlob(sql_stmt_write_matches_, blob, 2);
+    FeatureMatches swapped_matches = matches;
+    SwapFeatureMatches(&swapped_matches);
+    data = FeatureMatchesToCompactBlob(swapped_matches);
   } else {
-    WriteMatrixBlob(sql_stmt_write_matches_, blob, 2);
+    data = FeatureMatchesToCompactBlob(matches);
   }
 
+  WriteEncodedBlob(sql_stmt_write_matches_, matches.size(), kNumCols, data,
+                   BlobEncoding::COMPACT, 2);
+  RecordBlobWrite("matches", data.size());
+
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_matches_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_matches_));
 }
@@ -585,22 +1175,74 @@ void Database::WriteInlierMatches(
   const image_pair_t pair_id = ImagePairToPairId(image_id1, image_id2);
   SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_inlier_matches_, 1, pair_id));
 
-  // Important: the swapped data must live until the query is executed.
-  FeatureMatchesBlob blob =
-      FeatureMatchesToBlob(two_view_geometry.inlier_matches);
+  // Important: the encoded data must live until the query is executed.
+  const size_t kNumCols = 2;
+  std::vector<uint8_t> data;
   if (SwapImagePair(image_id1, image_id2)) {
-    SwapFeatureMatchesBlob(&blob);
+    FeatureMatches swapped_inlier_matches = two_view_geometry.inlier_matches;
+    SwapFeatureMatches(&swapped_inlier_matches);
+    data = FeatureMatchesToCompactBlob(swapped_inlier_matches);
+  } else {
+    data = FeatureMatchesToCompactBlob(two_view_geometry.inlier_matches);
   }
 
-  WriteMatrixBlob(sql_stmt_write_inlier_matches_, blob, 2);
+  WriteEncodedBlob(sql_stmt_write_inlier_matches_,
+                   two_view_geometry.inlier_matches.size(), kNumCols, data,
+                   BlobEncoding::COMPACT, 2);
+  RecordBlobWrite("inlier_matches", data.size());
 
-  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_inlier_matches_, 5,
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_inlier_matches_, 6,
                                   two_view_geometry.config));
 
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_inlier_matches_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_inlier_matches_));
 }
 
+void Database::WriteKeypointsBatch(
+    const std::vector<image_t>& image_ids,
+    const std::vector<FeatureKeypoints>& keypoints) const {
+  CHECK_EQ(image_ids.size(), keypoints.size());
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    WriteKeypoints(image_ids[i], keypoints[i]);
+  }
+}
+
+void Database::WriteDescriptorsBatch(
+    const std::vector<image_t>& image_ids,
+    const std::vector<FeatureDescriptors>& descriptors) const {
+  CHECK_EQ(image_ids.size(), descriptors.size());
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    WriteDescriptors(image_ids[i], descriptors[i]);
+  }
+}
+
+void Database::WriteMatchesBatch(
+    const std::vector<std::pair<image_t, image_t>>& image_pairs,
+    const std::vector<FeatureMatches>& matches) const {
+  CHECK_EQ(image_pairs.size(), matches.size());
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    WriteMatches(image_pairs[i].first, image_pairs[i].second, matches[i]);
+  }
+}
+
+void Database::WriteInlierMatchesBatch(
+    const std::vector<std::pair<image_t, image_t>>& image_pairs,
+    const std::vector<TwoViewGeometry>& two_view_geometries) const {
+  CHECK_EQ(image_pairs.size(), two_view_geometries.size());
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    WriteInlierMatches(image_pairs[i].first, image_pairs[i].second,
+                       two_view_geometries[i]);
+  }
+}
+
+void Database::SetQuantizeKeypoints(const bool quantize_keypoints) {
+  quantize_keypoints_ = quantize_keypoints;
+}
+
+void Database::SetDefaultQuantizeKeypoints(const bool quantize_keypoints) {
+  default_quantize_keypoints_ = quantize_keypoints;
+}
+
 void Database::UpdateCamera(const Camera& camera) {
   SQLITE3_CALL(
       sqlite3_bind_int64(sql_stmt_update_camera_, 1, camera.ModelId()));
@@ -650,6 +1292,211 @@ void Database::UpdateImage(const Image& image) {
   SQLITE3_CALL(sqlite3_reset(sql_stmt_update_image_));
 }
 
+bool Database::MergeMatches(const std::string& path,
+                            size_t* num_merged_matches,
+                            size_t* num_merged_inlier_matches) {
+  CHECK_NOTNULL(num_merged_matches);
+  CHECK_NOTNULL(num_merged_inlier_matches);
+
+  *num_merged_matches = 0;
+  *num_merged_inlier_matches = 0;
+
+  sqlite3_stmt* sql_stmt;
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, "ATTACH DATABASE ? AS shard;", -1,
+                                  &sql_stmt, 0));
+  SQLITE3_CALL(sqlite3_bind_text(sql_stmt, 1, path.c_str(),
+                                 static_cast<int>(path.size()), SQLITE_STATIC));
+  SQLITE3_CALL(sqlite3_step(sql_stmt));
+  SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+
+  auto CountInconsistentRows = [this](const std::string& sql) {
+    sqlite3_stmt* sql_stmt;
+    SQLITE3_CALL(
+        sqlite3_prepare_v2(database_, sql.c_str(), -1, &sql_stmt, 0));
+    size_t count = 0;
+    if (SQLITE3_CALL(sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+      count = static_cast<size_t>(sqlite3_column_int64(sql_stmt, 0));
+    }
+    SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+    return count;
+  };
+
+  const size_t num_inconsistent_cameras = CountInconsistentRows(
+      "SELECT COUNT(*) FROM shard.cameras AS s LEFT JOIN main.cameras AS m "
+      "ON s.camera_id = m.camera_id AND s.model = m.model AND "
+      "s.width = m.width AND s.height = m.height "
+      "WHERE m.camera_id IS NULL;");
+  const size_t num_inconsistent_images = CountInconsistentRows(
+      "SELECT COUNT(*) FROM shard.images AS s LEFT JOIN main.images AS m "
+      "ON s.image_id = m.image_id AND s.name = m.name AND "
+      "s.camera_id = m.camera_id "
+      "WHERE m.image_id IS NULL;");
+
+  const bool consistent =
+      num_inconsistent_cameras == 0 && num_inconsistent_images == 0;
+
+  if (consistent) {
+    DatabaseTransaction database_transaction(this, true);
+
+    SQLITE3_EXEC(database_,
+                 "INSERT OR IGNORE INTO main.matches "
+                 "(pair_id, rows, cols, data, encoding) "
+                 "SELECT pair_id, rows, cols, data, encoding "
+                 "FROM shard.matches;",
+                 nullptr);
+    *num_merged_matches = static_cast<size_t>(sqlite3_changes(database_));
+
+    SQLITE3_EXEC(database_,
+                 "INSERT OR IGNORE INTO main.inlier_matches "
+                 "(pair_id, rows, cols, data, config, encoding) "
+                 "SELECT pair_id, rows, cols, data, config, encoding "
+                 "FROM shard.inlier_matches;",
+                 nullptr);
+    *num_merged_inlier_matches =
+        static_cast<size_t>(sqlite3_changes(database_));
+  } else {
+    std::cout << StringPrintf(
+                     "WARNING: Database %s has %d cameras and %d images, "
+                     "which do not exist in this database",
+                     path.c_str(), num_inconsistent_cameras,
+                     num_inconsistent_images)
+              << std::endl;
+  }
+
+  SQLITE3_EXEC(database_, "DETACH DATABASE shard;", nullptr);
+
+  return consistent;
+}
+
+bool Database::MergeFeatures(const std::string& path,
+                             const bool single_camera,
+                             size_t* num_merged_images) {
+  CHECK_NOTNULL(num_merged_images);
+
+  *num_merged_images = 0;
+
+  std::vector<Camera> shard_cameras;
+  std::vector<Image> shard_images;
+  {
+    Database shard_database;
+    shard_database.OpenReadOnly(path);
+    shard_cameras = shard_database.ReadAllCameras();
+    shard_images = shard_database.ReadAllImages();
+  }
+
+  std::sort(shard_images.begin(), shard_images.end(),
+            [](const Image& image1, const Image& image2) {
+              return image1.ImageId() < image2.ImageId();
+            });
+
+  std::unordered_map<camera_t, const Camera*> shard_cameras_by_id;
+  for (const auto& camera : shard_cameras) {
+    shard_cameras_by_id.emplace(camera.CameraId(), &camera);
+  }
+
+  // With a single camera, all shard cameras must have the dimensions of it.
+  Camera single_camera_data;
+  if (single_camera) {
+    const std::vector<Camera> cameras = ReadAllCameras();
+    if (!cameras.empty()) {
+      single_camera_data = cameras.front();
+    } else if (!shard_cameras.empty()) {
+      single_camera_data = shard_cameras.front();
+      single_camera_data.SetCameraId(kInvalidCameraId);
+    }
+
+    for (const auto& camera : shard_cameras) {
+      if (camera.ModelId() != single_camera_data.ModelId() ||
+          camera.Width() != single_camera_data.Width() ||
+          camera.Height() != single_camera_data.Height()) {
+        std::cout << StringPrintf(
+                         "WARNING: Single camera specified, but camera %d of "
+                         "database %s has a different model or dimensions",
+                         camera.CameraId(), path.c_str())
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+
+  sqlite3_stmt* sql_stmt;
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, "ATTACH DATABASE ? AS shard;", -1,
+                                  &sql_stmt, 0));
+  SQLITE3_CALL(sqlite3_bind_text(sql_stmt, 1, path.c_str(),
+                                 static_cast<int>(path.size()), SQLITE_STATIC));
+  SQLITE3_CALL(sqlite3_step(sql_stmt));
+  SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+
+  // The feature blobs are copied without decoding them.
+  sqlite3_stmt* sql_stmt_copy_keypoints;
+  SQLITE3_CALL(sqlite3_prepare_v2(
+      database_,
+      "INSERT INTO main.keypoints (image_id, rows, cols, data, encoding) "
+      "SELECT ?, rows, cols, data, encoding FROM shard.keypoints "
+      "WHERE image_id = ?;",
+      -1, &sql_stmt_copy_keypoints, 0));
+  sqlite3_stmt* sql_stmt_copy_descriptors;
+  SQLITE3_CALL(sqlite3_prepare_v2(
+      database_,
+      "INSERT INTO main.descriptors (image_id, rows, cols, data) "
+      "SELECT ?, rows, cols, data FROM shard.descriptors WHERE image_id = ?;",
+      -1, &sql_stmt_copy_descriptors, 0));
+
+  auto CopyFeatures = [](sqlite3_stmt* sql_stmt, const image_t image_id,
+                         const image_t shard_image_id) {
+    SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1, image_id));
+    SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 2, shard_image_id));
+    SQLITE3_CALL(sqlite3_step(sql_stmt));
+    SQLITE3_CALL(sqlite3_reset(sql_stmt));
+  };
+
+  {
+    DatabaseTransaction database_transaction(this, true);
+
+    std::unordered_map<camera_t, camera_t> camera_id_map;
+    for (const auto& shard_image : shard_images) {
+      if (ExistsImageWithName(shard_image.Name())) {
+        continue;
+      }
+
+      Image image = shard_image;
+      if (single_camera) {
+        if (single_camera_data.CameraId() == kInvalidCameraId) {
+          single_camera_data.SetCameraId(WriteCamera(single_camera_data));
+        }
+        image.SetCameraId(single_camera_data.CameraId());
+      } else {
+        const auto camera_id_it = camera_id_map.find(shard_image.CameraId());
+        if (camera_id_it == camera_id_map.end()) {
+          const auto shard_camera_it =
+              shard_cameras_by_id.find(shard_image.CameraId());
+          CHECK(shard_camera_it != shard_cameras_by_id.end());
+          const camera_t camera_id = WriteCamera(*shard_camera_it->second);
+          camera_id_map.emplace(shard_image.CameraId(), camera_id);
+          image.SetCameraId(camera_id);
+        } else {
+          image.SetCameraId(camera_id_it->second);
+        }
+      }
+
+      image.SetImageId(WriteImage(image));
+      CopyFeatures(sql_stmt_copy_keypoints, image.ImageId(),
+                   shard_image.ImageId());
+      CopyFeatures(sql_stmt_copy_descriptors, image.ImageId(),
+                   shard_image.ImageId());
+
+      *num_merged_images += 1;
+    }
+  }
+
+  SQLITE3_CALL(sqlite3_finalize(sql_stmt_copy_keypoints));
+  SQLITE3_CALL(sqlite3_finalize(sql_stmt_copy_descriptors));
+
+  SQLITE3_EXEC(database_, "DETACH DATABASE shard;", nullptr);
+
+  return true;
+}
+
 void Database::ClearMatches() const {
   SQLITE3_CALL(sqlite3_step(sql_stmt_clear_matches_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_clear_matches_));
@@ -660,12 +1507,27 @@ void Database::ClearInlierMatches() const {
   SQLITE3_CALL(sqlite3_reset(sql_stmt_clear_inlier_matches_));
 }
 
-void Database::BeginTransaction() const {
-  SQLITE3_EXEC(database_, "BEGIN TRANSACTION", nullptr);
+void Database::BeginTransaction(const bool immediate) const {
+  if (collect_stats_) {
+    transaction_timer_.Restart();
+  }
+  if (immediate) {
+    SQLITE3_EXEC(database_, "BEGIN IMMEDIATE TRANSACTION", nullptr);
+  } else {
+    SQLITE3_EXEC(database_, "BEGIN TRANSACTION", nullptr);
+  }
 }
 
 void Database::EndTransaction() const {
   SQLITE3_EXEC(database_, "END TRANSACTION", nullptr);
+  if (collect_stats_) {
+    const double elapsed_time = transaction_timer_.ElapsedSeconds();
+    std::unique_lock<std::mutex> lock(stats_mutex_);
+    stats_.num_transactions += 1;
+    stats_.transaction_time += elapsed_time;
+    stats_.max_transaction_time =
+        std::max(stats_.max_transaction_time, elapsed_time);
+  }
 }
 
 void Database::PrepareSQLStatements() {
@@ -788,7 +1650,16 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_read_images_, 0));
   sql_stmts_.push_back(sql_stmt_read_images_);
 
-  sql = "SELECT rows, cols, data FROM keypoints WHERE image_id = ?;";
+  sql =
+      "SELECT images.name FROM images "
+      "INNER JOIN keypoints ON images.image_id = keypoints.image_id "
+      "INNER JOIN descriptors ON images.image_id = descriptors.image_id;";
+  SQLITE3_CALL(
+      sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                         &sql_stmt_read_image_names_with_features_, 0));
+  sql_stmts_.push_back(sql_stmt_read_image_names_with_features_);
+
+  sql = "SELECT rows, cols, data, encoding FROM keypoints WHERE image_id = ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_read_keypoints_, 0));
   sql_stmts_.push_back(sql_stmt_read_keypoints_);
@@ -798,37 +1669,56 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_read_descriptors_, 0));
   sql_stmts_.push_back(sql_stmt_read_descriptors_);
 
-  sql = "SELECT rows, cols, data FROM matches WHERE pair_id = ?;";
+  sql = "SELECT rows, cols, data, encoding FROM matches WHERE pair_id = ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_read_matches_, 0));
   sql_stmts_.push_back(sql_stmt_read_matches_);
 
-  sql = "SELECT * FROM matches WHERE rows > 0;";
+  sql =
+      "SELECT pair_id, rows, cols, data, encoding FROM matches "
+      "WHERE rows > 0;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_read_matches_all_, 0));
   sql_stmts_.push_back(sql_stmt_read_matches_all_);
 
+  sql = "SELECT pair_id FROM matches;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_read_matches_pair_ids_, 0));
+  sql_stmts_.push_back(sql_stmt_read_matches_pair_ids_);
+
   sql =
-      "SELECT rows, cols, data, config FROM inlier_matches "
+      "SELECT rows, cols, data, encoding, config FROM inlier_matches "
       "WHERE pair_id = ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_read_inlier_matches_, 0));
   sql_stmts_.push_back(sql_stmt_read_inlier_matches_);
 
-  sql = "SELECT * FROM inlier_matches WHERE rows > 0;";
+  sql =
+      "SELECT pair_id, rows, cols, data, encoding, config FROM inlier_matches "
+      "WHERE rows >= ? AND config != ? AND pair_id >= ? AND pair_id < ?;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_read_inlier_matches_filtered_, 0));
+  sql_stmts_.push_back(sql_stmt_read_inlier_matches_filtered_);
+
+  sql =
+      "SELECT pair_id, rows FROM inlier_matches "
+      "WHERE rows >= ? AND config != ? AND pair_id >= ? AND pair_id < ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
-                                  &sql_stmt_read_inlier_matches_all_, 0));
-  sql_stmts_.push_back(sql_stmt_read_inlier_matches_all_);
+                                  &sql_stmt_read_inlier_matches_graph_filtered_,
+                                  0));
+  sql_stmts_.push_back(sql_stmt_read_inlier_matches_graph_filtered_);
 
-  sql = "SELECT pair_id, rows FROM inlier_matches WHERE rows > 0;";
+  sql = "SELECT pair_id FROM inlier_matches;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
-                                  &sql_stmt_read_inlier_matches_graph_, 0));
-  sql_stmts_.push_back(sql_stmt_read_inlier_matches_graph_);
+                                  &sql_stmt_read_inlier_matches_pair_ids_, 0));
+  sql_stmts_.push_back(sql_stmt_read_inlier_matches_pair_ids_);
 
   //////////////////////////////////////////////////////////////////////////////
   // write_*
   //////////////////////////////////////////////////////////////////////////////
-  sql = "INSERT INTO keypoints(image_id, rows, cols, data) VALUES(?, ?, ?, ?);";
+  sql =
+      "INSERT INTO keypoints(image_id, rows, cols, data, encoding) "
+      "VALUES(?, ?, ?, ?, ?);";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_write_keypoints_, 0));
   sql_stmts_.push_back(sql_stmt_write_keypoints_);
@@ -839,14 +1729,16 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_write_descriptors_, 0));
   sql_stmts_.push_back(sql_stmt_write_descriptors_);
 
-  sql = "INSERT INTO matches(pair_id, rows, cols, data) VALUES(?, ?, ?, ?);";
+  sql =
+      "INSERT INTO matches(pair_id, rows, cols, data, encoding) "
+      "VALUES(?, ?, ?, ?, ?);";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_write_matches_, 0));
   sql_stmts_.push_back(sql_stmt_write_matches_);
 
   sql =
-      "INSERT INTO inlier_matches(pair_id, rows, cols, data, config) "
-      "VALUES(?, ?, ?, ?, ?);";
+      "INSERT INTO inlier_matches(pair_id, rows, cols, data, encoding, config) "
+      "VALUES(?, ?, ?, ?, ?, ?);";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_write_inlier_matches_, 0));
   sql_stmts_.push_back(sql_stmt_write_inlier_matches_);
@@ -878,6 +1770,7 @@ void Database::CreateTables() const {
   CreateDescriptorsTable();
   CreateMatchesTable();
   CreateInlierMatchesTable();
+  CreateGenerationsTable();
 }
 
 void Database::CreateCameraTable() const {
@@ -921,6 +1814,7 @@ void Database::CreateKeypointsTable() const {
       "    rows      INTEGER               NOT NULL,"
       "    cols      INTEGER               NOT NULL,"
       "    data      BLOB,"
+      "    encoding  INTEGER               NOT NULL  DEFAULT 0,"
       "FOREIGN KEY(image_id) REFERENCES images(image_id) ON DELETE CASCADE);";
 
   SQLITE3_EXEC(database_, sql.c_str(), nullptr);
@@ -944,7 +1838,8 @@ void Database::CreateMatchesTable() const {
       "   (pair_id  INTEGER  PRIMARY KEY  NOT NULL,"
       "    rows     INTEGER               NOT NULL,"
       "    cols     INTEGER               NOT NULL,"
-      "    data     BLOB);";
+      "    data     BLOB,"
+      "    encoding INTEGER               NOT NULL  DEFAULT 0);";
 
   SQLITE3_EXEC(database_, sql.c_str(), nullptr);
 }
@@ -956,7 +1851,45 @@ void Database::CreateInlierMatchesTable() const {
       "    rows     INTEGER               NOT NULL,"
       "    cols     INTEGER               NOT NULL,"
       "    data     BLOB,"
-      "    config   INTEGER               NOT NULL);";
+      "    config   INTEGER               NOT NULL,"
+      "    encoding INTEGER               NOT NULL  DEFAULT 0);";
+
+  SQLITE3_EXEC(database_, sql.c_str(), nullptr);
+}
+
+void Database::CreateGenerationsTable() const {
+  const std::string sql =
+      "CREATE TABLE IF NOT EXISTS generations"
+      "   (name        TEXT     PRIMARY KEY  NOT NULL,"
+      "    generation  INTEGER               NOT NULL);";
+
+  SQLITE3_EXEC(database_, sql.c_str(), nullptr);
+
+  // Random identifier of the database, assigned once on creation.
+  const std::string identifier_sql =
+      "INSERT OR IGNORE INTO generations(name, generation) "
+      "VALUES('database', random());";
+  SQLITE3_EXEC(database_, identifier_sql.c_str(), nullptr);
+
+  CreateGenerationTriggers("keypoints");
+  CreateGenerationTriggers("descriptors");
+  CreateGenerationTriggers("inlier_matches");
+}
+
+void Database::CreateGenerationTriggers(const std::string& table) const {
+  std::string sql = StringPrintf(
+      "INSERT OR IGNORE INTO generations(name, generation) VALUES('%s', 0);",
+      table.c_str());
+  const std::vector<std::pair<std::string, std::string>> events = {
+      {"insert", "INSERT"}, {"update", "UPDATE"}, {"delete", "DELETE"}};
+  for (const auto& event : events) {
+    sql += StringPrintf(
+        "CREATE TRIGGER IF NOT EXISTS %s_generation_%s AFTER %s ON %s "
+        "BEGIN UPDATE generations SET generation = generation + 1 "
+        "WHERE name = '%s'; END;",
+        table.c_str(), event.first.c_str(), event.second.c_str(),
+        table.c_str(), table.c_str());
+  }
 
   SQLITE3_EXEC(database_, sql.c_str(), nullptr);
 }
@@ -974,18 +1907,52 @@ void Database::UpdateSchema() const {
     // user_version == 0: initial value from SQLite, nothing to do, since all
     // tables were created in `Database::CreateTables`
     if (user_version > 0) {
-      // if (user_version < 2) {}
+      // if (user_version < 3) {}
     }
   }
 
   SQLITE3_CALL(sqlite3_finalize(query_user_version_sql_stmt));
 
+  // Schema version 2 added the blob encoding columns. Existing blobs were
+  // written in the raw encoding, which is the default value of the columns.
+  // Note that the columns are checked explicitly, since databases created
+  // before the introduction of the schema version have a user_version of 0.
+  for (const std::string table : {"keypoints", "matches", "inlier_matches"}) {
+    if (!ExistsColumn(table, "encoding")) {
+      const std::string add_column_sql =
+          "ALTER TABLE " + table +
+          " ADD COLUMN encoding INTEGER NOT NULL DEFAULT 0;";
+      SQLITE3_EXEC(database_, add_column_sql.c_str(), nullptr);
+    }
+  }
+
   // Update user_version
   const std::string update_user_version_sql =
       "PRAGMA user_version = " + std::to_string(kSchemaVersion) + ";";
   SQLITE3_EXEC(database_, update_user_version_sql.c_str(), nullptr);
 }
 
+bool Database::ExistsColumn(const std::string& table,
+                            const std::string& column) const {
+  const std::string sql = "PRAGMA table_info(" + table + ");";
+  sqlite3_stmt* sql_stmt;
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1, &sql_stmt, 0));
+
+  bool exists_column = false;
+  while (SQLITE3_CALL(sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+    const std::string name = std::string(
+        reinterpret_cast<const char*>(sqlite3_column_text(sql_stmt, 1)));
+    if (name == column) {
+      exists_column = true;
+      break;
+    }
+  }
+
+  SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+
+  return exists_column;
+}
+
 bool Database::ExistsRowId(sqlite3_stmt* sql_stmt,
                            const sqlite3_int64 row_id) const {
   SQLITE3_CALL(
@@ -1015,6 +1982,24 @@ bool Database::ExistsRowString(sqlite3_stmt* sql_stmt,
   return exists;
 }
 
+uint64_t Database::ReadGeneration(const std::string& table) const {
+  const std::string sql = "SELECT generation FROM generations WHERE name = '" +
+                          table + "';";
+  sqlite3_stmt* sql_stmt;
+
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1, &sql_stmt, 0));
+
+  uint64_t generation = 0;
+  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt));
+  if (rc == SQLITE_ROW) {
+    generation = static_cast<uint64_t>(sqlite3_column_int64(sql_stmt, 0));
+  }
+
+  SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+
+  return generation;
+}
+
 size_t Database::CountRows(const std::string& table) const {
   const std::string sql = "SELECT COUNT(*) FROM " + table + ";";
   sqlite3_stmt* sql_stmt;
@@ -1065,10 +2050,55 @@ size_t Database::SumColumn(const std::string& column,
   return sum;
 }
 
-DatabaseTransaction::DatabaseTransaction(Database* database)
+void Database::RecordBlobRead(const char* table, sqlite3_stmt* sql_stmt,
+                              const int col) const {
+  if (!collect_stats_) {
+    return;
+  }
+  const size_t num_bytes =
+      static_cast<size_t>(sqlite3_column_bytes(sql_stmt, col));
+  std::unique_lock<std::mutex> lock(stats_mutex_);
+  struct Stats::Table& table_stats = stats_.tables[table];
+  table_stats.num_rows_read += 1;
+  table_stats.num_bytes_read += num_bytes;
+}
+
+void Database::RecordBlobWrite(const char* table,
+                               const size_t num_bytes) const {
+  if (!collect_stats_) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(stats_mutex_);
+  struct Stats::Table& table_stats = stats_.tables[table];
+  table_stats.num_rows_written += 1;
+  table_stats.num_bytes_written += num_bytes;
+}
+
+int Database::TraceCallback(unsigned int type, void* context, void* arg1,
+                            void* arg2) {
+  if (type != SQLITE_TRACE_PROFILE) {
+    return 0;
+  }
+
+  const Database* database = static_cast<const Database*>(context);
+  const char* sql = sqlite3_sql(static_cast<sqlite3_stmt*>(arg1));
+  const double elapsed_time =
+      *static_cast<const sqlite3_int64*>(arg2) / 1e9;
+
+  std::unique_lock<std::mutex> lock(database->stats_mutex_);
+  struct Stats::Statement& statement_stats =
+      database->stats_.statements[sql == nullptr ? "" : sql];
+  statement_stats.num_calls += 1;
+  statement_stats.elapsed_time += elapsed_time;
+
+  return 0;
+}
+
+DatabaseTransaction::DatabaseTransaction(Database* database,
+                                         const bool immediate)
     : database_(database), database_lock_(database->transaction_mutex_) {
   CHECK_NOTNULL(database_);
-  database_->BeginTransaction();
+  database_->BeginTransaction(immediate);
 }
 
 DatabaseTransaction::~DatabaseTransaction() { database_->EndTransaction(); }
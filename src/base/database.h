@@ -17,8 +17,14 @@
 #ifndef COLMAP_SRC_BASE_DATABASE_H_
 #define COLMAP_SRC_BASE_DATABASE_H_
 
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <map>
 #include <mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <Eigen/Core>
@@ -29,6 +35,7 @@
 #include "estimators/two_view_geometry.h"
 #include "ext/SQLite/sqlite3.h"
 #include "util/sqlite3_utils.h"
+#include "util/timer.h"
 #include "util/types.h"
 
 namespace colmap {
@@ -40,7 +47,59 @@ namespace colmap {
 // and trailing `EndTransaction`.
 class Database {
  public:
-  const static int kSchemaVersion = 1;
+  const static int kSchemaVersion = 2;
+
+  // Filter for streaming inlier matches, which is evaluated in SQL, so that
+  // the matches of rejected image pairs are never decoded.
+  struct InlierMatchesFilter {
+    // Minimum number of inlier matches of an image pair.
+    size_t min_num_matches = 1;
+
+    // Whether to skip image pairs with the watermark configuration.
+    bool ignore_watermarks = false;
+
+    // Range `min_pair_id <= pair_id < max_pair_id` of the image pairs.
+    image_pair_t min_pair_id = 0;
+    image_pair_t max_pair_id =
+        static_cast<image_pair_t>(std::numeric_limits<int64_t>::max());
+  };
+
+  // Profiling statistics of a connection, which are only collected if enabled
+  // with `SetCollectStats`.
+  struct Stats {
+    struct Statement {
+      // Number of executions, i.e. from the first step until the reset.
+      size_t num_calls = 0;
+      // Cumulative wall time of all executions in seconds.
+      double elapsed_time = 0;
+    };
+
+    struct Table {
+      // Number of read and written blobs and their total size in bytes.
+      size_t num_rows_read = 0;
+      size_t num_bytes_read = 0;
+      size_t num_rows_written = 0;
+      size_t num_bytes_written = 0;
+    };
+
+    // The executed statements by their SQL text.
+    std::map<std::string, Statement> statements;
+
+    // The keypoints, descriptors, and matches blob I/O by table name.
+    std::map<std::string, Table> tables;
+
+    // Number and cumulative wall time in seconds of transactions.
+    size_t num_transactions = 0;
+    double transaction_time = 0;
+    double max_transaction_time = 0;
+
+    // Page cache statistics of the connection, where cache misses are read
+    // from storage and cache writes are written to storage.
+    size_t page_size = 0;
+    size_t num_cache_hits = 0;
+    size_t num_cache_misses = 0;
+    size_t num_cache_writes = 0;
+  };
 
   // The maximum number of images, that can be stored in the database.
   // This limitation arises due to the fact, that we generate unique IDs for
@@ -57,6 +116,27 @@ class Database {
   void Open(const std::string& path);
   void Close();
 
+  // Open an existing database in read-only mode. Multiple read-only
+  // connections can read from the same database concurrently, e.g., to load
+  // data in parallel. The schema of the database is neither created nor
+  // updated, so the database must have been opened with `Open` before.
+  void OpenReadOnly(const std::string& path);
+
+  // The path of the database file or an empty string for in-memory databases.
+  std::string Path() const;
+
+  // Enable or disable the collection of profiling statistics for the open
+  // connection, which adds a small overhead to each statement. Enabling the
+  // collection resets the statistics. If enabled, the statistics are printed
+  // when the connection is closed.
+  void SetCollectStats(const bool collect_stats);
+  // Enable or disable the collection of profiling statistics for all
+  // connections that are opened afterwards in this process.
+  static void SetDefaultCollectStats(const bool collect_stats);
+  struct Stats Stats() const;
+  void ResetStats();
+  void PrintStats() const;
+
   // Check if entry already exists in database. For image pairs, the order of
   // `image_id1` and `image_id2` does not matter.
   bool ExistsCamera(const camera_t camera_id) const;
@@ -126,6 +206,10 @@ class Database {
   Image ReadImageWithName(const std::string& name) const;
   std::vector<Image> ReadAllImages() const;
 
+  // Names of all images with both keypoints and descriptors, read in a single
+  // query, e.g., to skip already processed images before reading them.
+  std::unordered_set<std::string> ReadImageNamesWithFeatures() const;
+
   FeatureKeypoints ReadKeypoints(const image_t image_id) const;
   FeatureDescriptors ReadDescriptors(const image_t image_id) const;
 
@@ -139,12 +223,67 @@ class Database {
       std::vector<image_pair_t>* image_pair_ids,
       std::vector<TwoViewGeometry>* two_view_geometries) const;
 
+  // Read the inlier matches of all image pairs with identifiers in the range
+  // `min_pair_id <= pair_id < max_pair_id`, which allows to split the reading
+  // of all inlier matches into multiple parts with separate connections.
+  void ReadInlierMatchesInRange(
+      const image_pair_t min_pair_id, const image_pair_t max_pair_id,
+      std::vector<image_pair_t>* image_pair_ids,
+      std::vector<TwoViewGeometry>* two_view_geometries) const;
+
+  // Stream the identifiers of all image pairs that have an entry in the
+  // `matches` or `inlier_matches` table, without reading the matches. This is
+  // equivalent to `ExistsMatches` or `ExistsInlierMatches` for all pairs.
+  void ForEachMatchesPairId(
+      const std::function<void(const image_pair_t)>& callback) const;
+  void ForEachInlierMatchesPairId(
+      const std::function<void(const image_pair_t)>& callback) const;
+
   // Read all image pairs that have an entry in the `inlier_matches` table with
   // at least one inlier match and their corresponding number of inlier matches.
   void ReadInlierMatchesGraph(
       std::vector<std::pair<image_t, image_t>>* image_pairs,
       std::vector<int>* num_inliers) const;
 
+  // Stream the entries of the `matches` or `inlier_matches` table in the order
+  // of their image pair identifiers, one row at a time, instead of reading
+  // all of them into memory. The callbacks are invoked while the underlying
+  // statement is active, so they must not read or write the same table
+  // through this connection.
+  void ForEachMatches(const std::function<void(const image_pair_t,
+                                               const FeatureMatches&)>&
+                          callback) const;
+  void ForEachInlierMatches(
+      const InlierMatchesFilter& filter,
+      const std::function<void(const image_pair_t, const TwoViewGeometry&)>&
+          callback) const;
+
+  // Stream the image pairs and their number of inlier matches that pass the
+  // filter without reading the matches themselves.
+  void ForEachInlierMatchesGraph(
+      const InlierMatchesFilter& filter,
+      const std::function<void(const image_pair_t, const int)>& callback)
+      const;
+
+  // Random identifier assigned when the database is created, e.g., to tell
+  // apart data derived from different databases that were created at the
+  // same path.
+  uint64_t Identifier() const;
+
+  // Number of inserted, updated, and deleted rows of keypoints and
+  // descriptors or of inlier matches over the lifetime of the database, as
+  // counted by triggers. Unlike a checksum of the data, it is read in
+  // constant time, e.g., to detect whether data derived from it is outdated.
+  uint64_t FeaturesGeneration() const;
+  uint64_t InlierMatchesGeneration() const;
+
+  // Checksum over the image identifiers, shapes, and blob sizes of all
+  // keypoints and descriptors. The blobs themselves are not read, so the
+  // checksum is cheap to compute but only detects changes to the number of
+  // features per image and to their encoding. Use `FeaturesGeneration` to
+  // detect any change of the features.
+  uint64_t FeatureShapesChecksum() const;
+
   // Add new camera and return its database identifier. If `use_camera_id`
   // is false a new identifier is automatically generated.
   camera_t WriteCamera(const Camera& camera,
@@ -166,6 +305,30 @@ class Database {
   void WriteInlierMatches(const image_t image_id1, const image_t image_id2,
                           const TwoViewGeometry& two_view_geometry) const;
 
+  // Write multiple new entries of the same type by reusing the same prepared
+  // statement for all rows. The input vectors must have the same size. For
+  // optimal performance, wrap the calls inside a `DatabaseTransaction`.
+  void WriteKeypointsBatch(
+      const std::vector<image_t>& image_ids,
+      const std::vector<FeatureKeypoints>& keypoints) const;
+  void WriteDescriptorsBatch(
+      const std::vector<image_t>& image_ids,
+      const std::vector<FeatureDescriptors>& descriptors) const;
+  void WriteMatchesBatch(
+      const std::vector<std::pair<image_t, image_t>>& image_pairs,
+      const std::vector<FeatureMatches>& matches) const;
+  void WriteInlierMatchesBatch(
+      const std::vector<std::pair<image_t, image_t>>& image_pairs,
+      const std::vector<TwoViewGeometry>& two_view_geometries) const;
+
+  // Whether to store the scale and orientation of newly written keypoints in a
+  // lossy, quantized encoding, which reduces the size of the keypoint blobs by
+  // a quarter. The location of the keypoints is always stored losslessly.
+  void SetQuantizeKeypoints(const bool quantize_keypoints);
+  // Set whether connections that are created afterwards in this process
+  // quantize newly written keypoints.
+  static void SetDefaultQuantizeKeypoints(const bool quantize_keypoints);
+
   // Update an existing camera in the database. The user is responsible for
   // making sure that the entry already exists.
   void UpdateCamera(const Camera& camera);
@@ -174,6 +337,26 @@ class Database {
   // making sure that the entry already exists.
   void UpdateImage(const Image& image);
 
+  // Merge the matches and inlier matches of another database into this
+  // database, e.g., a shard of a distributed feature matching. The entries are
+  // copied in bulk and image pairs that already exist in this database are
+  // skipped. The other database must be a copy of this database, i.e., its
+  // cameras and images must exist in this database with the same identifiers,
+  // and it must use the current schema. Returns false if it is inconsistent.
+  bool MergeMatches(const std::string& path, size_t* num_merged_matches,
+                    size_t* num_merged_inlier_matches);
+
+  // Merge the cameras, images, keypoints, and descriptors of another database
+  // into this database, e.g., a shard of a distributed feature extraction.
+  // Images that already exist in this database by name are skipped, and the
+  // merged cameras and images are assigned new identifiers in the order of
+  // their identifiers in the other database. If `single_camera` is true, all
+  // merged images share the first camera of this database, or the first
+  // camera of the other database if this database has none. Returns false if
+  // the cameras are inconsistent with the single camera.
+  bool MergeFeatures(const std::string& path, const bool single_camera,
+                     size_t* num_merged_images);
+
   // Clear the entire matches table.
   void ClearMatches() const;
 
@@ -187,8 +370,10 @@ class Database {
   // into a `BeginTransaction` and `EndTransaction`. You can create a scoped
   // transaction with `DatabaseTransaction` that ends when the transaction
   // object is destructed. Combining queries results in faster transaction time
-  // due to reduced locking of the database etc.
-  void BeginTransaction() const;
+  // due to reduced locking of the database etc. An immediate transaction
+  // acquires the write lock at its beginning, which avoids failures when
+  // upgrading a read to a write transaction with concurrent connections.
+  void BeginTransaction(const bool immediate = false) const;
   void EndTransaction() const;
 
   // Prepare SQL statements once at construction of the database, and reuse
@@ -204,21 +389,46 @@ class Database {
   void CreateDescriptorsTable() const;
   void CreateMatchesTable() const;
   void CreateInlierMatchesTable() const;
+  void CreateGenerationsTable() const;
+  void CreateGenerationTriggers(const std::string& table) const;
 
   // Keep track of database schema version.
   void UpdateSchema() const;
 
+  bool ExistsColumn(const std::string& table, const std::string& column) const;
+
   bool ExistsRowId(sqlite3_stmt* sql_stmt, const sqlite3_int64 row_id) const;
   bool ExistsRowString(sqlite3_stmt* sql_stmt,
                        const std::string& row_entry) const;
 
+  uint64_t ReadGeneration(const std::string& table) const;
   size_t CountRows(const std::string& table) const;
   size_t CountRowsForEntry(sqlite3_stmt* sql_stmt,
                            const sqlite3_int64 row_id) const;
   size_t SumColumn(const std::string& column, const std::string& table) const;
 
+  // Record the size of a read or written blob, if statistics are collected.
+  void RecordBlobRead(const char* table, sqlite3_stmt* sql_stmt,
+                      const int col) const;
+  void RecordBlobWrite(const char* table, const size_t num_bytes) const;
+
+  // Called by SQLite at the end of each statement execution.
+  static int TraceCallback(unsigned int type, void* context, void* arg1,
+                           void* arg2);
+
   sqlite3* database_;
 
+  // Whether and which profiling statistics are collected.
+  static std::atomic<bool> default_collect_stats_;
+  bool collect_stats_;
+  mutable std::mutex stats_mutex_;
+  mutable struct Stats stats_;
+  mutable Timer transaction_timer_;
+
+  // Whether to write keypoints in the quantized encoding.
+  static std::atomic<bool> default_quantize_keypoints_;
+  bool quantize_keypoints_;
+
   // Used to ensure that only one transaction is active at the same time.
   std::mutex transaction_mutex_;
 
@@ -252,13 +462,16 @@ class Database {
   sqlite3_stmt* sql_stmt_read_image_id_;
   sqlite3_stmt* sql_stmt_read_image_name_;
   sqlite3_stmt* sql_stmt_read_images_;
+  sqlite3_stmt* sql_stmt_read_image_names_with_features_;
   sqlite3_stmt* sql_stmt_read_keypoints_;
   sqlite3_stmt* sql_stmt_read_descriptors_;
   sqlite3_stmt* sql_stmt_read_matches_;
   sqlite3_stmt* sql_stmt_read_matches_all_;
+  sqlite3_stmt* sql_stmt_read_matches_pair_ids_;
+  sqlite3_stmt* sql_stmt_read_inlier_matches_pair_ids_;
   sqlite3_stmt* sql_stmt_read_inlier_matches_;
-  sqlite3_stmt* sql_stmt_read_inlier_matches_all_;
-  sqlite3_stmt* sql_stmt_read_inlier_matches_graph_;
+  sqlite3_stmt* sql_stmt_read_inlier_matches_filtered_;
+  sqlite3_stmt* sql_stmt_read_inlier_matches_graph_filtered_;
 
   // write_*
   sqlite3_stmt* sql_stmt_write_keypoints_;
@@ -276,7 +489,7 @@ class Database {
 // destruction, respectively.
 class DatabaseTransaction {
  public:
-  DatabaseTransaction(Database* database);
+  DatabaseTransaction(Database* database, const bool immediate = false);
   ~DatabaseTransaction();
 
  private:
@@ -16,16 +16,100 @@
 
 #include "base/database_cache.h"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <unordered_set>
 
+#include "base/feature_store.h"
 #include "util/string.h"
+#include "util/threading.h"
 #include "util/timer.h"
 
 namespace colmap {
+namespace {
+
+// Maximum number of inlier matches that are kept in memory at the same time
+// while the scene graph is built from the streamed matches.
+const size_t kMaxNumBufferedMatches = 1 << 24;
+
+// Split the image pairs, sorted by their identifiers, into contiguous ranges
+// `[min_pair_id, max_pair_id)` with at most `max_num_matches` inlier matches,
+// unless a single image pair has more inlier matches.
+std::vector<std::pair<image_pair_t, image_pair_t>> SplitImagePairIdRanges(
+    const std::vector<std::pair<image_pair_t, int>>& pair_ids,
+    const size_t max_num_matches) {
+  std::vector<std::pair<image_pair_t, image_pair_t>> pair_id_ranges;
+  if (pair_ids.empty()) {
+    return pair_id_ranges;
+  }
+
+  image_pair_t min_pair_id = pair_ids.front().first;
+  size_t num_range_matches = 0;
+  for (const auto& pair_id : pair_ids) {
+    const size_t num_matches = static_cast<size_t>(pair_id.second);
+    if (num_range_matches > 0 &&
+        num_range_matches + num_matches > max_num_matches) {
+      pair_id_ranges.emplace_back(min_pair_id, pair_id.first);
+      min_pair_id = pair_id.first;
+      num_range_matches = 0;
+    }
+    num_range_matches += num_matches;
+  }
+
+  pair_id_ranges.emplace_back(min_pair_id, pair_ids.back().first + 1);
+
+  return pair_id_ranges;
+}
+
+uint64_t HashCombine(const uint64_t seed, const uint64_t value) {
+  uint64_t hash = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) +
+                          (seed >> 2));
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+}
+
+// Fingerprint of the data from which the scene graph is built, i.e., the
+// number of points of the loaded images and the loaded image pairs with their
+// number of inlier matches, both sorted by their identifiers, and the
+// generation of the inlier matches, which changes whenever they are written.
+uint64_t SceneGraphFingerprint(
+    const EIGEN_STL_UMAP(image_t, class Image) & images,
+    const std::vector<std::pair<image_pair_t, int>>& image_pair_ids,
+    const uint64_t inlier_matches_generation) {
+  std::vector<std::pair<image_t, point2D_t>> image_num_points2D;
+  image_num_points2D.reserve(images.size());
+  for (const auto& image : images) {
+    image_num_points2D.emplace_back(image.first, image.second.NumPoints2D());
+  }
+  std::sort(image_num_points2D.begin(), image_num_points2D.end());
+
+  uint64_t fingerprint = HashCombine(0, image_num_points2D.size());
+  for (const auto& image : image_num_points2D) {
+    fingerprint = HashCombine(fingerprint, image.first);
+    fingerprint = HashCombine(fingerprint, image.second);
+  }
+
+  fingerprint = HashCombine(fingerprint, image_pair_ids.size());
+  for (const auto& pair_id : image_pair_ids) {
+    fingerprint = HashCombine(fingerprint, pair_id.first);
+    fingerprint = HashCombine(fingerprint, pair_id.second);
+  }
+
+  return HashCombine(fingerprint, inlier_matches_generation);
+}
+
+}  // namespace
 
 DatabaseCache::DatabaseCache() {}
 
+std::string DatabaseCache::DefaultSceneGraphPath(
+    const std::string& database_path) {
+  return database_path + ".scene_graph";
+}
+
 void DatabaseCache::AddCamera(const class Camera& camera) {
   CHECK(!ExistsCamera(camera.CameraId()));
   cameras_.emplace(camera.CameraId(), camera);
@@ -39,7 +123,54 @@ void DatabaseCache::AddImage(const class Image& image) {
 
 void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
                          const bool ignore_watermarks,
-                         const std::set<std::string>& image_names) {
+                         const std::set<std::string>& image_names,
+                         const std::string& feature_store_path,
+                         const int num_threads,
+                         const std::string& scene_graph_path) {
+  Timer total_timer;
+  total_timer.Start();
+
+  ThreadPool thread_pool(num_threads);
+
+  // Reading in parallel requires a separate connection per thread, which is
+  // only possible for databases stored in a file. Otherwise, all data is read
+  // serially through the given connection.
+  const std::string database_path = database.Path();
+  const bool parallel = !database_path.empty() && thread_pool.NumThreads() > 1;
+
+  // Read-only connections of the worker threads, opened on first use.
+  std::vector<std::unique_ptr<Database>> worker_databases(
+      thread_pool.NumThreads());
+  auto WorkerDatabase = [&]() -> const Database& {
+    std::unique_ptr<Database>& worker_database =
+        worker_databases.at(thread_pool.GetCurrentIndex());
+    if (!worker_database) {
+      worker_database.reset(new Database());
+      worker_database->OpenReadOnly(database_path);
+    }
+    return *worker_database;
+  };
+
+  // Process the items in chunks in parallel, or all items at once serially.
+  auto ParallelFor = [&](
+      const size_t num_items,
+      const std::function<void(const Database&, size_t, size_t)>& func) {
+    if (!parallel) {
+      func(database, 0, num_items);
+      return;
+    }
+    const size_t kNumChunksPerThread = 4;
+    const size_t num_chunks = kNumChunksPerThread * thread_pool.NumThreads();
+    const size_t chunk_size =
+        std::max<size_t>(1, (num_items + num_chunks - 1) / num_chunks);
+    for (size_t begin = 0; begin < num_items; begin += chunk_size) {
+      const size_t end = std::min(begin + chunk_size, num_items);
+      thread_pool.AddTask(
+          [&, begin, end]() { func(WorkerDatabase(), begin, end); });
+    }
+    thread_pool.Wait();
+  };
+
   //////////////////////////////////////////////////////////////////////////////
   // Load cameras
   //////////////////////////////////////////////////////////////////////////////
@@ -57,33 +188,38 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
     }
   }
 
+  const double cameras_elapsed_time = timer.ElapsedSeconds();
   std::cout << StringPrintf(" %d in %.3fs", cameras_.size(),
-                            timer.ElapsedSeconds())
+                            cameras_elapsed_time)
             << std::endl;
 
   //////////////////////////////////////////////////////////////////////////////
-  // Load matches
+  // Load match graph
   //////////////////////////////////////////////////////////////////////////////
 
   timer.Restart();
-  std::cout << "Loading matches..." << std::flush;
-
-  std::vector<image_pair_t> image_pair_ids;
-  std::vector<TwoViewGeometry> two_view_geometries;
-  database.ReadAllInlierMatches(&image_pair_ids, &two_view_geometries);
-
-  std::cout << StringPrintf(" %d in %.3fs", image_pair_ids.size(),
-                            timer.ElapsedSeconds())
+  std::cout << "Loading match graph..." << std::flush;
+
+  // Only the image pair identifiers and number of inlier matches are read
+  // here, the matches themselves are streamed when building the scene graph.
+  const size_t num_image_pairs = database.NumVerifiedImagePairs();
+
+  Database::InlierMatchesFilter inlier_matches_filter;
+  inlier_matches_filter.min_num_matches = min_num_matches;
+  inlier_matches_filter.ignore_watermarks = ignore_watermarks;
+
+  std::vector<std::pair<image_pair_t, int>> image_pair_ids;
+  database.ForEachInlierMatchesGraph(
+      inlier_matches_filter,
+      [&image_pair_ids](const image_pair_t pair_id, const int num_inliers) {
+        image_pair_ids.emplace_back(pair_id, num_inliers);
+      });
+
+  const double match_graph_elapsed_time = timer.ElapsedSeconds();
+  std::cout << StringPrintf(" %d in %.3fs", num_image_pairs,
+                            match_graph_elapsed_time)
             << std::endl;
 
-  auto UseInlierMatchesCheck = [min_num_matches, ignore_watermarks](
-      const TwoViewGeometry& two_view_geometry) {
-    return static_cast<size_t>(two_view_geometry.inlier_matches.size()) >=
-               min_num_matches &&
-           (!ignore_watermarks ||
-            two_view_geometry.config != TwoViewGeometry::WATERMARK);
-  };
-
   //////////////////////////////////////////////////////////////////////////////
   // Load images
   //////////////////////////////////////////////////////////////////////////////
@@ -92,6 +228,7 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
   std::cout << "Loading images..." << std::flush;
 
   std::unordered_set<image_t> image_ids;
+  double images_elapsed_time = 0;
 
   {
     const std::vector<class Image> images = database.ReadAllImages();
@@ -109,39 +246,67 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
       }
     }
 
-    // Collect all images that are connected in the scene graph.
+    // Collect all images that are connected in the scene graph and only keep
+    // the image pairs between those images.
     std::unordered_set<image_t> connected_image_ids;
     connected_image_ids.reserve(image_ids.size());
-    for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-      if (UseInlierMatchesCheck(two_view_geometries[i])) {
-        image_t image_id1;
-        image_t image_id2;
-        Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
-        if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
-          connected_image_ids.insert(image_id1);
-          connected_image_ids.insert(image_id2);
-        }
+    size_t num_connected_image_pairs = 0;
+    for (const auto& pair_id : image_pair_ids) {
+      image_t image_id1;
+      image_t image_id2;
+      Database::PairIdToImagePair(pair_id.first, &image_id1, &image_id2);
+      if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
+        connected_image_ids.insert(image_id1);
+        connected_image_ids.insert(image_id2);
+        image_pair_ids[num_connected_image_pairs] = pair_id;
+        num_connected_image_pairs += 1;
       }
     }
+    image_pair_ids.resize(num_connected_image_pairs);
+
+    const std::unique_ptr<FeatureStore> feature_store =
+        FeatureStore::Open(feature_store_path, database);
 
     // Load images with correspondences and discard images without
-    // correspondences, as those images are useless for SfM.
+    // correspondences, as those images are useless for SfM. The images are
+    // inserted first, so that their points can be loaded concurrently.
+    std::vector<class Image*> connected_images;
+    connected_images.reserve(connected_image_ids.size());
     images_.reserve(connected_image_ids.size());
     for (const class Image& image : images) {
       if (image_ids.count(image.ImageId()) > 0 &&
           connected_image_ids.count(image.ImageId()) > 0) {
-        images_.emplace(image.ImageId(), image);
-        const FeatureKeypoints keypoints =
-            database.ReadKeypoints(image.ImageId());
-        const std::vector<Eigen::Vector2d> points =
-            FeatureKeypointsToPointsVector(keypoints);
-        images_[image.ImageId()].SetPoints2D(points);
+        connected_images.push_back(
+            &images_.emplace(image.ImageId(), image).first->second);
       }
     }
 
+    ParallelFor(connected_images.size(), [&](const Database& worker_database,
+                                             const size_t begin,
+                                             const size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        class Image& image = *connected_images[i];
+        std::vector<Eigen::Vector2d> points;
+        if (feature_store && feature_store->ExistsImage(image.ImageId())) {
+          const FeatureKeypoint* keypoints_data =
+              feature_store->KeypointsData(image.ImageId());
+          points.resize(feature_store->NumFeaturesForImage(image.ImageId()));
+          for (size_t j = 0; j < points.size(); ++j) {
+            points[j] =
+                Eigen::Vector2d(keypoints_data[j].x, keypoints_data[j].y);
+          }
+        } else {
+          const FeatureKeypoints keypoints =
+              worker_database.ReadKeypoints(image.ImageId());
+          points = FeatureKeypointsToPointsVector(keypoints);
+        }
+        image.SetPoints2D(points);
+      }
+    });
+
+    images_elapsed_time = timer.ElapsedSeconds();
     std::cout << StringPrintf(" %d in %.3fs (connected %d)", images.size(),
-                              timer.ElapsedSeconds(),
-                              connected_image_ids.size())
+                              images_elapsed_time, connected_image_ids.size())
               << std::endl;
   }
 
@@ -149,31 +314,83 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
   // Build scene graph
   //////////////////////////////////////////////////////////////////////////////
 
+  const size_t num_connections = parallel ? thread_pool.NumThreads() : 1;
+
   timer.Restart();
-  std::cout << "Building scene graph..." << std::flush;
 
-  for (const auto& image : images_) {
-    scene_graph_.AddImage(image.first, image.second.NumPoints2D());
+  uint64_t scene_graph_fingerprint = 0;
+  bool scene_graph_from_snapshot = false;
+  if (!scene_graph_path.empty()) {
+    std::cout << "Reading scene graph snapshot..." << std::flush;
+    scene_graph_fingerprint = SceneGraphFingerprint(
+        images_, image_pair_ids, database.InlierMatchesGeneration());
+    scene_graph_from_snapshot =
+        scene_graph_.ReadSnapshot(scene_graph_path, scene_graph_fingerprint);
+    if (!scene_graph_from_snapshot) {
+      std::cout << " outdated" << std::endl;
+    }
   }
 
-  size_t num_ignored_image_pairs = 0;
-  for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-    if (UseInlierMatchesCheck(two_view_geometries[i])) {
-      image_t image_id1;
-      image_t image_id2;
-      Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
-      if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
-         scene_graph_.AddCorrespondences(image_id1, image_id2,
-                                         two_view_geometries[i].inlier_matches);
-      } else {
-        num_ignored_image_pairs += 1;
+  if (!scene_graph_from_snapshot) {
+    std::cout << "Building scene graph..." << std::flush;
+
+    for (const auto& image : images_) {
+      scene_graph_.AddImage(image.first, image.second.NumPoints2D());
+    }
+
+    // Stream the inlier matches in batches of bounded size, where each batch
+    // is split into one image pair range per connection. The image pairs are
+    // added in the order of their identifiers, as if they were added
+    // sequentially.
+    const std::vector<std::pair<image_pair_t, image_pair_t>> pair_id_ranges =
+        SplitImagePairIdRanges(
+            image_pair_ids,
+            std::max<size_t>(1, kMaxNumBufferedMatches / num_connections));
+
+    for (size_t batch_begin = 0; batch_begin < pair_id_ranges.size();
+         batch_begin += num_connections) {
+      const size_t batch_size =
+          std::min(num_connections, pair_id_ranges.size() - batch_begin);
+
+      std::vector<std::vector<std::pair<image_t, image_t>>> range_image_pairs(
+          batch_size);
+      std::vector<std::vector<FeatureMatches>> range_matches(batch_size);
+      ParallelFor(batch_size, [&](const Database& worker_database,
+                                  const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          Database::InlierMatchesFilter range_filter = inlier_matches_filter;
+          range_filter.min_pair_id = pair_id_ranges[batch_begin + i].first;
+          range_filter.max_pair_id = pair_id_ranges[batch_begin + i].second;
+          worker_database.ForEachInlierMatches(
+              range_filter, [&](const image_pair_t pair_id,
+                                const TwoViewGeometry& two_view_geometry) {
+                image_t image_id1;
+                image_t image_id2;
+                Database::PairIdToImagePair(pair_id, &image_id1, &image_id2);
+                if (image_ids.count(image_id1) > 0 &&
+                    image_ids.count(image_id2) > 0) {
+                  range_image_pairs[i].emplace_back(image_id1, image_id2);
+                  range_matches[i].push_back(two_view_geometry.inlier_matches);
+                }
+              });
+        }
+      });
+
+      std::vector<std::pair<image_t, image_t>> image_pairs;
+      std::vector<const FeatureMatches*> matches;
+      for (size_t i = 0; i < batch_size; ++i) {
+        image_pairs.insert(image_pairs.end(), range_image_pairs[i].begin(),
+                           range_image_pairs[i].end());
+        for (const auto& pair_matches : range_matches[i]) {
+          matches.push_back(&pair_matches);
+        }
       }
-    } else {
-      num_ignored_image_pairs += 1;
+
+      scene_graph_.AddCorrespondences(image_pairs, matches, num_threads);
     }
-  }
 
-  scene_graph_.Finalize();
+    scene_graph_.Finalize();
+  }
 
   // Set number of observations and correspondences per image.
   for (auto& image : images_) {
@@ -183,9 +400,28 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
         scene_graph_.NumCorrespondencesForImage(image.first));
   }
 
-  std::cout << StringPrintf(" in %.3fs (ignored %d)", timer.ElapsedSeconds(),
+  const size_t num_ignored_image_pairs =
+      num_image_pairs - image_pair_ids.size();
+
+  const double scene_graph_elapsed_time = timer.ElapsedSeconds();
+  std::cout << StringPrintf(" in %.3fs (ignored %d)", scene_graph_elapsed_time,
                             num_ignored_image_pairs)
             << std::endl;
+
+  if (!scene_graph_path.empty() && !scene_graph_from_snapshot &&
+      !scene_graph_.WriteSnapshot(scene_graph_path, scene_graph_fingerprint)) {
+    std::cout << "WARNING: Could not write scene graph snapshot "
+              << scene_graph_path << std::endl;
+  }
+
+  std::cout << StringPrintf(
+                   "Loaded database in %.3fs (cameras %.3fs, match graph %.3fs, "
+                   "images %.3fs, scene graph %.3fs, %d connections)",
+                   total_timer.ElapsedSeconds(), cameras_elapsed_time,
+                   match_graph_elapsed_time, images_elapsed_time,
+                   scene_graph_elapsed_time,
+                   num_connections)
+            << std::endl;
 }
 
 }  // namespace colmap
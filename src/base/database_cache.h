@@ -40,6 +40,9 @@ class DatabaseCache {
  public:
   DatabaseCache();
 
+  // The default path of the scene graph snapshot for the given database path.
+  static std::string DefaultSceneGraphPath(const std::string& database_path);
+
   // Get number of objects.
   inline size_t NumCameras() const;
   inline size_t NumImages() const;
@@ -65,7 +68,9 @@ class DatabaseCache {
   void AddCamera(const class Camera& camera);
   void AddImage(const class Image& image);
 
-  // Load cameras, images, features, and matches from database.
+  // Load cameras, images, features, and matches from database. The inlier
+  // matches are streamed from the database in batches of bounded size, so
+  // that they are never all kept in memory next to the scene graph.
   //
   // @param database              Source database from which to load data.
   // @param min_num_matches       Only load image pairs with a minimum number
@@ -73,9 +78,27 @@ class DatabaseCache {
   // @param ignore_watermarks     Whether to ignore watermark image pairs.
   // @param image_names           Whether to use only load the data for a subset
   //                              of the images. All images are used if empty.
+  // @param feature_store_path    Optional path to a feature store, from which
+  //                              the keypoints are read without copying, if
+  //                              it is consistent with the database.
+  // @param num_threads           Number of threads used to read the matches
+  //                              and keypoints with separate read-only
+  //                              connections and to build the scene graph.
+  //                              In-memory databases are read serially.
+  // @param scene_graph_path      Optional path to a scene graph snapshot. If
+  //                              the snapshot matches the fingerprint of the
+  //                              loaded images and image pairs, the scene
+  //                              graph is read from it instead of the inlier
+  //                              matches. Otherwise, the snapshot is rebuilt.
+  //                              The fingerprint includes the generation of
+  //                              the inlier matches, so any write to them
+  //                              invalidates the snapshot.
   void Load(const Database& database, const size_t min_num_matches,
             const bool ignore_watermarks,
-            const std::set<std::string>& image_names);
+            const std::set<std::string>& image_names,
+            const std::string& feature_store_path = "",
+            const int num_threads = -1,
+            const std::string& scene_graph_path = "");
 
  private:
   class SceneGraph scene_graph_;
@@ -18,6 +18,8 @@
 #define BOOST_TEST_MODULE "base/database_cache"
 #include <boost/test/unit_test.hpp>
 
+#include <boost/filesystem.hpp>
+
 #include "base/database_cache.h"
 
 using namespace colmap;
@@ -69,3 +71,161 @@ BOOST_AUTO_TEST_CASE(TestAddImage) {
   BOOST_CHECK_EQUAL(cache.SceneGraph().NumObservationsForImage(image.ImageId()),
                     0);
 }
+
+BOOST_AUTO_TEST_CASE(TestLoadParallel) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+
+  const image_t kNumImages = 10;
+  const size_t kNumKeypoints = 100;
+
+  {
+    Database database(database_path);
+    Camera camera;
+    camera.InitializeWithId(SimplePinholeCameraModel::model_id, 1, 1, 1);
+    const camera_t camera_id = database.WriteCamera(camera);
+    for (image_t i = 0; i < kNumImages; ++i) {
+      Image image;
+      image.SetName("image" + std::to_string(i));
+      image.SetCameraId(camera_id);
+      const image_t image_id = database.WriteImage(image);
+      FeatureKeypoints keypoints(kNumKeypoints);
+      for (size_t j = 0; j < kNumKeypoints; ++j) {
+        keypoints[j].x = image_id;
+        keypoints[j].y = j;
+      }
+      database.WriteKeypoints(image_id, keypoints);
+    }
+    // The last image has no matches.
+    for (image_t image_id1 = 1; image_id1 < kNumImages; ++image_id1) {
+      for (image_t image_id2 = image_id1 + 1; image_id2 < kNumImages;
+           ++image_id2) {
+        TwoViewGeometry two_view_geometry;
+        two_view_geometry.inlier_matches.resize(image_id1 + image_id2);
+        for (size_t j = 0; j < two_view_geometry.inlier_matches.size(); ++j) {
+          two_view_geometry.inlier_matches[j].point2D_idx1 = j;
+          two_view_geometry.inlier_matches[j].point2D_idx2 = j;
+        }
+        database.WriteInlierMatches(image_id1, image_id2, two_view_geometry);
+      }
+    }
+  }
+
+  Database database(database_path);
+
+  DatabaseCache cache1;
+  cache1.Load(database, 0, false, {}, "", 1);
+  DatabaseCache cache2;
+  cache2.Load(database, 0, false, {}, "", 4);
+
+  BOOST_CHECK_EQUAL(cache1.NumCameras(), 1);
+  BOOST_CHECK_EQUAL(cache1.NumImages(), kNumImages - 1);
+  BOOST_CHECK_EQUAL(cache2.NumCameras(), cache1.NumCameras());
+  BOOST_CHECK_EQUAL(cache2.NumImages(), cache1.NumImages());
+  BOOST_CHECK(cache1.SceneGraph().NumCorrespondencesBetweenImages() ==
+              cache2.SceneGraph().NumCorrespondencesBetweenImages());
+
+  for (const auto& image : cache1.Images()) {
+    const class Image& image2 = cache2.Image(image.first);
+    BOOST_CHECK_EQUAL(image.second.Name(), image2.Name());
+    BOOST_CHECK_EQUAL(image.second.NumPoints2D(), kNumKeypoints);
+    BOOST_CHECK_EQUAL(image2.NumPoints2D(), kNumKeypoints);
+    BOOST_CHECK_EQUAL(image2.Point2D(kNumKeypoints - 1).X(), image.first);
+    BOOST_CHECK_EQUAL(image2.Point2D(kNumKeypoints - 1).Y(),
+                      kNumKeypoints - 1);
+    BOOST_CHECK_EQUAL(image.second.NumObservations(),
+                      image2.NumObservations());
+    BOOST_CHECK_EQUAL(image.second.NumCorrespondences(),
+                      image2.NumCorrespondences());
+  }
+
+  size_t num_image_pairs = 0;
+  for (image_t image_id1 = 1; image_id1 < kNumImages; ++image_id1) {
+    for (image_t image_id2 = image_id1 + 1; image_id2 < kNumImages;
+         ++image_id2) {
+      if (image_id1 + image_id2 >= 15) {
+        num_image_pairs += 1;
+      }
+    }
+  }
+
+  DatabaseCache cache3;
+  cache3.Load(database, 15, false, {}, "", 4);
+  BOOST_CHECK_EQUAL(
+      cache3.SceneGraph().NumCorrespondencesBetweenImages().size(),
+      num_image_pairs);
+  BOOST_CHECK(!cache3.ExistsImage(1));
+  BOOST_CHECK(cache3.ExistsImage(6));
+
+  // The first load writes the snapshot and the second load reads it.
+  const std::string scene_graph_path =
+      DatabaseCache::DefaultSceneGraphPath(database_path);
+  for (int i = 0; i < 2; ++i) {
+    DatabaseCache cache4;
+    cache4.Load(database, 0, false, {}, "", 4, scene_graph_path);
+    BOOST_CHECK(boost::filesystem::exists(scene_graph_path));
+    BOOST_CHECK_EQUAL(cache4.NumImages(), cache1.NumImages());
+    BOOST_CHECK(cache4.SceneGraph().NumCorrespondencesBetweenImages() ==
+                cache1.SceneGraph().NumCorrespondencesBetweenImages());
+    for (const auto& image : cache1.Images()) {
+      const class Image& image4 = cache4.Image(image.first);
+      BOOST_CHECK_EQUAL(image.second.NumObservations(),
+                        image4.NumObservations());
+      BOOST_CHECK_EQUAL(image.second.NumCorrespondences(),
+                        image4.NumCorrespondences());
+      for (point2D_t point2D_idx = 0; point2D_idx < kNumKeypoints;
+           ++point2D_idx) {
+        BOOST_CHECK_EQUAL(
+            cache1.SceneGraph()
+                .FindCorrespondences(image.first, point2D_idx)
+                .size(),
+            cache4.SceneGraph()
+                .FindCorrespondences(image.first, point2D_idx)
+                .size());
+      }
+    }
+  }
+
+  // Different options invalidate the snapshot.
+  DatabaseCache cache5;
+  cache5.Load(database, 15, false, {}, "", 4, scene_graph_path);
+  BOOST_CHECK(cache5.SceneGraph().NumCorrespondencesBetweenImages() ==
+              cache3.SceneGraph().NumCorrespondencesBetweenImages());
+  BOOST_CHECK(!cache5.ExistsImage(1));
+
+  // Inlier matches with the same number of matches but different contents
+  // invalidate the snapshot.
+  DatabaseCache cache6;
+  cache6.Load(database, 0, false, {}, "", 4, scene_graph_path);
+  database.ClearInlierMatches();
+  for (image_t image_id1 = 1; image_id1 < kNumImages; ++image_id1) {
+    for (image_t image_id2 = image_id1 + 1; image_id2 < kNumImages;
+         ++image_id2) {
+      TwoViewGeometry two_view_geometry;
+      two_view_geometry.inlier_matches.resize(image_id1 + image_id2);
+      for (size_t j = 0; j < two_view_geometry.inlier_matches.size(); ++j) {
+        two_view_geometry.inlier_matches[j].point2D_idx1 = j;
+        two_view_geometry.inlier_matches[j].point2D_idx2 =
+            kNumKeypoints - 1 - j;
+      }
+      database.WriteInlierMatches(image_id1, image_id2, two_view_geometry);
+    }
+  }
+  DatabaseCache cache7;
+  cache7.Load(database, 0, false, {}, "", 4, scene_graph_path);
+  BOOST_CHECK(cache7.SceneGraph().NumCorrespondencesBetweenImages() ==
+              cache6.SceneGraph().NumCorrespondencesBetweenImages());
+  const auto corrs = cache7.SceneGraph().FindCorrespondencesBetweenImages(1, 2);
+  BOOST_CHECK_EQUAL(corrs.size(), 3);
+  for (const auto& corr : corrs) {
+    BOOST_CHECK_EQUAL(corr.second, kNumKeypoints - 1 - corr.first);
+  }
+
+  database.Close();
+  boost::filesystem::remove(scene_graph_path);
+  boost::filesystem::remove(database_path);
+  boost::filesystem::remove(database_path + "-shm");
+  boost::filesystem::remove(database_path + "-wal");
+}
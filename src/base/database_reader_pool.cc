@@ -0,0 +1,82 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "base/database_reader_pool.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "util/logging.h"
+
+namespace colmap {
+
+DatabaseReaderPool::Reader::Reader(DatabaseReaderPool* pool, Database* database)
+    : pool_(pool), database_(database) {}
+
+DatabaseReaderPool::Reader::Reader(Reader&& other)
+    : pool_(other.pool_), database_(other.database_) {
+  other.pool_ = nullptr;
+  other.database_ = nullptr;
+}
+
+DatabaseReaderPool::Reader::~Reader() {
+  if (pool_ != nullptr) {
+    pool_->Release(database_);
+  }
+}
+
+DatabaseReaderPool::DatabaseReaderPool(const std::string& path,
+                                       const int num_connections) {
+  CHECK(boost::filesystem::exists(path)) << path;
+
+  int num_effective_connections = num_connections;
+  if (num_connections == ThreadPool::kMaxNumThreads) {
+    num_effective_connections = std::thread::hardware_concurrency();
+  }
+  num_effective_connections = std::max(1, num_effective_connections);
+
+  databases_.reserve(num_effective_connections);
+  available_databases_.reserve(num_effective_connections);
+  for (int i = 0; i < num_effective_connections; ++i) {
+    databases_.emplace_back(new Database());
+    databases_.back()->OpenReadOnly(path);
+    available_databases_.push_back(databases_.back().get());
+  }
+}
+
+size_t DatabaseReaderPool::NumConnections() const { return databases_.size(); }
+
+DatabaseReaderPool::Reader DatabaseReaderPool::Acquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  release_condition_.wait(lock, [this]() {
+    return !available_databases_.empty();
+  });
+  Database* database = available_databases_.back();
+  available_databases_.pop_back();
+  return Reader(this, database);
+}
+
+void DatabaseReaderPool::Release(Database* database) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    available_databases_.push_back(database);
+  }
+  release_condition_.notify_one();
+}
+
+}  // namespace colmap
@@ -0,0 +1,103 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_BASE_DATABASE_READER_POOL_H_
+#define COLMAP_SRC_BASE_DATABASE_READER_POOL_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/database.h"
+#include "util/threading.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// Pool of read-only connections to the same database file, which allows
+// multiple threads to read from the database concurrently instead of
+// serializing all reads on a single connection. Since the database is in WAL
+// mode, the readers are not blocked by a concurrent writer on another
+// connection, but they only see its committed transactions.
+//
+//    DatabaseReaderPool reader_pool(database_path, num_threads);
+//    // In any thread:
+//    const auto reader = reader_pool.Acquire();
+//    const FeatureDescriptors descriptors = reader->ReadDescriptors(image_id);
+//
+class DatabaseReaderPool {
+ public:
+  // Scoped handle to one of the connections of the pool. The connection is
+  // exclusively used by the owner of the handle until it is destructed.
+  class Reader {
+   public:
+    Reader(Reader&& other);
+    ~Reader();
+
+    inline const Database& operator*() const;
+    inline const Database* operator->() const;
+
+   private:
+    NON_COPYABLE(Reader)
+
+    friend class DatabaseReaderPool;
+    Reader(DatabaseReaderPool* pool, Database* database);
+
+    DatabaseReaderPool* pool_;
+    Database* database_;
+  };
+
+  // Open the given number of read-only connections to an existing database.
+  // By default, one connection per hardware thread is opened.
+  explicit DatabaseReaderPool(
+      const std::string& path,
+      const int num_connections = ThreadPool::kMaxNumThreads);
+
+  size_t NumConnections() const;
+
+  // Acquire a connection, which blocks while all connections are in use.
+  Reader Acquire();
+
+ private:
+  NON_COPYABLE(DatabaseReaderPool)
+  NON_MOVABLE(DatabaseReaderPool)
+
+  void Release(Database* database);
+
+  std::vector<std::unique_ptr<Database>> databases_;
+
+  std::mutex mutex_;
+  std::condition_variable release_condition_;
+  std::vector<Database*> available_databases_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+const Database& DatabaseReaderPool::Reader::operator*() const {
+  return *database_;
+}
+
+const Database* DatabaseReaderPool::Reader::operator->() const {
+  return database_;
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BASE_DATABASE_READER_POOL_H_
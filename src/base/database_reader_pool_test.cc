@@ -0,0 +1,107 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "base/database_reader_pool"
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+
+#include <boost/filesystem.hpp>
+
+#include "base/database_reader_pool.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string CreateTestDatabase(const size_t num_images) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+  Database database(database_path);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  for (size_t i = 0; i < num_images; ++i) {
+    Image image;
+    image.SetName("image" + std::to_string(i));
+    image.SetCameraId(camera.CameraId());
+    const image_t image_id = database.WriteImage(image);
+    database.WriteKeypoints(image_id, FeatureKeypoints(image_id));
+  }
+  return database_path;
+}
+
+void RemoveTestDatabase(const std::string& database_path) {
+  boost::filesystem::remove(database_path);
+  boost::filesystem::remove(database_path + "-shm");
+  boost::filesystem::remove(database_path + "-wal");
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestAcquire) {
+  const std::string database_path = CreateTestDatabase(3);
+  {
+    DatabaseReaderPool reader_pool(database_path, 2);
+    BOOST_CHECK_EQUAL(reader_pool.NumConnections(), 2);
+    const auto reader1 = reader_pool.Acquire();
+    const auto reader2 = reader_pool.Acquire();
+    BOOST_CHECK_NE(&*reader1, &*reader2);
+    BOOST_CHECK_EQUAL(reader1->NumImages(), 3);
+    BOOST_CHECK_EQUAL(reader2->ReadKeypoints(2).size(), 2);
+  }
+  RemoveTestDatabase(database_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentReads) {
+  const size_t kNumImages = 20;
+  const std::string database_path = CreateTestDatabase(kNumImages);
+  {
+    DatabaseReaderPool reader_pool(database_path, 3);
+    std::atomic<size_t> num_keypoints(0);
+    ThreadPool thread_pool(8);
+    for (size_t i = 0; i < 100; ++i) {
+      thread_pool.AddTask([&reader_pool, &num_keypoints, i]() {
+        const image_t image_id = 1 + i % kNumImages;
+        const auto reader = reader_pool.Acquire();
+        num_keypoints += reader->ReadKeypoints(image_id).size();
+      });
+    }
+    thread_pool.Wait();
+    BOOST_CHECK_EQUAL(num_keypoints, 5 * kNumImages * (kNumImages + 1) / 2);
+  }
+  RemoveTestDatabase(database_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentWriter) {
+  const std::string database_path = CreateTestDatabase(1);
+  {
+    Database database(database_path);
+    DatabaseReaderPool reader_pool(database_path, 1);
+    BOOST_CHECK(!reader_pool.Acquire()->ExistsDescriptors(1));
+
+    // Uncommitted writes are not visible to the readers.
+    {
+      DatabaseTransaction database_transaction(&database);
+      database.WriteDescriptors(1, FeatureDescriptors(1, 128));
+      BOOST_CHECK(!reader_pool.Acquire()->ExistsDescriptors(1));
+    }
+    BOOST_CHECK(reader_pool.Acquire()->ExistsDescriptors(1));
+  }
+  RemoveTestDatabase(database_path);
+}
@@ -20,7 +20,12 @@
 
 #include <thread>
 
+#include <boost/filesystem.hpp>
+
 #include "base/database.h"
+#include "util/math.h"
+#include "util/random.h"
+#include "util/string.h"
 
 using namespace colmap;
 
@@ -245,6 +250,64 @@ BOOST_AUTO_TEST_CASE(TestDescriptors) {
   BOOST_CHECK_EQUAL(database.NumDescriptorsForImage(image.ImageId()), 10);
 }
 
+BOOST_AUTO_TEST_CASE(TestReadImageNamesWithFeatures) {
+  Database database(kMemoryDatabasePath);
+  BOOST_CHECK(database.ReadImageNamesWithFeatures().empty());
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetCameraId(camera.CameraId());
+  image.SetName("test1");
+  image.SetImageId(database.WriteImage(image));
+  database.WriteKeypoints(image.ImageId(), FeatureKeypoints(10));
+  database.WriteDescriptors(image.ImageId(),
+                            FeatureDescriptors::Random(10, 128));
+  image.SetName("test2");
+  image.SetImageId(database.WriteImage(image));
+  database.WriteKeypoints(image.ImageId(), FeatureKeypoints(10));
+  image.SetName("test3");
+  image.SetImageId(database.WriteImage(image));
+  database.WriteDescriptors(image.ImageId(),
+                            FeatureDescriptors::Random(10, 128));
+  image.SetName("test4");
+  image.SetImageId(database.WriteImage(image));
+  database.WriteKeypoints(image.ImageId(), FeatureKeypoints(0));
+  database.WriteDescriptors(image.ImageId(), FeatureDescriptors(0, 128));
+  const std::unordered_set<std::string> image_names =
+      database.ReadImageNamesWithFeatures();
+  BOOST_CHECK_EQUAL(image_names.size(), 2);
+  BOOST_CHECK_EQUAL(image_names.count("test1"), 1);
+  BOOST_CHECK_EQUAL(image_names.count("test4"), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestFeaturesBatch) {
+  Database database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  std::vector<image_t> image_ids;
+  std::vector<FeatureKeypoints> keypoints;
+  std::vector<FeatureDescriptors> descriptors;
+  for (size_t i = 0; i < 5; ++i) {
+    Image image;
+    image.SetName("test" + std::to_string(i));
+    image.SetCameraId(camera.CameraId());
+    image_ids.push_back(database.WriteImage(image));
+    keypoints.emplace_back(i + 1);
+    descriptors.push_back(FeatureDescriptors::Random(i + 1, 128));
+  }
+  {
+    DatabaseTransaction database_transaction(&database);
+    database.WriteKeypointsBatch(image_ids, keypoints);
+    database.WriteDescriptorsBatch(image_ids, descriptors);
+  }
+  BOOST_CHECK_EQUAL(database.NumKeypoints(), 15);
+  BOOST_CHECK_EQUAL(database.NumDescriptors(), 15);
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    BOOST_CHECK_EQUAL(database.NumKeypointsForImage(image_ids[i]), i + 1);
+    BOOST_CHECK_EQUAL(database.ReadDescriptors(image_ids[i]), descriptors[i]);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestMatches) {
   Database database(kMemoryDatabasePath);
   const image_t image_id1 = 1;
@@ -266,6 +329,37 @@ BOOST_AUTO_TEST_CASE(TestMatches) {
   BOOST_CHECK_EQUAL(database.NumMatches(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(TestMatchesBatch) {
+  Database database(kMemoryDatabasePath);
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+  std::vector<FeatureMatches> matches;
+  std::vector<TwoViewGeometry> two_view_geometries;
+  for (image_t image_id = 1; image_id <= 10; ++image_id) {
+    image_pairs.emplace_back(image_id, image_id + 1);
+    matches.emplace_back(image_id);
+    two_view_geometries.emplace_back();
+    two_view_geometries.back().inlier_matches = FeatureMatches(image_id);
+  }
+  {
+    DatabaseTransaction database_transaction(&database);
+    database.WriteMatchesBatch(image_pairs, matches);
+    database.WriteInlierMatchesBatch(image_pairs, two_view_geometries);
+  }
+  BOOST_CHECK_EQUAL(database.NumMatchedImagePairs(), 10);
+  BOOST_CHECK_EQUAL(database.NumMatches(), 55);
+  BOOST_CHECK_EQUAL(database.NumInlierMatches(), 55);
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    BOOST_CHECK_EQUAL(
+        database.ReadMatches(image_pairs[i].first, image_pairs[i].second)
+            .size(),
+        matches[i].size());
+    BOOST_CHECK_EQUAL(
+        database.ReadInlierMatches(image_pairs[i].first, image_pairs[i].second)
+            .inlier_matches.size(),
+        two_view_geometries[i].inlier_matches.size());
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestInlierMatches) {
   Database database(kMemoryDatabasePath);
   const image_t image_id1 = 1;
@@ -302,3 +396,615 @@ BOOST_AUTO_TEST_CASE(TestInlierMatches) {
   database.ClearInlierMatches();
   BOOST_CHECK_EQUAL(database.NumInlierMatches(), 0);
 }
+
+BOOST_AUTO_TEST_CASE(TestQuantizedKeypoints) {
+  Database database(kMemoryDatabasePath);
+  database.SetQuantizeKeypoints(true);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetName("test");
+  image.SetCameraId(camera.CameraId());
+  image.SetImageId(database.WriteImage(image));
+  FeatureKeypoints keypoints(100);
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    keypoints[i].x = RandomReal(0.0f, 1000.0f);
+    keypoints[i].y = RandomReal(0.0f, 1000.0f);
+    keypoints[i].scale = i == 0 ? 0.0f : RandomReal(0.1f, 500.0f);
+    keypoints[i].orientation = RandomReal(-2 * M_PI, 2 * M_PI);
+  }
+  database.WriteKeypoints(image.ImageId(), keypoints);
+  const FeatureKeypoints keypoints_read =
+      database.ReadKeypoints(image.ImageId());
+  BOOST_CHECK_EQUAL(keypoints.size(), keypoints_read.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(keypoints[i].x, keypoints_read[i].x);
+    BOOST_CHECK_EQUAL(keypoints[i].y, keypoints_read[i].y);
+    BOOST_CHECK_CLOSE(keypoints[i].scale, keypoints_read[i].scale, 1e-1);
+    BOOST_CHECK_GE(keypoints_read[i].orientation, -M_PI);
+    BOOST_CHECK_LT(keypoints_read[i].orientation, M_PI);
+    BOOST_CHECK_SMALL(std::sin(keypoints[i].orientation) -
+                          std::sin(keypoints_read[i].orientation),
+                      1e-3f);
+    BOOST_CHECK_SMALL(std::cos(keypoints[i].orientation) -
+                          std::cos(keypoints_read[i].orientation),
+                      1e-3f);
+  }
+  BOOST_CHECK_EQUAL(database.NumKeypoints(), 100);
+
+  // Connections created while the default is enabled quantize keypoints.
+  Database::SetDefaultQuantizeKeypoints(true);
+  Database other_database(kMemoryDatabasePath);
+  Database::SetDefaultQuantizeKeypoints(false);
+  camera.SetCameraId(other_database.WriteCamera(camera));
+  image.SetCameraId(camera.CameraId());
+  image.SetImageId(other_database.WriteImage(image));
+  other_database.WriteKeypoints(image.ImageId(), keypoints);
+  const FeatureKeypoints other_keypoints_read =
+      other_database.ReadKeypoints(image.ImageId());
+  BOOST_CHECK_EQUAL(keypoints.size(), other_keypoints_read.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(keypoints_read[i].scale, other_keypoints_read[i].scale);
+    BOOST_CHECK_EQUAL(keypoints_read[i].orientation,
+                      other_keypoints_read[i].orientation);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestCompactMatches) {
+  Database database(kMemoryDatabasePath);
+  // Small sorted indices, large indices, and invalid indices.
+  FeatureMatches matches(3000);
+  for (size_t i = 0; i < 1000; ++i) {
+    matches[i].point2D_idx1 = 2 * i;
+    matches[i].point2D_idx2 = RandomInteger(0, 8000);
+  }
+  for (size_t i = 1000; i < 2000; ++i) {
+    matches[i].point2D_idx1 = RandomInteger(0, 1000000);
+    matches[i].point2D_idx2 = RandomInteger(0, 1000000);
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    FeatureMatches matches_subset;
+    if (i == 0) {
+      matches_subset.assign(matches.begin(), matches.begin() + 1000);
+    } else if (i == 1) {
+      matches_subset.assign(matches.begin() + 1000, matches.begin() + 2000);
+    } else if (i == 2) {
+      matches_subset = matches;
+    }
+
+    const image_t image_id1 = 2 * i + 2;
+    const image_t image_id2 = 2 * i + 1;
+    TwoViewGeometry two_view_geometry;
+    two_view_geometry.config = TwoViewGeometry::CALIBRATED;
+    two_view_geometry.inlier_matches = matches_subset;
+    database.WriteMatches(image_id1, image_id2, matches_subset);
+    database.WriteInlierMatches(image_id1, image_id2, two_view_geometry);
+
+    for (const bool swap : {false, true}) {
+      const FeatureMatches matches_read =
+          swap ? database.ReadMatches(image_id2, image_id1)
+               : database.ReadMatches(image_id1, image_id2);
+      const TwoViewGeometry two_view_geometry_read =
+          swap ? database.ReadInlierMatches(image_id2, image_id1)
+               : database.ReadInlierMatches(image_id1, image_id2);
+      BOOST_CHECK_EQUAL(two_view_geometry_read.config,
+                        TwoViewGeometry::CALIBRATED);
+      BOOST_CHECK_EQUAL(matches_read.size(), matches_subset.size());
+      BOOST_CHECK_EQUAL(two_view_geometry_read.inlier_matches.size(),
+                        matches_subset.size());
+      for (size_t j = 0; j < matches_subset.size(); ++j) {
+        const point2D_t point2D_idx1 = swap ? matches_subset[j].point2D_idx2
+                                            : matches_subset[j].point2D_idx1;
+        const point2D_t point2D_idx2 = swap ? matches_subset[j].point2D_idx1
+                                            : matches_subset[j].point2D_idx2;
+        BOOST_CHECK_EQUAL(matches_read[j].point2D_idx1, point2D_idx1);
+        BOOST_CHECK_EQUAL(matches_read[j].point2D_idx2, point2D_idx2);
+        BOOST_CHECK_EQUAL(
+            two_view_geometry_read.inlier_matches[j].point2D_idx1,
+            point2D_idx1);
+        BOOST_CHECK_EQUAL(
+            two_view_geometry_read.inlier_matches[j].point2D_idx2,
+            point2D_idx2);
+      }
+    }
+  }
+  BOOST_CHECK_EQUAL(database.NumMatches(), 5000);
+  BOOST_CHECK_EQUAL(database.NumInlierMatches(), 5000);
+  BOOST_CHECK_EQUAL(database.ReadAllMatches().size(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(TestCompactMatchesUInt16) {
+  Database database(kMemoryDatabasePath);
+  // Unsorted indices below 2^16 are stored as fixed-size 16-bit integers at
+  // an odd offset in the blob.
+  FeatureMatches matches(1001);
+  for (auto& match : matches) {
+    match.point2D_idx1 = RandomInteger(0, 65535);
+    match.point2D_idx2 = RandomInteger(0, 65535);
+  }
+  database.WriteMatches(1, 2, matches);
+  const FeatureMatches matches_read = database.ReadMatches(1, 2);
+  BOOST_CHECK_EQUAL(matches_read.size(), matches.size());
+  for (size_t i = 0; i < matches.size(); ++i) {
+    BOOST_CHECK_EQUAL(matches_read[i].point2D_idx1, matches[i].point2D_idx1);
+    BOOST_CHECK_EQUAL(matches_read[i].point2D_idx2, matches[i].point2D_idx2);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestLegacyBlobs) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+
+  // Create a database with the raw blobs of schema version 1.
+  {
+    sqlite3* database;
+    SQLITE3_CALL(sqlite3_open(database_path.c_str(), &database));
+    SQLITE3_EXEC(database,
+                 "CREATE TABLE matches"
+                 "   (pair_id  INTEGER  PRIMARY KEY  NOT NULL,"
+                 "    rows     INTEGER               NOT NULL,"
+                 "    cols     INTEGER               NOT NULL,"
+                 "    data     BLOB);"
+                 "PRAGMA user_version = 1;",
+                 nullptr);
+    const uint32_t data[4] = {1, 2, 3, 4};
+    sqlite3_stmt* sql_stmt;
+    SQLITE3_CALL(sqlite3_prepare_v2(
+        database, "INSERT INTO matches VALUES(?, 2, 2, ?);", -1, &sql_stmt, 0));
+    SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1,
+                                    Database::ImagePairToPairId(1, 2)));
+    SQLITE3_CALL(sqlite3_bind_blob(sql_stmt, 2, data, sizeof(data),
+                                   SQLITE_STATIC));
+    SQLITE3_CALL(sqlite3_step(sql_stmt));
+    SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+    SQLITE3_CALL(sqlite3_close(database));
+  }
+
+  {
+    Database database(database_path);
+    const FeatureMatches matches = database.ReadMatches(1, 2);
+    BOOST_CHECK_EQUAL(matches.size(), 2);
+    BOOST_CHECK_EQUAL(matches[0].point2D_idx1, 1);
+    BOOST_CHECK_EQUAL(matches[0].point2D_idx2, 2);
+    BOOST_CHECK_EQUAL(matches[1].point2D_idx1, 3);
+    BOOST_CHECK_EQUAL(matches[1].point2D_idx2, 4);
+
+    // New blobs are written in the compact encoding next to the old blobs.
+    database.WriteMatches(3, 4, matches);
+    BOOST_CHECK_EQUAL(database.ReadMatches(3, 4).size(), 2);
+    BOOST_CHECK_EQUAL(database.ReadMatches(3, 4)[1].point2D_idx2, 4);
+    BOOST_CHECK_EQUAL(database.ReadAllMatches().size(), 2);
+    BOOST_CHECK_EQUAL(database.NumMatches(), 4);
+  }
+
+  boost::filesystem::remove(database_path);
+  boost::filesystem::remove(database_path + "-shm");
+  boost::filesystem::remove(database_path + "-wal");
+}
+
+BOOST_AUTO_TEST_CASE(TestReadOnlyAndRange) {
+  BOOST_CHECK_EQUAL(Database(kMemoryDatabasePath).Path(), "");
+
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+
+  {
+    Database database(database_path);
+    BOOST_CHECK(!database.Path().empty());
+    TwoViewGeometry two_view_geometry;
+    two_view_geometry.inlier_matches = FeatureMatches(10);
+    database.WriteInlierMatches(1, 2, two_view_geometry);
+    database.WriteInlierMatches(1, 3, two_view_geometry);
+    database.WriteInlierMatches(2, 3, two_view_geometry);
+  }
+
+  Database database;
+  database.OpenReadOnly(database_path);
+  BOOST_CHECK_EQUAL(database.NumInlierMatches(), 30);
+
+  std::vector<image_pair_t> image_pair_ids;
+  std::vector<TwoViewGeometry> two_view_geometries;
+  database.ReadInlierMatchesInRange(0, Database::ImagePairToPairId(1, 3),
+                                    &image_pair_ids, &two_view_geometries);
+  BOOST_CHECK_EQUAL(image_pair_ids.size(), 1);
+  BOOST_CHECK_EQUAL(image_pair_ids[0], Database::ImagePairToPairId(1, 2));
+  BOOST_CHECK_EQUAL(two_view_geometries[0].inlier_matches.size(), 10);
+
+  database.ReadInlierMatchesInRange(Database::ImagePairToPairId(1, 3),
+                                    Database::ImagePairToPairId(2, 3) + 1,
+                                    &image_pair_ids, &two_view_geometries);
+  BOOST_CHECK_EQUAL(image_pair_ids.size(), 3);
+  BOOST_CHECK_EQUAL(image_pair_ids[1], Database::ImagePairToPairId(1, 3));
+  BOOST_CHECK_EQUAL(image_pair_ids[2], Database::ImagePairToPairId(2, 3));
+  BOOST_CHECK_EQUAL(two_view_geometries.size(), 3);
+
+  database.Close();
+  boost::filesystem::remove(database_path);
+  boost::filesystem::remove(database_path + "-shm");
+  boost::filesystem::remove(database_path + "-wal");
+}
+
+BOOST_AUTO_TEST_CASE(TestForEachInlierMatches) {
+  Database database(kMemoryDatabasePath);
+  TwoViewGeometry two_view_geometry;
+  two_view_geometry.config = TwoViewGeometry::CALIBRATED;
+  two_view_geometry.inlier_matches = FeatureMatches(10);
+  database.WriteInlierMatches(1, 2, two_view_geometry);
+  two_view_geometry.inlier_matches = FeatureMatches(5);
+  database.WriteInlierMatches(1, 3, two_view_geometry);
+  two_view_geometry.config = TwoViewGeometry::WATERMARK;
+  database.WriteInlierMatches(2, 3, two_view_geometry);
+  two_view_geometry.inlier_matches.clear();
+  database.WriteInlierMatches(3, 4, two_view_geometry);
+  database.WriteMatches(1, 2, FeatureMatches(7));
+  database.WriteMatches(2, 3, FeatureMatches(3));
+
+  std::vector<image_pair_t> pair_ids;
+  std::vector<size_t> num_matches;
+  auto Collect = [&](const image_pair_t pair_id,
+                     const TwoViewGeometry& two_view_geometry) {
+    pair_ids.push_back(pair_id);
+    num_matches.push_back(two_view_geometry.inlier_matches.size());
+  };
+
+  Database::InlierMatchesFilter filter;
+  database.ForEachInlierMatches(filter, Collect);
+  BOOST_CHECK_EQUAL(pair_ids.size(), 3);
+  BOOST_CHECK_EQUAL(pair_ids[0], Database::ImagePairToPairId(1, 2));
+  BOOST_CHECK_EQUAL(num_matches[0], 10);
+  BOOST_CHECK_EQUAL(pair_ids[2], Database::ImagePairToPairId(2, 3));
+
+  pair_ids.clear();
+  num_matches.clear();
+  filter.min_num_matches = 6;
+  database.ForEachInlierMatches(filter, Collect);
+  BOOST_CHECK_EQUAL(pair_ids.size(), 1);
+  BOOST_CHECK_EQUAL(pair_ids[0], Database::ImagePairToPairId(1, 2));
+
+  pair_ids.clear();
+  num_matches.clear();
+  filter.min_num_matches = 0;
+  filter.ignore_watermarks = true;
+  database.ForEachInlierMatches(filter, Collect);
+  BOOST_CHECK_EQUAL(pair_ids.size(), 2);
+  BOOST_CHECK_EQUAL(pair_ids[1], Database::ImagePairToPairId(1, 3));
+  BOOST_CHECK_EQUAL(num_matches[1], 5);
+
+  size_t num_graph_pairs = 0;
+  size_t num_graph_inliers = 0;
+  database.ForEachInlierMatchesGraph(
+      filter, [&](const image_pair_t, const int num_inliers) {
+        num_graph_pairs += 1;
+        num_graph_inliers += num_inliers;
+      });
+  BOOST_CHECK_EQUAL(num_graph_pairs, 2);
+  BOOST_CHECK_EQUAL(num_graph_inliers, 15);
+
+  size_t num_all_matches = 0;
+  database.ForEachMatches(
+      [&](const image_pair_t, const FeatureMatches& matches) {
+        num_all_matches += matches.size();
+      });
+  BOOST_CHECK_EQUAL(num_all_matches, 10);
+}
+
+BOOST_AUTO_TEST_CASE(TestIdentifier) {
+  Database database1(kMemoryDatabasePath);
+  Database database2(kMemoryDatabasePath);
+  BOOST_CHECK_EQUAL(database1.Identifier(), database1.Identifier());
+  BOOST_CHECK_NE(database1.Identifier(), database2.Identifier());
+}
+
+BOOST_AUTO_TEST_CASE(TestFeaturesGeneration) {
+  Database database(kMemoryDatabasePath);
+  BOOST_CHECK_EQUAL(database.FeaturesGeneration(), 0);
+
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetName("test");
+  image.SetCameraId(camera.CameraId());
+  image.SetImageId(database.WriteImage(image));
+  BOOST_CHECK_EQUAL(database.FeaturesGeneration(), 0);
+
+  database.WriteKeypoints(image.ImageId(), FeatureKeypoints(10));
+  const uint64_t keypoints_generation = database.FeaturesGeneration();
+  BOOST_CHECK_GT(keypoints_generation, 0);
+  database.WriteDescriptors(image.ImageId(), FeatureDescriptors(10, 128));
+  BOOST_CHECK_GT(database.FeaturesGeneration(), keypoints_generation);
+}
+
+BOOST_AUTO_TEST_CASE(TestInlierMatchesGeneration) {
+  Database database(kMemoryDatabasePath);
+  BOOST_CHECK_EQUAL(database.InlierMatchesGeneration(), 0);
+
+  TwoViewGeometry two_view_geometry;
+  two_view_geometry.config = TwoViewGeometry::CALIBRATED;
+  two_view_geometry.inlier_matches = FeatureMatches(2);
+  database.WriteInlierMatches(1, 2, two_view_geometry);
+  database.WriteInlierMatches(1, 3, two_view_geometry);
+  const uint64_t generation = database.InlierMatchesGeneration();
+  BOOST_CHECK_GT(generation, 0);
+
+  // Writes to other tables do not change the generation.
+  database.WriteMatches(1, 2, FeatureMatches(2));
+  BOOST_CHECK_EQUAL(database.InlierMatchesGeneration(), generation);
+
+  // Rewriting the same number of inlier matches changes the generation.
+  database.ClearInlierMatches();
+  BOOST_CHECK_GT(database.InlierMatchesGeneration(), generation);
+  const uint64_t cleared_generation = database.InlierMatchesGeneration();
+  database.WriteInlierMatches(1, 2, two_view_geometry);
+  database.WriteInlierMatches(1, 3, two_view_geometry);
+  BOOST_CHECK_GT(database.InlierMatchesGeneration(), cleared_generation);
+}
+
+BOOST_AUTO_TEST_CASE(TestForEachMatchesPairId) {
+  Database database(kMemoryDatabasePath);
+  database.WriteMatches(1, 2, FeatureMatches(1));
+  database.WriteMatches(3, 2, FeatureMatches());
+  TwoViewGeometry two_view_geometry;
+  database.WriteInlierMatches(4, 5, two_view_geometry);
+
+  std::vector<image_pair_t> pair_ids;
+  database.ForEachMatchesPairId(
+      [&pair_ids](const image_pair_t pair_id) { pair_ids.push_back(pair_id); });
+  BOOST_CHECK_EQUAL(pair_ids.size(), 2);
+  BOOST_CHECK_EQUAL(pair_ids[0], Database::ImagePairToPairId(1, 2));
+  BOOST_CHECK_EQUAL(pair_ids[1], Database::ImagePairToPairId(2, 3));
+
+  pair_ids.clear();
+  database.ForEachInlierMatchesPairId(
+      [&pair_ids](const image_pair_t pair_id) { pair_ids.push_back(pair_id); });
+  BOOST_CHECK_EQUAL(pair_ids.size(), 1);
+  BOOST_CHECK_EQUAL(pair_ids[0], Database::ImagePairToPairId(4, 5));
+}
+
+BOOST_AUTO_TEST_CASE(TestMergeMatches) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+  const std::string shard_path = database_path + ".shard";
+
+  {
+    Database database(database_path);
+    Camera camera;
+    camera.InitializeWithName("PINHOLE", 1.0, 1, 1);
+    camera.SetCameraId(database.WriteCamera(camera));
+    for (int i = 0; i < 3; ++i) {
+      Image image;
+      image.SetName("image" + std::to_string(i));
+      image.SetCameraId(camera.CameraId());
+      database.WriteImage(image);
+    }
+    database.WriteMatches(1, 2, FeatureMatches(1));
+  }
+
+  boost::filesystem::copy_file(database_path, shard_path);
+
+  {
+    Database shard_database(shard_path);
+    // The existing pair is not overwritten by the merge.
+    shard_database.ClearMatches();
+    shard_database.WriteMatches(1, 2, FeatureMatches(5));
+    shard_database.WriteMatches(1, 3, FeatureMatches(2));
+    TwoViewGeometry two_view_geometry;
+    two_view_geometry.config = TwoViewGeometry::UNCALIBRATED;
+    two_view_geometry.inlier_matches = FeatureMatches(1);
+    shard_database.WriteInlierMatches(1, 2, two_view_geometry);
+    two_view_geometry.inlier_matches = FeatureMatches(3);
+    shard_database.WriteInlierMatches(2, 3, two_view_geometry);
+  }
+
+  Database database(database_path);
+  size_t num_merged_matches = 0;
+  size_t num_merged_inlier_matches = 0;
+  BOOST_CHECK(database.MergeMatches(shard_path, &num_merged_matches,
+                                    &num_merged_inlier_matches));
+  BOOST_CHECK_EQUAL(num_merged_matches, 1);
+  BOOST_CHECK_EQUAL(num_merged_inlier_matches, 2);
+  BOOST_CHECK_EQUAL(database.NumMatchedImagePairs(), 2);
+  BOOST_CHECK_EQUAL(database.ReadMatches(1, 2).size(), 1);
+  BOOST_CHECK_EQUAL(database.ReadMatches(1, 3).size(), 2);
+  BOOST_CHECK_EQUAL(database.ReadInlierMatches(2, 3).inlier_matches.size(), 3);
+  BOOST_CHECK_EQUAL(database.ReadInlierMatches(2, 3).config,
+                    TwoViewGeometry::UNCALIBRATED);
+
+  // Merging again does not duplicate any entries.
+  BOOST_CHECK(database.MergeMatches(shard_path, &num_merged_matches,
+                                    &num_merged_inlier_matches));
+  BOOST_CHECK_EQUAL(num_merged_matches, 0);
+  BOOST_CHECK_EQUAL(num_merged_inlier_matches, 0);
+
+  // Shards with images that do not exist in the database are rejected.
+  {
+    Database shard_database(shard_path);
+    Image image;
+    image.SetName("image3");
+    image.SetCameraId(1);
+    shard_database.WriteImage(image);
+    shard_database.WriteMatches(1, 4, FeatureMatches(1));
+  }
+  BOOST_CHECK(!database.MergeMatches(shard_path, &num_merged_matches,
+                                     &num_merged_inlier_matches));
+  BOOST_CHECK_EQUAL(num_merged_matches, 0);
+  BOOST_CHECK(!database.ExistsMatches(1, 4));
+
+  database.Close();
+  for (const auto& path : {database_path, shard_path}) {
+    boost::filesystem::remove(path);
+    boost::filesystem::remove(path + "-shm");
+    boost::filesystem::remove(path + "-wal");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestMergeFeatures) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+  const std::vector<std::string> shard_paths = {database_path + ".shard0",
+                                                database_path + ".shard1"};
+
+  // Each shard has its own camera and images with overlapping identifiers.
+  for (size_t shard_idx = 0; shard_idx < shard_paths.size(); ++shard_idx) {
+    Database shard_database(shard_paths[shard_idx]);
+    Camera camera;
+    camera.InitializeWithName("SIMPLE_PINHOLE", 1.0 + shard_idx, 1, 1);
+    camera.SetCameraId(shard_database.WriteCamera(camera));
+    for (int i = 0; i < 2; ++i) {
+      Image image;
+      image.SetName(StringPrintf("image%d", 2 * shard_idx + i));
+      image.SetCameraId(camera.CameraId());
+      image.SetImageId(shard_database.WriteImage(image));
+      shard_database.WriteKeypoints(image.ImageId(),
+                                    FeatureKeypoints(2 * shard_idx + i + 1));
+      shard_database.WriteDescriptors(
+          image.ImageId(), FeatureDescriptors::Constant(
+                               2 * shard_idx + i + 1, 128, image.ImageId()));
+    }
+  }
+
+  {
+    Database database(database_path);
+    size_t num_merged_images = 0;
+    for (const auto& shard_path : shard_paths) {
+      BOOST_CHECK(
+          database.MergeFeatures(shard_path, false, &num_merged_images));
+      BOOST_CHECK_EQUAL(num_merged_images, 2);
+    }
+
+    BOOST_CHECK_EQUAL(database.NumCameras(), 2);
+    BOOST_CHECK_EQUAL(database.NumImages(), 4);
+    for (image_t image_id = 1; image_id <= 4; ++image_id) {
+      const Image image = database.ReadImage(image_id);
+      BOOST_CHECK_EQUAL(image.Name(), StringPrintf("image%d", image_id - 1));
+      BOOST_CHECK_EQUAL(image.CameraId(), image_id <= 2 ? 1 : 2);
+      BOOST_CHECK_EQUAL(database.NumKeypointsForImage(image_id), image_id);
+      const FeatureDescriptors descriptors = database.ReadDescriptors(image_id);
+      BOOST_CHECK_EQUAL(descriptors.rows(), image_id);
+      BOOST_CHECK_EQUAL(descriptors(0, 0), (image_id - 1) % 2 + 1);
+    }
+
+    // Merging again does not duplicate any entries.
+    BOOST_CHECK(
+        database.MergeFeatures(shard_paths[1], false, &num_merged_images));
+    BOOST_CHECK_EQUAL(num_merged_images, 0);
+    BOOST_CHECK_EQUAL(database.NumImages(), 4);
+  }
+
+  boost::filesystem::remove(database_path);
+
+  {
+    Database database(database_path);
+    size_t num_merged_images = 0;
+    for (const auto& shard_path : shard_paths) {
+      BOOST_CHECK(database.MergeFeatures(shard_path, true, &num_merged_images));
+      BOOST_CHECK_EQUAL(num_merged_images, 2);
+    }
+
+    BOOST_CHECK_EQUAL(database.NumCameras(), 1);
+    BOOST_CHECK_EQUAL(database.ReadCamera(1).FocalLength(), 1.0);
+    for (const auto& image : database.ReadAllImages()) {
+      BOOST_CHECK_EQUAL(image.CameraId(), 1);
+    }
+  }
+
+  // Shards with cameras of different dimensions cannot share a camera.
+  {
+    Database shard_database(shard_paths[0]);
+    Camera camera;
+    camera.InitializeWithName("SIMPLE_PINHOLE", 1.0, 2, 1);
+    camera.SetCameraId(shard_database.WriteCamera(camera));
+    Image image;
+    image.SetName("image4");
+    image.SetCameraId(camera.CameraId());
+    shard_database.WriteImage(image);
+  }
+
+  {
+    Database database(database_path);
+    size_t num_merged_images = 0;
+    BOOST_CHECK(
+        !database.MergeFeatures(shard_paths[0], true, &num_merged_images));
+    BOOST_CHECK_EQUAL(num_merged_images, 0);
+    BOOST_CHECK(!database.ExistsImageWithName("image4"));
+    BOOST_CHECK(
+        database.MergeFeatures(shard_paths[0], false, &num_merged_images));
+    BOOST_CHECK_EQUAL(num_merged_images, 1);
+    BOOST_CHECK_EQUAL(database.NumCameras(), 2);
+  }
+
+  for (const auto& path : {database_path, shard_paths[0], shard_paths[1]}) {
+    boost::filesystem::remove(path);
+    boost::filesystem::remove(path + "-shm");
+    boost::filesystem::remove(path + "-wal");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestStats) {
+  Database database(kMemoryDatabasePath);
+  BOOST_CHECK_EQUAL(database.Stats().statements.size(), 0);
+
+  database.SetCollectStats(true);
+  BOOST_CHECK_GT(database.Stats().page_size, 0);
+
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetName("test");
+  image.SetCameraId(camera.CameraId());
+  image.SetImageId(database.WriteImage(image));
+  {
+    DatabaseTransaction database_transaction(&database);
+    database.WriteKeypoints(image.ImageId(), FeatureKeypoints(10));
+    database.WriteDescriptors(image.ImageId(), FeatureDescriptors(10, 128));
+  }
+  database.ReadKeypoints(image.ImageId());
+  database.ReadKeypoints(image.ImageId());
+  database.ReadDescriptors(image.ImageId());
+
+  const auto stats = database.Stats();
+  BOOST_CHECK_EQUAL(stats.num_transactions, 1);
+  BOOST_CHECK_GE(stats.transaction_time, 0);
+  BOOST_CHECK_EQUAL(stats.tables.at("keypoints").num_rows_written, 1);
+  BOOST_CHECK_EQUAL(stats.tables.at("keypoints").num_rows_read, 2);
+  BOOST_CHECK_EQUAL(stats.tables.at("keypoints").num_bytes_read,
+                    2 * stats.tables.at("keypoints").num_bytes_written);
+  BOOST_CHECK_EQUAL(stats.tables.at("descriptors").num_bytes_written,
+                    10 * 128);
+  BOOST_CHECK_EQUAL(stats.tables.at("descriptors").num_bytes_read, 10 * 128);
+  BOOST_CHECK_EQUAL(stats.tables.count("matches"), 0);
+
+  size_t num_read_keypoints_calls = 0;
+  for (const auto& statement : stats.statements) {
+    BOOST_CHECK_GE(statement.second.elapsed_time, 0);
+    if (statement.first.find("FROM keypoints") != std::string::npos &&
+        statement.first.find("SELECT rows, cols, data") == 0) {
+      num_read_keypoints_calls += statement.second.num_calls;
+    }
+  }
+  BOOST_CHECK_EQUAL(num_read_keypoints_calls, 2);
+
+  database.ResetStats();
+  BOOST_CHECK_EQUAL(database.Stats().statements.size(), 0);
+  BOOST_CHECK_EQUAL(database.Stats().tables.size(), 0);
+  BOOST_CHECK_EQUAL(database.Stats().num_transactions, 0);
+
+  database.SetCollectStats(false);
+  database.ReadKeypoints(image.ImageId());
+  BOOST_CHECK_EQUAL(database.Stats().tables.size(), 0);
+  BOOST_CHECK_EQUAL(database.Stats().statements.size(), 0);
+
+  // Connections opened while the default is enabled collect statistics.
+  Database::SetDefaultCollectStats(true);
+  Database other_database(kMemoryDatabasePath);
+  Database::SetDefaultCollectStats(false);
+  other_database.ReadAllCameras();
+  BOOST_CHECK_GT(other_database.Stats().statements.size(), 0);
+}
@@ -0,0 +1,202 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "base/database_writer.h"
+
+#include <memory>
+
+#include "util/logging.h"
+
+namespace colmap {
+
+void DatabaseWriter::Options::Check() const {
+  CHECK_GT(max_num_queued_requests, 0);
+  CHECK_GT(max_transaction_size, 0);
+}
+
+DatabaseWriter::DatabaseWriter(const Options& options, Database* database)
+    : options_(options),
+      database_(database),
+      request_queue_(static_cast<size_t>(options.max_num_queued_requests)),
+      num_pending_requests_(0) {
+  options_.Check();
+  CHECK_NOTNULL(database_);
+  thread_ = std::thread(&DatabaseWriter::Run, this);
+}
+
+DatabaseWriter::~DatabaseWriter() {
+  Flush();
+  request_queue_.Stop();
+  thread_.join();
+}
+
+void DatabaseWriter::WriteImageWithFeatures(const Image& image,
+                                            FeatureKeypoints keypoints,
+                                            FeatureDescriptors descriptors) {
+  // Move the data into shared storage to avoid copies of the request.
+  auto keypoints_ptr = std::make_shared<FeatureKeypoints>(std::move(keypoints));
+  auto descriptors_ptr =
+      std::make_shared<FeatureDescriptors>(std::move(descriptors));
+  Push([image, keypoints_ptr, descriptors_ptr](const Database& database) {
+    if (image.ImageId() == kInvalidImageId) {
+      const image_t image_id = database.WriteImage(image);
+      database.WriteKeypoints(image_id, *keypoints_ptr);
+      database.WriteDescriptors(image_id, *descriptors_ptr);
+    } else {
+      if (!database.ExistsKeypoints(image.ImageId())) {
+        database.WriteKeypoints(image.ImageId(), *keypoints_ptr);
+      }
+      if (!database.ExistsDescriptors(image.ImageId())) {
+        database.WriteDescriptors(image.ImageId(), *descriptors_ptr);
+      }
+    }
+  });
+}
+
+std::shared_ptr<const image_t> DatabaseWriter::WriteImage(
+    const Image& image) {
+  auto image_id_ptr = std::make_shared<image_t>(kInvalidImageId);
+  Push([image, image_id_ptr](const Database& database) {
+    *image_id_ptr = database.WriteImage(image);
+  });
+  return image_id_ptr;
+}
+
+void DatabaseWriter::WriteFeatures(std::shared_ptr<const image_t> image_id,
+                                   FeatureKeypoints keypoints,
+                                   FeatureDescriptors descriptors) {
+  CHECK(image_id);
+  auto keypoints_ptr = std::make_shared<FeatureKeypoints>(std::move(keypoints));
+  auto descriptors_ptr =
+      std::make_shared<FeatureDescriptors>(std::move(descriptors));
+  Push([image_id, keypoints_ptr, descriptors_ptr](const Database& database) {
+    CHECK_NE(*image_id, kInvalidImageId);
+    if (!database.ExistsKeypoints(*image_id)) {
+      database.WriteKeypoints(*image_id, *keypoints_ptr);
+    }
+    if (!database.ExistsDescriptors(*image_id)) {
+      database.WriteDescriptors(*image_id, *descriptors_ptr);
+    }
+  });
+}
+
+void DatabaseWriter::WriteKeypointsBatch(
+    std::vector<image_t> image_ids, std::vector<FeatureKeypoints> keypoints) {
+  auto image_ids_ptr =
+      std::make_shared<std::vector<image_t>>(std::move(image_ids));
+  auto keypoints_ptr =
+      std::make_shared<std::vector<FeatureKeypoints>>(std::move(keypoints));
+  Push([image_ids_ptr, keypoints_ptr](const Database& database) {
+    database.WriteKeypointsBatch(*image_ids_ptr, *keypoints_ptr);
+  });
+}
+
+void DatabaseWriter::WriteDescriptorsBatch(
+    std::vector<image_t> image_ids,
+    std::vector<FeatureDescriptors> descriptors) {
+  auto image_ids_ptr =
+      std::make_shared<std::vector<image_t>>(std::move(image_ids));
+  auto descriptors_ptr =
+      std::make_shared<std::vector<FeatureDescriptors>>(std::move(descriptors));
+  Push([image_ids_ptr, descriptors_ptr](const Database& database) {
+    database.WriteDescriptorsBatch(*image_ids_ptr, *descriptors_ptr);
+  });
+}
+
+void DatabaseWriter::WriteMatchesBatch(
+    std::vector<std::pair<image_t, image_t>> image_pairs,
+    std::vector<FeatureMatches> matches) {
+  auto image_pairs_ptr =
+      std::make_shared<std::vector<std::pair<image_t, image_t>>>(
+          std::move(image_pairs));
+  auto matches_ptr =
+      std::make_shared<std::vector<FeatureMatches>>(std::move(matches));
+  Push([image_pairs_ptr, matches_ptr](const Database& database) {
+    database.WriteMatchesBatch(*image_pairs_ptr, *matches_ptr);
+  });
+}
+
+void DatabaseWriter::WriteInlierMatchesBatch(
+    std::vector<std::pair<image_t, image_t>> image_pairs,
+    std::vector<TwoViewGeometry> two_view_geometries) {
+  auto image_pairs_ptr =
+      std::make_shared<std::vector<std::pair<image_t, image_t>>>(
+          std::move(image_pairs));
+  auto two_view_geometries_ptr =
+      std::make_shared<std::vector<TwoViewGeometry>>(
+          std::move(two_view_geometries));
+  Push([image_pairs_ptr, two_view_geometries_ptr](const Database& database) {
+    database.WriteInlierMatchesBatch(*image_pairs_ptr,
+                                     *two_view_geometries_ptr);
+  });
+}
+
+void DatabaseWriter::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  flush_condition_.wait(lock, [this]() { return num_pending_requests_ == 0; });
+}
+
+size_t DatabaseWriter::NumPendingRequests() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return num_pending_requests_;
+}
+
+void DatabaseWriter::Push(const Request& request) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_pending_requests_ += 1;
+  }
+  CHECK(request_queue_.Push(request));
+}
+
+void DatabaseWriter::Run() {
+  const size_t max_transaction_size =
+      static_cast<size_t>(options_.max_transaction_size);
+
+  while (true) {
+    auto request = request_queue_.Pop();
+    if (!request.IsValid()) {
+      break;
+    }
+
+    // Commit the first request together with all requests that were queued
+    // in the meantime in one transaction. Other connections may write to the
+    // database concurrently, so the write lock is acquired upfront.
+    size_t num_requests = 0;
+    {
+      DatabaseTransaction database_transaction(database_, true);
+      request.Data()(*database_);
+      num_requests += 1;
+      while (num_requests < max_transaction_size &&
+             request_queue_.Size() > 0) {
+        request = request_queue_.Pop();
+        if (!request.IsValid()) {
+          break;
+        }
+        request.Data()(*database_);
+        num_requests += 1;
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_pending_requests_ -= num_requests;
+    if (num_pending_requests_ == 0) {
+      flush_condition_.notify_all();
+    }
+  }
+}
+
+}  // namespace colmap
@@ -0,0 +1,121 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_BASE_DATABASE_WRITER_H_
+#define COLMAP_SRC_BASE_DATABASE_WRITER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base/database.h"
+#include "util/threading.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// Asynchronous database writer, which queues write requests and commits them
+// in large transactions on a dedicated thread. This decouples the compute
+// threads from the database commit latency. While the writer is alive, the
+// given database must not be accessed by any other thread. Use a separate
+// connection to the same database file to read data concurrently, but note
+// that queued requests are only visible to other connections after `Flush`.
+//
+//    DatabaseWriter writer(DatabaseWriter::Options(), &database);
+//    writer.WriteImageWithFeatures(image, keypoints, descriptors);
+//    writer.WriteMatchesBatch(image_pairs, matches);
+//    writer.Flush();
+//
+class DatabaseWriter {
+ public:
+  struct Options {
+    // Maximum number of queued write requests. Producers block if the queue
+    // is full, which bounds the memory used by the pending data.
+    int max_num_queued_requests = 256;
+
+    // Maximum number of write requests that are committed in one transaction.
+    int max_transaction_size = 1000;
+
+    void Check() const;
+  };
+
+  DatabaseWriter(const Options& options, Database* database);
+
+  // Flushes all pending requests and stops the writer thread.
+  ~DatabaseWriter();
+
+  // Write the image and its features. If the image does not have a valid
+  // identifier, a new image is written to the database. Otherwise, only the
+  // features that do not yet exist in the database are written.
+  void WriteImageWithFeatures(const Image& image, FeatureKeypoints keypoints,
+                              FeatureDescriptors descriptors);
+
+  // Write a new image and return its future identifier, which is set once the
+  // request is committed. Since the requests are committed in the order of the
+  // calls, the identifiers of new images follow the order of the calls, even
+  // if their features are computed and written in a different order. The
+  // returned identifier can be passed to `WriteFeatures` right away, but the
+  // caller must only read it after `Flush`.
+  std::shared_ptr<const image_t> WriteImage(const Image& image);
+
+  // Write the features of the image that do not yet exist in the database.
+  void WriteFeatures(std::shared_ptr<const image_t> image_id,
+                     FeatureKeypoints keypoints,
+                     FeatureDescriptors descriptors);
+
+  // Queue batches of new entries. See `Database::Write*Batch` for details.
+  void WriteKeypointsBatch(std::vector<image_t> image_ids,
+                           std::vector<FeatureKeypoints> keypoints);
+  void WriteDescriptorsBatch(std::vector<image_t> image_ids,
+                             std::vector<FeatureDescriptors> descriptors);
+  void WriteMatchesBatch(std::vector<std::pair<image_t, image_t>> image_pairs,
+                         std::vector<FeatureMatches> matches);
+  void WriteInlierMatchesBatch(
+      std::vector<std::pair<image_t, image_t>> image_pairs,
+      std::vector<TwoViewGeometry> two_view_geometries);
+
+  // Block until all queued requests are committed to the database.
+  void Flush();
+
+  // The number of queued and not yet committed requests.
+  size_t NumPendingRequests();
+
+ private:
+  NON_COPYABLE(DatabaseWriter)
+  NON_MOVABLE(DatabaseWriter)
+
+  typedef std::function<void(const Database&)> Request;
+
+  void Push(const Request& request);
+  void Run();
+
+  const Options options_;
+  Database* database_;
+
+  JobQueue<Request> request_queue_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::condition_variable flush_condition_;
+  size_t num_pending_requests_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BASE_DATABASE_WRITER_H_
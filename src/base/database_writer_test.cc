@@ -0,0 +1,131 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "base/database_writer"
+#include <boost/test/unit_test.hpp>
+
+#include "base/database_writer.h"
+
+using namespace colmap;
+
+const static std::string kMemoryDatabasePath = ":memory:";
+
+BOOST_AUTO_TEST_CASE(TestConstructorDestructor) {
+  Database database(kMemoryDatabasePath);
+  DatabaseWriter writer(DatabaseWriter::Options(), &database);
+  BOOST_CHECK_EQUAL(writer.NumPendingRequests(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteImageWithFeatures) {
+  Database database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+
+  Image image1;
+  image1.SetName("test1");
+  image1.SetCameraId(camera.CameraId());
+  Image image2;
+  image2.SetName("test2");
+  image2.SetCameraId(camera.CameraId());
+  image2.SetImageId(database.WriteImage(image2));
+  database.WriteKeypoints(image2.ImageId(), FeatureKeypoints(5));
+
+  {
+    DatabaseWriter::Options options;
+    options.max_num_queued_requests = 1;
+    options.max_transaction_size = 1;
+    DatabaseWriter writer(options, &database);
+    writer.WriteImageWithFeatures(image1, FeatureKeypoints(10),
+                                  FeatureDescriptors::Random(10, 128));
+    writer.WriteImageWithFeatures(image2, FeatureKeypoints(10),
+                                  FeatureDescriptors::Random(10, 128));
+    writer.Flush();
+    BOOST_CHECK_EQUAL(writer.NumPendingRequests(), 0);
+  }
+
+  BOOST_CHECK_EQUAL(database.NumImages(), 2);
+  BOOST_CHECK(database.ExistsImageWithName("test1"));
+  const image_t image_id1 = database.ReadImageWithName("test1").ImageId();
+  BOOST_CHECK_EQUAL(database.NumKeypointsForImage(image_id1), 10);
+  BOOST_CHECK_EQUAL(database.NumDescriptorsForImage(image_id1), 10);
+  BOOST_CHECK_EQUAL(database.NumKeypointsForImage(image2.ImageId()), 5);
+  BOOST_CHECK_EQUAL(database.NumDescriptorsForImage(image2.ImageId()), 10);
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteImageAndFeatures) {
+  Database database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+
+  const int kNumImages = 5;
+
+  {
+    DatabaseWriter writer(DatabaseWriter::Options(), &database);
+
+    std::vector<std::shared_ptr<const image_t>> image_ids;
+    for (int i = 0; i < kNumImages; ++i) {
+      Image image;
+      image.SetName("test" + std::to_string(i));
+      image.SetCameraId(camera.CameraId());
+      image_ids.push_back(writer.WriteImage(image));
+    }
+
+    // The features are written in reverse order of the images.
+    for (int i = kNumImages - 1; i >= 0; --i) {
+      writer.WriteFeatures(image_ids[i], FeatureKeypoints(i + 1),
+                           FeatureDescriptors::Random(i + 1, 128));
+    }
+
+    writer.Flush();
+
+    for (int i = 0; i < kNumImages; ++i) {
+      BOOST_CHECK_EQUAL(*image_ids[i], static_cast<image_t>(i + 1));
+    }
+  }
+
+  BOOST_CHECK_EQUAL(database.NumImages(), kNumImages);
+  for (int i = 0; i < kNumImages; ++i) {
+    const Image image = database.ReadImageWithName("test" + std::to_string(i));
+    BOOST_CHECK_EQUAL(image.ImageId(), static_cast<image_t>(i + 1));
+    BOOST_CHECK_EQUAL(database.NumKeypointsForImage(image.ImageId()), i + 1);
+    BOOST_CHECK_EQUAL(database.NumDescriptorsForImage(image.ImageId()), i + 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteBatches) {
+  Database database(kMemoryDatabasePath);
+
+  {
+    DatabaseWriter writer(DatabaseWriter::Options(), &database);
+    for (image_t image_id = 1; image_id <= 100; ++image_id) {
+      std::vector<std::pair<image_t, image_t>> image_pairs;
+      std::vector<FeatureMatches> matches;
+      std::vector<TwoViewGeometry> two_view_geometries;
+      image_pairs.emplace_back(image_id, image_id + 1);
+      matches.emplace_back(10);
+      two_view_geometries.emplace_back();
+      two_view_geometries.back().inlier_matches = FeatureMatches(5);
+      writer.WriteMatchesBatch(image_pairs, std::move(matches));
+      writer.WriteInlierMatchesBatch(std::move(image_pairs),
+                                     std::move(two_view_geometries));
+    }
+  }
+
+  BOOST_CHECK_EQUAL(database.NumMatchedImagePairs(), 100);
+  BOOST_CHECK_EQUAL(database.NumMatches(), 1000);
+  BOOST_CHECK_EQUAL(database.NumInlierMatches(), 500);
+}
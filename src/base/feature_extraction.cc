@@ -16,11 +16,20 @@
 
 #include "base/feature_extraction.h"
 
+#include <array>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <map>
+#include <sstream>
+#include <unordered_set>
 
 #include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include "base/camera_models.h"
+#include "base/database_writer.h"
 #include "base/feature.h"
 #include "ext/VLFeat/sift.h"
 #include "util/math.h"
@@ -58,6 +67,248 @@ void ScaleBitmap(const int max_image_size, double* scale_x, double* scale_y,
   }
 }
 
+// Scale the keypoint locations from a bitmap, which was down-sampled while
+// reading the image, to the original dimensions of the camera.
+void ScaleKeypoints(const Bitmap& bitmap, const Camera& camera,
+                    FeatureKeypoints* keypoints) {
+  if (static_cast<size_t>(bitmap.Width()) == camera.Width() &&
+      static_cast<size_t>(bitmap.Height()) == camera.Height()) {
+    return;
+  }
+
+  const float scale_x = static_cast<float>(camera.Width()) / bitmap.Width();
+  const float scale_y = static_cast<float>(camera.Height()) / bitmap.Height();
+  const float scale_xy = (scale_x + scale_y) / 2.0f;
+  for (auto& keypoint : *keypoints) {
+    keypoint.x *= scale_x;
+    keypoint.y *= scale_y;
+    keypoint.scale *= scale_xy;
+  }
+}
+
+// Header of the binary feature files, which is followed by the keypoints and
+// the descriptors.
+const char kBinaryFeaturesMagic[8] = {'C', 'O', 'L', 'M', 'A', 'P', 'F', 'T'};
+const uint32_t kBinaryFeaturesVersion = 1;
+
+struct BinaryFeaturesHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dim;
+  uint64_t num_features;
+};
+
+static_assert(sizeof(BinaryFeaturesHeader) == 24, "Unexpected header size");
+static_assert(sizeof(FeatureKeypoint) == 4 * sizeof(float),
+              "Keypoints must be densely packed");
+
+// Features of one DOG level, where the levels are identified by their octave
+// and level index and ordered by increasing scale.
+struct SiftLevelFeatures {
+  size_t num_features = 0;
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+};
+
+typedef std::map<std::pair<int, int>, SiftLevelFeatures> SiftLevels;
+
+// Estimate the memory in bytes per image pixel that VLFeat allocates for the
+// Gaussian, DOG, and gradient levels of the first octave, plus the input.
+double SiftScaleSpaceBytesPerPixel(const SiftOptions& options) {
+  const int num_levels = options.octave_resolution + 3;
+  const int num_buffers = 1 + num_levels + 3 * (num_levels - 1);
+  return sizeof(float) * (num_buffers * std::pow(4.0, -options.first_octave) +
+                          1) +
+         1;
+}
+
+// Compute the margin in pixels around a tile, so that the features inside the
+// tile are not affected by the tile boundary. The margin is the accumulated
+// support of the Gaussian kernels, with which VLFeat successively smoothes the
+// levels of all octaves, plus the support of the largest descriptor.
+double SiftTileMargin(const SiftOptions& options, const int num_octaves) {
+  const int S = options.octave_resolution;
+  const int s_min = -1;
+  const int s_max = S + 1;
+  const int s_best = std::min(s_min + S, s_max);
+  const int last_octave = options.first_octave + num_octaves - 1;
+  const double sigmak = std::pow(2.0, 1.0 / S);
+  const double sigma0 = 1.6 * sigmak;
+  const double sigman = 0.5;
+  const double dsigma0 = sigma0 * std::sqrt(1.0 - 1.0 / (sigmak * sigmak));
+
+  // VLFeat truncates the Gaussian kernels at four standard deviations.
+  auto KernelRadius = [](const double sigma) { return std::ceil(4.0 * sigma); };
+
+  double max_radius = 0;
+  double base_radius = 0;
+  for (int o = options.first_octave; o <= last_octave; ++o) {
+    const double octave_scale = std::pow(2.0, o);
+    const double sa = sigma0 * std::pow(sigmak, s_min);
+    const double sb = o == options.first_octave
+                          ? sigman * std::pow(2.0, -options.first_octave)
+                          : sigma0 * std::pow(sigmak, s_best - S);
+    // The downsampled or upsampled base level uses up to two pixels.
+    double radius = base_radius + 2 * octave_scale;
+    if (sa > sb) {
+      radius += KernelRadius(std::sqrt(sa * sa - sb * sb)) * octave_scale;
+    }
+    for (int s = s_min + 1; s <= s_max; ++s) {
+      radius += KernelRadius(dsigma0 * std::pow(sigmak, s)) * octave_scale;
+      if (s == s_best) {
+        base_radius = radius;
+      }
+    }
+    max_radius = std::max(max_radius, radius);
+  }
+
+  // The descriptor window has 4x4 bins with a size of 3 sigma, and the
+  // detection and gradients use the neighboring pixels in the last octave.
+  const double max_sigma =
+      sigma0 * std::pow(sigmak, s_max) * std::pow(2.0, last_octave);
+  const double descriptor_radius = std::sqrt(2.0) * 3.0 * max_sigma * 5 / 2;
+
+  return max_radius + descriptor_radius + 2 * std::pow(2.0, last_octave);
+}
+
+// Extract the features of the region [min_x, max_x) x [min_y, max_y) of the
+// bitmap and keep only the features inside [keep_min_x, keep_max_x) x
+// [keep_min_y, keep_max_y). The keypoint locations are relative to the entire
+// bitmap. The extracted features are grouped by DOG level.
+bool ExtractSiftLevelFeatures(const SiftOptions& options, const Bitmap& bitmap,
+                              const int num_octaves, const int min_x,
+                              const int min_y, const int max_x,
+                              const int max_y, const int keep_min_x,
+                              const int keep_min_y, const int keep_max_x,
+                              const int keep_max_y, SiftLevels* levels) {
+  const int width = max_x - min_x;
+  const int height = max_y - min_y;
+
+  // Setup SIFT extractor.
+  std::unique_ptr<VlSiftFilt, void (*)(VlSiftFilt*)> sift(
+      vl_sift_new(width, height, num_octaves, options.octave_resolution,
+                  options.first_octave),
+      &vl_sift_delete);
+  if (!sift) {
+    return false;
+  }
+
+  vl_sift_set_peak_thresh(sift.get(), options.peak_threshold);
+  vl_sift_set_edge_thresh(sift.get(), options.edge_threshold);
+
+  // Iterate through octaves.
+  bool first_octave = true;
+  while (true) {
+    if (first_octave) {
+      std::vector<float> data_float(width * height);
+      for (int y = 0; y < height; ++y) {
+        const uint8_t* line = bitmap.GetScanline(min_y + y) + min_x;
+        float* data_line = data_float.data() + y * width;
+        for (int x = 0; x < width; ++x) {
+          data_line[x] = static_cast<float>(line[x]) / 255.0f;
+        }
+      }
+      if (vl_sift_process_first_octave(sift.get(), data_float.data())) {
+        break;
+      }
+      first_octave = false;
+    } else {
+      if (vl_sift_process_next_octave(sift.get())) {
+        break;
+      }
+    }
+
+    // Detect keypoints.
+    vl_sift_detect(sift.get());
+
+    // Extract detected keypoints.
+    const VlSiftKeypoint* vl_keypoints = vl_sift_get_keypoints(sift.get());
+    const int num_keypoints = vl_sift_get_nkeypoints(sift.get());
+    if (num_keypoints == 0) {
+      continue;
+    }
+
+    // Extract features with different orientations per DOG level.
+    SiftLevelFeatures* level = nullptr;
+    size_t level_idx = 0;
+    int prev_level = -1;
+    for (int i = 0; i < num_keypoints; ++i) {
+      const float x = vl_keypoints[i].x + min_x;
+      const float y = vl_keypoints[i].y + min_y;
+      if (x < keep_min_x || x >= keep_max_x || y < keep_min_y ||
+          y >= keep_max_y) {
+        continue;
+      }
+
+      if (vl_keypoints[i].is != prev_level) {
+        if (level != nullptr) {
+          // Resize containers of previous DOG level.
+          level->keypoints.resize(level_idx);
+          level->descriptors.conservativeResize(level_idx, 128);
+        }
+
+        // Add containers for new DOG level.
+        level = &(*levels)[std::make_pair(vl_keypoints[i].o,
+                                          vl_keypoints[i].is)];
+        level_idx = level->keypoints.size();
+        level->keypoints.resize(level_idx +
+                                options.max_num_orientations * num_keypoints);
+        level->descriptors.conservativeResize(
+            level_idx + options.max_num_orientations * num_keypoints, 128);
+      }
+
+      level->num_features += 1;
+      prev_level = vl_keypoints[i].is;
+
+      // Extract feature orientations.
+      double angles[4];
+      int num_orientations;
+      if (options.upright) {
+        num_orientations = 1;
+        angles[0] = 0.0;
+      } else {
+        num_orientations = vl_sift_calc_keypoint_orientations(
+            sift.get(), angles, &vl_keypoints[i]);
+      }
+
+      // Note that this is different from SiftGPU, which selects the top
+      // global maxima as orientations while this selects the first two
+      // local maxima. It is not clear which procedure is better.
+      const int num_used_orientations =
+          std::min(num_orientations, options.max_num_orientations);
+
+      for (int o = 0; o < num_used_orientations; ++o) {
+        level->keypoints[level_idx].x = x + 0.5f;
+        level->keypoints[level_idx].y = y + 0.5f;
+        level->keypoints[level_idx].scale = vl_keypoints[i].sigma;
+        level->keypoints[level_idx].orientation = angles[o];
+
+        Eigen::MatrixXf desc(1, 128);
+        vl_sift_calc_keypoint_descriptor(sift.get(), desc.data(),
+                                         &vl_keypoints[i], angles[o]);
+        if (options.normalization == SiftOptions::Normalization::L2) {
+          desc = L2NormalizeFeatureDescriptors(desc);
+        } else if (options.normalization ==
+                   SiftOptions::Normalization::L1_ROOT) {
+          desc = L1RootNormalizeFeatureDescriptors(desc);
+        }
+        level->descriptors.row(level_idx) =
+            FeatureDescriptorsToUnsignedByte(desc);
+
+        level_idx += 1;
+      }
+    }
+
+    // Resize containers for last DOG level in octave.
+    if (level != nullptr) {
+      level->keypoints.resize(level_idx);
+      level->descriptors.conservativeResize(level_idx, 128);
+    }
+  }
+
+  return true;
+}
+
 }  // namespace
 
 void SiftOptions::Check() const {
@@ -67,10 +318,15 @@ void SiftOptions::Check() const {
   CHECK_GT(peak_threshold, 0.0);
   CHECK_GT(edge_threshold, 0.0);
   CHECK_GT(max_num_orientations, 0);
+  CHECK_GE(num_tile_threads, -1);
+  CHECK_NE(num_tile_threads, 0);
 }
 
 void ImageReader::Options::Check() const {
   CHECK_GT(default_focal_length_factor, 0.0);
+  CHECK_GT(num_shards, 0);
+  CHECK_GE(shard_index, 0);
+  CHECK_LT(shard_index, num_shards);
   const int model_id = CameraModelNameToId(camera_model);
   CHECK_NE(model_id, -1);
   if (!camera_params.empty()) {
@@ -80,7 +336,12 @@ void ImageReader::Options::Check() const {
 }
 
 ImageReader::ImageReader(const Options& options)
-    : options_(options), image_index_(0) {
+    : options_(options),
+      image_index_(0),
+      prefetch_thread_pool_(nullptr),
+      num_prefetch_images_(0),
+      next_prefetch_image_idx_(0),
+      decode_time_(0) {
   options_.Check();
 
   // Ensure trailing slash, so that we can build the correct image name.
@@ -97,6 +358,48 @@ ImageReader::ImageReader(const Options& options)
     }
   }
 
+  // Restrict the image list to the range of the shard.
+  if (options_.num_shards > 1) {
+    const size_t num_images = options_.image_list.size();
+    const size_t begin_idx =
+        num_images * options_.shard_index / options_.num_shards;
+    const size_t end_idx =
+        num_images * (options_.shard_index + 1) / options_.num_shards;
+    options_.image_list =
+        std::vector<std::string>(options_.image_list.begin() + begin_idx,
+                                 options_.image_list.begin() + end_idx);
+    std::cout << StringPrintf("Reading images [%d, %d) of %d for shard %d",
+                              begin_idx, end_idx, num_images,
+                              options_.shard_index)
+              << std::endl;
+  }
+
+  // Skip the images whose features were already extracted before reading
+  // them, which avoids redundant queries and decoding when resuming.
+  {
+    Database database(options_.database_path);
+    const std::unordered_set<std::string> completed_image_names =
+        database.ReadImageNamesWithFeatures();
+    if (!completed_image_names.empty()) {
+      const size_t num_images = options_.image_list.size();
+      options_.image_list.erase(
+          std::remove_if(options_.image_list.begin(),
+                         options_.image_list.end(),
+                         [&](const std::string& image_path) {
+                           return completed_image_names.count(
+                                      ImageNameFromPath(image_path)) > 0;
+                         }),
+          options_.image_list.end());
+      const size_t num_skipped_images = num_images - options_.image_list.size();
+      if (num_skipped_images > 0) {
+        std::cout << StringPrintf(
+                         "Skipping %d images with already extracted features",
+                         num_skipped_images)
+                  << std::endl;
+      }
+    }
+  }
+
   // Set the manually specified camera parameters.
   prev_camera_.SetCameraId(kInvalidCameraId);
   prev_camera_.SetModelIdFromName(options_.camera_model);
@@ -105,7 +408,14 @@ ImageReader::ImageReader(const Options& options)
   }
 }
 
-bool ImageReader::Next(Image* image, Bitmap* bitmap) {
+ImageReader::~ImageReader() {
+  // The prefetching tasks refer to this object.
+  for (auto& prefetched_bitmap : prefetched_bitmaps_) {
+    prefetched_bitmap.second.wait();
+  }
+}
+
+bool ImageReader::Next(Image* image, Bitmap* bitmap, Camera* camera) {
   CHECK_NOTNULL(image);
   CHECK_NOTNULL(bitmap);
 
@@ -114,6 +424,8 @@ bool ImageReader::Next(Image* image, Bitmap* bitmap) {
     return false;
   }
 
+  SchedulePrefetch();
+
   const std::string image_path = options_.image_list.at(image_index_ - 1);
 
   Database database(options_.database_path);
@@ -122,9 +434,7 @@ bool ImageReader::Next(Image* image, Bitmap* bitmap) {
   // Set the image name.
   //////////////////////////////////////////////////////////////////////////////
 
-  image->SetName(image_path);
-  image->SetName(StringReplace(image->Name(), "\\", "/"));
-  image->SetName(StringReplace(image->Name(), options_.image_path, ""));
+  image->SetName(ImageNameFromPath(image_path));
 
   std::cout << "  Name:           " << image->Name() << std::endl;
 
@@ -151,12 +461,20 @@ bool ImageReader::Next(Image* image, Bitmap* bitmap) {
   // Read image.
   //////////////////////////////////////////////////////////////////////////////
 
-  if (!bitmap->Read(image_path, false)) {
+  ReadResult read_result;
+  if (!ReadBitmap(image_index_ - 1, &read_result)) {
     std::cout << "  SKIP: Cannot read image at path " << image_path
               << std::endl;
     return false;
   }
 
+  *bitmap = std::move(read_result.bitmap);
+
+  // The dimensions of the image, which differ from the dimensions of the
+  // bitmap if it was down-sampled while decoding.
+  const size_t width = static_cast<size_t>(read_result.original_width);
+  const size_t height = static_cast<size_t>(read_result.original_height);
+
   //////////////////////////////////////////////////////////////////////////////
   // Check for well-formed data.
   //////////////////////////////////////////////////////////////////////////////
@@ -173,8 +491,7 @@ bool ImageReader::Next(Image* image, Bitmap* bitmap) {
       return false;
     }
 
-    if (static_cast<size_t>(bitmap->Width()) != camera.Width() ||
-        static_cast<size_t>(bitmap->Height()) != camera.Height()) {
+    if (width != camera.Width() || height != camera.Height()) {
       std::cerr << "  ERROR: Image previously processed, but current version "
                    "has different dimensions."
                 << std::endl;
@@ -186,16 +503,15 @@ bool ImageReader::Next(Image* image, Bitmap* bitmap) {
   //////////////////////////////////////////////////////////////////////////////
 
   if (options_.single_camera && prev_camera_.CameraId() != kInvalidCameraId &&
-      (prev_camera_.Width() != static_cast<size_t>(bitmap->Width()) ||
-       prev_camera_.Height() != static_cast<size_t>(bitmap->Height()))) {
+      (prev_camera_.Width() != width || prev_camera_.Height() != height)) {
     std::cerr << "  ERROR: Single camera specified, but images have "
                  "different dimensions."
               << std::endl;
     return false;
   }
 
-  prev_camera_.SetWidth(static_cast<size_t>(bitmap->Width()));
-  prev_camera_.SetHeight(static_cast<size_t>(bitmap->Height()));
+  prev_camera_.SetWidth(width);
+  prev_camera_.SetHeight(height);
 
   std::cout << "  Width:          " << prev_camera_.Width() << "px"
             << std::endl;
@@ -211,12 +527,15 @@ bool ImageReader::Next(Image* image, Bitmap* bitmap) {
       // Extract focal length.
       double focal_length = 0.0;
       if (bitmap->ExifFocalLength(&focal_length)) {
+        // The EXIF focal length is proportional to the bitmap dimensions.
+        focal_length *= static_cast<double>(std::max(width, height)) /
+                        std::max(bitmap->Width(), bitmap->Height());
         prev_camera_.SetPriorFocalLength(true);
         std::cout << "  Focal length:   " << focal_length << "px (EXIF)"
                   << std::endl;
       } else {
-        focal_length = options_.default_focal_length_factor *
-                       std::max(bitmap->Width(), bitmap->Height());
+        focal_length =
+            options_.default_focal_length_factor * std::max(width, height);
         prev_camera_.SetPriorFocalLength(false);
         std::cout << "  Focal length:   " << focal_length << "px" << std::endl;
       }
@@ -256,13 +575,157 @@ bool ImageReader::Next(Image* image, Bitmap* bitmap) {
     image->TvecPrior(2) = std::numeric_limits<double>::quiet_NaN();
   }
 
+  if (camera != nullptr) {
+    *camera = prev_camera_;
+  }
+
   return true;
 }
 
+std::string ImageReader::ImageNameFromPath(
+    const std::string& image_path) const {
+  return StringReplace(StringReplace(image_path, "\\", "/"),
+                       options_.image_path, "");
+}
+
 size_t ImageReader::NextIndex() const { return image_index_; }
 
 size_t ImageReader::NumImages() const { return options_.image_list.size(); }
 
+void ImageReader::Prefetch(ThreadPool* thread_pool, const size_t num_images) {
+  CHECK_NOTNULL(thread_pool);
+  CHECK(prefetched_bitmaps_.empty());
+  prefetch_thread_pool_ = thread_pool;
+  num_prefetch_images_ = num_images;
+  next_prefetch_image_idx_ = image_index_;
+}
+
+void ImageReader::ScheduleLargestFirst(ThreadPool* thread_pool) {
+  CHECK_NOTNULL(thread_pool);
+  CHECK_EQ(image_index_, 0);
+  CHECK(prefetched_bitmaps_.empty());
+
+  Timer timer;
+  timer.Start();
+
+  std::vector<std::future<double>> futures;
+  futures.reserve(options_.image_list.size());
+  for (const auto& image_path : options_.image_list) {
+    futures.push_back(thread_pool->AddTask([this, image_path]() {
+      int width = 0;
+      int height = 0;
+      if (!Bitmap::ReadDimensions(image_path, &width, &height)) {
+        return -1.0;
+      }
+      double scale = 1.0;
+      if (options_.max_image_size > 0 &&
+          std::max(width, height) > options_.max_image_size) {
+        scale = static_cast<double>(options_.max_image_size) /
+                std::max(width, height);
+      }
+      return scale * scale * width * height;
+    }));
+  }
+
+  std::vector<std::pair<double, std::string>> costs;
+  costs.reserve(options_.image_list.size());
+  size_t num_unknown = 0;
+  for (size_t i = 0; i < futures.size(); ++i) {
+    costs.emplace_back(futures[i].get(), options_.image_list[i]);
+    if (costs.back().first < 0) {
+      num_unknown += 1;
+    }
+  }
+
+  std::stable_sort(costs.begin(), costs.end(),
+                   [](const std::pair<double, std::string>& cost1,
+                      const std::pair<double, std::string>& cost2) {
+                     return cost1.first > cost2.first;
+                   });
+
+  for (size_t i = 0; i < costs.size(); ++i) {
+    options_.image_list[i] = std::move(costs[i].second);
+  }
+
+  std::cout << StringPrintf(
+                   "Scheduled %d images by decreasing size in %.3fs "
+                   "(%d with unknown size)",
+                   costs.size(), timer.ElapsedSeconds(), num_unknown)
+            << std::endl;
+}
+
+double ImageReader::DecodeTime() const {
+  std::unique_lock<std::mutex> lock(decode_time_mutex_);
+  return decode_time_;
+}
+
+bool ImageReader::ReadBitmap(const size_t image_idx, ReadResult* result) {
+  const auto prefetched_bitmap = prefetched_bitmaps_.find(image_idx);
+  if (prefetched_bitmap == prefetched_bitmaps_.end()) {
+    Timer timer;
+    timer.Start();
+    const bool success = result->bitmap.Read(
+        options_.image_list.at(image_idx), false, options_.max_image_size,
+        &result->original_width, &result->original_height);
+    std::unique_lock<std::mutex> lock(decode_time_mutex_);
+    decode_time_ += timer.ElapsedSeconds();
+    return success;
+  }
+
+  const std::shared_ptr<ReadResult> read_result =
+      prefetched_bitmap->second.get();
+  prefetched_bitmaps_.erase(prefetched_bitmap);
+  if (!read_result) {
+    return false;
+  }
+
+  *result = std::move(*read_result);
+
+  return true;
+}
+
+void ImageReader::SchedulePrefetch() {
+  if (prefetch_thread_pool_ == nullptr) {
+    return;
+  }
+
+  // The current image has index `image_index_ - 1`.
+  for (auto it = prefetched_bitmaps_.begin();
+       it != prefetched_bitmaps_.end();) {
+    if (it->first + 1 < image_index_) {
+      it->second.wait();
+      it = prefetched_bitmaps_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  next_prefetch_image_idx_ =
+      std::max(next_prefetch_image_idx_, image_index_ - 1);
+  const size_t end_prefetch_image_idx = std::min(
+      options_.image_list.size(), image_index_ + num_prefetch_images_);
+  for (; next_prefetch_image_idx_ < end_prefetch_image_idx;
+       ++next_prefetch_image_idx_) {
+    const std::string image_path =
+        options_.image_list.at(next_prefetch_image_idx_);
+    prefetched_bitmaps_.emplace(
+        next_prefetch_image_idx_,
+        prefetch_thread_pool_->AddTask([this, image_path]() {
+          Timer timer;
+          timer.Start();
+          std::shared_ptr<ReadResult> result = std::make_shared<ReadResult>();
+          if (!result->bitmap.Read(image_path, false, options_.max_image_size,
+                                   &result->original_width,
+                                   &result->original_height)) {
+            result.reset();
+          }
+          std::unique_lock<std::mutex> lock(decode_time_mutex_);
+          decode_time_ += timer.ElapsedSeconds();
+          return result;
+        }));
+  }
+}
+
 SiftCPUFeatureExtractor::SiftCPUFeatureExtractor(
     const ImageReader::Options& reader_options, const SiftOptions& sift_options,
     const Options& cpu_options)
@@ -280,89 +743,186 @@ void SiftCPUFeatureExtractor::Options::Check() const {
 void SiftCPUFeatureExtractor::Run() {
   PrintHeading1("Feature extraction (CPU)");
 
-  ImageReader image_reader(reader_options_);
+  // Decode the images directly at the resolution used for extraction.
+  ImageReader::Options reader_options = reader_options_;
+  reader_options.max_image_size = sift_options_.max_image_size;
+
+  ImageReader image_reader(reader_options);
   Database database(reader_options_.database_path);
+  DatabaseWriter database_writer(DatabaseWriter::Options(), &database);
 
-  ThreadPool thread_pool(cpu_options_.num_threads);
+  ThreadPool decode_thread_pool(cpu_options_.num_decode_threads);
+  ThreadPool extraction_thread_pool(cpu_options_.num_threads);
 
-  const size_t batch_size = static_cast<size_t>(cpu_options_.batch_size_factor *
-                                                thread_pool.NumThreads());
+  const size_t queue_size = static_cast<size_t>(
+      cpu_options_.batch_size_factor * extraction_thread_pool.NumThreads());
 
-  struct ExtractionResult {
-    FeatureKeypoints keypoints;
-    FeatureDescriptors descriptors;
-  };
+  if (cpu_options_.largest_first) {
+    image_reader.ScheduleLargestFirst(&decode_thread_pool);
+  }
 
-  while (image_reader.NextIndex() < image_reader.NumImages()) {
-    if (IsStopped()) {
-      break;
-    }
+  image_reader.Prefetch(&decode_thread_pool, queue_size);
 
-    PrintHeading2("Preparing batch");
+  std::ofstream image_log_file;
+  if (!cpu_options_.image_log_path.empty()) {
+    image_log_file.open(cpu_options_.image_log_path);
+    CHECK(image_log_file.is_open()) << cpu_options_.image_log_path;
+    image_log_file << "# name, width, height, num_features, extraction_time"
+                   << std::endl;
+  }
 
-    std::vector<size_t> image_idxs;
-    std::vector<Image> images;
-    std::vector<std::future<ExtractionResult>> futures;
-    while (futures.size() < batch_size &&
-           image_reader.NextIndex() < image_reader.NumImages()) {
-      if (IsStopped()) {
-        break;
-      }
+  struct ExtractionJob {
+    size_t image_idx = 0;
+    Image image;
+    std::shared_ptr<const image_t> image_id;
+    Camera camera;
+    std::shared_ptr<Bitmap> bitmap;
+  };
 
-      std::cout << StringPrintf("Preparing file [%d/%d]",
-                                image_reader.NextIndex() + 1,
-                                image_reader.NumImages())
-                << std::endl;
+  JobQueue<ExtractionJob> extraction_queue(queue_size);
 
-      Image image;
-      std::shared_ptr<Bitmap> bitmap = std::make_shared<Bitmap>();
-      if (!image_reader.Next(&image, bitmap.get())) {
-        continue;
-      }
+  std::mutex stats_mutex;
+  size_t num_images = 0;
+  double extraction_time = 0;
+  double write_time = 0;
 
-      image_idxs.push_back(image_reader.NextIndex());
-      images.push_back(image);
-      futures.push_back(thread_pool.AddTask([this, bitmap]() {
-        ExtractionResult result;
-        if (!ExtractSiftFeaturesCPU(sift_options_, *bitmap, &result.keypoints,
-                                    &result.descriptors)) {
-          std::cerr << "  ERROR: Could not extract features." << std::endl;
+  for (size_t i = 0; i < extraction_thread_pool.NumThreads(); ++i) {
+    extraction_thread_pool.AddTask([&]() {
+      Timer timer;
+      while (true) {
+        auto job = extraction_queue.Pop();
+        if (!job.IsValid()) {
+          break;
         }
-        return result;
-      }));
-    }
 
-    if (futures.empty()) {
-      break;
-    }
+        ExtractionJob& extraction_job = job.Data();
 
-    PrintHeading2("Processing batch");
+        timer.Restart();
+        FeatureKeypoints keypoints;
+        FeatureDescriptors descriptors;
+        if (!ExtractSiftFeaturesCPU(sift_options_, *extraction_job.bitmap,
+                                    &keypoints, &descriptors)) {
+          std::cerr << "  ERROR: Could not extract features." << std::endl;
+        }
+        ScaleKeypoints(*extraction_job.bitmap, extraction_job.camera,
+                       &keypoints);
+        const int bitmap_width = extraction_job.bitmap->Width();
+        const int bitmap_height = extraction_job.bitmap->Height();
+        extraction_job.bitmap.reset();
+        const double job_extraction_time = timer.ElapsedSeconds();
+
+        std::cout << StringPrintf("  Features:       %d in %.3fs [%d/%d]",
+                                  keypoints.size(), job_extraction_time,
+                                  extraction_job.image_idx,
+                                  image_reader.NumImages())
+                  << std::endl;
 
-    DatabaseTransaction database_transaction(&database);
+        if (image_log_file.is_open()) {
+          std::unique_lock<std::mutex> lock(stats_mutex);
+          image_log_file << StringPrintf("%s, %d, %d, %d, %.6f",
+                                         extraction_job.image.Name().c_str(),
+                                         bitmap_width, bitmap_height,
+                                         keypoints.size(), job_extraction_time)
+                         << std::endl;
+        }
 
-    for (size_t i = 0; i < futures.size(); ++i) {
-      Image& image = images[i];
-      const ExtractionResult result = futures[i].get();
+        timer.Restart();
+        database_writer.WriteFeatures(extraction_job.image_id,
+                                      std::move(keypoints),
+                                      std::move(descriptors));
+        const double job_write_time = timer.ElapsedSeconds();
 
-      if (image.ImageId() == kInvalidImageId) {
-        image.SetImageId(database.WriteImage(image));
+        std::unique_lock<std::mutex> lock(stats_mutex);
+        num_images += 1;
+        extraction_time += job_extraction_time;
+        write_time += job_write_time;
       }
+    });
+  }
 
-      if (!database.ExistsKeypoints(image.ImageId())) {
-        database.WriteKeypoints(image.ImageId(), result.keypoints);
-      }
+  Timer read_timer;
+  double read_time = 0;
 
-      if (!database.ExistsDescriptors(image.ImageId())) {
-        database.WriteDescriptors(image.ImageId(), result.descriptors);
-      }
+  while (image_reader.NextIndex() < image_reader.NumImages()) {
+    if (IsStopped()) {
+      break;
+    }
 
-      std::cout << StringPrintf("  Features:       %d [%d/%d]",
-                                result.keypoints.size(), image_idxs[i],
-                                image_reader.NumImages())
-                << std::endl;
+    std::cout << StringPrintf("Processing file [%d/%d]",
+                              image_reader.NextIndex() + 1,
+                              image_reader.NumImages())
+              << std::endl;
+
+    read_timer.Restart();
+    ExtractionJob extraction_job;
+    extraction_job.bitmap = std::make_shared<Bitmap>();
+    const bool success =
+        image_reader.Next(&extraction_job.image, extraction_job.bitmap.get(),
+                          &extraction_job.camera);
+    read_time += read_timer.ElapsedSeconds();
+    if (!success) {
+      continue;
+    }
+
+    // New images are written in the order of the reader, so that their
+    // identifiers do not depend on the order in which extraction finishes.
+    if (extraction_job.image.ImageId() == kInvalidImageId) {
+      extraction_job.image_id =
+          database_writer.WriteImage(extraction_job.image);
+    } else {
+      extraction_job.image_id =
+          std::make_shared<const image_t>(extraction_job.image.ImageId());
+    }
+
+    extraction_job.image_idx = image_reader.NextIndex();
+    if (!extraction_queue.Push(extraction_job)) {
+      break;
     }
   }
 
+  if (IsStopped()) {
+    extraction_queue.Stop();
+  } else {
+    extraction_queue.Wait();
+  }
+
+  extraction_thread_pool.Wait();
+
+  Timer flush_timer;
+  flush_timer.Start();
+  database_writer.Flush();
+  write_time += flush_timer.ElapsedSeconds();
+
+  // For each stage, report the fraction of time its threads were busy and the
+  // maximum throughput that the stage could sustain with its threads. The
+  // reading stage includes waiting for the decoding of the images.
+  const double elapsed_time = GetTimer().ElapsedSeconds();
+  auto PrintStageStats = [&](const std::string& name, const double busy_time,
+                             const size_t num_threads) {
+    std::cout << StringPrintf(
+                     "  %-12s %.3fs busy, %.0f%% utilization, "
+                     "%.2f images/s capacity (%d threads)",
+                     name.c_str(), busy_time,
+                     100.0 * busy_time / (num_threads * elapsed_time),
+                     busy_time > 0 ? num_images * num_threads / busy_time : 0.0,
+                     num_threads)
+              << std::endl;
+  };
+
+  std::cout << std::endl
+            << StringPrintf("Processed %d images in %.3fs (%.2f images/s)",
+                            num_images, elapsed_time,
+                            num_images / elapsed_time)
+            << std::endl;
+  PrintStageStats("Decoding:", image_reader.DecodeTime(),
+                  decode_thread_pool.NumThreads());
+  PrintStageStats("Reading:", read_time, 1);
+  PrintStageStats("Extraction:", extraction_time,
+                  extraction_thread_pool.NumThreads());
+  std::cout << StringPrintf("  %-12s %.3fs waiting for the database writer",
+                            "Writing:", write_time)
+            << std::endl;
+
   GetTimer().PrintMinutes();
 }
 
@@ -383,8 +943,13 @@ void SiftGPUFeatureExtractor::Run() {
     return;
   }
 
-  ImageReader image_reader(reader_options_);
+  // Decode the images directly at the resolution used for extraction.
+  ImageReader::Options reader_options = reader_options_;
+  reader_options.max_image_size = sift_options_.max_image_size;
+
+  ImageReader image_reader(reader_options);
   Database database(reader_options_.database_path);
+  DatabaseWriter database_writer(DatabaseWriter::Options(), &database);
 
   while (image_reader.NextIndex() < image_reader.NumImages()) {
     if (IsStopped()) {
@@ -398,7 +963,8 @@ void SiftGPUFeatureExtractor::Run() {
 
     Image image;
     Bitmap bitmap;
-    if (!image_reader.Next(&image, &bitmap)) {
+    Camera camera;
+    if (!image_reader.Next(&image, &bitmap, &camera)) {
       continue;
     }
 
@@ -410,30 +976,25 @@ void SiftGPUFeatureExtractor::Run() {
       continue;
     }
 
-    DatabaseTransaction database_transaction(&database);
-
-    if (image.ImageId() == kInvalidImageId) {
-      image.SetImageId(database.WriteImage(image));
-    }
-
-    if (!database.ExistsKeypoints(image.ImageId())) {
-      database.WriteKeypoints(image.ImageId(), keypoints);
-    }
-
-    if (!database.ExistsDescriptors(image.ImageId())) {
-      database.WriteDescriptors(image.ImageId(), descriptors);
-    }
+    ScaleKeypoints(bitmap, camera, &keypoints);
 
     std::cout << "  Features:       " << keypoints.size() << std::endl;
+
+    database_writer.WriteImageWithFeatures(image, std::move(keypoints),
+                                           std::move(descriptors));
   }
 
+  database_writer.Flush();
+
   GetTimer().PrintMinutes();
 }
 
 FeatureImporter::FeatureImporter(const ImageReader::Options& reader_options,
-                                 const std::string& import_path)
+                                 const std::string& import_path,
+                                 const int num_threads)
     : reader_options_(reader_options),
-      import_path_(import_path) {}
+      import_path_(import_path),
+      num_threads_(num_threads) {}
 
 void FeatureImporter::Run() {
   PrintHeading1("Feature import");
@@ -445,6 +1006,67 @@ void FeatureImporter::Run() {
 
   ImageReader image_reader(reader_options_);
   Database database(reader_options_.database_path);
+  DatabaseWriter database_writer(DatabaseWriter::Options(), &database);
+
+  // The images are read and decoded to determine the camera parameters, which
+  // is done in parallel to the loading of the feature files.
+  ThreadPool decode_thread_pool(num_threads_);
+  ThreadPool load_thread_pool(num_threads_);
+
+  const size_t queue_size = 2 * load_thread_pool.NumThreads();
+
+  image_reader.Prefetch(&decode_thread_pool, queue_size);
+
+  struct LoadJob {
+    size_t image_idx = 0;
+    Image image;
+    std::shared_ptr<const image_t> image_id;
+    std::string path;
+    bool binary = false;
+  };
+
+  JobQueue<LoadJob> load_queue(queue_size);
+
+  std::mutex stats_mutex;
+  size_t num_images = 0;
+
+  for (size_t i = 0; i < load_thread_pool.NumThreads(); ++i) {
+    load_thread_pool.AddTask([&]() {
+      while (true) {
+        auto job = load_queue.Pop();
+        if (!job.IsValid()) {
+          break;
+        }
+
+        const LoadJob& load_job = job.Data();
+
+        FeatureKeypoints keypoints;
+        FeatureDescriptors descriptors;
+        if (load_job.binary) {
+          if (!LoadSiftFeaturesFromBinaryFile(load_job.path, &keypoints,
+                                              &descriptors)) {
+            std::cout << "  SKIP: Invalid features file " << load_job.path
+                      << std::endl;
+            continue;
+          }
+        } else {
+          LoadSiftFeaturesFromTextFile(load_job.path, &keypoints,
+                                       &descriptors);
+        }
+
+        std::cout << StringPrintf("  Features:       %d [%d/%d]",
+                                  keypoints.size(), load_job.image_idx,
+                                  image_reader.NumImages())
+                  << std::endl;
+
+        database_writer.WriteFeatures(load_job.image_id, std::move(keypoints),
+                                      std::move(descriptors));
+
+        std::unique_lock<std::mutex> lock(stats_mutex);
+        num_images += 1;
+      }
+    });
+  }
 
   while (image_reader.NextIndex() < image_reader.NumImages()) {
     if (IsStopped()) {
@@ -457,40 +1079,52 @@ void FeatureImporter::Run() {
               << std::endl;
 
     // Load image data and possibly save camera to database.
+    LoadJob load_job;
     Bitmap bitmap;
-    Image image;
-    if (!image_reader.Next(&image, &bitmap)) {
+    if (!image_reader.Next(&load_job.image, &bitmap)) {
       continue;
     }
 
-    const std::string path = JoinPaths(import_path_, image.Name() + ".txt");
-
-    if (boost::filesystem::exists(path)) {
-      FeatureKeypoints keypoints;
-      FeatureDescriptors descriptors;
-      LoadSiftFeaturesFromTextFile(path, &keypoints, &descriptors);
+    load_job.image_idx = image_reader.NextIndex();
 
-      std::cout << "  Features:       " << keypoints.size() << std::endl;
+    const std::string path = JoinPaths(import_path_, load_job.image.Name());
+    if (boost::filesystem::exists(path + ".bin")) {
+      load_job.path = path + ".bin";
+      load_job.binary = true;
+    } else if (boost::filesystem::exists(path + ".txt")) {
+      load_job.path = path + ".txt";
+    } else {
+      std::cout << "  SKIP: No features found at " << path << ".{bin,txt}"
+                << std::endl;
+      continue;
+    }
 
-      DatabaseTransaction database_transaction(&database);
+    // New images are written in the order of the reader, so that their
+    // identifiers do not depend on the order in which loading finishes.
+    if (load_job.image.ImageId() == kInvalidImageId) {
+      load_job.image_id = database_writer.WriteImage(load_job.image);
+    } else {
+      load_job.image_id =
+          std::make_shared<const image_t>(load_job.image.ImageId());
+    }
 
-      if (image.ImageId() == kInvalidImageId) {
-        image.SetImageId(database.WriteImage(image));
-      }
+    if (!load_queue.Push(load_job)) {
+      break;
+    }
+  }
 
-      if (!database.ExistsKeypoints(image.ImageId())) {
-        database.WriteKeypoints(image.ImageId(), keypoints);
-      }
+  if (IsStopped()) {
+    load_queue.Stop();
+  } else {
+    load_queue.Wait();
+  }
 
-      if (!database.ExistsDescriptors(image.ImageId())) {
-        database.WriteDescriptors(image.ImageId(), descriptors);
-      }
+  load_thread_pool.Wait();
+  database_writer.Flush();
 
-      std::cout << "  SKIP: Image already processed." << std::endl;
-    } else {
-      std::cout << "  SKIP: No features found at " << path << std::endl;
-    }
-  }
+  std::cout << std::endl
+            << StringPrintf("Imported features of %d images", num_images)
+            << std::endl;
 
   GetTimer().PrintMinutes();
 }
@@ -512,150 +1146,146 @@ bool ExtractSiftFeaturesCPU(const SiftOptions& options, const Bitmap& bitmap,
   // Extract features
   //////////////////////////////////////////////////////////////////////////////
 
-  const float inv_scale_x = static_cast<float>(1.0 / scale_x);
-  const float inv_scale_y = static_cast<float>(1.0 / scale_y);
-  const float inv_scale_xy = (inv_scale_x + inv_scale_y) / 2.0f;
-
-  // Setup SIFT extractor.
-  std::unique_ptr<VlSiftFilt, void (*)(VlSiftFilt*)> sift(
-      vl_sift_new(scaled_bitmap.Width(), scaled_bitmap.Height(),
-                  options.num_octaves, options.octave_resolution,
-                  options.first_octave),
-      &vl_sift_delete);
-  if (!sift) {
-    return false;
-  }
-
-  vl_sift_set_peak_thresh(sift.get(), options.peak_threshold);
-  vl_sift_set_edge_thresh(sift.get(), options.edge_threshold);
+  const int width = scaled_bitmap.Width();
+  const int height = scaled_bitmap.Height();
+
+  // Fix the number of octaves for all tiles to the number of octaves that
+  // VLFeat would choose for the entire image.
+  const int num_octaves =
+      options.num_octaves > 0
+          ? options.num_octaves
+          : std::max(static_cast<int>(std::floor(
+                         std::log2(std::min(width, height)))) -
+                         options.first_octave - 3,
+                     1);
+
+  const double image_memory =
+      SiftScaleSpaceBytesPerPixel(options) * width * height;
+  const double max_tile_memory = options.max_tile_memory * 1024.0 * 1024.0;
+
+  SiftLevels levels;
+  if (options.max_tile_memory <= 0 || image_memory <= max_tile_memory) {
+    if (!ExtractSiftLevelFeatures(options, scaled_bitmap, num_octaves, 0, 0,
+                                  width, height, 0, 0, width, height,
+                                  &levels)) {
+      return false;
+    }
+  } else {
+    // The tiles are aligned to the pixel grid of the last octave, so that all
+    // octaves of a tile sample the same pixels as for the entire image.
+    const int last_octave = options.first_octave + num_octaves - 1;
+    const int alignment = 1 << std::max(last_octave, 0);
+    const int margin =
+        alignment * static_cast<int>(std::ceil(
+                        SiftTileMargin(options, num_octaves) / alignment));
+
+    const int max_tile_size = static_cast<int>(std::sqrt(
+        max_tile_memory / SiftScaleSpaceBytesPerPixel(options)));
+    int core_size = (max_tile_size - 2 * margin) / alignment * alignment;
+    if (core_size < alignment) {
+      std::cout << StringPrintf(
+                       "  WARNING: Tile memory limit is too small for "
+                       "tile margins of %dpx.",
+                       margin)
+                << std::endl;
+      core_size = std::max(margin, alignment);
+    }
 
-  // Iterate through octaves.
-  std::vector<size_t> level_num_features;
-  std::vector<FeatureKeypoints> level_keypoints;
-  std::vector<FeatureDescriptors> level_descriptors;
-  bool first_octave = true;
-  while (true) {
-    if (first_octave) {
-      const std::vector<uint8_t> data_uint8 =
-          scaled_bitmap.ConvertToRowMajorArray();
-      std::vector<float> data_float(data_uint8.size());
-      for (size_t i = 0; i < data_uint8.size(); ++i) {
-        data_float[i] = static_cast<float>(data_uint8[i]) / 255.0f;
+    // The tiles are extracted in parallel, but merged in a fixed order.
+    std::vector<std::array<int, 4>> tiles;
+    for (int y = 0; y < height; y += core_size) {
+      for (int x = 0; x < width; x += core_size) {
+        tiles.push_back({{x, y, std::min(x + core_size, width),
+                          std::min(y + core_size, height)}});
       }
-      if (vl_sift_process_first_octave(sift.get(), data_float.data())) {
-        break;
+    }
+
+    std::vector<SiftLevels> tile_levels(tiles.size());
+    auto ExtractTile = [&](const size_t tile_idx) {
+      const std::array<int, 4>& tile = tiles[tile_idx];
+      return ExtractSiftLevelFeatures(
+          options, scaled_bitmap, num_octaves, std::max(tile[0] - margin, 0),
+          std::max(tile[1] - margin, 0), std::min(tile[2] + margin, width),
+          std::min(tile[3] + margin, height), tile[0], tile[1], tile[2],
+          tile[3], &tile_levels[tile_idx]);
+    };
+
+    bool success = true;
+    if (options.num_tile_threads == 1) {
+      for (size_t tile_idx = 0; tile_idx < tiles.size(); ++tile_idx) {
+        success &= ExtractTile(tile_idx);
       }
-      first_octave = false;
     } else {
-      if (vl_sift_process_next_octave(sift.get())) {
-        break;
+      ThreadPool thread_pool(options.num_tile_threads);
+      std::vector<std::future<bool>> futures;
+      futures.reserve(tiles.size());
+      for (size_t tile_idx = 0; tile_idx < tiles.size(); ++tile_idx) {
+        futures.push_back(thread_pool.AddTask(ExtractTile, tile_idx));
+      }
+      for (auto& future : futures) {
+        success &= future.get();
       }
     }
 
-    // Detect keypoints.
-    vl_sift_detect(sift.get());
-
-    // Extract detected keypoints.
-    const VlSiftKeypoint* vl_keypoints = vl_sift_get_keypoints(sift.get());
-    const int num_keypoints = vl_sift_get_nkeypoints(sift.get());
-    if (num_keypoints == 0) {
-      continue;
+    if (!success) {
+      return false;
     }
 
-    // Extract features with different orientations per DOG level.
-    size_t level_idx = 0;
-    int prev_level = -1;
-    for (int i = 0; i < num_keypoints; ++i) {
-      if (vl_keypoints[i].is != prev_level) {
-        if (i > 0) {
-          // Resize containers of previous DOG level.
-          level_keypoints.back().resize(level_idx);
-          level_descriptors.back().conservativeResize(level_idx, 128);
-        }
-
-        // Add containers for new DOG level.
-        level_idx = 0;
-        level_num_features.push_back(0);
-        level_keypoints.emplace_back(options.max_num_orientations *
-                                     num_keypoints);
-        level_descriptors.emplace_back(
-            options.max_num_orientations * num_keypoints, 128);
-      }
-
-      level_num_features.back() += 1;
-      prev_level = vl_keypoints[i].is;
-
-      // Extract feature orientations.
-      double angles[4];
-      int num_orientations;
-      if (options.upright) {
-        num_orientations = 1;
-        angles[0] = 0.0;
-      } else {
-        num_orientations = vl_sift_calc_keypoint_orientations(
-            sift.get(), angles, &vl_keypoints[i]);
-      }
-
-      // Note that this is different from SiftGPU, which selects the top
-      // global maxima as orientations while this selects the first two
-      // local maxima. It is not clear which procedure is better.
-      const int num_used_orientations =
-          std::min(num_orientations, options.max_num_orientations);
-
-      for (int o = 0; o < num_used_orientations; ++o) {
-        level_keypoints.back()[level_idx].x = vl_keypoints[i].x + 0.5f;
-        level_keypoints.back()[level_idx].y = vl_keypoints[i].y + 0.5f;
-        level_keypoints.back()[level_idx].scale = vl_keypoints[i].sigma;
-        level_keypoints.back()[level_idx].orientation = angles[o];
-
-        if (scale_x != 1.0 || scale_y != 1.0) {
-          level_keypoints.back()[level_idx].x *= inv_scale_x;
-          level_keypoints.back()[level_idx].y *= inv_scale_y;
-          level_keypoints.back()[level_idx].scale *= inv_scale_xy;
-        }
-
-        Eigen::MatrixXf desc(1, 128);
-        vl_sift_calc_keypoint_descriptor(sift.get(), desc.data(),
-                                         &vl_keypoints[i], angles[o]);
-        if (options.normalization == SiftOptions::Normalization::L2) {
-          desc = L2NormalizeFeatureDescriptors(desc);
-        } else if (options.normalization ==
-                   SiftOptions::Normalization::L1_ROOT) {
-          desc = L1RootNormalizeFeatureDescriptors(desc);
-        }
-        level_descriptors.back().row(level_idx) =
-            FeatureDescriptorsToUnsignedByte(desc);
-
-        level_idx += 1;
+    for (auto& tile_level : tile_levels) {
+      for (auto& level : tile_level) {
+        SiftLevelFeatures& merged_level = levels[level.first];
+        merged_level.num_features += level.second.num_features;
+        merged_level.keypoints.insert(merged_level.keypoints.end(),
+                                      level.second.keypoints.begin(),
+                                      level.second.keypoints.end());
+        merged_level.descriptors.conservativeResize(
+            merged_level.descriptors.rows() + level.second.descriptors.rows(),
+            128);
+        merged_level.descriptors.bottomRows(level.second.descriptors.rows()) =
+            level.second.descriptors;
       }
+      tile_level.clear();
     }
+  }
 
-    // Resize containers for last DOG level in octave.
-    level_keypoints.back().resize(level_idx);
-    level_descriptors.back().conservativeResize(level_idx, 128);
+  // Determine how many DOG levels to keep to satisfy max_num_features option,
+  // where the levels are ordered by increasing scale.
+  std::vector<const SiftLevelFeatures*> level_features;
+  level_features.reserve(levels.size());
+  for (const auto& level : levels) {
+    level_features.push_back(&level.second);
   }
 
-  // Determine how many DOG levels to keep to satisfy max_num_features option.
   int first_level_to_keep = 0;
   int num_features = 0;
   int num_features_with_orientations = 0;
-  for (int i = level_keypoints.size() - 1; i >= 0; --i) {
-    num_features += level_num_features[i];
-    num_features_with_orientations += level_keypoints[i].size();
+  for (int i = level_features.size() - 1; i >= 0; --i) {
+    num_features += level_features[i]->num_features;
+    num_features_with_orientations += level_features[i]->keypoints.size();
     if (num_features > options.max_num_features) {
       first_level_to_keep = i;
       break;
     }
   }
 
-  // Extract the features to be kept.
+  // Extract the features to be kept and scale locations if original bitmap
+  // was down-sampled.
+  const float inv_scale_x = static_cast<float>(1.0 / scale_x);
+  const float inv_scale_y = static_cast<float>(1.0 / scale_y);
+  const float inv_scale_xy = (inv_scale_x + inv_scale_y) / 2.0f;
+
   size_t k = 0;
   keypoints->resize(num_features_with_orientations);
   descriptors->resize(num_features_with_orientations, 128);
-  for (size_t i = first_level_to_keep; i < level_keypoints.size(); ++i) {
-    for (size_t j = 0; j < level_keypoints[i].size(); ++j) {
-      (*keypoints)[k] = level_keypoints[i][j];
-      descriptors->row(k) = level_descriptors[i].row(j);
+  for (size_t i = first_level_to_keep; i < level_features.size(); ++i) {
+    for (size_t j = 0; j < level_features[i]->keypoints.size(); ++j) {
+      (*keypoints)[k] = level_features[i]->keypoints[j];
+      if (scale_x != 1.0 || scale_y != 1.0) {
+        (*keypoints)[k].x *= inv_scale_x;
+        (*keypoints)[k].y *= inv_scale_y;
+        (*keypoints)[k].scale *= inv_scale_xy;
+      }
+      descriptors->row(k) = level_features[i]->descriptors.row(j);
       k += 1;
     }
   }
@@ -815,45 +1445,35 @@ void LoadSiftFeaturesFromTextFile(const std::string& path,
   std::ifstream file(path.c_str());
   CHECK(file.is_open());
 
-  std::string line;
-  std::string item;
-
-  std::getline(file, line);
-  std::stringstream header_line_stream(line);
-
-  std::getline(header_line_stream >> std::ws, item, ' ');
-  const point2D_t num_features = boost::lexical_cast<point2D_t>(item);
+  // Read the entire file at once and parse the numbers in place, which is much
+  // faster than tokenizing the lines with streams.
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  const std::string content = buffer.str();
+
+  const char* pos = content.c_str();
+  auto ParseNumber = [&pos, &path]() {
+    char* end;
+    const double value = std::strtod(pos, &end);
+    CHECK_NE(pos, end) << "Invalid number in " << path;
+    pos = end;
+    return value;
+  };
 
-  std::getline(header_line_stream >> std::ws, item, ' ');
-  const size_t dim = boost::lexical_cast<size_t>(item);
+  const point2D_t num_features = static_cast<point2D_t>(ParseNumber());
+  const size_t dim = static_cast<size_t>(ParseNumber());
 
   keypoints->resize(num_features);
   descriptors->resize(num_features, dim);
 
   for (size_t i = 0; i < num_features; ++i) {
-    std::getline(file, line);
-    std::stringstream feature_line_stream(line);
-
-    // X
-    std::getline(feature_line_stream >> std::ws, item, ' ');
-    (*keypoints)[i].x = boost::lexical_cast<float>(item);
+    (*keypoints)[i].x = static_cast<float>(ParseNumber());
+    (*keypoints)[i].y = static_cast<float>(ParseNumber());
+    (*keypoints)[i].scale = static_cast<float>(ParseNumber());
+    (*keypoints)[i].orientation = static_cast<float>(ParseNumber());
 
-    // Y
-    std::getline(feature_line_stream >> std::ws, item, ' ');
-    (*keypoints)[i].y = boost::lexical_cast<float>(item);
-
-    // Scale
-    std::getline(feature_line_stream >> std::ws, item, ' ');
-    (*keypoints)[i].scale = boost::lexical_cast<float>(item);
-
-    // Orientation
-    std::getline(feature_line_stream >> std::ws, item, ' ');
-    (*keypoints)[i].orientation = boost::lexical_cast<float>(item);
-
-    // Descriptor
     for (size_t j = 0; j < dim; ++j) {
-      std::getline(feature_line_stream >> std::ws, item, ' ');
-      const double value = boost::lexical_cast<double>(item);
+      const double value = ParseNumber();
       CHECK_GE(value, 0);
       CHECK_LE(value, 255);
       (*descriptors)(i, j) = TruncateCast<double, uint8_t>(value);
@@ -861,4 +1481,65 @@ void LoadSiftFeaturesFromTextFile(const std::string& path,
   }
 }
 
+bool LoadSiftFeaturesFromBinaryFile(const std::string& path,
+                                    FeatureKeypoints* keypoints,
+                                    FeatureDescriptors* descriptors) {
+  CHECK_NOTNULL(keypoints);
+  CHECK_NOTNULL(descriptors);
+
+  if (!boost::filesystem::exists(path) ||
+      boost::filesystem::file_size(path) < sizeof(BinaryFeaturesHeader)) {
+    return false;
+  }
+
+  const boost::interprocess::file_mapping file_mapping(
+      path.c_str(), boost::interprocess::read_only);
+  const boost::interprocess::mapped_region mapped_region(
+      file_mapping, boost::interprocess::read_only);
+  const char* data = static_cast<const char*>(mapped_region.get_address());
+
+  BinaryFeaturesHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kBinaryFeaturesMagic,
+                  sizeof(kBinaryFeaturesMagic)) != 0 ||
+      header.version != kBinaryFeaturesVersion ||
+      mapped_region.get_size() !=
+          sizeof(header) +
+              header.num_features * (sizeof(FeatureKeypoint) + header.dim)) {
+    return false;
+  }
+
+  keypoints->resize(header.num_features);
+  descriptors->resize(header.num_features, header.dim);
+  std::memcpy(keypoints->data(), data + sizeof(header),
+              header.num_features * sizeof(FeatureKeypoint));
+  std::memcpy(descriptors->data(),
+              data + sizeof(header) +
+                  header.num_features * sizeof(FeatureKeypoint),
+              header.num_features * header.dim);
+
+  return true;
+}
+
+void WriteSiftFeaturesToBinaryFile(const std::string& path,
+                                   const FeatureKeypoints& keypoints,
+                                   const FeatureDescriptors& descriptors) {
+  CHECK_EQ(keypoints.size(), descriptors.rows());
+
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  CHECK(file.is_open()) << path;
+
+  BinaryFeaturesHeader header;
+  std::memcpy(header.magic, kBinaryFeaturesMagic, sizeof(header.magic));
+  header.version = kBinaryFeaturesVersion;
+  header.dim = static_cast<uint32_t>(descriptors.cols());
+  header.num_features = keypoints.size();
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(keypoints.data()),
+             keypoints.size() * sizeof(FeatureKeypoint));
+  file.write(reinterpret_cast<const char*>(descriptors.data()),
+             descriptors.size());
+}
+
 }  // namespace colmap
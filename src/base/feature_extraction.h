@@ -17,6 +17,11 @@
 #ifndef COLMAP_SRC_BASE_FEATURE_EXTRACTION_H_
 #define COLMAP_SRC_BASE_FEATURE_EXTRACTION_H_
 
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 #include "base/database.h"
 #include "ext/SiftGPU/SiftGPU.h"
 #include "util/bitmap.h"
@@ -57,6 +62,16 @@ struct SiftOptions {
   // Note that this feature is only available in the OpenGL SiftGPU version.
   bool darkness_adaptivity = true;
 
+  // Maximum memory in megabytes of the scale space of one image in the CPU
+  // version. Larger images are processed in overlapping tiles, whose margins
+  // cover the support of the largest features, and the features of all tiles
+  // are merged. Disabled if non-positive.
+  int max_tile_memory = -1;
+
+  // Number of threads for the parallel extraction of the tiles of one image
+  // in the CPU version. Each thread uses up to `max_tile_memory`.
+  int num_tile_threads = 1;
+
   enum class Normalization {
     // L1-normalizes each descriptor followed by element-wise square rooting.
     // This normalization is usually better than standard L2-normalization.
@@ -99,35 +114,117 @@ class ImageReader {
     // value `default_focal_length_factor * max(width, height)`.
     double default_focal_length_factor = 1.2;
 
+    // Maximum dimension of the read bitmaps. Larger images are down-sampled
+    // already while decoding, but the cameras keep the original dimensions.
+    // Disabled if non-positive.
+    int max_image_size = -1;
+
+    // Only read the `shard_index`-th of `num_shards` contiguous ranges of the
+    // image list, so that multiple processes can extract disjoint subsets of
+    // the images into separate databases. Merging the shards in the order of
+    // their index yields the same image identifiers as a single process.
+    int num_shards = 1;
+    int shard_index = 0;
+
     void Check() const;
   };
 
   ImageReader(const Options& options);
+  ~ImageReader();
 
-  bool Next(Image* image, Bitmap* bitmap);
+  // Read the next image and its bitmap. The camera of the image is optionally
+  // returned, whose dimensions differ from the bitmap if it was down-sampled.
+  bool Next(Image* image, Bitmap* bitmap, Camera* camera = nullptr);
   size_t NextIndex() const;
   size_t NumImages() const;
 
+  // Read and decode the upcoming images asynchronously in the given thread
+  // pool, so that `Next` only blocks for images that are not yet decoded. At
+  // most `num_images` images are decoded ahead of the current image.
+  void Prefetch(ThreadPool* thread_pool, const size_t num_images);
+
+  // Reorder the images by decreasing estimated cost of feature extraction,
+  // i.e., their number of pixels after down-sampling, so that the largest
+  // images are processed first and do not delay the completion of the last
+  // images. The dimensions are read from the image headers in the given
+  // thread pool without decoding the images. Images with unknown dimensions
+  // are processed last. Must be called before `Next` and `Prefetch`.
+  void ScheduleLargestFirst(ThreadPool* thread_pool);
+
+  // Cumulative time in seconds spent reading and decoding images, summed over
+  // all prefetching threads.
+  double DecodeTime() const;
+
  private:
+  NON_COPYABLE(ImageReader)
+  NON_MOVABLE(ImageReader)
+
+  struct ReadResult {
+    Bitmap bitmap;
+    int original_width = -1;
+    int original_height = -1;
+  };
+
+  // Name of the image relative to the image path.
+  std::string ImageNameFromPath(const std::string& image_path) const;
+
+  // Read the bitmap of the image with the given index, either from the
+  // prefetched bitmaps or directly from the file.
+  bool ReadBitmap(const size_t image_idx, ReadResult* result);
+
+  // Schedule the prefetching of the images following the current image and
+  // discard the prefetched bitmaps of skipped images.
+  void SchedulePrefetch();
+
   // Image reader options.
   Options options_;
   // Index of previously processed image.
   size_t image_index_;
   // Previously processed camera.
   Camera prev_camera_;
+
+  // Prefetched bitmaps by image index, which are null if the image could not
+  // be read.
+  ThreadPool* prefetch_thread_pool_;
+  size_t num_prefetch_images_;
+  size_t next_prefetch_image_idx_;
+  std::unordered_map<size_t, std::future<std::shared_ptr<ReadResult>>>
+      prefetched_bitmaps_;
+
+  mutable std::mutex decode_time_mutex_;
+  double decode_time_;
 };
 
-// Extract DoG SIFT features using the CPU.
+// Extract DoG SIFT features using the CPU. The images are processed in a
+// pipeline, in which multiple threads read and decode the images, multiple
+// threads extract the features, and the database writer stores the results.
+// The stages are connected by bounded queues, so that no stage waits for the
+// completion of a whole batch of images.
 class SiftCPUFeatureExtractor : public Thread {
  public:
   struct Options {
-    // Number of images to process in one batch,
+    // Number of images that are queued between the pipeline stages,
     // defined as a factor of the number of threads.
     int batch_size_factor = 3;
 
     // Number of threads for parallel feature extraction.
     int num_threads = -1;
 
+    // Number of threads for parallel reading and decoding of images.
+    int num_decode_threads = -1;
+
+    // Whether to extract the images in the order of decreasing size, which
+    // reduces the idle time of the threads on datasets with mixed resolutions.
+    // Note that the images are then also written in this order, i.e., the
+    // image identifiers follow the size instead of the name, and with a single
+    // camera, its parameters are derived from the largest instead of the first
+    // image.
+    bool largest_first = false;
+
+    // Optional path of a CSV file, to which the name, bitmap dimensions,
+    // number of features, and extraction time of each image are written.
+    std::string image_log_path = "";
+
     void Check() const;
   };
 
@@ -157,21 +254,26 @@ class SiftGPUFeatureExtractor : public Thread {
   OpenGLContextManager opengl_context_;
 };
 
-// Import features from text files. Each image must have a corresponding text
-// file with the same name and an additional ".txt" suffix.
+// Import features from binary or text files. Each image must have a
+// corresponding file with the same name and an additional ".bin" suffix for
+// the binary format or ".txt" suffix for the text format. The files are loaded
+// in parallel and the features are written by a single database writer.
 class FeatureImporter : public Thread {
  public:
   FeatureImporter(const ImageReader::Options& reader_options,
-                  const std::string& import_path);
+                  const std::string& import_path, const int num_threads = -1);
 
  private:
   void Run();
 
   const ImageReader::Options reader_options_;
   const std::string import_path_;
+  const int num_threads_;
 };
 
-// Extract SIFT features for the given image on the CPU.
+// Extract SIFT features for the given image on the CPU. If the scale space of
+// the image exceeds `SiftOptions::max_tile_memory`, the image is processed in
+// overlapping tiles.
 bool ExtractSiftFeaturesCPU(const SiftOptions& sift_options,
                             const Bitmap& bitmap, FeatureKeypoints* keypoints,
                             FeatureDescriptors* descriptors);
@@ -209,6 +311,26 @@ void LoadSiftFeaturesFromTextFile(const std::string& path,
                                   FeatureKeypoints* keypoints,
                                   FeatureDescriptors* descriptors);
 
+// Load keypoints and descriptors from binary file in the following format:
+//
+//    HEADER:      MAGIC VERSION DIM NUM_FEATURES
+//    KEYPOINTS:   NUM_FEATURES x (X Y SCALE ORIENTATION)
+//    DESCRIPTORS: NUM_FEATURES x DIM
+//
+// where MAGIC is the 8 byte string "COLMAPFT", VERSION and DIM are of type
+// uint32_t, NUM_FEATURES is of type uint64_t, the keypoints are of type float,
+// and the descriptors are of type uint8_t, all in little-endian byte order.
+// The file is memory-mapped and copied without parsing. Returns false if the
+// file is not a valid feature file.
+bool LoadSiftFeaturesFromBinaryFile(const std::string& path,
+                                    FeatureKeypoints* keypoints,
+                                    FeatureDescriptors* descriptors);
+
+// Write keypoints and descriptors to binary file in the format described above.
+void WriteSiftFeaturesToBinaryFile(const std::string& path,
+                                   const FeatureKeypoints& keypoints,
+                                   const FeatureDescriptors& descriptors);
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_BASE_FEATURE_EXTRACTION_H_
@@ -18,9 +18,14 @@
 #define BOOST_TEST_MODULE "base/feature_extraction_test"
 #include <boost/test/unit_test.hpp>
 
+#include <fstream>
+
 #include <QApplication>
 
+#include <boost/filesystem.hpp>
+
 #include "base/feature_extraction.h"
+#include "ext/VLFeat/generic.h"
 
 using namespace colmap;
 
@@ -60,6 +65,405 @@ BOOST_AUTO_TEST_CASE(TestExtractSiftFeaturesCPU) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestExtractSiftFeaturesCPUSIMD) {
+  Bitmap bitmap;
+  CreateImageWithSquare(317, &bitmap);
+
+  // The vectorized VLFeat kernels must reproduce the scalar results exactly.
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+  vl_set_simd_enabled(false);
+  BOOST_CHECK(
+      ExtractSiftFeaturesCPU(SiftOptions(), bitmap, &keypoints, &descriptors));
+
+  FeatureKeypoints simd_keypoints;
+  FeatureDescriptors simd_descriptors;
+  vl_set_simd_enabled(true);
+  BOOST_CHECK(ExtractSiftFeaturesCPU(SiftOptions(), bitmap, &simd_keypoints,
+                                     &simd_descriptors));
+
+  BOOST_CHECK_GT(keypoints.size(), 0);
+  BOOST_REQUIRE_EQUAL(keypoints.size(), simd_keypoints.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(keypoints[i].x, simd_keypoints[i].x);
+    BOOST_CHECK_EQUAL(keypoints[i].y, simd_keypoints[i].y);
+    BOOST_CHECK_EQUAL(keypoints[i].scale, simd_keypoints[i].scale);
+    BOOST_CHECK_EQUAL(keypoints[i].orientation, simd_keypoints[i].orientation);
+  }
+  BOOST_CHECK(descriptors == simd_descriptors);
+}
+
+BOOST_AUTO_TEST_CASE(TestExtractSiftFeaturesCPUTiled) {
+  Bitmap bitmap;
+  CreateImageWithSquare(1024, &bitmap);
+
+  SiftOptions options;
+  options.first_octave = 0;
+  options.num_octaves = 2;
+
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+  BOOST_CHECK(
+      ExtractSiftFeaturesCPU(options, bitmap, &keypoints, &descriptors));
+
+  // The scale space of the image requires around 100MB.
+  options.max_tile_memory = 40;
+  options.num_tile_threads = 2;
+  FeatureKeypoints tiled_keypoints;
+  FeatureDescriptors tiled_descriptors;
+  BOOST_CHECK(ExtractSiftFeaturesCPU(options, bitmap, &tiled_keypoints,
+                                     &tiled_descriptors));
+
+  BOOST_CHECK_GT(keypoints.size(), 0);
+  BOOST_REQUIRE_EQUAL(keypoints.size(), tiled_keypoints.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_LT(std::abs(keypoints[i].x - tiled_keypoints[i].x), 1e-3);
+    BOOST_CHECK_LT(std::abs(keypoints[i].y - tiled_keypoints[i].y), 1e-3);
+    BOOST_CHECK_LT(std::abs(keypoints[i].scale - tiled_keypoints[i].scale),
+                   1e-3);
+    BOOST_CHECK_LT(std::abs(keypoints[i].orientation -
+                            tiled_keypoints[i].orientation),
+                   1e-3);
+  }
+  BOOST_CHECK(descriptors == tiled_descriptors);
+}
+
+BOOST_AUTO_TEST_CASE(TestImageReaderPrefetch) {
+  const boost::filesystem::path image_path =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("%%%%-%%%%-%%%%");
+  boost::filesystem::create_directory(image_path);
+
+  const int kNumImages = 10;
+  for (int i = 0; i < kNumImages; ++i) {
+    Bitmap bitmap;
+    CreateImageWithSquare(32 + i, &bitmap);
+    BOOST_CHECK(bitmap.Write(
+        (image_path / StringPrintf("image%d.png", i)).string()));
+  }
+
+  // Invalid images are skipped.
+  std::ofstream((image_path / "image_invalid.png").string()) << "invalid";
+
+  ImageReader::Options options;
+  options.database_path = (image_path / "database.db").string();
+  options.image_path = image_path.string();
+  options.max_image_size = 34;
+  for (int i = 0; i < kNumImages; ++i) {
+    options.image_list.push_back(StringPrintf("image%d.png", i));
+    if (i == kNumImages / 2) {
+      options.image_list.push_back("image_invalid.png");
+    }
+  }
+
+  ThreadPool thread_pool(3);
+  ImageReader image_reader(options);
+  image_reader.Prefetch(&thread_pool, 4);
+
+  int num_images = 0;
+  while (image_reader.NextIndex() < image_reader.NumImages()) {
+    Image image;
+    Bitmap bitmap;
+    Camera camera;
+    if (!image_reader.Next(&image, &bitmap, &camera)) {
+      BOOST_CHECK_EQUAL(options.image_list.at(image_reader.NextIndex() - 1),
+                        "image_invalid.png");
+      continue;
+    }
+    BOOST_CHECK_EQUAL(image.Name(), StringPrintf("image%d.png", num_images));
+    BOOST_CHECK_EQUAL(bitmap.Width(), std::min(32 + num_images, 34));
+    BOOST_CHECK_EQUAL(bitmap.Height(), std::min(32 + num_images, 34));
+    BOOST_CHECK_EQUAL(camera.Width(), 32 + num_images);
+    BOOST_CHECK_EQUAL(camera.Height(), 32 + num_images);
+    BOOST_CHECK(bitmap.IsGrey());
+    num_images += 1;
+  }
+
+  BOOST_CHECK_EQUAL(num_images, kNumImages);
+  BOOST_CHECK_GE(image_reader.DecodeTime(), 0);
+
+  boost::filesystem::remove_all(image_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestImageReaderResume) {
+  const boost::filesystem::path image_path =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("%%%%-%%%%-%%%%");
+  boost::filesystem::create_directory(image_path);
+
+  const int kNumImages = 4;
+  for (int i = 0; i < kNumImages; ++i) {
+    Bitmap bitmap;
+    CreateImageWithSquare(32, &bitmap);
+    BOOST_CHECK(bitmap.Write(
+        (image_path / StringPrintf("image%d.png", i)).string()));
+  }
+
+  ImageReader::Options options;
+  options.database_path = (image_path / "database.db").string();
+  options.image_path = image_path.string();
+
+  // The first two images are completed, the third image has no features.
+  {
+    Database database(options.database_path);
+    Camera camera;
+    camera.InitializeWithName("SIMPLE_RADIAL", 1, 32, 32);
+    camera.SetCameraId(database.WriteCamera(camera));
+    for (int i = 0; i < 3; ++i) {
+      Image image;
+      image.SetName(StringPrintf("image%d.png", i));
+      image.SetCameraId(camera.CameraId());
+      image.SetImageId(database.WriteImage(image));
+      if (i < 2) {
+        database.WriteKeypoints(image.ImageId(), FeatureKeypoints(1));
+        database.WriteDescriptors(image.ImageId(), FeatureDescriptors(1, 128));
+      }
+    }
+  }
+
+  ImageReader image_reader(options);
+  BOOST_CHECK_EQUAL(image_reader.NumImages(), 2);
+
+  for (int i = 2; i < kNumImages; ++i) {
+    Image image;
+    Bitmap bitmap;
+    BOOST_CHECK(image_reader.Next(&image, &bitmap));
+    BOOST_CHECK_EQUAL(image.Name(), StringPrintf("image%d.png", i));
+  }
+
+  boost::filesystem::remove_all(image_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestImageReaderLargestFirst) {
+  const boost::filesystem::path image_path =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("%%%%-%%%%-%%%%");
+  boost::filesystem::create_directory(image_path);
+
+  const std::vector<int> kImageSizes = {40, 64, 32, 48};
+  for (size_t i = 0; i < kImageSizes.size(); ++i) {
+    Bitmap bitmap;
+    CreateImageWithSquare(kImageSizes[i], &bitmap);
+    BOOST_CHECK(bitmap.Write(
+        (image_path / StringPrintf("image%d.png", i)).string()));
+  }
+
+  ImageReader::Options options;
+  options.database_path = (image_path / "database.db").string();
+  options.image_path = image_path.string();
+  options.max_image_size = 50;
+  for (size_t i = 0; i < kImageSizes.size(); ++i) {
+    options.image_list.push_back(StringPrintf("image%d.png", i));
+  }
+  // Images with unknown size are processed last.
+  options.image_list.push_back("image_missing.png");
+
+  ThreadPool thread_pool(2);
+  ImageReader image_reader(options);
+  image_reader.ScheduleLargestFirst(&thread_pool);
+
+  // The cost of the largest image is limited by the maximum image size.
+  const std::vector<std::string> kImageNames = {
+      "image1.png", "image3.png", "image0.png", "image2.png",
+      "image_missing.png"};
+  for (const auto& image_name : kImageNames) {
+    Image image;
+    Bitmap bitmap;
+    image_reader.Next(&image, &bitmap);
+    BOOST_CHECK_EQUAL(image.Name(), image_name);
+  }
+
+  boost::filesystem::remove_all(image_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestImageReaderShards) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+
+  const int kNumImages = 10;
+  const int kNumShards = 3;
+
+  ImageReader::Options options;
+  options.database_path = database_path;
+  for (int i = 0; i < kNumImages; ++i) {
+    options.image_list.push_back(StringPrintf("image%d.png", i));
+  }
+
+  // The shards are contiguous and disjoint ranges of all images.
+  options.num_shards = kNumShards;
+  std::vector<size_t> num_images_per_shard;
+  for (int shard_index = 0; shard_index < kNumShards; ++shard_index) {
+    options.shard_index = shard_index;
+    ImageReader image_reader(options);
+    num_images_per_shard.push_back(image_reader.NumImages());
+  }
+
+  BOOST_CHECK_EQUAL(num_images_per_shard[0], 3);
+  BOOST_CHECK_EQUAL(num_images_per_shard[1], 3);
+  BOOST_CHECK_EQUAL(num_images_per_shard[2], 4);
+
+  boost::filesystem::remove(database_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestSiftCPUFeatureExtractorShards) {
+  const boost::filesystem::path test_path =
+      boost::filesystem::temp_directory_path() /
+      boost::filesystem::unique_path("%%%%-%%%%-%%%%");
+  const boost::filesystem::path image_path = test_path / "images";
+  boost::filesystem::create_directories(image_path);
+
+  const int kNumImages = 8;
+  const int kNumShards = 2;
+  for (int i = 0; i < kNumImages; ++i) {
+    Bitmap bitmap;
+    CreateImageWithSquare(64 + 8 * i, &bitmap);
+    BOOST_CHECK(bitmap.Write(
+        (image_path / StringPrintf("image%d.png", i)).string()));
+  }
+
+  auto Extract = [&image_path](const std::string& database_path,
+                               const int num_shards, const int shard_index) {
+    ImageReader::Options reader_options;
+    reader_options.database_path = database_path;
+    reader_options.image_path = image_path.string();
+    reader_options.num_shards = num_shards;
+    reader_options.shard_index = shard_index;
+    SiftCPUFeatureExtractor::Options cpu_options;
+    cpu_options.num_threads = 4;
+    cpu_options.num_decode_threads = 2;
+    SiftCPUFeatureExtractor extractor(reader_options, SiftOptions(),
+                                      cpu_options);
+    extractor.Start();
+    extractor.Wait();
+  };
+
+  const std::string database_path = (test_path / "database.db").string();
+  Extract(database_path, 1, 0);
+
+  // Merging the shards in the order of their index reproduces the image and
+  // camera identifiers of the single extraction.
+  const std::string merged_database_path = (test_path / "merged.db").string();
+  {
+    Database merged_database(merged_database_path);
+    for (int shard_index = 0; shard_index < kNumShards; ++shard_index) {
+      const std::string shard_database_path =
+          (test_path / StringPrintf("shard%d.db", shard_index)).string();
+      Extract(shard_database_path, kNumShards, shard_index);
+      size_t num_merged_images = 0;
+      BOOST_CHECK(merged_database.MergeFeatures(shard_database_path, false,
+                                                &num_merged_images));
+      BOOST_CHECK_EQUAL(num_merged_images, kNumImages / kNumShards);
+    }
+  }
+
+  Database database(database_path);
+  Database merged_database(merged_database_path);
+  BOOST_CHECK_EQUAL(database.NumImages(), kNumImages);
+  BOOST_CHECK_EQUAL(merged_database.NumImages(), kNumImages);
+  for (int i = 0; i < kNumImages; ++i) {
+    const std::string image_name = StringPrintf("image%d.png", i);
+    const Image image = database.ReadImageWithName(image_name);
+    const Image merged_image = merged_database.ReadImageWithName(image_name);
+    BOOST_CHECK_EQUAL(image.ImageId(), static_cast<image_t>(i + 1));
+    BOOST_CHECK_EQUAL(merged_image.ImageId(), image.ImageId());
+    BOOST_CHECK_EQUAL(merged_image.CameraId(), image.CameraId());
+    BOOST_CHECK_EQUAL(merged_database.NumKeypointsForImage(image.ImageId()),
+                      database.NumKeypointsForImage(image.ImageId()));
+  }
+
+  boost::filesystem::remove_all(test_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestLoadSiftFeaturesFromTextFile) {
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.txt"))
+          .string();
+  {
+    std::ofstream file(path);
+    file << "2 4" << std::endl;
+    file << "0.5 1.5 2 3.25 1 2 3 4" << std::endl;
+    file << "  1e1 -2 0.5 1  255 0 7.9 42 " << std::endl;
+  }
+
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+  LoadSiftFeaturesFromTextFile(path, &keypoints, &descriptors);
+
+  BOOST_REQUIRE_EQUAL(keypoints.size(), 2);
+  BOOST_CHECK_EQUAL(keypoints[0].x, 0.5);
+  BOOST_CHECK_EQUAL(keypoints[0].y, 1.5);
+  BOOST_CHECK_EQUAL(keypoints[0].scale, 2);
+  BOOST_CHECK_EQUAL(keypoints[0].orientation, 3.25);
+  BOOST_CHECK_EQUAL(keypoints[1].x, 10);
+  BOOST_CHECK_EQUAL(keypoints[1].y, -2);
+  BOOST_REQUIRE_EQUAL(descriptors.rows(), 2);
+  BOOST_REQUIRE_EQUAL(descriptors.cols(), 4);
+  BOOST_CHECK_EQUAL(descriptors(0, 0), 1);
+  BOOST_CHECK_EQUAL(descriptors(0, 3), 4);
+  BOOST_CHECK_EQUAL(descriptors(1, 0), 255);
+  BOOST_CHECK_EQUAL(descriptors(1, 2), 7);
+  BOOST_CHECK_EQUAL(descriptors(1, 3), 42);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestLoadSiftFeaturesFromBinaryFile) {
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.bin"))
+          .string();
+
+  FeatureKeypoints keypoints(3);
+  FeatureDescriptors descriptors(3, 128);
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    keypoints[i].x = i + 0.5f;
+    keypoints[i].y = i + 1.5f;
+    keypoints[i].scale = i + 2.0f;
+    keypoints[i].orientation = i + 0.25f;
+    for (int j = 0; j < descriptors.cols(); ++j) {
+      descriptors(i, j) = static_cast<uint8_t>(i * 128 + j);
+    }
+  }
+
+  WriteSiftFeaturesToBinaryFile(path, keypoints, descriptors);
+
+  FeatureKeypoints read_keypoints;
+  FeatureDescriptors read_descriptors;
+  BOOST_CHECK(
+      LoadSiftFeaturesFromBinaryFile(path, &read_keypoints, &read_descriptors));
+  BOOST_REQUIRE_EQUAL(read_keypoints.size(), keypoints.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(read_keypoints[i].x, keypoints[i].x);
+    BOOST_CHECK_EQUAL(read_keypoints[i].y, keypoints[i].y);
+    BOOST_CHECK_EQUAL(read_keypoints[i].scale, keypoints[i].scale);
+    BOOST_CHECK_EQUAL(read_keypoints[i].orientation,
+                      keypoints[i].orientation);
+  }
+  BOOST_CHECK(read_descriptors == descriptors);
+
+  WriteSiftFeaturesToBinaryFile(path, FeatureKeypoints(),
+                                FeatureDescriptors(0, 128));
+  BOOST_CHECK(
+      LoadSiftFeaturesFromBinaryFile(path, &read_keypoints, &read_descriptors));
+  BOOST_CHECK_EQUAL(read_keypoints.size(), 0);
+  BOOST_CHECK_EQUAL(read_descriptors.rows(), 0);
+
+  // Truncated and invalid files are rejected.
+  WriteSiftFeaturesToBinaryFile(path, keypoints, descriptors);
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+  BOOST_CHECK(!LoadSiftFeaturesFromBinaryFile(path, &read_keypoints,
+                                              &read_descriptors));
+  std::ofstream(path) << "invalid";
+  BOOST_CHECK(!LoadSiftFeaturesFromBinaryFile(path, &read_keypoints,
+                                              &read_descriptors));
+  boost::filesystem::remove(path);
+  BOOST_CHECK(!LoadSiftFeaturesFromBinaryFile(path, &read_keypoints,
+                                              &read_descriptors));
+}
+
 BOOST_AUTO_TEST_CASE(TestExtractSiftFeaturesGPU) {
   char app_name[] = "Test";
   int argc = 1;
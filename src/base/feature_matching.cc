@@ -16,8 +16,17 @@
 
 #include "base/feature_matching.h"
 
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <fstream>
+#include <limits>
 #include <numeric>
+#include <random>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
@@ -30,11 +39,16 @@
 #include "estimators/two_view_geometry.h"
 #include "optim/ransac.h"
 #include "retrieval/visual_index.h"
+#include "util/math.h"
 #include "util/misc.h"
 
 namespace colmap {
 namespace {
 
+size_t CacheSizeBytes(const SiftMatchOptions& match_options) {
+  return static_cast<size_t>(match_options.cache_size_mb) * 1024 * 1024;
+}
+
 void PrintElapsedTime(const Timer& timer) {
   std::cout << StringPrintf(" in %.3fs", timer.ElapsedSeconds()) << std::endl;
 }
@@ -61,11 +75,11 @@ void IndexImagesInVisualIndex(const int num_threads, const int max_num_features,
               << std::flush;
 
     retrieval::VisualIndex::Desc descriptors =
-        cache->GetDescriptors(image_ids[i]);
+        *cache->GetDescriptors(image_ids[i]);
     if (max_num_features > 0 && descriptors.rows() > max_num_features) {
       const auto keypoints = cache->GetKeypoints(image_ids[i]);
       descriptors =
-          ExtractTopScaleDescriptors(keypoints, descriptors, max_num_features);
+          ExtractTopScaleDescriptors(*keypoints, descriptors, max_num_features);
     }
 
     visual_index->Add(index_options, image_ids[i], descriptors);
@@ -103,7 +117,7 @@ void MatchNearestNeighborsInVisualIndex(
       std::min(image_ids.size(), 2 * retrieval_thread_pool.NumThreads());
   for (; image_idx < init_num_tasks; ++image_idx) {
     const retrieval::VisualIndex::Desc& descriptors =
-        cache->GetDescriptors(image_ids[image_idx]);
+        *cache->GetDescriptors(image_ids[image_idx]);
     retrieval_thread_pool.AddTask(QueryFunc, descriptors);
   }
 
@@ -123,10 +137,10 @@ void MatchNearestNeighborsInVisualIndex(
     // Push the next image to the retrieval queue.
     if (image_idx < image_ids.size()) {
       retrieval::VisualIndex::Desc descriptors =
-          cache->GetDescriptors(image_ids[image_idx]);
+          *cache->GetDescriptors(image_ids[image_idx]);
       if (max_num_features > 0 && descriptors.rows() > max_num_features) {
         const auto keypoints = cache->GetKeypoints(image_ids[image_idx]);
-        descriptors = ExtractTopScaleDescriptors(keypoints, descriptors,
+        descriptors = ExtractTopScaleDescriptors(*keypoints, descriptors,
                                                  max_num_features);
       }
       retrieval_thread_pool.AddTask(QueryFunc, descriptors);
@@ -150,11 +164,137 @@ void MatchNearestNeighborsInVisualIndex(
   }
 }
 
-Eigen::MatrixXi ComputeSiftDistanceMatrix(
+// Number of descriptors in the blocks of the matching. The descriptors of one
+// block of the second image stay in the L1 cache, while they are compared
+// against all descriptors of the first image.
+const int kDescriptorBlockSize = 64;
+
+// Best and second best match of a descriptor. The distances are the dot
+// products of the descriptors, i.e., larger values are better matches.
+struct BestMatch {
+  int idx = -1;
+  int dist = 0;
+  int second_dist = 0;
+};
+
+inline void UpdateBestMatch(const int idx, const int dist,
+                            BestMatch* best_match) {
+  if (dist > best_match->dist) {
+    best_match->idx = idx;
+    best_match->second_dist = best_match->dist;
+    best_match->dist = dist;
+  } else if (dist > best_match->second_dist) {
+    best_match->second_dist = dist;
+  }
+}
+
+// Convert the descriptors to 16-bit integers, whose pairwise products can be
+// summed in 32-bit integers by SIMD instructions. The descriptors are padded
+// with zero descriptors to a multiple of four.
+std::vector<int16_t> ConvertSiftDescriptorsToInt16(
+    const FeatureDescriptors& descriptors) {
+  const size_t num_descriptors = (descriptors.rows() + 3) / 4 * 4;
+  std::vector<int16_t> descriptors_int16(num_descriptors * 128, 0);
+  std::copy(descriptors.data(), descriptors.data() + descriptors.size(),
+            descriptors_int16.begin());
+  return descriptors_int16;
+}
+
+#ifdef __SSE2__
+inline __m128i LoadDescriptorSSE2(const int16_t* descriptor) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(descriptor));
+}
+
+// Sum the elements of each of the four vectors.
+inline __m128i HorizontalSum4(const __m128i sum0, const __m128i sum1,
+                              const __m128i sum2, const __m128i sum3) {
+  const __m128i sum01 = _mm_add_epi32(_mm_unpacklo_epi32(sum0, sum1),
+                                      _mm_unpackhi_epi32(sum0, sum1));
+  const __m128i sum23 = _mm_add_epi32(_mm_unpacklo_epi32(sum2, sum3),
+                                      _mm_unpackhi_epi32(sum2, sum3));
+  return _mm_add_epi32(_mm_unpacklo_epi64(sum01, sum23),
+                       _mm_unpackhi_epi64(sum01, sum23));
+}
+#endif
+
+#ifdef __AVX2__
+inline __m256i LoadDescriptorAVX2(const int16_t* descriptor) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(descriptor));
+}
+
+inline __m128i HorizontalSum2(const __m256i sum) {
+  return _mm_add_epi32(_mm256_castsi256_si128(sum),
+                       _mm256_extracti128_si256(sum, 1));
+}
+#endif
+
+// Compute the dot products of one descriptor with four consecutive
+// descriptors. The result is exact, since the products of two descriptor
+// elements and their sums fit into 32-bit integers.
+inline void ComputeSiftDotProducts4(const int16_t* descriptor,
+                                    const int16_t* descriptors4, int* dists) {
+#if defined(__AVX2__)
+  __m256i sum0 = _mm256_setzero_si256();
+  __m256i sum1 = _mm256_setzero_si256();
+  __m256i sum2 = _mm256_setzero_si256();
+  __m256i sum3 = _mm256_setzero_si256();
+  for (int k = 0; k < 128; k += 16) {
+    const __m256i d = LoadDescriptorAVX2(descriptor + k);
+    sum0 = _mm256_add_epi32(
+        sum0, _mm256_madd_epi16(d, LoadDescriptorAVX2(descriptors4 + k)));
+    sum1 = _mm256_add_epi32(
+        sum1, _mm256_madd_epi16(d, LoadDescriptorAVX2(descriptors4 + 128 + k)));
+    sum2 = _mm256_add_epi32(
+        sum2, _mm256_madd_epi16(d, LoadDescriptorAVX2(descriptors4 + 256 + k)));
+    sum3 = _mm256_add_epi32(
+        sum3, _mm256_madd_epi16(d, LoadDescriptorAVX2(descriptors4 + 384 + k)));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dists),
+                   HorizontalSum4(HorizontalSum2(sum0), HorizontalSum2(sum1),
+                                  HorizontalSum2(sum2), HorizontalSum2(sum3)));
+#elif defined(__SSE2__)
+  __m128i sum0 = _mm_setzero_si128();
+  __m128i sum1 = _mm_setzero_si128();
+  __m128i sum2 = _mm_setzero_si128();
+  __m128i sum3 = _mm_setzero_si128();
+  for (int k = 0; k < 128; k += 8) {
+    const __m128i d = LoadDescriptorSSE2(descriptor + k);
+    sum0 = _mm_add_epi32(
+        sum0, _mm_madd_epi16(d, LoadDescriptorSSE2(descriptors4 + k)));
+    sum1 = _mm_add_epi32(
+        sum1, _mm_madd_epi16(d, LoadDescriptorSSE2(descriptors4 + 128 + k)));
+    sum2 = _mm_add_epi32(
+        sum2, _mm_madd_epi16(d, LoadDescriptorSSE2(descriptors4 + 256 + k)));
+    sum3 = _mm_add_epi32(
+        sum3, _mm_madd_epi16(d, LoadDescriptorSSE2(descriptors4 + 384 + k)));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dists),
+                   HorizontalSum4(sum0, sum1, sum2, sum3));
+#else
+  for (int i = 0; i < 4; ++i) {
+    int dist = 0;
+    for (int k = 0; k < 128; ++k) {
+      dist += descriptor[k] * descriptors4[i * 128 + k];
+    }
+    dists[i] = dist;
+  }
+#endif
+}
+
+// Find the best and second best matches of all descriptors in the first image
+// and, optionally, of all descriptors in the second image. The descriptors are
+// compared block-wise and the best matches are updated in the same pass, so
+// that the full distance matrix is never stored. Pairs of descriptors that are
+// rejected by the guided filter have zero distance. Among equal distances,
+// the match with the smallest index is chosen.
+void ComputeBestSiftMatches(
     const FeatureKeypoints* keypoints1, const FeatureKeypoints* keypoints2,
     const FeatureDescriptors& descriptors1,
     const FeatureDescriptors& descriptors2,
-    const std::function<bool(float, float, float, float)>& guided_filter) {
+    const std::function<bool(float, float, float, float)>& guided_filter,
+    std::vector<BestMatch>* best_matches12,
+    std::vector<BestMatch>* best_matches21) {
+  CHECK_NOTNULL(best_matches12);
   if (guided_filter != nullptr) {
     CHECK_NOTNULL(keypoints1);
     CHECK_NOTNULL(keypoints2);
@@ -162,60 +302,84 @@ Eigen::MatrixXi ComputeSiftDistanceMatrix(
     CHECK_EQ(keypoints2->size(), descriptors2.rows());
   }
 
-  const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors1_int =
-      descriptors1.cast<int>();
-  const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors2_int =
-      descriptors2.cast<int>();
+  const int num_descriptors1 = static_cast<int>(descriptors1.rows());
+  const int num_descriptors2 = static_cast<int>(descriptors2.rows());
 
-  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> dists(
-      descriptors1.rows(), descriptors2.rows());
+  best_matches12->assign(num_descriptors1, BestMatch());
+  if (best_matches21 != nullptr) {
+    best_matches21->assign(num_descriptors2, BestMatch());
+  }
 
-  for (FeatureDescriptors::Index i1 = 0; i1 < descriptors1.rows(); ++i1) {
-    for (FeatureDescriptors::Index i2 = 0; i2 < descriptors2.rows(); ++i2) {
-      if (guided_filter != nullptr &&
-          guided_filter((*keypoints1)[i1].x, (*keypoints1)[i1].y,
-                        (*keypoints2)[i2].x, (*keypoints2)[i2].y)) {
-        dists(i1, i2) = 0;
-      } else {
-        dists(i1, i2) = descriptors1_int.row(i1).dot(descriptors2_int.row(i2));
+  if (num_descriptors1 == 0 || num_descriptors2 == 0) {
+    return;
+  }
+
+  CHECK_EQ(descriptors1.cols(), 128);
+  CHECK_EQ(descriptors2.cols(), 128);
+
+  const std::vector<int16_t> descriptors1_int16 =
+      ConvertSiftDescriptorsToInt16(descriptors1);
+  const std::vector<int16_t> descriptors2_int16 =
+      ConvertSiftDescriptorsToInt16(descriptors2);
+
+  std::array<int, kDescriptorBlockSize> dists;
+
+  for (int begin2 = 0; begin2 < num_descriptors2;
+       begin2 += kDescriptorBlockSize) {
+    const int end2 = std::min(begin2 + kDescriptorBlockSize, num_descriptors2);
+    for (int i1 = 0; i1 < num_descriptors1; ++i1) {
+      const int16_t* descriptor1 = descriptors1_int16.data() + i1 * 128;
+      for (int i2 = begin2; i2 < end2; i2 += 4) {
+        ComputeSiftDotProducts4(descriptor1,
+                                descriptors2_int16.data() + i2 * 128,
+                                dists.data() + i2 - begin2);
+      }
+
+      if (guided_filter != nullptr) {
+        const FeatureKeypoint& keypoint1 = (*keypoints1)[i1];
+        for (int i2 = begin2; i2 < end2; ++i2) {
+          const FeatureKeypoint& keypoint2 = (*keypoints2)[i2];
+          if (guided_filter(keypoint1.x, keypoint1.y, keypoint2.x,
+                            keypoint2.y)) {
+            dists[i2 - begin2] = 0;
+          }
+        }
+      }
+
+      BestMatch best_match12 = (*best_matches12)[i1];
+      for (int i2 = begin2; i2 < end2; ++i2) {
+        UpdateBestMatch(i2, dists[i2 - begin2], &best_match12);
+      }
+      (*best_matches12)[i1] = best_match12;
+
+      if (best_matches21 != nullptr) {
+        for (int i2 = begin2; i2 < end2; ++i2) {
+          UpdateBestMatch(i1, dists[i2 - begin2], &(*best_matches21)[i2]);
+        }
       }
     }
   }
-
-  return dists;
 }
 
-size_t FindBestMatchesOneWay(const Eigen::MatrixXi& dists,
+size_t FindBestMatchesOneWay(const std::vector<BestMatch>& best_matches,
                              const float max_ratio, const float max_distance,
                              std::vector<int>* matches) {
   // SIFT descriptor vectors are normalized to length 512.
   const float kDistNorm = 1.0f / (512.0f * 512.0f);
 
   size_t num_matches = 0;
-  matches->resize(dists.rows(), -1);
-
-  for (Eigen::MatrixXi::Index i1 = 0; i1 < dists.rows(); ++i1) {
-    int best_i2 = -1;
-    int best_dist = 0;
-    int second_best_dist = 0;
-    for (Eigen::MatrixXi::Index i2 = 0; i2 < dists.cols(); ++i2) {
-      const int dist = dists(i1, i2);
-      if (dist > best_dist) {
-        best_i2 = i2;
-        second_best_dist = best_dist;
-        best_dist = dist;
-      } else if (dist > second_best_dist) {
-        second_best_dist = dist;
-      }
-    }
+  matches->resize(best_matches.size(), -1);
+
+  for (size_t i1 = 0; i1 < best_matches.size(); ++i1) {
+    const BestMatch& best_match = best_matches[i1];
 
     // Check if any match found.
-    if (best_i2 == -1) {
+    if (best_match.idx == -1) {
       continue;
     }
 
     const float best_dist_normed =
-        std::acos(std::min(kDistNorm * best_dist, 1.0f));
+        std::acos(std::min(kDistNorm * best_match.dist, 1.0f));
 
     // Check if match distance passes threshold.
     if (best_dist_normed > max_distance) {
@@ -223,7 +387,7 @@ size_t FindBestMatchesOneWay(const Eigen::MatrixXi& dists,
     }
 
     const float second_best_dist_normed =
-        std::acos(std::min(kDistNorm * second_best_dist, 1.0f));
+        std::acos(std::min(kDistNorm * best_match.second_dist, 1.0f));
 
     // Check if match passes ratio test. Keep this comparison >= in order to
     // ensure that the case of best == second_best is detected.
@@ -232,25 +396,106 @@ size_t FindBestMatchesOneWay(const Eigen::MatrixXi& dists,
     }
 
     num_matches += 1;
-    (*matches)[i1] = best_i2;
+    (*matches)[i1] = best_match.idx;
   }
 
   return num_matches;
 }
 
-void FindBestMatches(const Eigen::MatrixXi& dists, const float max_ratio,
-                     const float max_distance, const bool cross_check,
-                     FeatureMatches* matches) {
+// Compute the best and second best match of a query descriptor among the
+// given candidates by their exact distances. The candidates must be sorted in
+// ascending order, such that ties are resolved in the same way as in the
+// exhaustive search.
+BestMatch ComputeBestSiftMatch(
+    const Eigen::Matrix<int, 1, 128>& query_descriptor,
+    const FeatureDescriptors& descriptors, const int* candidate_idxs,
+    const size_t num_candidates) {
+  BestMatch best_match;
+  for (size_t k = 0; k < num_candidates; ++k) {
+    const int dist = query_descriptor.dot(
+        descriptors.row(candidate_idxs[k]).cast<int>());
+    UpdateBestMatch(candidate_idxs[k], dist, &best_match);
+  }
+  return best_match;
+}
+
+// Compute the best and second best match for each query descriptor among the
+// approximate nearest neighbors returned by the kd-forest.
+void SearchBestSiftMatches(const SiftDescriptorIndex& index,
+                           const FeatureDescriptors& query_descriptors,
+                           const int num_checks,
+                           std::vector<BestMatch>* best_matches) {
+  Eigen::Matrix<size_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      indices;
+  index.Search(query_descriptors, num_checks, &indices);
+
+  best_matches->assign(query_descriptors.rows(), BestMatch());
+  for (FeatureDescriptors::Index i = 0; i < indices.rows(); ++i) {
+    std::array<int, 2> candidate_idxs;
+    for (FeatureDescriptors::Index k = 0; k < indices.cols(); ++k) {
+      candidate_idxs[k] = static_cast<int>(indices(i, k));
+    }
+    std::sort(candidate_idxs.begin(), candidate_idxs.begin() + indices.cols());
+    (*best_matches)[i] = ComputeBestSiftMatch(
+        query_descriptors.row(i).cast<int>(), index.Descriptors(),
+        candidate_idxs.data(), indices.cols());
+  }
+}
+
+// Compute the best and second best match for each descriptor of the query
+// index among the candidates returned by cascade hashing.
+void SearchBestSiftMatches(const SiftCascadeHashingIndex& index,
+                           const SiftCascadeHashingIndex& query_index,
+                           const int num_candidates,
+                           std::vector<BestMatch>* best_matches) {
+  std::vector<std::vector<int>> candidate_idxs;
+  index.Search(query_index, num_candidates, &candidate_idxs);
+
+  const FeatureDescriptors& query_descriptors = query_index.Descriptors();
+  best_matches->resize(query_descriptors.rows());
+  for (FeatureDescriptors::Index i = 0; i < query_descriptors.rows(); ++i) {
+    (*best_matches)[i] = ComputeBestSiftMatch(
+        query_descriptors.row(i).cast<int>(), index.Descriptors(),
+        candidate_idxs[i].data(), candidate_idxs[i].size());
+  }
+}
+
+// Random projections of the cascade hashing, which are the same for all
+// images, such that the binary codes of different images are comparable. The
+// first rows project to the binary codes and the remaining rows to the bucket
+// identifiers of all bucket groups. SIFT descriptors are non-negative and
+// their mean is dominated by its component along the all-ones vector, so each
+// projection has zero sum instead of centering the descriptors by the mean of
+// all descriptors in the dataset, which is unknown when an image is hashed.
+const Eigen::MatrixXf& CascadeHashingProjections(const int num_projections) {
+  static const Eigen::MatrixXf projections = [num_projections]() {
+    std::mt19937 prng(0);
+    std::normal_distribution<float> distribution(0.0f, 1.0f);
+    Eigen::MatrixXf projections(num_projections, 128);
+    for (Eigen::MatrixXf::Index i = 0; i < projections.size(); ++i) {
+      projections(i) = distribution(prng);
+    }
+    projections.colwise() -= projections.rowwise().mean();
+    return projections;
+  }();
+  CHECK_EQ(projections.rows(), num_projections);
+  return projections;
+}
+
+void FindBestMatches(const std::vector<BestMatch>& best_matches12,
+                     const std::vector<BestMatch>& best_matches21,
+                     const float max_ratio, const float max_distance,
+                     const bool cross_check, FeatureMatches* matches) {
   matches->clear();
 
   std::vector<int> matches12;
-  const size_t num_matches12 =
-      FindBestMatchesOneWay(dists, max_ratio, max_distance, &matches12);
+  const size_t num_matches12 = FindBestMatchesOneWay(
+      best_matches12, max_ratio, max_distance, &matches12);
 
   if (cross_check) {
     std::vector<int> matches21;
     const size_t num_matches21 = FindBestMatchesOneWay(
-        dists.transpose(), max_ratio, max_distance, &matches21);
+        best_matches21, max_ratio, max_distance, &matches21);
     matches->reserve(std::min(num_matches12, num_matches21));
     for (size_t i1 = 0; i1 < matches12.size(); ++i1) {
       if (matches12[i1] != -1 && matches21[matches12[i1]] != -1 &&
@@ -274,6 +519,22 @@ void FindBestMatches(const Eigen::MatrixXi& dists, const float max_ratio,
   }
 }
 
+void FindBestMatches(
+    const FeatureKeypoints* keypoints1, const FeatureKeypoints* keypoints2,
+    const FeatureDescriptors& descriptors1,
+    const FeatureDescriptors& descriptors2,
+    const std::function<bool(float, float, float, float)>& guided_filter,
+    const float max_ratio, const float max_distance, const bool cross_check,
+    FeatureMatches* matches) {
+  std::vector<BestMatch> best_matches12;
+  std::vector<BestMatch> best_matches21;
+  ComputeBestSiftMatches(keypoints1, keypoints2, descriptors1, descriptors2,
+                         guided_filter, &best_matches12,
+                         cross_check ? &best_matches21 : nullptr);
+  FindBestMatches(best_matches12, best_matches21, max_ratio, max_distance,
+                  cross_check, matches);
+}
+
 void WarnIfMaxNumMatchesReachedGPU(const SiftMatchGPU& sift_match_gpu,
                                    const FeatureDescriptors& descriptors) {
   if (sift_match_gpu.GetMaxSift() < descriptors.rows()) {
@@ -285,6 +546,108 @@ void WarnIfMaxNumMatchesReachedGPU(const SiftMatchGPU& sift_match_gpu,
   }
 }
 
+// Division by two, which rounds towards negative infinity.
+int64_t HalveFloor(const int64_t value) {
+  return value >= 0 ? value / 2 : -((1 - value) / 2);
+}
+
+// Convert the distance along the generalized Hilbert curve over a square of
+// the given size to the coordinates of the cell. The curve is recursively
+// split into sub-rectangles of about half the size as in the "gilbert"
+// algorithm by J. Cerveny, so that, unlike the classical Hilbert curve, it
+// fills squares of any size with unit steps and without running along thin
+// stripes of the square.
+void GeneralizedHilbertCurveCell(const int64_t size, int64_t curve_idx,
+                                 int64_t* cell_x, int64_t* cell_y) {
+  // Origin of the current rectangle and its major and minor axis.
+  int64_t x = 0;
+  int64_t y = 0;
+  int64_t ax = size;
+  int64_t ay = 0;
+  int64_t bx = 0;
+  int64_t by = size;
+
+  while (true) {
+    const int64_t w = std::abs(ax + ay);
+    const int64_t h = std::abs(bx + by);
+    const int64_t dax = SignOfNumber(ax);
+    const int64_t day = SignOfNumber(ay);
+    const int64_t dbx = SignOfNumber(bx);
+    const int64_t dby = SignOfNumber(by);
+
+    if (h == 1) {
+      *cell_x = x + dax * curve_idx;
+      *cell_y = y + day * curve_idx;
+      return;
+    }
+
+    if (w == 1) {
+      *cell_x = x + dbx * curve_idx;
+      *cell_y = y + dby * curve_idx;
+      return;
+    }
+
+    int64_t ax2 = HalveFloor(ax);
+    int64_t ay2 = HalveFloor(ay);
+    int64_t bx2 = HalveFloor(bx);
+    int64_t by2 = HalveFloor(by);
+
+    if (2 * w > 3 * h) {
+      // Split a long rectangle into two halves along its major axis, where
+      // the first half preferably has an even length.
+      if (std::abs(ax2 + ay2) % 2 == 1 && w > 2) {
+        ax2 += dax;
+        ay2 += day;
+      }
+
+      const int64_t num_cells1 = std::abs(ax2 + ay2) * h;
+      if (curve_idx < num_cells1) {
+        ax = ax2;
+        ay = ay2;
+      } else {
+        curve_idx -= num_cells1;
+        x += ax2;
+        y += ay2;
+        ax -= ax2;
+        ay -= ay2;
+      }
+    } else {
+      // Split the rectangle into one step up along the minor axis, one long
+      // step along the major axis, and one step down, where the first step
+      // preferably has an even length.
+      if (std::abs(bx2 + by2) % 2 == 1 && h > 2) {
+        bx2 += dbx;
+        by2 += dby;
+      }
+
+      const int64_t num_cells1 = std::abs(bx2 + by2) * std::abs(ax2 + ay2);
+      const int64_t num_cells2 = w * std::abs(bx - bx2 + by - by2);
+      if (curve_idx < num_cells1) {
+        bx = ax2;
+        by = ay2;
+        ax = bx2;
+        ay = by2;
+      } else if (curve_idx < num_cells1 + num_cells2) {
+        curve_idx -= num_cells1;
+        x += bx2;
+        y += by2;
+        bx -= bx2;
+        by -= by2;
+      } else {
+        curve_idx -= num_cells1 + num_cells2;
+        x += (ax - dax) + (bx2 - dbx);
+        y += (ay - day) + (by2 - dby);
+        const int64_t next_bx = ax2 - ax;
+        const int64_t next_by = ay2 - ay;
+        ax = -bx2;
+        ay = -by2;
+        bx = next_bx;
+        by = next_by;
+      }
+    }
+  }
+}
+
 }  // namespace
 
 void SiftMatchOptions::Check() const {
@@ -296,13 +659,272 @@ void SiftMatchOptions::Check() const {
   CHECK_GE(min_inlier_ratio, 0);
   CHECK_LE(min_inlier_ratio, 1);
   CHECK_GE(min_num_inliers, 0);
+  CHECK_GT(num_shards, 0);
+  CHECK_GE(shard_index, 0);
+  CHECK_LT(shard_index, num_shards);
+  CHECK_GT(cpu_kd_forest_num_trees, 0);
+  CHECK_GT(cpu_kd_forest_checks, 0);
+  CHECK(!cpu_kd_forest || !cpu_cascade_hashing);
+  CHECK_GT(cpu_cascade_hashing_num_candidates, 0);
+  CHECK_GE(cache_size_mb, 0);
+  CHECK_GE(num_verification_threads, -1);
+}
+
+bool IsImagePairInShard(const image_t image_id1, const image_t image_id2,
+                        const int num_shards, const int shard_index) {
+  // Mix the bits of the pair identifier, since consecutive identifiers would
+  // otherwise assign all image pairs of an image to few shards.
+  uint64_t hash = Database::ImagePairToPairId(image_id1, image_id2);
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  hash = hash ^ (hash >> 31);
+  return static_cast<int>(hash % static_cast<uint64_t>(num_shards)) ==
+         shard_index;
+}
+
+const image_t ImagePairSet::kMaxBitmapImageId = 1 << 16;
+
+HilbertImagePairOrder::HilbertImagePairOrder(const size_t num_indices)
+    : num_indices_(num_indices), curve_idx_(0) {}
+
+size_t HilbertImagePairOrder::NumPairs() const {
+  return num_indices_ * (std::max<size_t>(num_indices_, 1) - 1) / 2;
+}
+
+bool HilbertImagePairOrder::Next(size_t* idx1, size_t* idx2) {
+  const int64_t curve_size = static_cast<int64_t>(num_indices_);
+  while (curve_idx_ < curve_size * curve_size) {
+    int64_t x;
+    int64_t y;
+    GeneralizedHilbertCurveCell(curve_size, curve_idx_, &x, &y);
+
+    curve_idx_ += 1;
+
+    if (x < y) {
+      *idx1 = static_cast<size_t>(x);
+      *idx2 = static_cast<size_t>(y);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+ImagePairSet::ImagePairSet(const image_t max_image_id)
+    : max_image_id_(std::min(max_image_id, kMaxBitmapImageId)),
+      num_pairs_(0) {
+  const size_t max_image_id_size = static_cast<size_t>(max_image_id_);
+  bitmap_.resize((max_image_id_size + 1) * max_image_id_size / 2, false);
+}
+
+size_t ImagePairSet::Size() const { return num_pairs_; }
+
+bool ImagePairSet::Exists(const image_t image_id1,
+                          const image_t image_id2) const {
+  const int64_t index = BitmapIndex(image_id1, image_id2);
+  if (index >= 0) {
+    return bitmap_[index];
+  }
+  return pair_ids_.count(Database::ImagePairToPairId(image_id1, image_id2)) >
+         0;
+}
+
+void ImagePairSet::Insert(const image_t image_id1, const image_t image_id2) {
+  const int64_t index = BitmapIndex(image_id1, image_id2);
+  if (index >= 0) {
+    if (!bitmap_[index]) {
+      bitmap_[index] = true;
+      num_pairs_ += 1;
+    }
+  } else if (pair_ids_
+                 .insert(Database::ImagePairToPairId(image_id1, image_id2))
+                 .second) {
+    num_pairs_ += 1;
+  }
+}
+
+int64_t ImagePairSet::BitmapIndex(const image_t image_id1,
+                                  const image_t image_id2) const {
+  const int64_t min_image_id = std::min(image_id1, image_id2);
+  const int64_t max_image_id = std::max(image_id1, image_id2);
+  if (min_image_id == max_image_id || max_image_id > max_image_id_) {
+    return -1;
+  }
+  return max_image_id * (max_image_id - 1) / 2 + min_image_id;
+}
+
+SiftDescriptorIndex::SiftDescriptorIndex(const FeatureDescriptors& descriptors,
+                                         const int num_trees)
+    : descriptors_(descriptors) {
+  CHECK_GT(num_trees, 0);
+  if (descriptors_.rows() == 0) {
+    return;
+  }
+
+  // The index refers to the descriptors of this object without copying them.
+  const flann::Matrix<uint8_t> data(const_cast<uint8_t*>(descriptors_.data()),
+                                    descriptors_.rows(), descriptors_.cols());
+  index_.reset(new flann::KDTreeIndex<flann::L2<uint8_t>>(
+      data, flann::KDTreeIndexParams(num_trees)));
+  index_->buildIndex();
+}
+
+const FeatureDescriptors& SiftDescriptorIndex::Descriptors() const {
+  return descriptors_;
+}
+
+size_t SiftDescriptorIndex::NumBytes() const {
+  size_t num_bytes = descriptors_.size();
+  if (index_) {
+    num_bytes += index_->usedMemory();
+  }
+  return num_bytes;
+}
+
+void SiftDescriptorIndex::Search(
+    const FeatureDescriptors& query_descriptors, const int num_checks,
+    Eigen::Matrix<size_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>*
+        indices) const {
+  CHECK_NOTNULL(indices);
+
+  const size_t knn = std::min<size_t>(2, descriptors_.rows());
+  indices->resize(query_descriptors.rows(), knn);
+  if (query_descriptors.rows() == 0 || knn == 0) {
+    return;
+  }
+
+  CHECK_EQ(query_descriptors.cols(), descriptors_.cols());
+
+  const flann::Matrix<uint8_t> queries(
+      const_cast<uint8_t*>(query_descriptors.data()), query_descriptors.rows(),
+      query_descriptors.cols());
+  flann::Matrix<size_t> indices_matrix(indices->data(), indices->rows(), knn);
+  std::vector<float> distances(indices->rows() * knn);
+  flann::Matrix<float> distances_matrix(distances.data(), indices->rows(), knn);
+  index_->knnSearch(queries, indices_matrix, distances_matrix, knn,
+                    flann::SearchParams(num_checks));
+}
+
+SiftCascadeHashingIndex::SiftCascadeHashingIndex(
+    const FeatureDescriptors& descriptors)
+    : descriptors_(descriptors),
+      codes_(descriptors.rows()),
+      bucket_ids_(descriptors.rows()),
+      buckets_(kNumBucketGroups * (1 << kNumBucketBits)) {
+  if (descriptors_.rows() == 0) {
+    return;
+  }
+
+  CHECK_EQ(descriptors_.cols(), 128);
+
+  const int kNumProjections = kNumCodeBits + kNumBucketGroups * kNumBucketBits;
+  const Eigen::MatrixXf projected_descriptors =
+      descriptors_.cast<float>() *
+      CascadeHashingProjections(kNumProjections).transpose();
+
+  for (FeatureDescriptors::Index i = 0; i < descriptors_.rows(); ++i) {
+    for (int k = 0; k < kNumCodeBits; ++k) {
+      if (projected_descriptors(i, k) > 0) {
+        codes_[i][k / 64] |= uint64_t(1) << (k % 64);
+      }
+    }
+
+    for (int group = 0; group < kNumBucketGroups; ++group) {
+      int bucket_id = 0;
+      for (int k = 0; k < kNumBucketBits; ++k) {
+        const int projection_idx = kNumCodeBits + group * kNumBucketBits + k;
+        if (projected_descriptors(i, projection_idx) > 0) {
+          bucket_id |= 1 << k;
+        }
+      }
+      bucket_ids_[i][group] = static_cast<uint8_t>(bucket_id);
+      buckets_[(group << kNumBucketBits) + bucket_id].push_back(i);
+    }
+  }
+}
+
+const FeatureDescriptors& SiftCascadeHashingIndex::Descriptors() const {
+  return descriptors_;
+}
+
+size_t SiftCascadeHashingIndex::NumBytes() const {
+  size_t num_bytes = descriptors_.size() +
+                     codes_.size() * sizeof(codes_[0]) +
+                     bucket_ids_.size() * sizeof(bucket_ids_[0]);
+  for (const auto& bucket : buckets_) {
+    num_bytes += bucket.size() * sizeof(int);
+  }
+  return num_bytes;
+}
+
+void SiftCascadeHashingIndex::Search(
+    const SiftCascadeHashingIndex& query_index, const int num_candidates,
+    std::vector<std::vector<int>>* candidate_idxs) const {
+  CHECK_GT(num_candidates, 0);
+  CHECK_NOTNULL(candidate_idxs);
+
+  const size_t num_queries = query_index.codes_.size();
+  candidate_idxs->clear();
+  candidate_idxs->resize(num_queries);
+
+  // Index of the last query for which a descriptor was ranked, to collect
+  // descriptors that share multiple buckets with the query only once.
+  std::vector<size_t> last_query_idxs(codes_.size(), num_queries);
+
+  // Candidates of the current query grouped by their Hamming distance.
+  std::vector<std::vector<int>> ranked_idxs(kNumCodeBits + 1);
+
+  for (size_t i = 0; i < num_queries; ++i) {
+    const std::array<uint64_t, 2>& query_code = query_index.codes_[i];
+
+    for (int group = 0; group < kNumBucketGroups; ++group) {
+      const int bucket_id = query_index.bucket_ids_[i][group];
+      for (const int idx : buckets_[(group << kNumBucketBits) + bucket_id]) {
+        if (last_query_idxs[idx] == i) {
+          continue;
+        }
+        last_query_idxs[idx] = i;
+        const size_t hamming_dist =
+            std::bitset<64>(query_code[0] ^ codes_[idx][0]).count() +
+            std::bitset<64>(query_code[1] ^ codes_[idx][1]).count();
+        ranked_idxs[hamming_dist].push_back(idx);
+      }
+    }
+
+    std::vector<int>& query_candidate_idxs = (*candidate_idxs)[i];
+    for (auto& idxs : ranked_idxs) {
+      for (const int idx : idxs) {
+        if (query_candidate_idxs.size() <
+            static_cast<size_t>(num_candidates)) {
+          query_candidate_idxs.push_back(idx);
+        }
+      }
+      idxs.clear();
+    }
+
+    std::sort(query_candidate_idxs.begin(), query_candidate_idxs.end());
+  }
 }
 
 FeatureMatcherCache::FeatureMatcherCache(const size_t cache_size,
-                                         const Database* database)
-    : database_(database) {
+                                         const Database* database,
+                                         const std::string& feature_store_path,
+                                         const int num_readers,
+                                         const size_t max_num_bytes)
+    : cache_size_(max_num_bytes > 0 ? std::numeric_limits<size_t>::max()
+                                    : cache_size),
+      max_num_bytes_(max_num_bytes > 0 ? max_num_bytes
+                                       : std::numeric_limits<size_t>::max()),
+      database_(database) {
   CHECK_NOTNULL(database);
 
+  const std::string database_path = database->Path();
+  if (!database_path.empty() && num_readers != 1) {
+    reader_pool_.reset(new DatabaseReaderPool(database_path, num_readers));
+  }
+
+  feature_store_ = FeatureStore::Open(feature_store_path, *database);
+
   const std::vector<Camera> cameras = database->ReadAllCameras();
   cameras_cache_.reserve(cameras.size());
   for (const auto& camera : cameras) {
@@ -315,15 +937,44 @@ FeatureMatcherCache::FeatureMatcherCache(const size_t cache_size,
     images_cache_.emplace(image.ImageId(), image);
   }
 
-  keypoints_cache_.reset(new LRUCache<image_t, FeatureKeypoints>(
-      cache_size, [database](const image_t image_id) {
-        return database->ReadKeypoints(image_id);
+  // The memory is split between the caches roughly in proportion to the size
+  // of their elements. Only one type of descriptor index is used at a time.
+  keypoints_cache_.reset(new SharedLRUCache<image_t, FeatureKeypoints>(
+      cache_size_, max_num_bytes_ / 8, kNumCacheShards,
+      [this](const image_t image_id) {
+        return std::make_shared<const FeatureKeypoints>(
+            LoadKeypoints(image_id));
+      },
+      [](const FeatureKeypoints& keypoints) {
+        return keypoints.size() * sizeof(FeatureKeypoint);
       }));
 
-  descriptors_cache_.reset(new LRUCache<image_t, FeatureDescriptors>(
-      cache_size, [database](const image_t image_id) {
-        return database->ReadDescriptors(image_id);
+  descriptors_cache_.reset(new SharedLRUCache<image_t, FeatureDescriptors>(
+      cache_size_, max_num_bytes_ / 4, kNumCacheShards,
+      [this](const image_t image_id) {
+        return std::make_shared<const FeatureDescriptors>(
+            LoadDescriptors(image_id));
+      },
+      [](const FeatureDescriptors& descriptors) {
+        return static_cast<size_t>(descriptors.size());
       }));
+
+  cascade_hashing_index_cache_.reset(
+      new SharedLRUCache<image_t, SiftCascadeHashingIndex>(
+          cache_size_, max_num_bytes_ / 2, kNumCacheShards,
+          [this](const image_t image_id) {
+            return std::make_shared<const SiftCascadeHashingIndex>(
+                *GetDescriptors(image_id));
+          },
+          [](const SiftCascadeHashingIndex& index) {
+            return index.NumBytes();
+          }));
+
+  if (reader_pool_) {
+    prefetch_thread_pool_.reset(new ThreadPool(num_readers));
+  } else {
+    prefetch_thread_pool_.reset(new ThreadPool(1));
+  }
 }
 
 const Camera& FeatureMatcherCache::GetCamera(const camera_t camera_id) const {
@@ -334,24 +985,93 @@ const Image& FeatureMatcherCache::GetImage(const image_t image_id) const {
   return images_cache_.at(image_id);
 }
 
-const FeatureKeypoints& FeatureMatcherCache::GetKeypoints(
+std::shared_ptr<const FeatureKeypoints> FeatureMatcherCache::GetKeypoints(
     const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
   return keypoints_cache_->Get(image_id);
 }
 
-const FeatureDescriptors& FeatureMatcherCache::GetDescriptors(
+std::shared_ptr<const FeatureDescriptors> FeatureMatcherCache::GetDescriptors(
     const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
   return descriptors_cache_->Get(image_id);
 }
 
 FeatureMatches FeatureMatcherCache::GetMatches(const image_t image_id1,
                                                const image_t image_id2) {
+  if (reader_pool_) {
+    return reader_pool_->Acquire()->ReadMatches(image_id1, image_id2);
+  }
   std::unique_lock<std::mutex> lock(database_mutex_);
   return database_->ReadMatches(image_id1, image_id2);
 }
 
+std::shared_ptr<const SiftDescriptorIndex>
+FeatureMatcherCache::GetDescriptorIndex(const image_t image_id,
+                                        const int num_trees) {
+  SharedLRUCache<image_t, SiftDescriptorIndex>* descriptor_index_cache;
+  {
+    std::unique_lock<std::mutex> lock(derived_caches_mutex_);
+    auto& cache = descriptor_index_caches_[num_trees];
+    if (!cache) {
+      cache.reset(new SharedLRUCache<image_t, SiftDescriptorIndex>(
+          cache_size_, max_num_bytes_ / 2, kNumCacheShards,
+          [this, num_trees](const image_t image_id) {
+            return std::make_shared<const SiftDescriptorIndex>(
+                *GetDescriptors(image_id), num_trees);
+          },
+          [](const SiftDescriptorIndex& index) { return index.NumBytes(); }));
+    }
+    descriptor_index_cache = cache.get();
+  }
+  return descriptor_index_cache->Get(image_id);
+}
+
+std::shared_ptr<const SiftCascadeHashingIndex>
+FeatureMatcherCache::GetCascadeHashingIndex(const image_t image_id) {
+  return cascade_hashing_index_cache_->Get(image_id);
+}
+
+std::shared_ptr<const FeatureDescriptors>
+FeatureMatcherCache::GetTopScaleDescriptors(const image_t image_id,
+                                            const int num_features) {
+  SharedLRUCache<image_t, FeatureDescriptors>* top_scale_descriptors_cache;
+  {
+    std::unique_lock<std::mutex> lock(derived_caches_mutex_);
+    auto& cache = top_scale_descriptors_caches_[num_features];
+    if (!cache) {
+      const size_t cache_size =
+          max_num_bytes_ == std::numeric_limits<size_t>::max()
+              ? std::max(cache_size_, images_cache_.size())
+              : cache_size_;
+      cache.reset(new SharedLRUCache<image_t, FeatureDescriptors>(
+          cache_size, max_num_bytes_ / 8, kNumCacheShards,
+          [this, num_features](const image_t image_id) {
+            return std::make_shared<const FeatureDescriptors>(
+                ExtractTopScaleDescriptors(*GetKeypoints(image_id),
+                                           *GetDescriptors(image_id),
+                                           num_features));
+          },
+          [](const FeatureDescriptors& descriptors) {
+            return static_cast<size_t>(descriptors.size());
+          }));
+    }
+    top_scale_descriptors_cache = cache.get();
+  }
+  return top_scale_descriptors_cache->Get(image_id);
+}
+
+void FeatureMatcherCache::Prefetch(const std::vector<image_t>& image_ids) {
+  for (const image_t image_id : image_ids) {
+    prefetch_thread_pool_->AddTask([this, image_id]() {
+      GetKeypoints(image_id);
+      GetDescriptors(image_id);
+    });
+  }
+}
+
+std::unique_lock<std::mutex> FeatureMatcherCache::LockDatabase() {
+  return std::unique_lock<std::mutex>(database_mutex_);
+}
+
 std::vector<image_t> FeatureMatcherCache::GetImageIds() const {
   std::vector<image_t> image_ids;
   image_ids.reserve(images_cache_.size());
@@ -361,10 +1081,41 @@ std::vector<image_t> FeatureMatcherCache::GetImageIds() const {
   return image_ids;
 }
 
+FeatureKeypoints FeatureMatcherCache::LoadKeypoints(const image_t image_id) {
+  if (feature_store_ && feature_store_->ExistsImage(image_id)) {
+    return feature_store_->ReadKeypoints(image_id);
+  }
+  if (reader_pool_) {
+    return reader_pool_->Acquire()->ReadKeypoints(image_id);
+  }
+  std::unique_lock<std::mutex> lock(database_mutex_);
+  return database_->ReadKeypoints(image_id);
+}
+
+FeatureDescriptors FeatureMatcherCache::LoadDescriptors(
+    const image_t image_id) {
+  if (feature_store_ && feature_store_->ExistsImage(image_id)) {
+    return feature_store_->ReadDescriptors(image_id);
+  }
+  if (reader_pool_) {
+    return reader_pool_->Acquire()->ReadDescriptors(image_id);
+  }
+  std::unique_lock<std::mutex> lock(database_mutex_);
+  return database_->ReadDescriptors(image_id);
+}
+
 SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchOptions& options,
                                        Database* database,
                                        FeatureMatcherCache* cache)
-    : options_(options), database_(database), cache_(cache) {
+    : options_(options),
+      database_(database),
+      cache_(cache),
+      num_pending_verifications_(0),
+      num_matched_pairs_(0),
+      matching_seconds_(0),
+      num_verified_pairs_(0),
+      verification_seconds_(0),
+      blocked_matching_seconds_(0) {
   options_.Check();
 
   if (options_.use_gpu) {
@@ -381,6 +1132,13 @@ SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchOptions& options,
   }
 }
 
+SiftFeatureMatcher::~SiftFeatureMatcher() {
+  if (verification_queue_) {
+    verification_queue_->Stop();
+    verification_thread_pool_.reset();
+  }
+}
+
 bool SiftFeatureMatcher::Setup() {
   if (options_.use_gpu) {
 #ifdef CUDA_ENABLED
@@ -403,6 +1161,48 @@ bool SiftFeatureMatcher::Setup() {
 
   thread_pool_.reset(new ThreadPool(options_.num_threads));
 
+  if (options_.num_verification_threads != 0) {
+    if (options_.use_gpu && options_.guided_matching) {
+      std::cout << "WARNING: Guided matching on the GPU requires the "
+                   "verification in the matching threads."
+                << std::endl;
+    } else {
+      verification_thread_pool_.reset(
+          new ThreadPool(options_.num_verification_threads));
+      // Bound the number of queued image pairs, such that the matching threads
+      // do not run ahead of verification and accumulate the matches in memory.
+      verification_queue_.reset(new JobQueue<VerificationJob>(
+          4 * verification_thread_pool_->NumThreads()));
+      for (size_t i = 0; i < verification_thread_pool_->NumThreads(); ++i) {
+        verification_thread_pool_->AddTask(
+            &SiftFeatureMatcher::VerificationWorkerFunc, this);
+      }
+    }
+  }
+
+  // Load the existing image pairs in bulk, so that already matched image pairs
+  // are skipped without querying the database for every image pair.
+  image_t max_image_id = 0;
+  for (const image_t image_id : cache_->GetImageIds()) {
+    max_image_id = std::max(max_image_id, image_id);
+  }
+
+  existing_matches_ = ImagePairSet(max_image_id);
+  database_->ForEachMatchesPairId([this](const image_pair_t pair_id) {
+    image_t image_id1;
+    image_t image_id2;
+    Database::PairIdToImagePair(pair_id, &image_id1, &image_id2);
+    existing_matches_.Insert(image_id1, image_id2);
+  });
+
+  existing_inlier_matches_ = ImagePairSet(max_image_id);
+  database_->ForEachInlierMatchesPairId([this](const image_pair_t pair_id) {
+    image_t image_id1;
+    image_t image_id2;
+    Database::PairIdToImagePair(pair_id, &image_id1, &image_id2);
+    existing_inlier_matches_.Insert(image_id1, image_id2);
+  });
+
   return true;
 }
 
@@ -427,8 +1227,6 @@ void SiftFeatureMatcher::MatchImagePairs(
 
   bool exists_all = true;
 
-  DatabaseTransaction database_transaction(database_);
-
   for (const auto image_pair : image_pairs) {
     // Avoid self-matches.
     if (image_pair.first == image_pair.second) {
@@ -436,6 +1234,14 @@ void SiftFeatureMatcher::MatchImagePairs(
       continue;
     }
 
+    // Skip image pairs that are matched by other shards.
+    if (options_.num_shards > 1 &&
+        !IsImagePairInShard(image_pair.first, image_pair.second,
+                            options_.num_shards, options_.shard_index)) {
+      exists_mask.emplace_back(true, true);
+      continue;
+    }
+
     // Avoid duplicate image pairs.
     const image_pair_t pair_id =
         Database::ImagePairToPairId(image_pair.first, image_pair.second);
@@ -447,9 +1253,9 @@ void SiftFeatureMatcher::MatchImagePairs(
     pair_ids.insert(pair_id);
 
     const bool exists_matches =
-        database_->ExistsMatches(image_pair.first, image_pair.second);
+        existing_matches_.Exists(image_pair.first, image_pair.second);
     const bool exists_inlier_matches =
-        database_->ExistsInlierMatches(image_pair.first, image_pair.second);
+        existing_inlier_matches_.Exists(image_pair.first, image_pair.second);
 
     exists_all = exists_all && exists_matches && exists_inlier_matches;
     exists_mask.emplace_back(exists_matches, exists_inlier_matches);
@@ -459,6 +1265,8 @@ void SiftFeatureMatcher::MatchImagePairs(
     return;
   }
 
+  DatabaseTransaction database_transaction(database_);
+
   //////////////////////////////////////////////////////////////////////////////
   // Match the image pairs
   //////////////////////////////////////////////////////////////////////////////
@@ -478,72 +1286,409 @@ void SiftFeatureMatcher::MatchImagePairs(
   // Write results to database
   //////////////////////////////////////////////////////////////////////////////
 
-  for (const auto& result : match_results) {
-    database_->WriteMatches(result.image_id1, result.image_id2, result.matches);
+  // Also write the results of the verification stage that finished meanwhile,
+  // including those of previous batches.
+  CollectVerificationResults(&inlier_match_results);
+
+  WriteResults(&match_results, &inlier_match_results);
+}
+
+void SiftFeatureMatcher::MatchImagePairsStreamed(
+    const size_t num_image_pairs,
+    const std::function<bool(std::pair<image_t, image_t>*)>& next_image_pair) {
+  CHECK_NOTNULL(database_);
+  CHECK_NOTNULL(cache_);
+  CHECK(thread_pool_);
+  CHECK(!options_.use_gpu);
+
+  struct StreamedResult {
+    std::pair<image_t, image_t> image_pair;
+    std::pair<bool, bool> exists;
+    FeatureMatches matches;
+    TwoViewGeometry two_view_geometry;
+    bool verification_queued;
+  };
+
+  const TwoViewGeometry::Options two_view_geometry_options =
+      GetTwoViewGeometryOptions();
+
+  // Keep enough pairs in flight, such that no worker runs out of work while
+  // the results of other pairs are written.
+  const size_t max_num_pairs_in_flight = 4 * thread_pool_->NumThreads();
+  const size_t kCommitSize = 1000;
+
+  JobQueue<StreamedResult> result_queue(max_num_pairs_in_flight);
+
+  // Number of pairs in flight per image, whose size is the working set.
+  std::unordered_map<image_t, int> working_set;
+  size_t max_working_set_size = 0;
+
+  size_t num_pairs_in_flight = 0;
+  size_t num_processed_pairs = 0;
+  bool has_next_image_pair = true;
+
+  auto AddImagePairs = [&]() {
+    std::pair<image_t, image_t> image_pair;
+    while (has_next_image_pair &&
+           num_pairs_in_flight < max_num_pairs_in_flight) {
+      has_next_image_pair = next_image_pair(&image_pair);
+      if (!has_next_image_pair) {
+        break;
+      }
+
+      // Skip self-matches and image pairs that are matched by other shards.
+      if (image_pair.first == image_pair.second ||
+          (options_.num_shards > 1 &&
+           !IsImagePairInShard(image_pair.first, image_pair.second,
+                               options_.num_shards, options_.shard_index))) {
+        num_processed_pairs += 1;
+        continue;
+      }
+
+      const std::pair<bool, bool> exists(
+          existing_matches_.Exists(image_pair.first, image_pair.second),
+          existing_inlier_matches_.Exists(image_pair.first,
+                                          image_pair.second));
+      if (exists.first && exists.second) {
+        num_processed_pairs += 1;
+        continue;
+      }
+
+      working_set[image_pair.first] += 1;
+      working_set[image_pair.second] += 1;
+      max_working_set_size = std::max(max_working_set_size, working_set.size());
+
+      num_pairs_in_flight += 1;
+      thread_pool_->AddTask([this, &two_view_geometry_options, &result_queue,
+                             image_pair, exists]() {
+        StreamedResult result;
+        result.image_pair = image_pair;
+        result.exists = exists;
+        result.verification_queued = MatchImagePairCPU(
+            image_pair, exists, two_view_geometry_options, &result.matches,
+            &result.two_view_geometry);
+        result_queue.Push(result);
+      });
+    }
+  };
+
+  auto RemoveFromWorkingSet = [&working_set](const image_t image_id) {
+    const auto it = working_set.find(image_id);
+    it->second -= 1;
+    if (it->second == 0) {
+      working_set.erase(it);
+    }
+  };
+
+  Timer timer;
+  timer.Start();
+
+  std::vector<MatchResult> match_results;
+  std::vector<InlierMatchResult> inlier_match_results;
+
+  AddImagePairs();
+
+  while (num_pairs_in_flight > 0) {
+    auto result = result_queue.Pop();
+    CHECK(result.IsValid());
+
+    num_pairs_in_flight -= 1;
+    num_processed_pairs += 1;
+
+    const auto& image_pair = result.Data().image_pair;
+    RemoveFromWorkingSet(image_pair.first);
+    RemoveFromWorkingSet(image_pair.second);
+
+    if (!result.Data().exists.first) {
+      match_results.emplace_back();
+      match_results.back().image_id1 = image_pair.first;
+      match_results.back().image_id2 = image_pair.second;
+      match_results.back().matches = std::move(result.Data().matches);
+    }
+
+    if (result.Data().verification_queued) {
+      // Avoid verifying the image pair twice, before its result is written.
+      existing_inlier_matches_.Insert(image_pair.first, image_pair.second);
+    } else if (!result.Data().exists.second) {
+      inlier_match_results.emplace_back();
+      inlier_match_results.back().image_id1 = image_pair.first;
+      inlier_match_results.back().image_id2 = image_pair.second;
+      inlier_match_results.back().two_view_geometry =
+          std::move(result.Data().two_view_geometry);
+    }
+
+    // Immediately refill the workers before writing the results.
+    AddImagePairs();
+
+    if (match_results.size() + inlier_match_results.size() >= kCommitSize ||
+        num_pairs_in_flight == 0) {
+      CollectVerificationResults(&inlier_match_results);
+      {
+        const std::unique_lock<std::mutex> database_lock =
+            cache_->LockDatabase();
+        DatabaseTransaction database_transaction(database_);
+        WriteResults(&match_results, &inlier_match_results);
+      }
+
+      std::cout << StringPrintf(
+                       "Matched pairs [%d/%d] in %.3fs (%.1f pairs/s), working "
+                       "set of %d images (max. %d)",
+                       num_processed_pairs, num_image_pairs,
+                       timer.ElapsedSeconds(),
+                       num_processed_pairs / timer.ElapsedSeconds(),
+                       working_set.size(), max_working_set_size)
+                << std::endl;
+    }
+  }
+}
+
+TwoViewGeometry::Options SiftFeatureMatcher::GetTwoViewGeometryOptions()
+    const {
+  TwoViewGeometry::Options two_view_geometry_options;
+  two_view_geometry_options.min_num_inliers =
+      static_cast<size_t>(options_.min_num_inliers);
+  two_view_geometry_options.ransac_options.max_error = options_.max_error;
+  two_view_geometry_options.ransac_options.confidence = options_.confidence;
+  two_view_geometry_options.ransac_options.max_num_trials =
+      static_cast<size_t>(options_.max_num_trials);
+  two_view_geometry_options.ransac_options.min_inlier_ratio =
+      options_.min_inlier_ratio;
+  return two_view_geometry_options;
+}
+
+void SiftFeatureMatcher::WriteResults(
+    std::vector<MatchResult>* match_results,
+    std::vector<InlierMatchResult>* inlier_match_results) {
+  std::vector<std::pair<image_t, image_t>> match_image_pairs;
+  std::vector<FeatureMatches> matches;
+  match_image_pairs.reserve(match_results->size());
+  matches.reserve(match_results->size());
+  for (auto& result : *match_results) {
+    match_image_pairs.emplace_back(result.image_id1, result.image_id2);
+    matches.push_back(std::move(result.matches));
+    existing_matches_.Insert(result.image_id1, result.image_id2);
+  }
+
+  database_->WriteMatchesBatch(match_image_pairs, matches);
+
+  std::vector<std::pair<image_t, image_t>> inlier_match_image_pairs;
+  std::vector<TwoViewGeometry> two_view_geometries;
+  inlier_match_image_pairs.reserve(inlier_match_results->size());
+  two_view_geometries.reserve(inlier_match_results->size());
+  for (auto& result : *inlier_match_results) {
+    inlier_match_image_pairs.emplace_back(result.image_id1, result.image_id2);
+    two_view_geometries.push_back(std::move(result.two_view_geometry));
+    existing_inlier_matches_.Insert(result.image_id1, result.image_id2);
   }
 
-  for (const auto& result : inlier_match_results) {
-    database_->WriteInlierMatches(result.image_id1, result.image_id2,
-                                  result.two_view_geometry);
+  database_->WriteInlierMatchesBatch(inlier_match_image_pairs,
+                                     two_view_geometries);
+
+  match_results->clear();
+  inlier_match_results->clear();
+}
+
+void SiftFeatureMatcher::Wait() {
+  if (!verification_queue_) {
+    return;
   }
+
+  {
+    std::unique_lock<std::mutex> lock(verification_mutex_);
+    verification_condition_.wait(
+        lock, [this]() { return num_pending_verifications_ == 0; });
+  }
+
+  std::vector<MatchResult> match_results;
+  std::vector<InlierMatchResult> inlier_match_results;
+  CollectVerificationResults(&inlier_match_results);
+  if (!inlier_match_results.empty()) {
+    const std::unique_lock<std::mutex> database_lock = cache_->LockDatabase();
+    DatabaseTransaction database_transaction(database_);
+    WriteResults(&match_results, &inlier_match_results);
+  }
+
+  std::unique_lock<std::mutex> lock(verification_mutex_);
+  std::cout << StringPrintf(
+                   "Matched %d image pairs in %.3fs (%.3fs per pair) with %d "
+                   "threads",
+                   num_matched_pairs_, matching_seconds_,
+                   matching_seconds_ /
+                       std::max(num_matched_pairs_, static_cast<size_t>(1)),
+                   thread_pool_->NumThreads())
+            << std::endl;
+  std::cout << StringPrintf(
+                   "Verified %d image pairs in %.3fs (%.3fs per pair) with %d "
+                   "threads, matching blocked for %.3fs by a full queue",
+                   num_verified_pairs_, verification_seconds_,
+                   verification_seconds_ /
+                       std::max(num_verified_pairs_, static_cast<size_t>(1)),
+                   verification_thread_pool_->NumThreads(),
+                   blocked_matching_seconds_)
+            << std::endl;
+}
+
+bool SiftFeatureMatcher::QueueVerification(
+    const std::pair<image_t, image_t>& image_pair,
+    const GeometricVerificationData& data) {
+  if (!verification_queue_) {
+    return false;
+  }
+
+  VerificationJob job;
+  job.image_id1 = image_pair.first;
+  job.image_id2 = image_pair.second;
+  job.data = data;
+  if (options_.guided_matching) {
+    job.descriptors1 = cache_->GetDescriptors(image_pair.first);
+    job.descriptors2 = cache_->GetDescriptors(image_pair.second);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(verification_mutex_);
+    num_pending_verifications_ += 1;
+  }
+
+  Timer timer;
+  timer.Start();
+  const bool queued = verification_queue_->Push(job);
+
+  std::unique_lock<std::mutex> lock(verification_mutex_);
+  blocked_matching_seconds_ += timer.ElapsedSeconds();
+  if (!queued) {
+    num_pending_verifications_ -= 1;
+    verification_condition_.notify_all();
+  }
+
+  return queued;
+}
+
+void SiftFeatureMatcher::VerificationWorkerFunc() {
+  const size_t min_num_inliers = static_cast<size_t>(options_.min_num_inliers);
+
+  while (true) {
+    auto job = verification_queue_->Pop();
+    if (!job.IsValid()) {
+      break;
+    }
+
+    Timer timer;
+    timer.Start();
+
+    const VerificationJob& data = job.Data();
+
+    InlierMatchResult result;
+    result.image_id1 = data.image_id1;
+    result.image_id2 = data.image_id2;
+    VerifyImagePair(data.data, options_, &result.two_view_geometry);
+
+    if (result.two_view_geometry.inlier_matches.size() >= min_num_inliers &&
+        data.descriptors1 && data.descriptors2) {
+      MatchGuidedSiftFeaturesCPU(options_, *data.data.keypoints1,
+                                 *data.data.keypoints2, *data.descriptors1,
+                                 *data.descriptors2, &result.two_view_geometry);
+      if (result.two_view_geometry.inlier_matches.size() < min_num_inliers) {
+        result.two_view_geometry.inlier_matches = {};
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(verification_mutex_);
+    verification_results_.push_back(std::move(result));
+    num_verified_pairs_ += 1;
+    verification_seconds_ += timer.ElapsedSeconds();
+    num_pending_verifications_ -= 1;
+    verification_condition_.notify_all();
+  }
+}
+
+void SiftFeatureMatcher::CollectVerificationResults(
+    std::vector<InlierMatchResult>* inlier_match_results) {
+  std::unique_lock<std::mutex> lock(verification_mutex_);
+  for (auto& result : verification_results_) {
+    inlier_match_results->push_back(std::move(result));
+  }
+  verification_results_.clear();
 }
 
 void SiftFeatureMatcher::MatchImagePairsWithPreemptiveFilter(
     const size_t preemptive_num_features,
     const size_t preemptive_min_num_matches,
     const std::vector<std::pair<image_t, image_t>>& image_pairs) {
+  CHECK(thread_pool_);
+
   if (image_pairs.empty()) {
     return;
   }
 
-  std::unordered_map<image_t, FeatureDescriptors> top_descriptors;
-
-  image_t prev_image_id1 = kInvalidImageId;
-  image_t prev_image_id2 = kInvalidImageId;
-
   std::unique_ptr<DatabaseTransaction> database_transaction(
       new DatabaseTransaction(database_));
 
-  std::vector<std::pair<image_t, image_t>> filtered_image_pairs;
+  std::vector<std::pair<image_t, image_t>> shard_image_pairs;
+  shard_image_pairs.reserve(image_pairs.size());
   for (const auto image_pair : image_pairs) {
-    if (top_descriptors.count(image_pair.first) == 0) {
-      top_descriptors.emplace(
-          image_pair.first,
-          ExtractTopScaleDescriptors(cache_->GetKeypoints(image_pair.first),
-                                     cache_->GetDescriptors(image_pair.first),
-                                     preemptive_num_features));
-    }
-    if (top_descriptors.count(image_pair.second) == 0) {
-      top_descriptors.emplace(
-          image_pair.second,
-          ExtractTopScaleDescriptors(cache_->GetKeypoints(image_pair.second),
-                                     cache_->GetDescriptors(image_pair.second),
-                                     preemptive_num_features));
-    }
-
-    FeatureMatches preemptive_matches;
-    if (options_.use_gpu) {
-      const FeatureDescriptors* descriptors1_ptr = nullptr;
+    // Skip image pairs that are matched by other shards.
+    if (options_.num_shards > 1 &&
+        !IsImagePairInShard(image_pair.first, image_pair.second,
+                            options_.num_shards, options_.shard_index)) {
+      continue;
+    }
+    shard_image_pairs.push_back(image_pair);
+  }
+
+  std::vector<std::pair<image_t, image_t>> filtered_image_pairs;
+
+  if (options_.use_gpu) {
+    image_t prev_image_id1 = kInvalidImageId;
+    image_t prev_image_id2 = kInvalidImageId;
+
+    for (const auto image_pair : shard_image_pairs) {
+      // Only upload the descriptors to the GPU, if the image changed.
+      std::shared_ptr<const FeatureDescriptors> descriptors1;
       if (image_pair.first != prev_image_id1) {
-        descriptors1_ptr = &top_descriptors.at(image_pair.first);
+        descriptors1 = cache_->GetTopScaleDescriptors(
+            image_pair.first, static_cast<int>(preemptive_num_features));
         prev_image_id1 = image_pair.first;
       }
 
-      const FeatureDescriptors* descriptors2_ptr = nullptr;
+      std::shared_ptr<const FeatureDescriptors> descriptors2;
       if (image_pair.second != prev_image_id2) {
-        descriptors2_ptr = &top_descriptors.at(image_pair.second);
+        descriptors2 = cache_->GetTopScaleDescriptors(
+            image_pair.second, static_cast<int>(preemptive_num_features));
         prev_image_id2 = image_pair.second;
       }
-      MatchSiftFeaturesGPU(options_, descriptors1_ptr, descriptors2_ptr,
+
+      FeatureMatches preemptive_matches;
+      MatchSiftFeaturesGPU(options_, descriptors1.get(), descriptors2.get(),
                            sift_match_gpu_.get(), &preemptive_matches);
-    } else {
-      MatchSiftFeaturesCPU(options_, top_descriptors.at(image_pair.first),
-                           top_descriptors.at(image_pair.second),
-                           &preemptive_matches);
+
+      if (preemptive_matches.size() >= preemptive_min_num_matches) {
+        filtered_image_pairs.push_back(image_pair);
+      }
+    }
+  } else {
+    std::vector<std::future<bool>> futures;
+    futures.reserve(shard_image_pairs.size());
+    for (const auto image_pair : shard_image_pairs) {
+      futures.push_back(thread_pool_->AddTask([this, preemptive_num_features,
+                                               preemptive_min_num_matches,
+                                               image_pair]() {
+        const std::shared_ptr<const FeatureDescriptors> descriptors1 =
+            cache_->GetTopScaleDescriptors(
+                image_pair.first, static_cast<int>(preemptive_num_features));
+        const std::shared_ptr<const FeatureDescriptors> descriptors2 =
+            cache_->GetTopScaleDescriptors(
+                image_pair.second, static_cast<int>(preemptive_num_features));
+        FeatureMatches preemptive_matches;
+        MatchSiftFeaturesCPU(options_, *descriptors1, *descriptors2,
+                             &preemptive_matches);
+        return preemptive_matches.size() >= preemptive_min_num_matches;
+      }));
     }
 
-    if (preemptive_matches.size() >= preemptive_min_num_matches) {
-      filtered_image_pairs.push_back(image_pair);
+    for (size_t i = 0; i < shard_image_pairs.size(); ++i) {
+      if (futures[i].get()) {
+        filtered_image_pairs.push_back(shard_image_pairs[i]);
+      }
     }
   }
 
@@ -563,24 +1708,15 @@ void SiftFeatureMatcher::MatchImagePairsCPU(
     std::vector<InlierMatchResult>* inlier_match_results) {
   CHECK_EQ(image_pairs.size(), exists_mask.size());
 
-  const size_t min_num_inliers = static_cast<size_t>(options_.min_num_inliers);
-
-  TwoViewGeometry::Options two_view_geometry_options;
-  two_view_geometry_options.min_num_inliers =
-      static_cast<size_t>(options_.min_num_inliers);
-  two_view_geometry_options.ransac_options.max_error = options_.max_error;
-  two_view_geometry_options.ransac_options.confidence = options_.confidence;
-  two_view_geometry_options.ransac_options.max_num_trials =
-      static_cast<size_t>(options_.max_num_trials);
-  two_view_geometry_options.ransac_options.min_inlier_ratio =
-      options_.min_inlier_ratio;
+  const TwoViewGeometry::Options two_view_geometry_options =
+      GetTwoViewGeometryOptions();
 
   match_results->clear();
   match_results->reserve(image_pairs.size());
   inlier_match_results->clear();
   inlier_match_results->reserve(image_pairs.size());
 
-  std::vector<std::future<void>> futures;
+  std::vector<std::future<bool>> futures;
   futures.reserve(image_pairs.size());
   std::vector<FeatureMatches> match_results_raw;
   match_results_raw.reserve(image_pairs.size());
@@ -597,62 +1733,13 @@ void SiftFeatureMatcher::MatchImagePairsCPU(
     FeatureMatches* matches_ptr = &match_results_raw.back();
     TwoViewGeometry* inlier_matches_ptr = &inlier_match_results_raw.back();
 
-    futures.push_back(thread_pool_->AddTask([this, &min_num_inliers,
-                                             &two_view_geometry_options, exists,
-                                             image_pair, matches_ptr,
-                                             inlier_matches_ptr]() {
-      if (exists.first && exists.second) {
-        return;
-      }
-
-      // Feature matching
-
-      if (exists.first) {
-        *matches_ptr = cache_->GetMatches(image_pair.first, image_pair.second);
-      } else {
-        const FeatureDescriptors descriptors1 =
-            cache_->GetDescriptors(image_pair.first);
-        const FeatureDescriptors descriptors2 =
-            cache_->GetDescriptors(image_pair.second);
-        MatchSiftFeaturesCPU(options_, descriptors1, descriptors2, matches_ptr);
-        if (matches_ptr->size() < min_num_inliers) {
-          *matches_ptr = {};
-        }
-      }
-
-      // Geometric verification.
-
-      if (!exists.second && matches_ptr->size() >= min_num_inliers) {
-        GeometricVerificationData data;
-        data.camera1 =
-            cache_->GetCamera(cache_->GetImage(image_pair.first).CameraId());
-        data.camera2 =
-            cache_->GetCamera(cache_->GetImage(image_pair.second).CameraId());
-        data.keypoints1 = cache_->GetKeypoints(image_pair.first);
-        data.keypoints2 = cache_->GetKeypoints(image_pair.second);
-        data.matches = *matches_ptr;
-        data.options = two_view_geometry_options;
-        VerifyImagePair(data, options_, inlier_matches_ptr);
-      }
-
-      if (inlier_matches_ptr->inlier_matches.size() >= min_num_inliers &&
-          options_.guided_matching) {
-        const FeatureKeypoints keypoints1 =
-            cache_->GetKeypoints(image_pair.first);
-        const FeatureKeypoints keypoints2 =
-            cache_->GetKeypoints(image_pair.second);
-        const FeatureDescriptors descriptors1 =
-            cache_->GetDescriptors(image_pair.first);
-        const FeatureDescriptors descriptors2 =
-            cache_->GetDescriptors(image_pair.second);
-        MatchGuidedSiftFeaturesCPU(options_, keypoints1, keypoints2,
-                                   descriptors1, descriptors2,
+    futures.push_back(thread_pool_->AddTask(
+        [this, &two_view_geometry_options, exists, image_pair, matches_ptr,
+         inlier_matches_ptr]() {
+          return MatchImagePairCPU(image_pair, exists,
+                                   two_view_geometry_options, matches_ptr,
                                    inlier_matches_ptr);
-        if (inlier_matches_ptr->inlier_matches.size() < min_num_inliers) {
-          inlier_matches_ptr->inlier_matches = {};
-        }
-      }
-    }));
+        }));
   }
 
   CHECK_EQ(image_pairs.size(), futures.size());
@@ -667,7 +1754,7 @@ void SiftFeatureMatcher::MatchImagePairsCPU(
 
     const auto& image_pair = image_pairs[i];
 
-    futures[i].get();
+    const bool verification_queued = futures[i].get();
 
     if (!exists.first) {
       MatchResult match_result;
@@ -677,7 +1764,10 @@ void SiftFeatureMatcher::MatchImagePairsCPU(
       match_results->push_back(match_result);
     }
 
-    if (!exists.second) {
+    if (verification_queued) {
+      // Avoid verifying the image pair twice, before its result is written.
+      existing_inlier_matches_.Insert(image_pair.first, image_pair.second);
+    } else if (!exists.second) {
       InlierMatchResult inlier_match_result;
       inlier_match_result.image_id1 = image_pair.first;
       inlier_match_result.image_id2 = image_pair.second;
@@ -687,6 +1777,93 @@ void SiftFeatureMatcher::MatchImagePairsCPU(
   }
 }
 
+bool SiftFeatureMatcher::MatchImagePairCPU(
+    const std::pair<image_t, image_t>& image_pair,
+    const std::pair<bool, bool>& exists,
+    const TwoViewGeometry::Options& two_view_geometry_options,
+    FeatureMatches* matches_ptr, TwoViewGeometry* inlier_matches_ptr) {
+  const size_t min_num_inliers = static_cast<size_t>(options_.min_num_inliers);
+
+  if (exists.first && exists.second) {
+    return false;
+  }
+
+  // Feature matching
+
+  if (exists.first) {
+    *matches_ptr = cache_->GetMatches(image_pair.first, image_pair.second);
+  } else {
+    Timer timer;
+    timer.Start();
+    if (options_.cpu_kd_forest) {
+      const std::shared_ptr<const SiftDescriptorIndex> index1 =
+          cache_->GetDescriptorIndex(image_pair.first,
+                                     options_.cpu_kd_forest_num_trees);
+      const std::shared_ptr<const SiftDescriptorIndex> index2 =
+          cache_->GetDescriptorIndex(image_pair.second,
+                                     options_.cpu_kd_forest_num_trees);
+      MatchSiftFeaturesCPUKDForest(options_, *index1, *index2, matches_ptr);
+    } else if (options_.cpu_cascade_hashing) {
+      const std::shared_ptr<const SiftCascadeHashingIndex> index1 =
+          cache_->GetCascadeHashingIndex(image_pair.first);
+      const std::shared_ptr<const SiftCascadeHashingIndex> index2 =
+          cache_->GetCascadeHashingIndex(image_pair.second);
+      MatchSiftFeaturesCPUCascadeHashing(options_, *index1, *index2,
+                                         matches_ptr);
+    } else {
+      const std::shared_ptr<const FeatureDescriptors> descriptors1 =
+          cache_->GetDescriptors(image_pair.first);
+      const std::shared_ptr<const FeatureDescriptors> descriptors2 =
+          cache_->GetDescriptors(image_pair.second);
+      MatchSiftFeaturesCPU(options_, *descriptors1, *descriptors2, matches_ptr);
+    }
+    if (matches_ptr->size() < min_num_inliers) {
+      *matches_ptr = {};
+    }
+    std::unique_lock<std::mutex> lock(verification_mutex_);
+    num_matched_pairs_ += 1;
+    matching_seconds_ += timer.ElapsedSeconds();
+  }
+
+  // Geometric verification.
+
+  if (!exists.second && matches_ptr->size() >= min_num_inliers) {
+    GeometricVerificationData data;
+    data.camera1 =
+        cache_->GetCamera(cache_->GetImage(image_pair.first).CameraId());
+    data.camera2 =
+        cache_->GetCamera(cache_->GetImage(image_pair.second).CameraId());
+    data.keypoints1 = cache_->GetKeypoints(image_pair.first);
+    data.keypoints2 = cache_->GetKeypoints(image_pair.second);
+    data.matches = *matches_ptr;
+    data.options = two_view_geometry_options;
+    if (QueueVerification(image_pair, data)) {
+      return true;
+    }
+    VerifyImagePair(data, options_, inlier_matches_ptr);
+  }
+
+  if (inlier_matches_ptr->inlier_matches.size() >= min_num_inliers &&
+      options_.guided_matching) {
+    const std::shared_ptr<const FeatureKeypoints> keypoints1 =
+        cache_->GetKeypoints(image_pair.first);
+    const std::shared_ptr<const FeatureKeypoints> keypoints2 =
+        cache_->GetKeypoints(image_pair.second);
+    const std::shared_ptr<const FeatureDescriptors> descriptors1 =
+        cache_->GetDescriptors(image_pair.first);
+    const std::shared_ptr<const FeatureDescriptors> descriptors2 =
+        cache_->GetDescriptors(image_pair.second);
+    MatchGuidedSiftFeaturesCPU(options_, *keypoints1, *keypoints2,
+                               *descriptors1, *descriptors2,
+                               inlier_matches_ptr);
+    if (inlier_matches_ptr->inlier_matches.size() < min_num_inliers) {
+      inlier_matches_ptr->inlier_matches = {};
+    }
+  }
+
+  return false;
+}
+
 void SiftFeatureMatcher::MatchImagePairsGPU(
     const std::vector<std::pair<image_t, image_t>>& image_pairs,
     const std::vector<std::pair<bool, bool>>& exists_mask,
@@ -711,15 +1888,8 @@ void SiftFeatureMatcher::MatchImagePairsGPU(
   std::vector<std::pair<image_t, image_t>> verification_image_pairs;
   verification_image_pairs.reserve(image_pairs.size());
 
-  TwoViewGeometry::Options two_view_geometry_options;
-  two_view_geometry_options.min_num_inliers =
-      static_cast<size_t>(options_.min_num_inliers);
-  two_view_geometry_options.ransac_options.max_error = options_.max_error;
-  two_view_geometry_options.ransac_options.confidence = options_.confidence;
-  two_view_geometry_options.ransac_options.max_num_trials =
-      static_cast<size_t>(options_.max_num_trials);
-  two_view_geometry_options.ransac_options.min_inlier_ratio =
-      options_.min_inlier_ratio;
+  const TwoViewGeometry::Options two_view_geometry_options =
+      GetTwoViewGeometryOptions();
 
   for (size_t i = 0; i < image_pairs.size(); ++i) {
     const auto exists = exists_mask[i];
@@ -744,6 +1914,9 @@ void SiftFeatureMatcher::MatchImagePairsGPU(
       // matches. We just need them for geometric verification.
       match_result.matches = cache_->GetMatches(image_id1, image_id2);
     } else {
+      Timer timer;
+      timer.Start();
+
       const FeatureDescriptors* descriptors1_ptr;
       GetGPUDescriptors(0, image_id1, &descriptors1_ptr);
       const FeatureDescriptors* descriptors2_ptr;
@@ -756,6 +1929,12 @@ void SiftFeatureMatcher::MatchImagePairsGPU(
         match_result.matches = {};
       }
 
+      {
+        std::unique_lock<std::mutex> lock(verification_mutex_);
+        num_matched_pairs_ += 1;
+        matching_seconds_ += timer.ElapsedSeconds();
+      }
+
       match_results->push_back(match_result);
     }
 
@@ -775,6 +1954,12 @@ void SiftFeatureMatcher::MatchImagePairsGPU(
         data.matches = match_result.matches;
         data.options = two_view_geometry_options;
 
+        if (QueueVerification(image_pair, data)) {
+          // Avoid verifying the image pair twice, before its result is written.
+          existing_inlier_matches_.Insert(image_id1, image_id2);
+          continue;
+        }
+
         verification_image_pairs.push_back(image_pair);
         verification_results.emplace_back();
 
@@ -839,8 +2024,8 @@ void SiftFeatureMatcher::VerifyImagePair(const GeometricVerificationData data,
                                          TwoViewGeometry* two_view_geometry) {
   *two_view_geometry = TwoViewGeometry();
 
-  const auto points1 = FeatureKeypointsToPointsVector(data.keypoints1);
-  const auto points2 = FeatureKeypointsToPointsVector(data.keypoints2);
+  const auto points1 = FeatureKeypointsToPointsVector(*data.keypoints1);
+  const auto points2 = FeatureKeypointsToPointsVector(*data.keypoints2);
 
   if (options.multiple_models) {
     two_view_geometry->EstimateMultiple(data.camera1, points1, data.camera2,
@@ -867,7 +2052,7 @@ void SiftFeatureMatcher::GetGPUKeypoints(
     *keypoints_ptr = nullptr;
   } else {
     prev_uploaded_keypoints_[index] = cache_->GetKeypoints(image_id);
-    *keypoints_ptr = &prev_uploaded_keypoints_[index];
+    *keypoints_ptr = prev_uploaded_keypoints_[index].get();
   }
 }
 
@@ -880,7 +2065,7 @@ void SiftFeatureMatcher::GetGPUDescriptors(
     *descriptors_ptr = nullptr;
   } else {
     prev_uploaded_descriptors_[index] = cache_->GetDescriptors(image_id);
-    *descriptors_ptr = &prev_uploaded_descriptors_[index];
+    *descriptors_ptr = prev_uploaded_descriptors_[index].get();
     prev_uploaded_image_ids_[index] = image_id;
   }
 }
@@ -903,7 +2088,10 @@ ExhaustiveFeatureMatcher::ExhaustiveFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(2 * options_.block_size, &database_),
+      cache_(3 * options_.block_size, &database_,
+             FeatureStore::DefaultPath(database_path),
+             match_options.num_threads,
+             CacheSizeBytes(match_options)),
       matcher_(match_options, &database_, &cache_) {
   options_.Check();
   match_options_.Check();
@@ -918,6 +2106,28 @@ void ExhaustiveFeatureMatcher::Run() {
 
   const std::vector<image_t> image_ids = cache_.GetImageIds();
 
+  // On the CPU, stream the image pairs along a Hilbert curve over the pair
+  // matrix to the workers instead of matching block by block.
+  if (!match_options_.use_gpu && !options_.preemptive) {
+    HilbertImagePairOrder image_pair_order(image_ids.size());
+    matcher_.MatchImagePairsStreamed(
+        image_pair_order.NumPairs(),
+        [this, &image_ids,
+         &image_pair_order](std::pair<image_t, image_t>* image_pair) {
+          size_t idx1;
+          size_t idx2;
+          if (IsStopped() || !image_pair_order.Next(&idx1, &idx2)) {
+            return false;
+          }
+          image_pair->first = image_ids[idx1];
+          image_pair->second = image_ids[idx2];
+          return true;
+        });
+    matcher_.Wait();
+    GetTimer().PrintMinutes();
+    return;
+  }
+
   const size_t block_size = static_cast<size_t>(options_.block_size);
   const size_t num_blocks = static_cast<size_t>(
       std::ceil(static_cast<double>(image_ids.size()) / block_size));
@@ -933,6 +2143,7 @@ void ExhaustiveFeatureMatcher::Run() {
           std::min(image_ids.size(), start_idx2 + block_size) - 1;
 
       if (IsStopped()) {
+        matcher_.Wait();
         GetTimer().PrintMinutes();
         return;
       }
@@ -959,6 +2170,25 @@ void ExhaustiveFeatureMatcher::Run() {
         }
       }
 
+      // Load the images of the next block while matching the current block.
+      size_t next_start_idx1 = start_idx1;
+      size_t next_start_idx2 = start_idx2 + block_size;
+      if (next_start_idx2 >= image_ids.size()) {
+        next_start_idx1 += block_size;
+        next_start_idx2 = 0;
+      }
+      if (next_start_idx1 < image_ids.size()) {
+        std::vector<image_t> prefetch_image_ids;
+        for (const size_t next_start_idx : {next_start_idx1, next_start_idx2}) {
+          const size_t next_end_idx =
+              std::min(image_ids.size(), next_start_idx + block_size);
+          prefetch_image_ids.insert(prefetch_image_ids.end(),
+                                    image_ids.begin() + next_start_idx,
+                                    image_ids.begin() + next_end_idx);
+        }
+        cache_.Prefetch(prefetch_image_ids);
+      }
+
       if (options_.preemptive) {
         matcher_.MatchImagePairsWithPreemptiveFilter(
             options_.preemptive_num_features,
@@ -971,6 +2201,7 @@ void ExhaustiveFeatureMatcher::Run() {
     }
   }
 
+  matcher_.Wait();
   GetTimer().PrintMinutes();
 }
 
@@ -992,7 +2223,9 @@ SequentialFeatureMatcher::SequentialFeatureMatcher(
       database_(database_path),
       cache_(std::max(5 * options_.loop_detection_num_images,
                       5 * options_.overlap),
-             &database_),
+             &database_, FeatureStore::DefaultPath(database_path),
+             match_options.num_threads,
+             CacheSizeBytes(match_options)),
       matcher_(match_options, &database_, &cache_) {
   options_.Check();
   match_options_.Check();
@@ -1012,6 +2245,7 @@ void SequentialFeatureMatcher::Run() {
     RunLoopDetection(ordered_image_ids);
   }
 
+  matcher_.Wait();
   GetTimer().PrintMinutes();
 }
 
@@ -1058,6 +2292,11 @@ void SequentialFeatureMatcher::RunSequentialMatching(
       image_pairs.emplace_back(image_ids[i], image_ids[j]);
     }
 
+    // Load the image that is first matched in the next iteration.
+    if (max_image_idx < image_ids.size()) {
+      cache_.Prefetch({image_ids[max_image_idx]});
+    }
+
     matcher_.MatchImagePairs(image_pairs);
 
     PrintElapsedTime(timer);
@@ -1102,7 +2341,10 @@ VocabTreeFeatureMatcher::VocabTreeFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.num_images, &database_),
+      cache_(5 * options_.num_images, &database_,
+             FeatureStore::DefaultPath(database_path),
+             match_options.num_threads,
+             CacheSizeBytes(match_options)),
       matcher_(match_options, &database_, &cache_) {
   options_.Check();
   match_options_.Check();
@@ -1157,6 +2399,7 @@ void VocabTreeFeatureMatcher::Run() {
                            &database_, &cache_, &visual_index);
 
   if (IsStopped()) {
+    matcher_.Wait();
     GetTimer().PrintMinutes();
     return;
   }
@@ -1167,6 +2410,7 @@ void VocabTreeFeatureMatcher::Run() {
                                      options_.max_num_features, image_ids, this,
                                      &cache_, &visual_index, &matcher_);
 
+  matcher_.Wait();
   GetTimer().PrintMinutes();
 }
 
@@ -1181,7 +2425,10 @@ SpatialFeatureMatcher::SpatialFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.max_num_neighbors, &database_),
+      cache_(5 * options_.max_num_neighbors, &database_,
+             FeatureStore::DefaultPath(database_path),
+             match_options.num_threads,
+             CacheSizeBytes(match_options)),
       matcher_(match_options, &database_, &cache_) {
   options_.Check();
   match_options_.Check();
@@ -1255,6 +2502,7 @@ void SpatialFeatureMatcher::Run() {
 
   if (num_locations == 0) {
     std::cout << " => No images with location data." << std::endl;
+    matcher_.Wait();
     GetTimer().PrintMinutes();
     return;
   }
@@ -1318,6 +2566,7 @@ void SpatialFeatureMatcher::Run() {
 
   for (size_t i = 0; i < num_locations; ++i) {
     if (IsStopped()) {
+      matcher_.Wait();
       GetTimer().PrintMinutes();
       return;
     }
@@ -1351,6 +2600,7 @@ void SpatialFeatureMatcher::Run() {
     PrintElapsedTime(timer);
   }
 
+  matcher_.Wait();
   GetTimer().PrintMinutes();
 }
 
@@ -1365,7 +2615,10 @@ ImagePairsFeatureMatcher::ImagePairsFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(options.block_size, &database_),
+      cache_(options.block_size, &database_,
+             FeatureStore::DefaultPath(database_path),
+             match_options.num_threads,
+             CacheSizeBytes(match_options)),
       matcher_(match_options, &database_, &cache_) {
   options_.Check();
   match_options_.Check();
@@ -1436,6 +2689,7 @@ void ImagePairsFeatureMatcher::Run() {
 
   for (size_t i = 0; i < image_pairs.size(); i += options_.block_size) {
     if (IsStopped()) {
+      matcher_.Wait();
       GetTimer().PrintMinutes();
       return;
     }
@@ -1461,6 +2715,7 @@ void ImagePairsFeatureMatcher::Run() {
     PrintElapsedTime(timer);
   }
 
+  matcher_.Wait();
   GetTimer().PrintMinutes();
 }
 
@@ -1474,7 +2729,9 @@ FeaturePairsFeatureMatcher::FeaturePairsFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(kCacheSize, &database_) {
+      cache_(kCacheSize, &database_,
+             FeatureStore::DefaultPath(database_path),
+             match_options.num_threads, CacheSizeBytes(match_options)) {
   options_.Check();
   match_options_.Check();
 }
@@ -1591,8 +2848,8 @@ void FeaturePairsFeatureMatcher::Run() {
           match_options_.min_inlier_ratio;
 
       two_view_geometry.Estimate(
-          camera1, FeatureKeypointsToPointsVector(keypoints1), camera2,
-          FeatureKeypointsToPointsVector(keypoints2), matches,
+          camera1, FeatureKeypointsToPointsVector(*keypoints1), camera2,
+          FeatureKeypointsToPointsVector(*keypoints2), matches,
           two_view_geometry_options);
 
       database_.WriteInlierMatches(image1.ImageId(), image2.ImageId(),
@@ -1623,10 +2880,8 @@ void MatchSiftFeaturesCPU(const SiftMatchOptions& match_options,
   match_options.Check();
   CHECK_NOTNULL(matches);
 
-  const Eigen::MatrixXi dists = ComputeSiftDistanceMatrix(
-      nullptr, nullptr, descriptors1, descriptors2, nullptr);
-
-  FindBestMatches(dists, match_options.max_ratio, match_options.max_distance,
+  FindBestMatches(nullptr, nullptr, descriptors1, descriptors2, nullptr,
+                  match_options.max_ratio, match_options.max_distance,
                   match_options.cross_check, matches);
 }
 
@@ -1673,14 +2928,58 @@ void MatchGuidedSiftFeaturesCPU(const SiftMatchOptions& match_options,
 
   CHECK(guided_filter);
 
-  const Eigen::MatrixXi dists = ComputeSiftDistanceMatrix(
-      &keypoints1, &keypoints2, descriptors1, descriptors2, guided_filter);
-
-  FindBestMatches(dists, match_options.max_ratio, match_options.max_distance,
-                  match_options.cross_check,
+  FindBestMatches(&keypoints1, &keypoints2, descriptors1, descriptors2,
+                  guided_filter, match_options.max_ratio,
+                  match_options.max_distance, match_options.cross_check,
                   &two_view_geometry->inlier_matches);
 }
 
+void MatchSiftFeaturesCPUKDForest(const SiftMatchOptions& match_options,
+                                  const SiftDescriptorIndex& index1,
+                                  const SiftDescriptorIndex& index2,
+                                  FeatureMatches* matches) {
+  match_options.Check();
+  CHECK_NOTNULL(matches);
+
+  std::vector<BestMatch> best_matches12;
+  SearchBestSiftMatches(index2, index1.Descriptors(),
+                        match_options.cpu_kd_forest_checks, &best_matches12);
+
+  std::vector<BestMatch> best_matches21;
+  if (match_options.cross_check) {
+    SearchBestSiftMatches(index1, index2.Descriptors(),
+                          match_options.cpu_kd_forest_checks, &best_matches21);
+  }
+
+  FindBestMatches(best_matches12, best_matches21, match_options.max_ratio,
+                  match_options.max_distance, match_options.cross_check,
+                  matches);
+}
+
+void MatchSiftFeaturesCPUCascadeHashing(
+    const SiftMatchOptions& match_options,
+    const SiftCascadeHashingIndex& index1,
+    const SiftCascadeHashingIndex& index2, FeatureMatches* matches) {
+  match_options.Check();
+  CHECK_NOTNULL(matches);
+
+  std::vector<BestMatch> best_matches12;
+  SearchBestSiftMatches(index2, index1,
+                        match_options.cpu_cascade_hashing_num_candidates,
+                        &best_matches12);
+
+  std::vector<BestMatch> best_matches21;
+  if (match_options.cross_check) {
+    SearchBestSiftMatches(index1, index2,
+                          match_options.cpu_cascade_hashing_num_candidates,
+                          &best_matches21);
+  }
+
+  FindBestMatches(best_matches12, best_matches21, match_options.max_ratio,
+                  match_options.max_distance, match_options.cross_check,
+                  matches);
+}
+
 bool CreateSiftGPUMatcher(const SiftMatchOptions& match_options,
                           SiftMatchGPU* sift_match_gpu) {
   match_options.Check();
@@ -18,11 +18,16 @@
 #define COLMAP_SRC_BASE_FEATURE_MATCHING_H_
 
 #include <array>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "base/database.h"
+#include "base/database_reader_pool.h"
+#include "base/feature_store.h"
+#include "ext/FLANN/flann.hpp"
 #include "ext/SiftGPU/SiftGPU.h"
 #include "util/alignment.h"
 #include "util/cache.h"
@@ -36,6 +41,13 @@ struct SiftMatchOptions {
   // Number of threads for feature matching and geometric verification.
   int num_threads = ThreadPool::kMaxNumThreads;
 
+  // Number of threads for geometric verification in a separate stage, which
+  // verifies the matched image pairs while the next image pairs are matched.
+  // The matching threads hand over the matches through a bounded queue and
+  // block when it is full. If zero, the image pairs are verified in the
+  // matching threads. Not supported for guided matching on the GPU.
+  int num_verification_threads = 0;
+
   // Whether to use the GPU for feature matching.
   bool use_gpu = true;
 
@@ -79,29 +91,243 @@ struct SiftMatchOptions {
   // Whether to perform guided matching, if geometric verification succeeds.
   bool guided_matching = false;
 
+  // Whether to use approximate nearest neighbor search in the CPU version.
+  // The descriptors of each image are indexed once in a randomized kd-forest,
+  // which is cached and queried by the descriptors of all images it is
+  // matched against, instead of comparing all descriptors of each pair.
+  bool cpu_kd_forest = false;
+
+  // Number of randomized kd-trees per image and number of leaves checked per
+  // query descriptor. Larger values are more accurate but slower.
+  int cpu_kd_forest_num_trees = 4;
+  int cpu_kd_forest_checks = 128;
+
+  // Whether to use cascade hashing in the CPU version, which cannot be
+  // combined with the kd-forest. The descriptors of each image are hashed once
+  // to binary codes, which are cached. Only descriptors sharing a hash bucket
+  // with the query are ranked by the Hamming distance of their codes, and the
+  // given number of best candidates are compared by their exact distance.
+  bool cpu_cascade_hashing = false;
+  int cpu_cascade_hashing_num_candidates = 10;
+
+  // Maximum memory of the cached features in megabytes. If zero, the cache
+  // holds the features of a fixed number of images, which depends on the
+  // matching mode, e.g., two blocks in exhaustive matching.
+  int cache_size_mb = 0;
+
+  // Distribute the matching of a project over multiple processes or machines.
+  // Each process only matches the image pairs assigned to its shard and writes
+  // the results to its own copy of the database. The shards are afterwards
+  // merged into the original database with the `database_merger`.
+  int num_shards = 1;
+  int shard_index = 0;
+
   void Check() const;
 };
 
+// Check whether an image pair is assigned to the given shard, when all image
+// pairs are evenly distributed over the given number of shards.
+bool IsImagePairInShard(const image_t image_id1, const image_t image_id2,
+                        const int num_shards, const int shard_index);
+
+// Enumerates all pairs of indices (idx1, idx2) with idx1 < idx2 < num_indices
+// along a generalized Hilbert curve over the pair matrix, which fills matrices
+// of any size. Consecutive pairs share their indices much more often than in
+// row-wise order, so that the pairs enumerated in any interval involve a small
+// number of distinct indices.
+class HilbertImagePairOrder {
+ public:
+  explicit HilbertImagePairOrder(const size_t num_indices);
+
+  // The total number of pairs.
+  size_t NumPairs() const;
+
+  // Get the next pair or return false if all pairs were enumerated.
+  bool Next(size_t* idx1, size_t* idx2);
+
+ private:
+  size_t num_indices_;
+  // Distance along the curve of the next cell of the pair matrix.
+  int64_t curve_idx_;
+};
+
+// Compact set of image pairs, in which the order of the two images of a pair
+// does not matter. Pairs between images with identifiers up to the given
+// maximum are stored as bits of a triangular matrix, e.g., 25MB for 20K
+// images, and all other pairs are stored in a hash set.
+class ImagePairSet {
+ public:
+  explicit ImagePairSet(const image_t max_image_id = 0);
+
+  size_t Size() const;
+
+  bool Exists(const image_t image_id1, const image_t image_id2) const;
+
+  void Insert(const image_t image_id1, const image_t image_id2);
+
+ private:
+  // Maximum image identifier for which the bitmap is used, which limits the
+  // size of the bitmap to 256MB.
+  static const image_t kMaxBitmapImageId;
+
+  // Index of the image pair in the bitmap or -1 if not in the bitmap.
+  int64_t BitmapIndex(const image_t image_id1, const image_t image_id2) const;
+
+  image_t max_image_id_;
+  std::vector<bool> bitmap_;
+  std::unordered_set<image_pair_t> pair_ids_;
+  size_t num_pairs_;
+};
+
+// Randomized kd-forest of the SIFT descriptors of one image for approximate
+// nearest neighbor matching on the CPU. The index keeps a copy of the
+// descriptors and can be queried concurrently from multiple threads.
+class SiftDescriptorIndex {
+ public:
+  SiftDescriptorIndex(const FeatureDescriptors& descriptors,
+                      const int num_trees);
+
+  const FeatureDescriptors& Descriptors() const;
+
+  // Approximate memory usage of the index including its descriptors.
+  size_t NumBytes() const;
+
+  // Find the indices of the two approximate nearest neighbors of each query
+  // descriptor, or only one neighbor if the index has a single descriptor,
+  // by checking the given number of leaves of the kd-forest.
+  void Search(const FeatureDescriptors& query_descriptors, const int num_checks,
+              Eigen::Matrix<size_t, Eigen::Dynamic, Eigen::Dynamic,
+                            Eigen::RowMajor>* indices) const;
+
+ private:
+  NON_COPYABLE(SiftDescriptorIndex)
+  NON_MOVABLE(SiftDescriptorIndex)
+
+  const FeatureDescriptors descriptors_;
+  std::unique_ptr<flann::KDTreeIndex<flann::L2<uint8_t>>> index_;
+};
+
+// Cascade hashing of the SIFT descriptors of one image for approximate nearest
+// neighbor matching on the CPU, as described in "Fast and Accurate Image
+// Matching with Cascade Hashing for 3D Reconstruction", Cheng et al., CVPR
+// 2014. The descriptors are projected to binary codes for Hamming distance
+// ranking and to the hash buckets of multiple bucket groups.
+class SiftCascadeHashingIndex {
+ public:
+  explicit SiftCascadeHashingIndex(const FeatureDescriptors& descriptors);
+
+  const FeatureDescriptors& Descriptors() const;
+
+  // Approximate memory usage of the index including its descriptors.
+  size_t NumBytes() const;
+
+  // Find the candidate matches in this index for each descriptor of the query
+  // index. The candidates share at least one bucket with the query and are the
+  // given number of descriptors with the smallest Hamming distance to the
+  // query. The candidates of each query are sorted by their index.
+  void Search(const SiftCascadeHashingIndex& query_index,
+              const int num_candidates,
+              std::vector<std::vector<int>>* candidate_idxs) const;
+
+ private:
+  NON_COPYABLE(SiftCascadeHashingIndex)
+  NON_MOVABLE(SiftCascadeHashingIndex)
+
+  static const int kNumCodeBits = 128;
+  static const int kNumBucketGroups = 6;
+  static const int kNumBucketBits = 8;
+
+  const FeatureDescriptors descriptors_;
+  std::vector<std::array<uint64_t, kNumCodeBits / 64>> codes_;
+  std::vector<std::array<uint8_t, kNumBucketGroups>> bucket_ids_;
+  // Descriptor indices in each bucket of each bucket group.
+  std::vector<std::vector<int>> buckets_;
+};
+
 // Cache for feature matching to minimize database access during matching.
+// If a consistent feature store exists at the given path, the features are
+// copied from the memory-mapped store instead of decoded from the database.
+// With multiple readers, cache misses are loaded concurrently through a pool
+// of read-only connections to the database file. Otherwise, and for in-memory
+// databases, all reads are serialized on the given connection.
+//
+// The cache is thread-safe and hands out shared pointers to its immutable
+// features, which remain valid after they are evicted, so that callers do not
+// need to copy them. The cache holds the features of the given number of
+// images or, if a maximum number of bytes is given, as many features as fit
+// into this memory budget.
 class FeatureMatcherCache {
  public:
-  FeatureMatcherCache(const size_t cache_size, const Database* database);
+  FeatureMatcherCache(const size_t cache_size, const Database* database,
+                      const std::string& feature_store_path = "",
+                      const int num_readers = 1,
+                      const size_t max_num_bytes = 0);
 
   const Camera& GetCamera(const camera_t camera_id) const;
   const Image& GetImage(const image_t image_id) const;
-  const FeatureKeypoints& GetKeypoints(const image_t image_id);
-  const FeatureDescriptors& GetDescriptors(const image_t image_id);
+  std::shared_ptr<const FeatureKeypoints> GetKeypoints(const image_t image_id);
+  std::shared_ptr<const FeatureDescriptors> GetDescriptors(
+      const image_t image_id);
   FeatureMatches GetMatches(const image_t image_id1, const image_t image_id2);
 
+  // Get the descriptor index of the image, which is built from its descriptors
+  // with the given number of trees when it is not yet cached. Indices with
+  // different numbers of trees are cached separately.
+  std::shared_ptr<const SiftDescriptorIndex> GetDescriptorIndex(
+      const image_t image_id, const int num_trees);
+
+  // Get the cascade hashing index of the image.
+  std::shared_ptr<const SiftCascadeHashingIndex> GetCascadeHashingIndex(
+      const image_t image_id);
+
+  // Get the descriptors of the image with the largest scale, e.g., for
+  // preemptive matching. Since they are small compared to all descriptors, the
+  // top-scale descriptors of all images are cached, unless the memory is
+  // limited. Different numbers of features are cached separately.
+  std::shared_ptr<const FeatureDescriptors> GetTopScaleDescriptors(
+      const image_t image_id, const int num_features);
+
+  // Asynchronously load the features of the given images into the cache, e.g.,
+  // the images that are matched next, while the current images are matched.
+  void Prefetch(const std::vector<image_t>& image_ids);
+
+  // Lock the database connection that the cache reads from, e.g., to write to
+  // the database while other threads concurrently read through the cache.
+  std::unique_lock<std::mutex> LockDatabase();
+
   std::vector<image_t> GetImageIds() const;
 
  private:
+  // Number of shards of the feature caches with separate locks.
+  static const size_t kNumCacheShards = 8;
+
+  FeatureKeypoints LoadKeypoints(const image_t image_id);
+  FeatureDescriptors LoadDescriptors(const image_t image_id);
+
+  const size_t cache_size_;
+  const size_t max_num_bytes_;
   const Database* database_;
   std::mutex database_mutex_;
+  std::unique_ptr<DatabaseReaderPool> reader_pool_;
+  std::unique_ptr<FeatureStore> feature_store_;
   EIGEN_STL_UMAP(camera_t, Camera) cameras_cache_;
   EIGEN_STL_UMAP(image_t, Image) images_cache_;
-  std::unique_ptr<LRUCache<image_t, FeatureKeypoints>> keypoints_cache_;
-  std::unique_ptr<LRUCache<image_t, FeatureDescriptors>> descriptors_cache_;
+  std::unique_ptr<SharedLRUCache<image_t, FeatureKeypoints>> keypoints_cache_;
+  std::unique_ptr<SharedLRUCache<image_t, FeatureDescriptors>>
+      descriptors_cache_;
+  // The descriptor index caches by number of trees and the top-scale
+  // descriptor caches by number of features, created on first use.
+  std::mutex derived_caches_mutex_;
+  std::unordered_map<
+      int, std::unique_ptr<SharedLRUCache<image_t, SiftDescriptorIndex>>>
+      descriptor_index_caches_;
+  std::unique_ptr<SharedLRUCache<image_t, SiftCascadeHashingIndex>>
+      cascade_hashing_index_cache_;
+  std::unordered_map<
+      int, std::unique_ptr<SharedLRUCache<image_t, FeatureDescriptors>>>
+      top_scale_descriptors_caches_;
+  // Destroyed first, such that no prefetch accesses the destroyed caches.
+  std::unique_ptr<ThreadPool> prefetch_thread_pool_;
 };
 
 // SIFT GPU feature matcher, which writes the computed results to the database
@@ -113,10 +339,18 @@ class SiftFeatureMatcher {
  public:
   SiftFeatureMatcher(const SiftMatchOptions& options, Database* database,
                      FeatureMatcherCache* cache);
+  ~SiftFeatureMatcher();
 
   // Setup the feature matcher and return if successful.
   bool Setup();
 
+  // Wait for the separate verification stage to verify all queued image pairs
+  // and write their results to the database, and report the metrics of the
+  // matching and verification stages. Image pairs, which are still queued when
+  // the matcher is destroyed, are not written and only verified in the next
+  // run. Has no effect, if verification is done in the matching threads.
+  void Wait();
+
   // Match one batch of multiple image pairs.
   void MatchImagePairs(
       const std::vector<std::pair<image_t, image_t>>& image_pairs);
@@ -129,6 +363,19 @@ class SiftFeatureMatcher {
       const size_t preemptive_min_num_matches,
       const std::vector<std::pair<image_t, image_t>>& image_pairs);
 
+  // Match the image pairs returned by the given function until it returns
+  // false. In contrast to `MatchImagePairs`, the pairs are continuously
+  // streamed to the worker threads without waiting for all pairs of a batch,
+  // so that slow pairs do not idle the other threads, and the results are
+  // written to the database while the workers match the next pairs. The total
+  // number of image pairs is only used to report the progress. The working set
+  // of images, i.e., the images of the pairs in flight, is bounded by a small
+  // multiple of the number of threads, if the image pairs are ordered such
+  // that consecutive pairs share their images. Only supported on the CPU.
+  void MatchImagePairsStreamed(
+      const size_t num_image_pairs,
+      const std::function<bool(std::pair<image_t, image_t>*)>& next_image_pair);
+
  private:
   struct MatchResult {
     image_t image_id1;
@@ -145,12 +392,21 @@ class SiftFeatureMatcher {
   struct GeometricVerificationData {
     Camera camera1;
     Camera camera2;
-    FeatureKeypoints keypoints1;
-    FeatureKeypoints keypoints2;
+    std::shared_ptr<const FeatureKeypoints> keypoints1;
+    std::shared_ptr<const FeatureKeypoints> keypoints2;
     FeatureMatches matches;
     TwoViewGeometry::Options options;
   };
 
+  struct VerificationJob {
+    image_t image_id1;
+    image_t image_id2;
+    GeometricVerificationData data;
+    // Only set for guided matching on the CPU.
+    std::shared_ptr<const FeatureDescriptors> descriptors1;
+    std::shared_ptr<const FeatureDescriptors> descriptors2;
+  };
+
   void MatchImagePairsCPU(
       const std::vector<std::pair<image_t, image_t>>& image_pairs,
       const std::vector<std::pair<bool, bool>>& exists_mask,
@@ -162,10 +418,34 @@ class SiftFeatureMatcher {
       std::vector<MatchResult>* match_results,
       std::vector<InlierMatchResult>* inlier_match_results);
 
+  // Match and verify a single image pair on the CPU, skipping the steps whose
+  // results already exist. Returns whether the verification was handed over
+  // to the verification stage, in which case the inlier matches are not set.
+  bool MatchImagePairCPU(
+      const std::pair<image_t, image_t>& image_pair,
+      const std::pair<bool, bool>& exists,
+      const TwoViewGeometry::Options& two_view_geometry_options,
+      FeatureMatches* matches_ptr, TwoViewGeometry* inlier_matches_ptr);
+
+  TwoViewGeometry::Options GetTwoViewGeometryOptions() const;
+
+  // Write the results to the database and clear them.
+  void WriteResults(std::vector<MatchResult>* match_results,
+                    std::vector<InlierMatchResult>* inlier_match_results);
+
   static void VerifyImagePair(const GeometricVerificationData data,
                               const SiftMatchOptions& options,
                               TwoViewGeometry* two_view_geometry);
 
+  // Hand over the image pair to the verification stage, if it is enabled, and
+  // return whether it was queued. Blocks while the queue is full. Thread-safe.
+  bool QueueVerification(const std::pair<image_t, image_t>& image_pair,
+                         const GeometricVerificationData& data);
+  void VerificationWorkerFunc();
+  // Move the results of the verification stage, which finished so far.
+  void CollectVerificationResults(
+      std::vector<InlierMatchResult>* inlier_match_results);
+
   void GetGPUKeypoints(const int index, const image_t image_id,
                        const FeatureDescriptors* const descriptors_ptr,
                        const FeatureKeypoints** keypoints_ptr);
@@ -177,18 +457,42 @@ class SiftFeatureMatcher {
   Database* database_;
   FeatureMatcherCache* cache_;
 
+  // The image pairs with existing matches and inlier matches, which are loaded
+  // once in `Setup` and updated whenever new results are written.
+  ImagePairSet existing_matches_;
+  ImagePairSet existing_inlier_matches_;
+
   std::unique_ptr<OpenGLContextManager> opengl_context_;
   std::unique_ptr<SiftMatchGPU> sift_match_gpu_;
   std::unique_ptr<ThreadPool> thread_pool_;
 
+  // The separate verification stage, which is fed by the matching threads.
+  std::unique_ptr<JobQueue<VerificationJob>> verification_queue_;
+  std::unique_ptr<ThreadPool> verification_thread_pool_;
+  std::mutex verification_mutex_;
+  std::condition_variable verification_condition_;
+  size_t num_pending_verifications_;
+  std::vector<InlierMatchResult> verification_results_;
+  // Metrics of the matching stage, i.e., the number of matched image pairs and
+  // the accumulated matching time, and of the verification stage, i.e., the
+  // number of verified image pairs, the accumulated verification time, and the
+  // accumulated time the matching threads were blocked by a full queue. All
+  // are guarded by the verification mutex.
+  size_t num_matched_pairs_;
+  double matching_seconds_;
+  size_t num_verified_pairs_;
+  double verification_seconds_;
+  double blocked_matching_seconds_;
+
   // The previously uploaded images to the GPU.
   std::array<image_t, 2> prev_uploaded_image_ids_;
-  // Temporary storage for keypoints and descriptors to be uploaded. This is
-  // necessary, since consecutive calls to GetGPUKeypoints / GetGPUDescriptors
-  // might invalidate the pointers because the keypoint/descriptor LRUCache
-  // can overflow in-between two consecutive calls.
-  std::array<FeatureKeypoints, 2> prev_uploaded_keypoints_;
-  std::array<FeatureDescriptors, 2> prev_uploaded_descriptors_;
+  // Keypoints and descriptors to be uploaded. Holding on to them is necessary,
+  // since they might be evicted from the cache in-between two consecutive calls
+  // to GetGPUKeypoints / GetGPUDescriptors.
+  std::array<std::shared_ptr<const FeatureKeypoints>, 2>
+      prev_uploaded_keypoints_;
+  std::array<std::shared_ptr<const FeatureDescriptors>, 2>
+      prev_uploaded_descriptors_;
 };
 
 // Exhaustively match images by processing each block in the exhaustive match
@@ -214,6 +518,11 @@ class SiftFeatureMatcher {
 //
 // Pairs will only be matched if 1, to avoid duplicate pairs. Pairs with #
 // are on the main diagonal and denote pairs of the same image.
+//
+// Without preemptive matching, the CPU matcher instead streams all pairs along
+// a Hilbert curve over the match matrix to the workers, which never wait for
+// the other pairs of a block. The cache holds the features of the images that
+// are visited by the curve within a few blocks.
 class ExhaustiveFeatureMatcher : public Thread {
  public:
   struct Options {
@@ -467,6 +776,23 @@ void MatchGuidedSiftFeaturesCPU(const SiftMatchOptions& match_options,
                                 const FeatureDescriptors& descriptors2,
                                 TwoViewGeometry* two_view_geometry);
 
+// Match the given SIFT features on the CPU by approximate nearest neighbor
+// search in the descriptor indices of both images. The ratio test, maximum
+// distance, and cross-check are applied to the exact distances of the two
+// approximate nearest neighbors of each descriptor.
+void MatchSiftFeaturesCPUKDForest(const SiftMatchOptions& match_options,
+                                  const SiftDescriptorIndex& index1,
+                                  const SiftDescriptorIndex& index2,
+                                  FeatureMatches* matches);
+
+// Match the given SIFT features on the CPU by cascade hashing. The ratio test,
+// maximum distance, and cross-check are applied to the exact distances of the
+// best candidates of each descriptor.
+void MatchSiftFeaturesCPUCascadeHashing(
+    const SiftMatchOptions& match_options,
+    const SiftCascadeHashingIndex& index1,
+    const SiftCascadeHashingIndex& index2, FeatureMatches* matches);
+
 // Create a SiftGPU feature matcher. Note that if CUDA is not available or the
 // gpu_index is -1, the OpenGLContextManager must be created in the main thread
 // of the Qt application before calling this function. The same SiftMatchGPU
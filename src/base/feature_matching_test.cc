@@ -20,6 +20,8 @@
 
 #include <QApplication>
 
+#include <boost/filesystem.hpp>
+
 #include "base/feature_matching.h"
 
 using namespace colmap;
@@ -97,6 +99,105 @@ BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPU) {
   BOOST_CHECK_EQUAL(matches.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPUBlocks) {
+  // The number of descriptors exceeds one block and is not a multiple of the
+  // number of descriptors processed at once.
+  const FeatureDescriptors descriptors1 = CreateRandomFeatureDescriptors(150);
+  const FeatureDescriptors descriptors2 = descriptors1.colwise().reverse();
+
+  SiftMatchOptions options;
+  FeatureMatches matches;
+
+  for (const bool cross_check : {true, false}) {
+    options.cross_check = cross_check;
+    MatchSiftFeaturesCPU(options, descriptors1, descriptors2, &matches);
+    BOOST_REQUIRE_EQUAL(matches.size(), 150);
+    for (size_t i = 0; i < matches.size(); ++i) {
+      BOOST_CHECK_EQUAL(matches[i].point2D_idx1, i);
+      BOOST_CHECK_EQUAL(matches[i].point2D_idx2, 149 - i);
+    }
+  }
+
+  // Duplicate descriptors in different blocks are rejected by the ratio test.
+  FeatureDescriptors descriptors3(300, 128);
+  descriptors3 << descriptors1, descriptors1;
+  MatchSiftFeaturesCPU(options, descriptors1, descriptors3, &matches);
+  BOOST_CHECK_EQUAL(matches.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPUKDForest) {
+  const FeatureDescriptors empty_descriptors =
+      CreateRandomFeatureDescriptors(0);
+  const FeatureDescriptors descriptors1 = CreateRandomFeatureDescriptors(150);
+  const FeatureDescriptors descriptors2 = descriptors1.colwise().reverse();
+
+  const SiftDescriptorIndex empty_index(empty_descriptors, 4);
+  const SiftDescriptorIndex index1(descriptors1, 4);
+  const SiftDescriptorIndex index2(descriptors2, 4);
+  BOOST_CHECK_EQUAL(index1.Descriptors(), descriptors1);
+
+  SiftMatchOptions options;
+  options.cpu_kd_forest = true;
+  FeatureMatches matches;
+
+  for (const bool cross_check : {true, false}) {
+    options.cross_check = cross_check;
+    MatchSiftFeaturesCPUKDForest(options, index1, index2, &matches);
+    BOOST_REQUIRE_EQUAL(matches.size(), 150);
+    for (size_t i = 0; i < matches.size(); ++i) {
+      BOOST_CHECK_EQUAL(matches[i].point2D_idx1, i);
+      BOOST_CHECK_EQUAL(matches[i].point2D_idx2, 149 - i);
+    }
+
+    MatchSiftFeaturesCPUKDForest(options, empty_index, index2, &matches);
+    BOOST_CHECK_EQUAL(matches.size(), 0);
+    MatchSiftFeaturesCPUKDForest(options, index1, empty_index, &matches);
+    BOOST_CHECK_EQUAL(matches.size(), 0);
+    MatchSiftFeaturesCPUKDForest(options, empty_index, empty_index, &matches);
+    BOOST_CHECK_EQUAL(matches.size(), 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPUCascadeHashing) {
+  const FeatureDescriptors empty_descriptors =
+      CreateRandomFeatureDescriptors(0);
+  const FeatureDescriptors descriptors1 = CreateRandomFeatureDescriptors(150);
+  const FeatureDescriptors descriptors2 = descriptors1.colwise().reverse();
+
+  const SiftCascadeHashingIndex empty_index(empty_descriptors);
+  const SiftCascadeHashingIndex index1(descriptors1);
+  const SiftCascadeHashingIndex index2(descriptors2);
+  BOOST_CHECK_EQUAL(index1.Descriptors(), descriptors1);
+
+  // Identical descriptors have identical hashes and are always candidates.
+  std::vector<std::vector<int>> candidate_idxs;
+  index2.Search(index1, 1, &candidate_idxs);
+  BOOST_REQUIRE_EQUAL(candidate_idxs.size(), 150);
+  for (size_t i = 0; i < candidate_idxs.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(candidate_idxs[i].size(), 1);
+    BOOST_CHECK_EQUAL(candidate_idxs[i][0], 149 - i);
+  }
+
+  SiftMatchOptions options;
+  options.cpu_cascade_hashing = true;
+  FeatureMatches matches;
+
+  for (const bool cross_check : {true, false}) {
+    options.cross_check = cross_check;
+    MatchSiftFeaturesCPUCascadeHashing(options, index1, index2, &matches);
+    BOOST_REQUIRE_EQUAL(matches.size(), 150);
+    for (size_t i = 0; i < matches.size(); ++i) {
+      BOOST_CHECK_EQUAL(matches[i].point2D_idx1, i);
+      BOOST_CHECK_EQUAL(matches[i].point2D_idx2, 149 - i);
+    }
+
+    MatchSiftFeaturesCPUCascadeHashing(options, empty_index, index2, &matches);
+    BOOST_CHECK_EQUAL(matches.size(), 0);
+    MatchSiftFeaturesCPUCascadeHashing(options, index1, empty_index, &matches);
+    BOOST_CHECK_EQUAL(matches.size(), 0);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestMatchGuidedSiftFeaturesCPU) {
   FeatureKeypoints empty_keypoints(0);
   FeatureKeypoints keypoints1(2);
@@ -430,3 +531,262 @@ BOOST_AUTO_TEST_CASE(TestMatchGuidedSiftFeaturesGPU) {
   TestThread thread;
   RunThreadWithOpenGLContext(&app, &thread);
 }
+
+BOOST_AUTO_TEST_CASE(TestFeatureMatcherCacheConcurrentReads) {
+  const std::string database_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+          .string();
+
+  const size_t kNumImages = 10;
+
+  {
+    Database database(database_path);
+    Camera camera;
+    camera.SetCameraId(database.WriteCamera(camera));
+    for (size_t i = 0; i < kNumImages; ++i) {
+      Image image;
+      image.SetName("image" + std::to_string(i));
+      image.SetCameraId(camera.CameraId());
+      const image_t image_id = database.WriteImage(image);
+      database.WriteKeypoints(image_id, FeatureKeypoints(image_id));
+      database.WriteDescriptors(image_id,
+                                CreateRandomFeatureDescriptors(image_id));
+    }
+    database.WriteMatches(1, 2, FeatureMatches(3));
+
+    FeatureMatcherCache cache(kNumImages, &database, "", 4);
+    ThreadPool thread_pool(8);
+    std::vector<std::future<size_t>> futures;
+    for (size_t i = 0; i < 100; ++i) {
+      futures.push_back(thread_pool.AddTask([&cache, i]() {
+        const image_t image_id = 1 + i % kNumImages;
+        const size_t num_keypoints = cache.GetKeypoints(image_id)->size();
+        const size_t num_descriptors = cache.GetDescriptors(image_id)->rows();
+        const size_t num_top_scale_descriptors =
+            cache.GetTopScaleDescriptors(image_id, 4)->rows();
+        return num_keypoints + num_descriptors + num_top_scale_descriptors;
+      }));
+    }
+    for (size_t i = 0; i < futures.size(); ++i) {
+      const size_t num_features = 1 + i % kNumImages;
+      BOOST_CHECK_EQUAL(futures[i].get(),
+                        2 * num_features + std::min<size_t>(num_features, 4));
+    }
+
+    BOOST_CHECK_EQUAL(cache.GetMatches(2, 1).size(), 3);
+
+    // Different parameters of the derived features are cached separately.
+    BOOST_CHECK_EQUAL(cache.GetTopScaleDescriptors(kNumImages, 2)->rows(), 2);
+    BOOST_CHECK_EQUAL(cache.GetTopScaleDescriptors(kNumImages, 4)->rows(), 4);
+    const auto descriptor_index = cache.GetDescriptorIndex(kNumImages, 1);
+    BOOST_CHECK_EQUAL(cache.GetDescriptorIndex(kNumImages, 1),
+                      descriptor_index);
+    BOOST_CHECK_NE(cache.GetDescriptorIndex(kNumImages, 2), descriptor_index);
+
+    // With a memory budget of one byte, only the most recently used features
+    // of each shard are cached, but handed out features remain valid.
+    FeatureMatcherCache small_cache(kNumImages, &database, "", 4, 1);
+    const auto keypoints = small_cache.GetKeypoints(1);
+    const auto descriptors = small_cache.GetDescriptors(1);
+    std::vector<image_t> image_ids;
+    for (image_t image_id = 1; image_id <= kNumImages; ++image_id) {
+      image_ids.push_back(image_id);
+    }
+    small_cache.Prefetch(image_ids);
+    for (const image_t image_id : image_ids) {
+      BOOST_CHECK_EQUAL(small_cache.GetKeypoints(image_id)->size(), image_id);
+      BOOST_CHECK_EQUAL(small_cache.GetDescriptors(image_id)->rows(),
+                        image_id);
+    }
+    BOOST_CHECK_EQUAL(keypoints->size(), 1);
+    BOOST_CHECK_EQUAL(descriptors->rows(), 1);
+  }
+
+  boost::filesystem::remove(database_path);
+  boost::filesystem::remove(database_path + "-shm");
+  boost::filesystem::remove(database_path + "-wal");
+}
+
+BOOST_AUTO_TEST_CASE(TestSiftFeatureMatcherVerificationThreads) {
+  const size_t kNumImages = 6;
+  const size_t kNumFeatures = 100;
+
+  // All images share the same descriptors and observe the same points shifted
+  // by a few pixels, such that all image pairs have many inlier matches.
+  const FeatureDescriptors descriptors =
+      CreateRandomFeatureDescriptors(kNumFeatures);
+  const Eigen::MatrixXf points =
+      Eigen::MatrixXf::Random(kNumFeatures, 2) * 200.0f;
+
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+  for (image_t image_id1 = 1; image_id1 <= kNumImages; ++image_id1) {
+    for (image_t image_id2 = image_id1 + 1; image_id2 <= kNumImages;
+         ++image_id2) {
+      image_pairs.emplace_back(image_id1, image_id2);
+    }
+  }
+
+  std::vector<std::vector<FeatureMatches>> inlier_matches_per_run;
+  for (const int num_verification_threads : {0, 2}) {
+    const std::string database_path =
+        (boost::filesystem::temp_directory_path() /
+         boost::filesystem::unique_path("%%%%-%%%%-%%%%.db"))
+            .string();
+
+    {
+      Database database(database_path);
+      Camera camera;
+      camera.InitializeWithName("SIMPLE_PINHOLE", 500, 640, 480);
+      camera.SetCameraId(database.WriteCamera(camera));
+      for (size_t i = 0; i < kNumImages; ++i) {
+        Image image;
+        image.SetName("image" + std::to_string(i));
+        image.SetCameraId(camera.CameraId());
+        const image_t image_id = database.WriteImage(image);
+        FeatureKeypoints keypoints(kNumFeatures);
+        for (size_t j = 0; j < kNumFeatures; ++j) {
+          keypoints[j].x = 320 + points(j, 0) + 5 * i;
+          keypoints[j].y = 240 + points(j, 1);
+        }
+        database.WriteKeypoints(image_id, keypoints);
+        database.WriteDescriptors(image_id, descriptors);
+      }
+
+      SiftMatchOptions options;
+      options.use_gpu = false;
+      options.num_threads = 2;
+      options.num_verification_threads = num_verification_threads;
+
+      FeatureMatcherCache cache(kNumImages, &database);
+      SiftFeatureMatcher matcher(options, &database, &cache);
+      BOOST_REQUIRE(matcher.Setup());
+
+      // The batches overlap, such that some image pairs are passed again,
+      // while their verification may still be queued.
+      const size_t num_first_pairs = 2 * image_pairs.size() / 3;
+      matcher.MatchImagePairs(std::vector<std::pair<image_t, image_t>>(
+          image_pairs.begin(), image_pairs.begin() + num_first_pairs));
+      matcher.MatchImagePairs(image_pairs);
+      matcher.Wait();
+
+      // Every image pair is verified and written exactly once.
+      BOOST_CHECK_EQUAL(database.NumMatchedImagePairs(), image_pairs.size());
+      BOOST_CHECK_EQUAL(database.NumVerifiedImagePairs(), image_pairs.size());
+      BOOST_CHECK_EQUAL(database.NumInlierMatches(),
+                        image_pairs.size() * kNumFeatures);
+      BOOST_CHECK_EQUAL(database.InlierMatchesGeneration(), image_pairs.size());
+
+      inlier_matches_per_run.emplace_back();
+      for (const auto& image_pair : image_pairs) {
+        inlier_matches_per_run.back().push_back(
+            database
+                .ReadInlierMatches(image_pair.first, image_pair.second)
+                .inlier_matches);
+        BOOST_CHECK_GE(inlier_matches_per_run.back().back().size(),
+                       options.min_num_inliers);
+      }
+    }
+
+    boost::filesystem::remove(database_path);
+    boost::filesystem::remove(database_path + "-shm");
+    boost::filesystem::remove(database_path + "-wal");
+  }
+
+  // The separate verification stage yields the same results.
+  BOOST_REQUIRE_EQUAL(inlier_matches_per_run.size(), 2);
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    CheckEqualMatches(inlier_matches_per_run[0][i],
+                      inlier_matches_per_run[1][i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestImagePairSet) {
+  ImagePairSet image_pair_set(10);
+  BOOST_CHECK_EQUAL(image_pair_set.Size(), 0);
+  BOOST_CHECK(!image_pair_set.Exists(1, 2));
+  image_pair_set.Insert(1, 2);
+  BOOST_CHECK(image_pair_set.Exists(1, 2));
+  BOOST_CHECK(image_pair_set.Exists(2, 1));
+  BOOST_CHECK_EQUAL(image_pair_set.Size(), 1);
+  image_pair_set.Insert(2, 1);
+  BOOST_CHECK_EQUAL(image_pair_set.Size(), 1);
+
+  // Pairs at the boundary and beyond the bitmap.
+  image_pair_set.Insert(9, 10);
+  image_pair_set.Insert(10, 11);
+  image_pair_set.Insert(3, 3);
+  BOOST_CHECK(image_pair_set.Exists(10, 9));
+  BOOST_CHECK(image_pair_set.Exists(11, 10));
+  BOOST_CHECK(image_pair_set.Exists(3, 3));
+  BOOST_CHECK(!image_pair_set.Exists(9, 11));
+  BOOST_CHECK(!image_pair_set.Exists(0, 10));
+  BOOST_CHECK_EQUAL(image_pair_set.Size(), 4);
+
+  for (image_t image_id1 = 0; image_id1 <= 10; ++image_id1) {
+    for (image_t image_id2 = image_id1 + 1; image_id2 <= 10; ++image_id2) {
+      image_pair_set.Insert(image_id1, image_id2);
+    }
+  }
+  BOOST_CHECK_EQUAL(image_pair_set.Size(), 11 * 10 / 2 + 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestHilbertImagePairOrder) {
+  for (const size_t num_indices : {0, 1, 2, 3, 17, 65, 100, 129}) {
+    HilbertImagePairOrder image_pair_order(num_indices);
+    const size_t num_pairs =
+        num_indices > 0 ? num_indices * (num_indices - 1) / 2 : 0;
+    BOOST_CHECK_EQUAL(image_pair_order.NumPairs(), num_pairs);
+
+    std::vector<std::pair<size_t, size_t>> pairs;
+    std::set<std::pair<size_t, size_t>> unique_pairs;
+    size_t idx1;
+    size_t idx2;
+    while (image_pair_order.Next(&idx1, &idx2)) {
+      BOOST_CHECK_LT(idx1, idx2);
+      BOOST_CHECK_LT(idx2, num_indices);
+      pairs.emplace_back(idx1, idx2);
+      unique_pairs.emplace(idx1, idx2);
+    }
+    BOOST_CHECK(!image_pair_order.Next(&idx1, &idx2));
+    BOOST_CHECK_EQUAL(pairs.size(), image_pair_order.NumPairs());
+    BOOST_CHECK_EQUAL(unique_pairs.size(), image_pair_order.NumPairs());
+
+    // Any 64 consecutive pairs involve far fewer indices than in row-wise
+    // order, where 64 pairs of one row already involve 65 indices.
+    for (size_t i = 0; i + 64 <= pairs.size(); ++i) {
+      std::set<size_t> indices;
+      for (size_t j = i; j < i + 64; ++j) {
+        indices.insert(pairs[j].first);
+        indices.insert(pairs[j].second);
+      }
+      BOOST_CHECK_LE(indices.size(), 32);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestIsImagePairInShard) {
+  const int kNumShards = 4;
+  std::vector<int> num_pairs_per_shard(kNumShards, 0);
+  for (image_t image_id1 = 1; image_id1 <= 50; ++image_id1) {
+    for (image_t image_id2 = image_id1 + 1; image_id2 <= 50; ++image_id2) {
+      int num_shards = 0;
+      for (int shard_index = 0; shard_index < kNumShards; ++shard_index) {
+        if (IsImagePairInShard(image_id1, image_id2, kNumShards,
+                               shard_index)) {
+          BOOST_CHECK(IsImagePairInShard(image_id2, image_id1, kNumShards,
+                                         shard_index));
+          num_pairs_per_shard[shard_index] += 1;
+          num_shards += 1;
+        }
+      }
+      BOOST_CHECK_EQUAL(num_shards, 1);
+    }
+  }
+
+  for (const int num_pairs : num_pairs_per_shard) {
+    BOOST_CHECK_GT(num_pairs, 50 * 49 / 2 / kNumShards / 2);
+  }
+
+  BOOST_CHECK(IsImagePairInShard(1, 2, 1, 0));
+}
@@ -0,0 +1,243 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "base/feature_store.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+#include "util/logging.h"
+
+namespace colmap {
+namespace {
+
+const char kMagic[8] = {'C', 'O', 'L', 'M', 'A', 'P', 'F', 'S'};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t num_images;
+  uint64_t index_offset;
+  uint64_t database_checksum;
+  uint64_t database_generation;
+  uint64_t database_identifier;
+  uint8_t padding[8];
+};
+
+struct FileIndexEntry {
+  uint32_t image_id;
+  uint32_t num_features;
+  uint32_t descriptor_dim;
+  uint32_t reserved;
+  uint64_t keypoints_offset;
+  uint64_t descriptors_offset;
+};
+
+static_assert(sizeof(FileHeader) == FeatureStore::kAlignment,
+              "Header must fill exactly one aligned block");
+static_assert(sizeof(FileIndexEntry) == 32, "Unexpected index entry size");
+static_assert(sizeof(FeatureKeypoint) == 4 * sizeof(float),
+              "Keypoints must be densely packed");
+
+// Write the data and pad the stream to the next multiple of the alignment.
+void WriteAligned(const char* data, const size_t num_bytes,
+                  std::ofstream* file, uint64_t* offset) {
+  file->write(data, num_bytes);
+  *offset += num_bytes;
+  const size_t num_padding_bytes =
+      (FeatureStore::kAlignment - *offset % FeatureStore::kAlignment) %
+      FeatureStore::kAlignment;
+  const char padding[FeatureStore::kAlignment] = {0};
+  file->write(padding, num_padding_bytes);
+  *offset += num_padding_bytes;
+}
+
+}  // namespace
+
+const int FeatureStore::kVersion;
+const size_t FeatureStore::kAlignment;
+
+std::string FeatureStore::DefaultPath(const std::string& database_path) {
+  return database_path + ".features";
+}
+
+void FeatureStore::Write(const std::string& path, const Database& database) {
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  CHECK(file.is_open()) << path;
+
+  FileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.database_checksum = database.FeatureShapesChecksum();
+  header.database_generation = database.FeaturesGeneration();
+  header.database_identifier = database.Identifier();
+
+  // Reserve space for the header, which is written after the data and index.
+  uint64_t offset = 0;
+  WriteAligned(reinterpret_cast<const char*>(&header), sizeof(header), &file,
+               &offset);
+
+  std::vector<FileIndexEntry> index;
+  for (const auto& image : database.ReadAllImages()) {
+    if (!database.ExistsKeypoints(image.ImageId()) ||
+        !database.ExistsDescriptors(image.ImageId())) {
+      continue;
+    }
+
+    const FeatureKeypoints keypoints = database.ReadKeypoints(image.ImageId());
+    const FeatureDescriptors descriptors =
+        database.ReadDescriptors(image.ImageId());
+    CHECK_EQ(keypoints.size(), descriptors.rows());
+
+    FileIndexEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.image_id = image.ImageId();
+    entry.num_features = static_cast<uint32_t>(keypoints.size());
+    entry.descriptor_dim = static_cast<uint32_t>(descriptors.cols());
+
+    entry.keypoints_offset = offset;
+    WriteAligned(reinterpret_cast<const char*>(keypoints.data()),
+                 keypoints.size() * sizeof(FeatureKeypoint), &file, &offset);
+
+    entry.descriptors_offset = offset;
+    WriteAligned(reinterpret_cast<const char*>(descriptors.data()),
+                 descriptors.size() * sizeof(uint8_t), &file, &offset);
+
+    index.push_back(entry);
+  }
+
+  header.num_images = index.size();
+  header.index_offset = offset;
+  WriteAligned(reinterpret_cast<const char*>(index.data()),
+               index.size() * sizeof(FileIndexEntry), &file, &offset);
+
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  CHECK(file.good()) << path;
+}
+
+std::unique_ptr<FeatureStore> FeatureStore::Open(const std::string& path,
+                                                 const Database& database) {
+  if (path.empty() || !boost::filesystem::exists(path)) {
+    return nullptr;
+  }
+
+  // Check the header before mapping the file, such that stores of other
+  // versions or databases are ignored instead of rejected as invalid.
+  FileHeader header;
+  std::ifstream file(path, std::ios::binary);
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      header.database_checksum != database.FeatureShapesChecksum() ||
+      header.database_generation != database.FeaturesGeneration() ||
+      header.database_identifier != database.Identifier()) {
+    std::cout << "WARNING: Ignoring outdated feature store at " << path
+              << std::endl;
+    return nullptr;
+  }
+  file.close();
+
+  return std::unique_ptr<FeatureStore>(new FeatureStore(path));
+}
+
+FeatureStore::FeatureStore(const std::string& path)
+    : file_mapping_(path.c_str(), boost::interprocess::read_only),
+      mapped_region_(file_mapping_, boost::interprocess::read_only),
+      data_(static_cast<const char*>(mapped_region_.get_address())),
+      num_features_(0) {
+  CHECK_GE(mapped_region_.get_size(), sizeof(FileHeader)) << path;
+
+  const FileHeader& header = *reinterpret_cast<const FileHeader*>(data_);
+  CHECK_EQ(std::memcmp(header.magic, kMagic, sizeof(kMagic)), 0)
+      << "Invalid feature store " << path;
+  CHECK_EQ(header.version, kVersion) << "Unsupported feature store " << path;
+  CHECK_LE(header.index_offset + header.num_images * sizeof(FileIndexEntry),
+           mapped_region_.get_size())
+      << "Truncated feature store " << path;
+
+  const FileIndexEntry* entries =
+      reinterpret_cast<const FileIndexEntry*>(data_ + header.index_offset);
+  index_.reserve(header.num_images);
+  for (size_t i = 0; i < header.num_images; ++i) {
+    const FileIndexEntry& file_entry = entries[i];
+    const uint64_t num_features = file_entry.num_features;
+    CHECK_LE(file_entry.keypoints_offset +
+                 num_features * sizeof(FeatureKeypoint),
+             mapped_region_.get_size())
+        << "Truncated feature store " << path;
+    CHECK_LE(file_entry.descriptors_offset +
+                 num_features * file_entry.descriptor_dim,
+             mapped_region_.get_size())
+        << "Truncated feature store " << path;
+    IndexEntry& entry = index_[file_entry.image_id];
+    entry.num_features = file_entry.num_features;
+    entry.descriptor_dim = file_entry.descriptor_dim;
+    entry.keypoints_offset = file_entry.keypoints_offset;
+    entry.descriptors_offset = file_entry.descriptors_offset;
+    num_features_ += file_entry.num_features;
+  }
+}
+
+size_t FeatureStore::NumImages() const { return index_.size(); }
+
+size_t FeatureStore::NumFeatures() const { return num_features_; }
+
+size_t FeatureStore::NumFeaturesForImage(const image_t image_id) const {
+  return GetIndexEntry(image_id).num_features;
+}
+
+bool FeatureStore::ExistsImage(const image_t image_id) const {
+  return index_.count(image_id) > 0;
+}
+
+const FeatureKeypoint* FeatureStore::KeypointsData(
+    const image_t image_id) const {
+  const IndexEntry& entry = GetIndexEntry(image_id);
+  return reinterpret_cast<const FeatureKeypoint*>(data_ +
+                                                  entry.keypoints_offset);
+}
+
+FeatureDescriptorsMap FeatureStore::DescriptorsMap(
+    const image_t image_id) const {
+  const IndexEntry& entry = GetIndexEntry(image_id);
+  return FeatureDescriptorsMap(
+      reinterpret_cast<const uint8_t*>(data_ + entry.descriptors_offset),
+      entry.num_features, entry.descriptor_dim);
+}
+
+FeatureKeypoints FeatureStore::ReadKeypoints(const image_t image_id) const {
+  const FeatureKeypoint* keypoints_data = KeypointsData(image_id);
+  return FeatureKeypoints(keypoints_data,
+                          keypoints_data + NumFeaturesForImage(image_id));
+}
+
+FeatureDescriptors FeatureStore::ReadDescriptors(const image_t image_id) const {
+  return DescriptorsMap(image_id);
+}
+
+const FeatureStore::IndexEntry& FeatureStore::GetIndexEntry(
+    const image_t image_id) const {
+  return index_.at(image_id);
+}
+
+}  // namespace colmap
@@ -0,0 +1,116 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_BASE_FEATURE_STORE_H_
+#define COLMAP_SRC_BASE_FEATURE_STORE_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <Eigen/Core>
+
+#include "base/database.h"
+#include "base/feature.h"
+#include "util/types.h"
+
+namespace colmap {
+
+typedef Eigen::Map<const FeatureDescriptors, Eigen::Aligned>
+    FeatureDescriptorsMap;
+
+// Read-only, memory-mapped binary feature store, which is created from the
+// keypoints and descriptors in a database and stored alongside it. The
+// features of each image are stored as contiguous, 64-byte aligned arrays,
+// such that they can be accessed without copying and decoding the SQLite
+// blobs. Since the data is backed by the page cache of the operating system,
+// multiple processes can share the same physical memory of the store.
+//
+// The file layout is as follows:
+//
+//    Header           64 bytes (magic, version, number of images, index offset,
+//                     checksum and generation of the database features,
+//                     identifier of the database)
+//    Data             per image, 64-byte aligned keypoints and descriptors
+//    Index            per image, number of features and data offsets
+//
+// Note that the store is a snapshot of the database at the time of creation
+// and must be recreated whenever the features in the database change.
+class FeatureStore {
+ public:
+  const static int kVersion = 3;
+
+  // Alignment of the per-image keypoint and descriptor arrays in bytes.
+  const static size_t kAlignment = 64;
+
+  // The default path of the store for the given database path.
+  static std::string DefaultPath(const std::string& database_path);
+
+  // Write the features of all images in the database to a new store.
+  static void Write(const std::string& path, const Database& database);
+
+  // Open the store, if it exists and is consistent with the database, i.e.,
+  // it was written from the same database and the checksum of the number of
+  // features per image and the generation of the features match the ones
+  // recorded when the store was written. Hence, any later write of keypoints
+  // or descriptors as well as re-extraction into a new database at the same
+  // path invalidate the store. Otherwise, a null pointer is returned.
+  static std::unique_ptr<FeatureStore> Open(const std::string& path,
+                                            const Database& database);
+
+  explicit FeatureStore(const std::string& path);
+
+  // Get number of objects.
+  size_t NumImages() const;
+  size_t NumFeatures() const;
+  size_t NumFeaturesForImage(const image_t image_id) const;
+
+  // Check whether the store contains the features of an image.
+  bool ExistsImage(const image_t image_id) const;
+
+  // Zero-copy access to the features of an image. The returned data is valid
+  // as long as the store is alive.
+  const FeatureKeypoint* KeypointsData(const image_t image_id) const;
+  FeatureDescriptorsMap DescriptorsMap(const image_t image_id) const;
+
+  // Copy the features of an image.
+  FeatureKeypoints ReadKeypoints(const image_t image_id) const;
+  FeatureDescriptors ReadDescriptors(const image_t image_id) const;
+
+ private:
+  struct IndexEntry {
+    uint32_t num_features;
+    uint32_t descriptor_dim;
+    uint64_t keypoints_offset;
+    uint64_t descriptors_offset;
+  };
+
+  const IndexEntry& GetIndexEntry(const image_t image_id) const;
+
+  boost::interprocess::file_mapping file_mapping_;
+  boost::interprocess::mapped_region mapped_region_;
+  const char* data_;
+  size_t num_features_;
+  std::unordered_map<image_t, IndexEntry> index_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BASE_FEATURE_STORE_H_
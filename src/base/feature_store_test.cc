@@ -0,0 +1,200 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE "base/feature_store"
+#include <boost/test/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include "base/feature_store.h"
+
+using namespace colmap;
+
+const static std::string kMemoryDatabasePath = ":memory:";
+
+std::string CreateTestPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("%%%%-%%%%-%%%%.features"))
+      .string();
+}
+
+void CreateTestDatabase(Database* database) {
+  Camera camera;
+  camera.SetCameraId(database->WriteCamera(camera));
+  for (size_t i = 0; i < 3; ++i) {
+    Image image;
+    image.SetName("test" + std::to_string(i));
+    image.SetCameraId(camera.CameraId());
+    image.SetImageId(database->WriteImage(image));
+    FeatureKeypoints keypoints(10 * i + 1);
+    for (size_t j = 0; j < keypoints.size(); ++j) {
+      keypoints[j].x = i;
+      keypoints[j].y = j;
+      keypoints[j].scale = i + j;
+      keypoints[j].orientation = 0.5f;
+    }
+    database->WriteKeypoints(image.ImageId(), keypoints);
+    database->WriteDescriptors(image.ImageId(),
+                               FeatureDescriptors::Random(10 * i + 1, 128));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteRead) {
+  Database database(kMemoryDatabasePath);
+  CreateTestDatabase(&database);
+
+  const std::string path = CreateTestPath();
+  FeatureStore::Write(path, database);
+
+  {
+    FeatureStore feature_store(path);
+    BOOST_CHECK_EQUAL(feature_store.NumImages(), 3);
+    BOOST_CHECK_EQUAL(feature_store.NumFeatures(), database.NumKeypoints());
+    BOOST_CHECK(!feature_store.ExistsImage(kInvalidImageId));
+
+    for (const auto& image : database.ReadAllImages()) {
+      BOOST_CHECK(feature_store.ExistsImage(image.ImageId()));
+      BOOST_CHECK_EQUAL(feature_store.NumFeaturesForImage(image.ImageId()),
+                        database.NumKeypointsForImage(image.ImageId()));
+
+      const FeatureKeypoints keypoints =
+          database.ReadKeypoints(image.ImageId());
+      const FeatureKeypoint* keypoints_data =
+          feature_store.KeypointsData(image.ImageId());
+      BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(keypoints_data) %
+                            FeatureStore::kAlignment,
+                        0);
+      for (size_t i = 0; i < keypoints.size(); ++i) {
+        BOOST_CHECK_EQUAL(keypoints[i].x, keypoints_data[i].x);
+        BOOST_CHECK_EQUAL(keypoints[i].y, keypoints_data[i].y);
+        BOOST_CHECK_EQUAL(keypoints[i].scale, keypoints_data[i].scale);
+        BOOST_CHECK_EQUAL(keypoints[i].orientation,
+                          keypoints_data[i].orientation);
+      }
+      BOOST_CHECK_EQUAL(
+          feature_store.ReadKeypoints(image.ImageId()).size(),
+          keypoints.size());
+
+      const FeatureDescriptors descriptors =
+          database.ReadDescriptors(image.ImageId());
+      const FeatureDescriptorsMap descriptors_map =
+          feature_store.DescriptorsMap(image.ImageId());
+      BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(descriptors_map.data()) %
+                            FeatureStore::kAlignment,
+                        0);
+      BOOST_CHECK_EQUAL(descriptors, descriptors_map);
+      BOOST_CHECK_EQUAL(descriptors,
+                        feature_store.ReadDescriptors(image.ImageId()));
+    }
+  }
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestOpen) {
+  Database database(kMemoryDatabasePath);
+  CreateTestDatabase(&database);
+
+  const std::string path = CreateTestPath();
+  BOOST_CHECK(!FeatureStore::Open(path, database));
+
+  FeatureStore::Write(path, database);
+  BOOST_CHECK(FeatureStore::Open(path, database));
+
+  // The store is outdated, if the features in the database change.
+  Image image;
+  image.SetName("test");
+  image.SetCameraId(database.ReadAllCameras()[0].CameraId());
+  image.SetImageId(database.WriteImage(image));
+  database.WriteKeypoints(image.ImageId(), FeatureKeypoints(1));
+  database.WriteDescriptors(image.ImageId(), FeatureDescriptors(1, 128));
+  BOOST_CHECK(!FeatureStore::Open(path, database));
+
+  // The store is outdated, if the total number of features is the same but
+  // the number of features per image differs.
+  FeatureStore::Write(path, database);
+  BOOST_CHECK(FeatureStore::Open(path, database));
+  Database other_database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(other_database.WriteCamera(camera));
+  const std::vector<Image> images = database.ReadAllImages();
+  for (size_t i = 0; i < images.size(); ++i) {
+    // Swap the number of features of the first two images.
+    const image_t image_id = images[i < 2 ? 1 - i : i].ImageId();
+    const size_t num_features = database.NumKeypointsForImage(image_id);
+    image.SetName(images[i].Name());
+    image.SetCameraId(camera.CameraId());
+    image.SetImageId(other_database.WriteImage(image));
+    other_database.WriteKeypoints(image.ImageId(),
+                                  FeatureKeypoints(num_features));
+    other_database.WriteDescriptors(image.ImageId(),
+                                    FeatureDescriptors(num_features, 128));
+  }
+  BOOST_CHECK_EQUAL(other_database.NumKeypoints(), database.NumKeypoints());
+  BOOST_CHECK(!FeatureStore::Open(path, other_database));
+
+  // The store is outdated, if the features are rewritten with the same
+  // number of features per image, e.g., by an external tool.
+  const std::string database_path = CreateTestPath() + ".db";
+  {
+    Database file_database(database_path);
+    CreateTestDatabase(&file_database);
+    FeatureStore::Write(path, file_database);
+    BOOST_CHECK(FeatureStore::Open(path, file_database));
+    const uint64_t checksum = file_database.FeatureShapesChecksum();
+
+    sqlite3* connection;
+    BOOST_CHECK_EQUAL(sqlite3_open(database_path.c_str(), &connection),
+                      SQLITE_OK);
+    BOOST_CHECK_EQUAL(
+        sqlite3_exec(connection,
+                     "UPDATE descriptors SET data = zeroblob(length(data)) "
+                     "WHERE image_id = 1;",
+                     nullptr, nullptr, nullptr),
+        SQLITE_OK);
+    sqlite3_close(connection);
+
+    BOOST_CHECK_EQUAL(file_database.FeatureShapesChecksum(), checksum);
+    BOOST_CHECK(!FeatureStore::Open(path, file_database));
+  }
+  boost::filesystem::remove(database_path);
+
+  // The store is outdated, if the database is recreated with the same number
+  // of features per image.
+  FeatureStore::Write(path, database);
+  BOOST_CHECK(FeatureStore::Open(path, database));
+  Database recreated_database(kMemoryDatabasePath);
+  CreateTestDatabase(&recreated_database);
+  image.SetName("test");
+  image.SetCameraId(recreated_database.ReadAllCameras()[0].CameraId());
+  image.SetImageId(recreated_database.WriteImage(image));
+  recreated_database.WriteKeypoints(image.ImageId(), FeatureKeypoints(1));
+  recreated_database.WriteDescriptors(image.ImageId(),
+                                      FeatureDescriptors(1, 128));
+  BOOST_CHECK_EQUAL(recreated_database.FeatureShapesChecksum(),
+                    database.FeatureShapesChecksum());
+  BOOST_CHECK_EQUAL(recreated_database.FeaturesGeneration(),
+                    database.FeaturesGeneration());
+  BOOST_CHECK(!FeatureStore::Open(path, recreated_database));
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestDefaultPath) {
+  BOOST_CHECK_EQUAL(FeatureStore::DefaultPath("database.db"),
+                    "database.db.features");
+}
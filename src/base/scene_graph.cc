@@ -16,13 +16,70 @@
 
 #include "base/scene_graph.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <unordered_set>
 
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
 #include "util/logging.h"
 #include "util/string.h"
+#include "util/threading.h"
 
 namespace colmap {
+namespace {
+
+const char kSnapshotMagic[8] = {'C', 'O', 'L', 'M', 'A', 'P', 'S', 'G'};
+const uint32_t kSnapshotVersion = 1;
+
+// The snapshot consists of the header followed by the image entries, the
+// image pair entries, the number of correspondences per image point, and the
+// correspondences, where each section is padded to a multiple of 8 bytes.
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t key;
+  uint64_t num_images;
+  uint64_t num_image_pairs;
+  uint64_t num_points2D;
+  uint64_t num_correspondences;
+  uint8_t padding[8];
+};
+
+struct SnapshotImage {
+  uint32_t image_id;
+  uint32_t num_points2D;
+  uint32_t num_observations;
+  uint32_t num_correspondences;
+};
+
+struct SnapshotImagePair {
+  uint64_t pair_id;
+  uint32_t num_correspondences;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "Unexpected header size");
+static_assert(sizeof(SnapshotImage) == 16, "Unexpected image entry size");
+static_assert(sizeof(SnapshotImagePair) == 16, "Unexpected pair entry size");
+static_assert(sizeof(SceneGraph::Correspondence) == 8,
+              "Correspondences must be densely packed");
+
+size_t PaddedSize(const size_t num_bytes) { return (num_bytes + 7) / 8 * 8; }
+
+void WritePadded(const void* data, const size_t num_bytes,
+                 std::ofstream* file) {
+  file->write(static_cast<const char*>(data), num_bytes);
+  const char padding[8] = {0};
+  file->write(padding, PaddedSize(num_bytes) - num_bytes);
+}
+
+}  // namespace
 
 SceneGraph::SceneGraph() {}
 
@@ -133,6 +190,158 @@ void SceneGraph::AddCorrespondences(const image_t image_id1,
   }
 }
 
+void SceneGraph::AddCorrespondences(
+    const std::vector<std::pair<image_t, image_t>>& image_pairs,
+    const std::vector<const FeatureMatches*>& matches, const int num_threads) {
+  CHECK_EQ(image_pairs.size(), matches.size());
+
+  // Look up the images serially, since the hash map must not be accessed
+  // concurrently, while the referenced images can be modified independently.
+  std::vector<Image*> images1(image_pairs.size(), nullptr);
+  std::vector<Image*> images2(image_pairs.size(), nullptr);
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    if (image_pairs[i].first != image_pairs[i].second) {
+      images1[i] = &images_.at(image_pairs[i].first);
+      images2[i] = &images_.at(image_pairs[i].second);
+    }
+  }
+
+  // Validate the matches of each image pair in parallel. Within an image pair
+  // a match is a duplicate, if one of its points was already matched by a
+  // previous valid match. The warnings are printed later in the same order as
+  // in the sequential version.
+  std::vector<std::vector<bool>> valid_masks(image_pairs.size());
+  std::vector<std::string> warnings(image_pairs.size());
+
+  auto ValidateMatches = [&](const size_t i) {
+    if (images1[i] == nullptr) {
+      return;
+    }
+
+    const image_t image_id1 = image_pairs[i].first;
+    const image_t image_id2 = image_pairs[i].second;
+    const size_t num_points1 = images1[i]->corrs.size();
+    const size_t num_points2 = images2[i]->corrs.size();
+
+    std::unordered_set<point2D_t> matched_idxs1;
+    std::unordered_set<point2D_t> matched_idxs2;
+    std::vector<bool>& valid_mask = valid_masks[i];
+    valid_mask.resize(matches[i]->size(), false);
+
+    for (size_t j = 0; j < matches[i]->size(); ++j) {
+      const point2D_t point2D_idx1 = (*matches[i])[j].point2D_idx1;
+      const point2D_t point2D_idx2 = (*matches[i])[j].point2D_idx2;
+
+      const bool valid_idx1 = point2D_idx1 < num_points1;
+      const bool valid_idx2 = point2D_idx2 < num_points2;
+
+      if (valid_idx1 && valid_idx2) {
+        if (matched_idxs1.count(point2D_idx1) > 0 ||
+            matched_idxs2.count(point2D_idx2) > 0) {
+          warnings[i] += StringPrintf(
+              "WARNING: Duplicate correspondence between "
+              "point2D_idx=%d in image_id=%d and point2D_idx=%d in "
+              "image_id=%d\n",
+              point2D_idx1, image_id1, point2D_idx2, image_id2);
+        } else {
+          matched_idxs1.insert(point2D_idx1);
+          matched_idxs2.insert(point2D_idx2);
+          valid_mask[j] = true;
+        }
+      } else {
+        if (!valid_idx1) {
+          warnings[i] += StringPrintf(
+              "WARNING: point2D_idx=%d in image_id=%d does not exist\n",
+              point2D_idx1, image_id1);
+        }
+        if (!valid_idx2) {
+          warnings[i] += StringPrintf(
+              "WARNING: point2D_idx=%d in image_id=%d does not exist\n",
+              point2D_idx2, image_id2);
+        }
+      }
+    }
+  };
+
+  ThreadPool thread_pool(num_threads);
+
+  // Process the image pairs in chunks to amortize the cost of a task.
+  const size_t kNumChunksPerThread = 8;
+  const size_t num_chunks = kNumChunksPerThread * thread_pool.NumThreads();
+  const size_t chunk_size =
+      std::max<size_t>(1, (image_pairs.size() + num_chunks - 1) / num_chunks);
+  for (size_t begin = 0; begin < image_pairs.size(); begin += chunk_size) {
+    const size_t end = std::min(begin + chunk_size, image_pairs.size());
+    thread_pool.AddTask([&ValidateMatches, begin, end]() {
+      for (size_t i = begin; i < end; ++i) {
+        ValidateMatches(i);
+      }
+    });
+  }
+  thread_pool.Wait();
+
+  // Update the number of correspondences and collect the image pairs of each
+  // image in the given order.
+  std::unordered_map<Image*, std::vector<size_t>> image_pair_idxs;
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    const image_t image_id1 = image_pairs[i].first;
+    const image_t image_id2 = image_pairs[i].second;
+
+    if (image_id1 == image_id2) {
+      std::cout << "WARNING: Cannot use self-matches for image_id=" << image_id1
+                << std::endl;
+      continue;
+    }
+
+    std::cout << warnings[i];
+
+    const point2D_t num_valid_matches = static_cast<point2D_t>(
+        std::count(valid_masks[i].begin(), valid_masks[i].end(), true));
+
+    images1[i]->num_correspondences += num_valid_matches;
+    images2[i]->num_correspondences += num_valid_matches;
+
+    const image_pair_t pair_id =
+        Database::ImagePairToPairId(image_id1, image_id2);
+    CHECK_EQ(image_pairs_.count(pair_id), 0)
+        << "Image pair " << image_id1 << ", " << image_id2
+        << " added multiple times";
+    image_pairs_.emplace(pair_id, num_valid_matches);
+
+    image_pair_idxs[images1[i]].push_back(i);
+    image_pair_idxs[images2[i]].push_back(i);
+  }
+
+  // Append the correspondences of each image in parallel, which results in
+  // the same order of correspondences as the sequential version.
+  auto AddImageCorrespondences = [&](Image* image,
+                                     const std::vector<size_t>* pair_idxs) {
+    for (const size_t i : *pair_idxs) {
+      const bool is_image1 = images1[i] == image;
+      const image_t other_image_id =
+          is_image1 ? image_pairs[i].second : image_pairs[i].first;
+      const FeatureMatches& pair_matches = *matches[i];
+      for (size_t j = 0; j < pair_matches.size(); ++j) {
+        if (!valid_masks[i][j]) {
+          continue;
+        }
+        if (is_image1) {
+          image->corrs[pair_matches[j].point2D_idx1].emplace_back(
+              other_image_id, pair_matches[j].point2D_idx2);
+        } else {
+          image->corrs[pair_matches[j].point2D_idx2].emplace_back(
+              other_image_id, pair_matches[j].point2D_idx1);
+        }
+      }
+    }
+  };
+
+  for (const auto& image : image_pair_idxs) {
+    thread_pool.AddTask(AddImageCorrespondences, image.first, &image.second);
+  }
+  thread_pool.Wait();
+}
+
 std::vector<SceneGraph::Correspondence>
 SceneGraph::FindTransitiveCorrespondences(const image_t image_id,
                                           const point2D_t point2D_idx,
@@ -209,6 +418,178 @@ SceneGraph::FindCorrespondencesBetweenImages(const image_t image_id1,
   return found_corrs;
 }
 
+bool SceneGraph::WriteSnapshot(const std::string& path,
+                               const uint64_t key) const {
+  // Write to a temporary file that is renamed over the snapshot once it is
+  // complete, such that an interrupted write never leaves a torn snapshot.
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream file(tmp_path, std::ios::trunc | std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  // Sort the images and image pairs to obtain deterministic snapshots.
+  std::vector<image_t> image_ids;
+  image_ids.reserve(images_.size());
+  for (const auto& image : images_) {
+    image_ids.push_back(image.first);
+  }
+  std::sort(image_ids.begin(), image_ids.end());
+
+  std::vector<SnapshotImage> snapshot_images;
+  snapshot_images.reserve(image_ids.size());
+  std::vector<uint32_t> num_point_corrs;
+  size_t num_corrs = 0;
+  for (const image_t image_id : image_ids) {
+    const struct Image& image = images_.at(image_id);
+    SnapshotImage snapshot_image;
+    snapshot_image.image_id = image_id;
+    snapshot_image.num_points2D = static_cast<uint32_t>(image.corrs.size());
+    snapshot_image.num_observations = image.num_observations;
+    snapshot_image.num_correspondences = image.num_correspondences;
+    snapshot_images.push_back(snapshot_image);
+    for (const auto& corrs : image.corrs) {
+      num_point_corrs.push_back(static_cast<uint32_t>(corrs.size()));
+      num_corrs += corrs.size();
+    }
+  }
+
+  std::vector<SnapshotImagePair> snapshot_image_pairs;
+  snapshot_image_pairs.reserve(image_pairs_.size());
+  for (const auto& image_pair : image_pairs_) {
+    SnapshotImagePair snapshot_image_pair;
+    snapshot_image_pair.pair_id = image_pair.first;
+    snapshot_image_pair.num_correspondences = image_pair.second;
+    snapshot_image_pair.reserved = 0;
+    snapshot_image_pairs.push_back(snapshot_image_pair);
+  }
+  std::sort(snapshot_image_pairs.begin(), snapshot_image_pairs.end(),
+            [](const SnapshotImagePair& pair1, const SnapshotImagePair& pair2) {
+              return pair1.pair_id < pair2.pair_id;
+            });
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  header.version = kSnapshotVersion;
+  header.key = key;
+  header.num_images = snapshot_images.size();
+  header.num_image_pairs = snapshot_image_pairs.size();
+  header.num_points2D = num_point_corrs.size();
+  header.num_correspondences = num_corrs;
+
+  WritePadded(&header, sizeof(header), &file);
+  WritePadded(snapshot_images.data(),
+              snapshot_images.size() * sizeof(SnapshotImage), &file);
+  WritePadded(snapshot_image_pairs.data(),
+              snapshot_image_pairs.size() * sizeof(SnapshotImagePair), &file);
+  WritePadded(num_point_corrs.data(),
+              num_point_corrs.size() * sizeof(uint32_t), &file);
+  for (const image_t image_id : image_ids) {
+    for (const auto& corrs : images_.at(image_id).corrs) {
+      file.write(reinterpret_cast<const char*>(corrs.data()),
+                 corrs.size() * sizeof(Correspondence));
+    }
+  }
+
+  file.close();
+  if (!file.good()) {
+    boost::filesystem::remove(tmp_path);
+    return false;
+  }
+
+  boost::system::error_code error_code;
+  boost::filesystem::rename(tmp_path, path, error_code);
+  return !error_code;
+}
+
+bool SceneGraph::ReadSnapshot(const std::string& path, const uint64_t key) {
+  if (!boost::filesystem::exists(path) ||
+      boost::filesystem::file_size(path) < sizeof(SnapshotHeader)) {
+    return false;
+  }
+
+  const boost::interprocess::file_mapping file_mapping(
+      path.c_str(), boost::interprocess::read_only);
+  const boost::interprocess::mapped_region mapped_region(
+      file_mapping, boost::interprocess::read_only);
+  const char* data = static_cast<const char*>(mapped_region.get_address());
+
+  SnapshotHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+      header.version != kSnapshotVersion || header.key != key) {
+    return false;
+  }
+
+  const size_t images_offset = sizeof(SnapshotHeader);
+  const size_t image_pairs_offset =
+      images_offset + PaddedSize(header.num_images * sizeof(SnapshotImage));
+  const size_t num_point_corrs_offset =
+      image_pairs_offset +
+      PaddedSize(header.num_image_pairs * sizeof(SnapshotImagePair));
+  const size_t corrs_offset =
+      num_point_corrs_offset +
+      PaddedSize(header.num_points2D * sizeof(uint32_t));
+  if (mapped_region.get_size() !=
+      corrs_offset + header.num_correspondences * sizeof(Correspondence)) {
+    std::cout << "WARNING: Ignoring corrupt scene graph snapshot " << path
+              << std::endl;
+    return false;
+  }
+
+  const SnapshotImage* snapshot_images =
+      reinterpret_cast<const SnapshotImage*>(data + images_offset);
+  const SnapshotImagePair* snapshot_image_pairs =
+      reinterpret_cast<const SnapshotImagePair*>(data + image_pairs_offset);
+  const uint32_t* num_point_corrs =
+      reinterpret_cast<const uint32_t*>(data + num_point_corrs_offset);
+  const Correspondence* corrs =
+      reinterpret_cast<const Correspondence*>(data + corrs_offset);
+
+  // Validate the number of correspondences before modifying the scene graph.
+  size_t num_points2D = 0;
+  for (size_t i = 0; i < header.num_images; ++i) {
+    num_points2D += snapshot_images[i].num_points2D;
+  }
+  size_t num_corrs = 0;
+  if (num_points2D == header.num_points2D) {
+    for (size_t i = 0; i < num_points2D; ++i) {
+      num_corrs += num_point_corrs[i];
+    }
+  }
+  if (num_points2D != header.num_points2D ||
+      num_corrs != header.num_correspondences) {
+    std::cout << "WARNING: Ignoring corrupt scene graph snapshot " << path
+              << std::endl;
+    return false;
+  }
+
+  images_.clear();
+  images_.reserve(header.num_images);
+  for (size_t i = 0; i < header.num_images; ++i) {
+    const SnapshotImage& snapshot_image = snapshot_images[i];
+    struct Image& image = images_[snapshot_image.image_id];
+    image.num_observations = snapshot_image.num_observations;
+    image.num_correspondences = snapshot_image.num_correspondences;
+    image.corrs.resize(snapshot_image.num_points2D);
+    for (auto& point_corrs : image.corrs) {
+      point_corrs.assign(corrs, corrs + *num_point_corrs);
+      corrs += *num_point_corrs;
+      num_point_corrs += 1;
+    }
+  }
+
+  image_pairs_.clear();
+  image_pairs_.reserve(header.num_image_pairs);
+  for (size_t i = 0; i < header.num_image_pairs; ++i) {
+    image_pairs_.emplace(snapshot_image_pairs[i].pair_id,
+                         snapshot_image_pairs[i].num_correspondences);
+  }
+
+  return true;
+}
+
 bool SceneGraph::IsTwoViewObservation(const image_t image_id,
                                       const point2D_t point2D_idx) const {
   const struct Image& image = images_.at(image_id);
@@ -17,7 +17,9 @@
 #ifndef COLMAP_SRC_BASE_SCENE_GRAPH_H_
 #define COLMAP_SRC_BASE_SCENE_GRAPH_H_
 
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "base/database.h"
@@ -83,6 +85,29 @@ class SceneGraph {
   void AddCorrespondences(const image_t image_id1, const image_t image_id2,
                           const FeatureMatches& matches);
 
+  // Add matches between many image pairs at once using multiple threads. The
+  // result is the same as calling `AddCorrespondences` for each image pair in
+  // the given order, but the validation of the matches and the construction
+  // of the correspondences is distributed over the images. Each image pair
+  // must only occur once and must not have been added before.
+  void AddCorrespondences(
+      const std::vector<std::pair<image_t, image_t>>& image_pairs,
+      const std::vector<const FeatureMatches*>& matches,
+      const int num_threads = -1);
+
+  // Write the finalized scene graph to a binary snapshot, which stores the
+  // correspondences of all images as flat arrays. The given key identifies
+  // the data from which the scene graph was built and is checked when the
+  // snapshot is read. The snapshot is written to a temporary file that then
+  // replaces the given path, so an interrupted write leaves any previous
+  // snapshot intact. Returns false if the file could not be written.
+  bool WriteSnapshot(const std::string& path, const uint64_t key) const;
+
+  // Replace the scene graph with the contents of a memory-mapped snapshot.
+  // Returns false and leaves the scene graph unchanged, if the file does not
+  // exist, has a different version or key, or is corrupt.
+  bool ReadSnapshot(const std::string& path, const uint64_t key);
+
   // Find the correspondence of an image point to any other image.
   inline const std::vector<Correspondence>& FindCorrespondences(
       const image_t image_id, const point2D_t point2D_idx) const;
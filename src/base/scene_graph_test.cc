@@ -18,6 +18,8 @@
 #define BOOST_TEST_MODULE "base/scene_graph"
 #include <boost/test/unit_test.hpp>
 
+#include <boost/filesystem.hpp>
+
 #include "base/scene_graph.h"
 
 using namespace colmap;
@@ -317,3 +319,129 @@ BOOST_AUTO_TEST_CASE(TestDuplicate) {
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().at(pair_id),
                     3);
 }
+
+BOOST_AUTO_TEST_CASE(TestAddCorrespondencesBatch) {
+  const image_t kNumImages = 6;
+  const point2D_t kNumPoints2D = 50;
+
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+  std::vector<FeatureMatches> matches;
+  for (image_t image_id1 = 0; image_id1 < kNumImages; ++image_id1) {
+    for (image_t image_id2 = image_id1 + 1; image_id2 < kNumImages;
+         ++image_id2) {
+      image_pairs.emplace_back(image_id1, image_id2);
+      FeatureMatches pair_matches;
+      for (point2D_t i = 0; i < 30; ++i) {
+        FeatureMatch match;
+        // Includes duplicate and out of bounds indices.
+        match.point2D_idx1 = (i * (image_id1 + 3)) % (kNumPoints2D + 5);
+        match.point2D_idx2 = (i * (image_id2 + 1)) % kNumPoints2D;
+        pair_matches.push_back(match);
+      }
+      matches.push_back(pair_matches);
+    }
+  }
+
+  // Self-matches are ignored.
+  image_pairs.emplace_back(0, 0);
+  matches.emplace_back(1);
+
+  SceneGraph scene_graph1;
+  SceneGraph scene_graph2;
+  for (image_t image_id = 0; image_id < kNumImages; ++image_id) {
+    scene_graph1.AddImage(image_id, kNumPoints2D);
+    scene_graph2.AddImage(image_id, kNumPoints2D);
+  }
+
+  std::vector<const FeatureMatches*> matches_ptrs;
+  for (size_t i = 0; i < image_pairs.size(); ++i) {
+    scene_graph1.AddCorrespondences(image_pairs[i].first,
+                                    image_pairs[i].second, matches[i]);
+    matches_ptrs.push_back(&matches[i]);
+  }
+
+  scene_graph2.AddCorrespondences(image_pairs, matches_ptrs, 3);
+
+  scene_graph1.Finalize();
+  scene_graph2.Finalize();
+
+  BOOST_CHECK_EQUAL(scene_graph1.NumImages(), scene_graph2.NumImages());
+  BOOST_CHECK(scene_graph1.NumCorrespondencesBetweenImages() ==
+              scene_graph2.NumCorrespondencesBetweenImages());
+  for (image_t image_id = 0; image_id < kNumImages; ++image_id) {
+    BOOST_CHECK_EQUAL(scene_graph1.NumObservationsForImage(image_id),
+                      scene_graph2.NumObservationsForImage(image_id));
+    BOOST_CHECK_EQUAL(scene_graph1.NumCorrespondencesForImage(image_id),
+                      scene_graph2.NumCorrespondencesForImage(image_id));
+    for (point2D_t point2D_idx = 0; point2D_idx < kNumPoints2D;
+         ++point2D_idx) {
+      const auto& corrs1 =
+          scene_graph1.FindCorrespondences(image_id, point2D_idx);
+      const auto& corrs2 =
+          scene_graph2.FindCorrespondences(image_id, point2D_idx);
+      BOOST_CHECK_EQUAL(corrs1.size(), corrs2.size());
+      for (size_t i = 0; i < std::min(corrs1.size(), corrs2.size()); ++i) {
+        BOOST_CHECK_EQUAL(corrs1[i].image_id, corrs2[i].image_id);
+        BOOST_CHECK_EQUAL(corrs1[i].point2D_idx, corrs2[i].point2D_idx);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestSnapshot) {
+  SceneGraph scene_graph;
+  scene_graph.AddImage(0, 10);
+  scene_graph.AddImage(1, 10);
+  scene_graph.AddImage(2, 10);
+  FeatureMatches matches01(2);
+  matches01[0].point2D_idx1 = 0;
+  matches01[0].point2D_idx2 = 0;
+  matches01[1].point2D_idx1 = 3;
+  matches01[1].point2D_idx2 = 4;
+  scene_graph.AddCorrespondences(0, 1, matches01);
+  FeatureMatches matches12(1);
+  matches12[0].point2D_idx1 = 0;
+  matches12[0].point2D_idx2 = 9;
+  scene_graph.AddCorrespondences(1, 2, matches12);
+  scene_graph.Finalize();
+
+  const std::string path = (boost::filesystem::temp_directory_path() /
+                            boost::filesystem::unique_path("%%%%-%%%%-%%%%"))
+                               .string();
+
+  SceneGraph read_scene_graph;
+  BOOST_CHECK(!read_scene_graph.ReadSnapshot(path, 1));
+  BOOST_CHECK(scene_graph.WriteSnapshot(path, 1));
+  BOOST_CHECK(!boost::filesystem::exists(path + ".tmp"));
+  BOOST_CHECK(!read_scene_graph.ReadSnapshot(path, 2));
+  BOOST_CHECK_EQUAL(read_scene_graph.NumImages(), 0);
+  BOOST_CHECK(read_scene_graph.ReadSnapshot(path, 1));
+
+  BOOST_CHECK_EQUAL(read_scene_graph.NumImages(), 3);
+  BOOST_CHECK(read_scene_graph.NumCorrespondencesBetweenImages() ==
+              scene_graph.NumCorrespondencesBetweenImages());
+  for (image_t image_id = 0; image_id < 3; ++image_id) {
+    BOOST_CHECK_EQUAL(read_scene_graph.NumObservationsForImage(image_id),
+                      scene_graph.NumObservationsForImage(image_id));
+    BOOST_CHECK_EQUAL(read_scene_graph.NumCorrespondencesForImage(image_id),
+                      scene_graph.NumCorrespondencesForImage(image_id));
+    for (point2D_t point2D_idx = 0; point2D_idx < 10; ++point2D_idx) {
+      const auto& corrs =
+          scene_graph.FindCorrespondences(image_id, point2D_idx);
+      const auto& read_corrs =
+          read_scene_graph.FindCorrespondences(image_id, point2D_idx);
+      BOOST_REQUIRE_EQUAL(read_corrs.size(), corrs.size());
+      for (size_t i = 0; i < corrs.size(); ++i) {
+        BOOST_CHECK_EQUAL(read_corrs[i].image_id, corrs[i].image_id);
+        BOOST_CHECK_EQUAL(read_corrs[i].point2D_idx, corrs[i].point2D_idx);
+      }
+    }
+  }
+
+  // Truncated snapshots are ignored.
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 8);
+  BOOST_CHECK(!read_scene_graph.ReadSnapshot(path, 1));
+  BOOST_CHECK_EQUAL(read_scene_graph.NumImages(), 3);
+
+  boost::filesystem::remove(path);
+}
@@ -0,0 +1,112 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <boost/filesystem.hpp>
+
+#include "base/database.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/option_manager.h"
+#include "util/timer.h"
+
+using namespace colmap;
+
+// Merge the shard databases of a distributed feature extraction or matching
+// into the original database, in the given order of the shards.
+//
+// For feature extraction, each shard is a database, in which the extractor
+// was run with `--ExtractionOptions.reader_num_shards N` and a unique
+// `--ExtractionOptions.reader_shard_index`. Their cameras, images, and features
+// are appended to the original database. With `--single_camera 1`, all merged
+// images share a single camera.
+//
+// For feature matching, each shard is a copy of the original database, in
+// which a matcher was run with `--MatchOptions.num_shards N` and a unique
+// `--MatchOptions.shard_index`.
+int main(int argc, char** argv) {
+  InitializeGlog(argv);
+
+  std::string shard_paths;
+  bool single_camera = false;
+
+  OptionManager options;
+  options.AddDatabaseOptions();
+  options.AddRequiredOption("shard_paths", &shard_paths);
+  options.AddDefaultOption("single_camera", single_camera, &single_camera);
+
+  if (!options.Parse(argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  if (options.ParseHelp(argc, argv)) {
+    return EXIT_SUCCESS;
+  }
+
+  PrintHeading1("Merging database shards");
+
+  Timer timer;
+  timer.Start();
+
+  Database database(*options.database_path);
+
+  size_t num_merged_shards = 0;
+  for (const auto& shard_path : CSVToVector<std::string>(shard_paths)) {
+    std::cout << "Merging " << shard_path << std::endl;
+
+    if (!boost::filesystem::exists(shard_path)) {
+      std::cout << "WARNING: Shard does not exist, skipping." << std::endl;
+      continue;
+    }
+
+    // Update the schema of the shard, if it was created by an older version.
+    bool has_matches = false;
+    {
+      Database shard_database(shard_path);
+      has_matches = shard_database.NumMatchedImagePairs() > 0 ||
+                    shard_database.NumVerifiedImagePairs() > 0;
+    }
+
+    size_t num_merged_images = 0;
+    if (!database.MergeFeatures(shard_path, single_camera,
+                                &num_merged_images)) {
+      continue;
+    }
+
+    std::cout << StringPrintf("  Merged %d images", num_merged_images)
+              << std::endl;
+
+    if (has_matches) {
+      size_t num_merged_matches = 0;
+      size_t num_merged_inlier_matches = 0;
+      if (!database.MergeMatches(shard_path, &num_merged_matches,
+                                 &num_merged_inlier_matches)) {
+        continue;
+      }
+      std::cout << StringPrintf("  Merged %d matches and %d inlier matches",
+                                num_merged_matches, num_merged_inlier_matches)
+                << std::endl;
+    }
+
+    num_merged_shards += 1;
+  }
+
+  std::cout << StringPrintf("Merged %d shards", num_merged_shards)
+            << std::endl;
+
+  timer.PrintMinutes();
+
+  return EXIT_SUCCESS;
+}
@@ -27,6 +27,7 @@ int main(int argc, char** argv) {
 
   std::string import_path;
   std::string image_list_path;
+  int num_threads = -1;
 
   OptionManager options;
   options.AddDatabaseOptions();
@@ -35,6 +36,7 @@ int main(int argc, char** argv) {
   options.AddRequiredOption("import_path", &import_path);
   options.AddDefaultOption("image_list_path", image_list_path,
                            &image_list_path);
+  options.AddDefaultOption("num_threads", num_threads, &num_threads);
 
   if (!options.Parse(argc, argv)) {
     return EXIT_FAILURE;
@@ -63,7 +65,7 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
-  FeatureImporter feature_importer(reader_options, import_path);
+  FeatureImporter feature_importer(reader_options, import_path, num_threads);
   feature_importer.Start();
   feature_importer.Wait();
 
@@ -0,0 +1,64 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2016  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "base/database.h"
+#include "base/feature_store.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/option_manager.h"
+#include "util/timer.h"
+
+using namespace colmap;
+
+int main(int argc, char** argv) {
+  InitializeGlog(argv);
+
+  std::string output_path;
+
+  OptionManager options;
+  options.AddDatabaseOptions();
+  options.AddDefaultOption("output_path", output_path, &output_path);
+
+  if (!options.Parse(argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  if (options.ParseHelp(argc, argv)) {
+    return EXIT_SUCCESS;
+  }
+
+  if (output_path.empty()) {
+    output_path = FeatureStore::DefaultPath(*options.database_path);
+  }
+
+  PrintHeading1("Building feature store");
+
+  Timer timer;
+  timer.Start();
+
+  Database database(*options.database_path);
+  FeatureStore::Write(output_path, database);
+
+  const FeatureStore feature_store(output_path);
+  std::cout << StringPrintf("Wrote %d features of %d images to %s",
+                            feature_store.NumFeatures(),
+                            feature_store.NumImages(), output_path.c_str())
+            << std::endl;
+
+  timer.PrintMinutes();
+
+  return EXIT_SUCCESS;
+}
@@ -16,6 +16,7 @@
 
 #include <boost/filesystem.hpp>
 
+#include "base/feature_store.h"
 #include "sfm/controllers.h"
 #include "util/logging.h"
 #include "util/misc.h"
@@ -66,7 +67,13 @@ int main(int argc, char** argv) {
         static_cast<size_t>(options.mapper_options->min_num_matches);
     database_cache.Load(database, min_num_matches,
                         options.mapper_options->ignore_watermarks,
-                        options.mapper_options->image_names);
+                        options.mapper_options->image_names,
+                        FeatureStore::DefaultPath(*options.database_path),
+                        options.mapper_options->num_threads,
+                        options.mapper_options->scene_graph_snapshot
+                            ? DatabaseCache::DefaultSceneGraphPath(
+                                  *options.database_path)
+                            : "");
     std::cout << std::endl;
     timer.PrintMinutes();
   }
@@ -0,0 +1,189 @@
+/** @file imopv_avx.c
+ ** @brief Vectorized image operations - AVX - Definition
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#if ! defined(VL_DISABLE_AVX) & ! defined(__AVX__)
+#error "Compiling with AVX enabled, but no __AVX__ defined"
+#endif
+
+#if ! defined(VL_DISABLE_AVX)
+
+#ifndef VL_IMOPV_AVX_INSTANTIATING
+
+#include <immintrin.h>
+
+#include "imopv.h"
+#include "imopv_avx.h"
+
+#define FLT VL_TYPE_FLOAT
+#define VL_IMOPV_AVX_INSTANTIATING
+#include "imopv_avx.c"
+
+#define FLT VL_TYPE_DOUBLE
+#define VL_IMOPV_AVX_INSTANTIATING
+#include "imopv_avx.c"
+
+/* ---------------------------------------------------------------- */
+/* VL_IMOPV_AVX_INSTANTIATING */
+#else
+
+#include "float.th"
+
+/* ---------------------------------------------------------------- */
+/* Same as _vl_imconvcol_v*_sse2, but processes VSIZEavx columns at
+ * once. The columns are loaded unaligned, such that the vectorized
+ * path is also taken for image widths that are not a multiple of
+ * the vector size. The filter taps are accumulated in the same order
+ * as in the scalar code, hence the results are identical.
+ */
+
+void
+VL_XCAT3(_vl_imconvcol_v, SFX, _avx)
+(T* dst, vl_size dst_stride,
+ T const* src,
+ vl_size src_width, vl_size src_height, vl_size src_stride,
+ T const* filt, vl_index filt_begin, vl_index filt_end,
+ int step, unsigned int flags)
+{
+  vl_index x = 0 ;
+  vl_index y ;
+  vl_index i ;
+  vl_index dheight = (src_height - 1) / step + 1 ;
+  vl_bool transp    = flags & VL_TRANSPOSE ;
+  vl_bool zeropad   = (flags & VL_PAD_MASK) == VL_PAD_BY_ZERO ;
+
+  /* let filt point to the last sample of the filter */
+  filt += filt_end - filt_begin ;
+
+  while (x < (signed)src_width) {
+    T const *filti ;
+    vl_index stop ;
+
+    if (x + VSIZEavx <= (signed)src_width) {
+      /* ----------------------------------------------  Vectorized */
+      for (y = 0 ; y < (signed)src_height ; y += step)  {
+        union {VTYPEavx v ; T x [VSIZEavx] ; } acc ;
+        VTYPEavx v, c ;
+        T const *srci ;
+        acc.v = VSTZavx () ;
+        v = VSTZavx () ;
+
+        filti = filt ;
+        stop = filt_end - y ;
+        srci = src + x - stop * src_stride ;
+
+        if (stop > 0) {
+          if (zeropad) {
+            v = VSTZavx () ;
+          } else {
+            v = VLDUavx (src + x) ;
+          }
+          while (filti > filt - stop) {
+            c = VLD1avx (filti--) ;
+            acc.v = VADDavx (acc.v,  VMULavx (v, c)) ;
+            srci += src_stride ;
+          }
+        }
+
+        stop = filt_end - VL_MAX(filt_begin, y - (signed)src_height + 1) + 1 ;
+        while (filti > filt - stop) {
+          v = VLDUavx (srci) ;
+          c = VLD1avx (filti--) ;
+          acc.v = VADDavx (acc.v, VMULavx (v, c)) ;
+          srci += src_stride ;
+        }
+
+        if (zeropad) v = VSTZavx () ;
+
+        stop = filt_end - filt_begin + 1;
+        while (filti > filt - stop) {
+          c = VLD1avx (filti--) ;
+          acc.v = VADDavx (acc.v, VMULavx (v, c)) ;
+        }
+
+        if (transp) {
+          for (i = 0 ; i < VSIZEavx ; ++i) {
+            *dst = acc.x[i] ; dst += dst_stride ;
+          }
+          dst += 1 * 1 - VSIZEavx * dst_stride ;
+        } else {
+          VST2Uavx (dst, acc.v) ;
+          dst += 1 * dst_stride ;
+        }
+      } /* next y */
+      if (transp) {
+        dst += VSIZEavx * dst_stride - dheight * 1 ;
+      } else {
+        dst += VSIZEavx * 1 - dheight * dst_stride ;
+      }
+      x += VSIZEavx ;
+    } else {
+      /* -------------------------------------------------  Vanilla */
+      for (y = 0 ; y < (signed)src_height ; y += step) {
+        T acc = 0 ;
+        T v = 0, c ;
+        T const* srci ;
+
+        filti = filt ;
+        stop = filt_end - y ;
+        srci = src + x - stop * src_stride ;
+
+        if (stop > 0) {
+          if (zeropad) {
+            v = 0 ;
+          } else {
+            v = *(src + x) ;
+          }
+          while (filti > filt - stop) {
+            c = *filti-- ;
+            acc += v * c ;
+            srci += src_stride ;
+          }
+        }
+
+        stop = filt_end - VL_MAX(filt_begin, y - (signed)src_height + 1) + 1 ;
+        while (filti > filt - (signed)stop) {
+          v = *srci ;
+          c = *filti-- ;
+          acc += v * c ;
+          srci += src_stride ;
+        }
+
+        if (zeropad) v = 0 ;
+
+        stop = filt_end - filt_begin + 1 ;
+        while (filti > filt - stop) {
+          c = *filti-- ;
+          acc += v * c ;
+        }
+
+        if (transp) {
+          *dst = acc ; dst += 1 ;
+        } else {
+          *dst = acc ; dst += dst_stride ;
+        }
+      } /* next y */
+      if (transp) {
+        dst += 1 * dst_stride - dheight * 1 ;
+      } else {
+        dst += 1 * 1 - dheight * dst_stride ;
+      }
+      x += 1 ;
+    } /* next x */
+  }
+}
+
+#undef FLT
+#undef VL_IMOPV_AVX_INSTANTIATING
+#endif
+
+/* ! VL_DISABLE_AVX */
+#endif
@@ -656,6 +656,8 @@ Gaussian window size is set to have standard deviation
 **/
 
 #include "sift.h"
+#include "sift_sse2.h"
+#include "sift_avx.h"
 #include "imopv.h"
 #include "mathop.h"
 
@@ -1138,6 +1140,45 @@ vl_sift_process_next_octave (VlSiftFilt *f)
   return VL_ERR_OK ;
 }
 
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Compute the difference of two scale space levels
+ **
+ ** @param dog    output buffer.
+ ** @param src_a  lower level.
+ ** @param src_b  upper level.
+ ** @param n      number of pixels.
+ **
+ ** The function dispatches to the fastest available implementation,
+ ** all of which produce identical results.
+ **/
+
+static void
+_vl_sift_dog (vl_sift_pix* dog,
+              vl_sift_pix const* src_a, vl_sift_pix const* src_b,
+              vl_size n)
+{
+  vl_sift_pix const* end_a = src_a + n ;
+
+#ifndef VL_DISABLE_AVX
+  if (vl_cpu_has_avx() && vl_get_simd_enabled()) {
+    _vl_sift_dog_avx (dog, src_a, src_b, n) ;
+    return ;
+  }
+#endif
+
+#ifndef VL_DISABLE_SSE2
+  if (vl_cpu_has_sse2() && vl_get_simd_enabled()) {
+    _vl_sift_dog_sse2 (dog, src_a, src_b, n) ;
+    return ;
+  }
+#endif
+
+  while (src_a != end_a) {
+    *dog++ = *src_b++ - *src_a++ ;
+  }
+}
+
 /** ------------------------------------------------------------------
  ** @brief Detect keypoints
  **
@@ -1178,10 +1219,8 @@ vl_sift_detect (VlSiftFilt * f)
   for (s = s_min ; s <= s_max - 1 ; ++s) {
     vl_sift_pix* src_a = vl_sift_get_octave (f, s    ) ;
     vl_sift_pix* src_b = vl_sift_get_octave (f, s + 1) ;
-    vl_sift_pix* end_a = src_a + w * h ;
-    while (src_a != end_a) {
-      *pt++ = *src_b++ - *src_a++ ;
-    }
+    _vl_sift_dog (pt, src_a, src_b, w * h) ;
+    pt += w * h ;
   }
 
   /* -----------------------------------------------------------------
@@ -1443,6 +1482,41 @@ vl_sift_detect (VlSiftFilt * f)
  ** @remark The minimum octave size is 2x2xS.
  **/
 
+/** ------------------------------------------------------------------
+ ** @internal
+ ** @brief Compute the gradient of interior pixels using SIMD instructions
+ **
+ ** @param grad  output gradient (modulus and angle interleaved).
+ ** @param src   first pixel.
+ ** @param n     number of pixels in the row.
+ ** @param yo    y-stride.
+ **
+ ** The function computes the gradient of the leading pixels of a
+ ** row, which must have neighbors in all four directions, and returns
+ ** the number of processed pixels. The remaining pixels, or all
+ ** pixels if no SIMD instructions are available, must be processed
+ ** by the caller. The results are identical to the scalar code.
+ **/
+
+static vl_size
+_vl_sift_gradient_simd (vl_sift_pix* grad, vl_sift_pix const* src,
+                        vl_size n, vl_size yo)
+{
+#ifndef VL_DISABLE_AVX
+  if (vl_cpu_has_avx() && vl_get_simd_enabled()) {
+    return _vl_sift_gradient_avx (grad, src, n, yo) ;
+  }
+#endif
+
+#ifndef VL_DISABLE_SSE2
+  if (vl_cpu_has_sse2() && vl_get_simd_enabled()) {
+    return _vl_sift_gradient_sse2 (grad, src, n, yo) ;
+  }
+#endif
+
+  return 0 ;
+}
+
 static void
 update_gradient (VlSiftFilt *f)
 {
@@ -1497,6 +1571,11 @@ update_gradient (VlSiftFilt *f)
 
       /* middle pixels of the middle rows */
       end = (src - 1) + w - 1 ;
+      {
+        vl_size n = _vl_sift_gradient_simd (grad, src, end - src, yo) ;
+        src  += n ;
+        grad += 2 * n ;
+      }
       while (src < end) {
         gx = 0.5 * (src[+xo] - src[-xo]) ;
         gy = 0.5 * (src[+yo] - src[-yo]) ;
@@ -0,0 +1,129 @@
+/** @file sift_avx.c
+ ** @brief Vectorized SIFT operations - AVX - Definition
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#if ! defined(VL_DISABLE_AVX) & ! defined(__AVX__)
+#error "Compiling with AVX enabled, but no __AVX__ defined"
+#endif
+
+#if ! defined(VL_DISABLE_AVX)
+
+#include <immintrin.h>
+
+#include "mathop.h"
+#include "sift_avx.h"
+
+/* The functions below evaluate the same floating point operations in
+ * the same order as the scalar code in sift.c (vl_fast_sqrt_f,
+ * vl_fast_atan2_f, vl_mod_2pi_f), hence the results are identical.
+ * AVX lacks 256 bit integer operations, so the initial guess of the
+ * inverse square root is computed on the two 128 bit halves.
+ */
+
+VL_INLINE __m256
+_vl_fast_sqrt_avx (__m256 x)
+{
+  __m256 const xhalf = _mm256_mul_ps (_mm256_set1_ps (0.5F), x) ;
+  __m256 const three_halfs = _mm256_set1_ps (1.5F) ;
+  __m128i const magic = _mm_set1_epi32 (0x5f3759df) ;
+  __m128i const lo = _mm_sub_epi32
+    (magic, _mm_srli_epi32 (_mm_castps_si128 (_mm256_castps256_ps128 (x)), 1)) ;
+  __m128i const hi = _mm_sub_epi32
+    (magic, _mm_srli_epi32 (_mm_castps_si128 (_mm256_extractf128_ps (x, 1)), 1)) ;
+  __m256 u = _mm256_insertf128_ps
+    (_mm256_castps128_ps256 (_mm_castsi128_ps (lo)), _mm_castsi128_ps (hi), 1) ;
+  u = _mm256_mul_ps (u, _mm256_sub_ps
+    (three_halfs, _mm256_mul_ps (_mm256_mul_ps (xhalf, u), u))) ;
+  u = _mm256_mul_ps (u, _mm256_sub_ps
+    (three_halfs, _mm256_mul_ps (_mm256_mul_ps (xhalf, u), u))) ;
+  /* (double) x < 1e-8 is equivalent to x <= 1e-8F */
+  return _mm256_andnot_ps (_mm256_cmp_ps (x, _mm256_set1_ps (1e-8F), _CMP_LE_OQ),
+                           _mm256_mul_ps (x, u)) ;
+}
+
+VL_INLINE __m256
+_vl_fast_atan2_avx (__m256 y, __m256 x)
+{
+  __m256 const sign = _mm256_set1_ps (-0.0F) ;
+  __m256 const zero = _mm256_setzero_ps () ;
+  __m256 const abs_y = _mm256_add_ps (_mm256_andnot_ps (sign, y),
+                                      _mm256_set1_ps (VL_EPSILON_F)) ;
+  __m256 const pos = _mm256_cmp_ps (x, zero, _CMP_GE_OQ) ;
+  __m256 const r = _mm256_div_ps
+    (_mm256_blendv_ps (_mm256_add_ps (x, abs_y), _mm256_sub_ps (x, abs_y), pos),
+     _mm256_blendv_ps (_mm256_sub_ps (abs_y, x), _mm256_add_ps (x, abs_y), pos)) ;
+  __m256 angle = _mm256_blendv_ps (_mm256_set1_ps ((float) (3 * VL_PI / 4)),
+                                   _mm256_set1_ps ((float) (VL_PI / 4)), pos) ;
+  angle = _mm256_add_ps
+    (angle, _mm256_mul_ps (_mm256_sub_ps (_mm256_mul_ps (_mm256_mul_ps (_mm256_set1_ps (0.1821F), r), r),
+                                          _mm256_set1_ps (0.9675F)), r)) ;
+  return _mm256_xor_ps (angle, _mm256_and_ps (_mm256_cmp_ps (y, zero, _CMP_LT_OQ), sign)) ;
+}
+
+VL_INLINE __m256
+_vl_angle_mod_2pi_avx (__m256 angle)
+{
+  /* the offset is added in double precision as in the scalar code */
+  __m256d const two_pi = _mm256_set1_pd (2 * VL_PI) ;
+  __m256 const two_pi_f = _mm256_set1_ps ((float) (2 * VL_PI)) ;
+  __m128 const lo = _mm256_cvtpd_ps (_mm256_add_pd
+    (_mm256_cvtps_pd (_mm256_castps256_ps128 (angle)), two_pi)) ;
+  __m128 const hi = _mm256_cvtpd_ps (_mm256_add_pd
+    (_mm256_cvtps_pd (_mm256_extractf128_ps (angle, 1)), two_pi)) ;
+  __m256 x = _mm256_insertf128_ps (_mm256_castps128_ps256 (lo), hi, 1) ;
+  /* the angle is in the range [-pi, pi], hence one step suffices */
+  x = _mm256_sub_ps (x, _mm256_and_ps (_mm256_cmp_ps (x, two_pi_f, _CMP_GT_OQ),
+                                       two_pi_f)) ;
+  return x ;
+}
+
+void
+_vl_sift_dog_avx (float* dog,
+                  float const* src_a, float const* src_b,
+                  vl_size n)
+{
+  vl_size i = 0 ;
+  for ( ; i + 8 <= n ; i += 8) {
+    _mm256_storeu_ps (dog + i, _mm256_sub_ps (_mm256_loadu_ps (src_b + i),
+                                              _mm256_loadu_ps (src_a + i))) ;
+  }
+  for ( ; i < n ; ++i) {
+    dog [i] = src_b [i] - src_a [i] ;
+  }
+}
+
+vl_size
+_vl_sift_gradient_avx (float* grad, float const* src,
+                       vl_size n, vl_size yo)
+{
+  __m256 const half = _mm256_set1_ps (0.5F) ;
+  vl_size i = 0 ;
+  for ( ; i + 8 <= n ; i += 8) {
+    float const* pt = src + i ;
+    __m256 const gx = _mm256_mul_ps (half, _mm256_sub_ps (_mm256_loadu_ps (pt + 1),
+                                                          _mm256_loadu_ps (pt - 1))) ;
+    __m256 const gy = _mm256_mul_ps (half, _mm256_sub_ps (_mm256_loadu_ps (pt + yo),
+                                                          _mm256_loadu_ps (pt - yo))) ;
+    __m256 const mod = _vl_fast_sqrt_avx
+      (_mm256_add_ps (_mm256_mul_ps (gx, gx), _mm256_mul_ps (gy, gy))) ;
+    __m256 const angle = _vl_angle_mod_2pi_avx (_vl_fast_atan2_avx (gy, gx)) ;
+    /* interleave the magnitudes and angles within the 128 bit lanes
+     * and then reorder the lanes */
+    __m256 const lo = _mm256_unpacklo_ps (mod, angle) ;
+    __m256 const hi = _mm256_unpackhi_ps (mod, angle) ;
+    _mm256_storeu_ps (grad + 2 * i,     _mm256_permute2f128_ps (lo, hi, 0x20)) ;
+    _mm256_storeu_ps (grad + 2 * i + 8, _mm256_permute2f128_ps (lo, hi, 0x31)) ;
+  }
+  return i ;
+}
+
+/* ! VL_DISABLE_AVX */
+#endif
@@ -0,0 +1,32 @@
+/** @file sift_avx.h
+ ** @brief Vectorized SIFT operations - AVX
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_SIFT_AVX_H
+#define VL_SIFT_AVX_H
+
+#include "generic.h"
+
+#ifndef VL_DISABLE_AVX
+
+VL_EXPORT
+void _vl_sift_dog_avx (float* dog,
+                       float const* src_a, float const* src_b,
+                       vl_size n) ;
+
+VL_EXPORT
+vl_size _vl_sift_gradient_avx (float* grad, float const* src,
+                               vl_size n, vl_size yo) ;
+
+#endif
+
+/* VL_SIFT_AVX_H */
+#endif
@@ -0,0 +1,124 @@
+/** @file sift_sse2.c
+ ** @brief Vectorized SIFT operations - SSE2 - Definition
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#if ! defined(VL_DISABLE_SSE2) & ! defined(__SSE2__)
+#error "Compiling with SSE2 enabled, but no __SSE2__ defined"
+#endif
+
+#if ! defined(VL_DISABLE_SSE2)
+
+#include <emmintrin.h>
+
+#include "mathop.h"
+#include "sift_sse2.h"
+
+/* The functions below evaluate the same floating point operations in
+ * the same order as the scalar code in sift.c (vl_fast_sqrt_f,
+ * vl_fast_atan2_f, vl_mod_2pi_f), hence the results are identical.
+ */
+
+VL_INLINE __m128
+_vl_select_sse2 (__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps (_mm_and_ps (mask, a), _mm_andnot_ps (mask, b)) ;
+}
+
+VL_INLINE __m128
+_vl_fast_sqrt_sse2 (__m128 x)
+{
+  __m128 const xhalf = _mm_mul_ps (_mm_set1_ps (0.5F), x) ;
+  __m128 const three_halfs = _mm_set1_ps (1.5F) ;
+  __m128i i = _mm_castps_si128 (x) ;
+  __m128 u ;
+  i = _mm_sub_epi32 (_mm_set1_epi32 (0x5f3759df), _mm_srli_epi32 (i, 1)) ;
+  u = _mm_castsi128_ps (i) ;
+  u = _mm_mul_ps (u, _mm_sub_ps (three_halfs,
+                                 _mm_mul_ps (_mm_mul_ps (xhalf, u), u))) ;
+  u = _mm_mul_ps (u, _mm_sub_ps (three_halfs,
+                                 _mm_mul_ps (_mm_mul_ps (xhalf, u), u))) ;
+  /* (double) x < 1e-8 is equivalent to x <= 1e-8F */
+  return _mm_andnot_ps (_mm_cmple_ps (x, _mm_set1_ps (1e-8F)),
+                        _mm_mul_ps (x, u)) ;
+}
+
+VL_INLINE __m128
+_vl_fast_atan2_sse2 (__m128 y, __m128 x)
+{
+  __m128 const sign = _mm_set1_ps (-0.0F) ;
+  __m128 const abs_y = _mm_add_ps (_mm_andnot_ps (sign, y),
+                                   _mm_set1_ps (VL_EPSILON_F)) ;
+  __m128 const pos = _mm_cmpge_ps (x, _mm_setzero_ps ()) ;
+  __m128 const r = _mm_div_ps
+    (_vl_select_sse2 (pos, _mm_sub_ps (x, abs_y), _mm_add_ps (x, abs_y)),
+     _vl_select_sse2 (pos, _mm_add_ps (x, abs_y), _mm_sub_ps (abs_y, x))) ;
+  __m128 angle = _vl_select_sse2 (pos,
+                                  _mm_set1_ps ((float) (VL_PI / 4)),
+                                  _mm_set1_ps ((float) (3 * VL_PI / 4))) ;
+  angle = _mm_add_ps
+    (angle, _mm_mul_ps (_mm_sub_ps (_mm_mul_ps (_mm_mul_ps (_mm_set1_ps (0.1821F), r), r),
+                                    _mm_set1_ps (0.9675F)), r)) ;
+  return _mm_xor_ps (angle, _mm_and_ps (_mm_cmplt_ps (y, _mm_setzero_ps ()), sign)) ;
+}
+
+VL_INLINE __m128
+_vl_angle_mod_2pi_sse2 (__m128 angle)
+{
+  /* the offset is added in double precision as in the scalar code */
+  __m128d const two_pi = _mm_set1_pd (2 * VL_PI) ;
+  __m128 const two_pi_f = _mm_set1_ps ((float) (2 * VL_PI)) ;
+  __m128 const lo = _mm_cvtpd_ps (_mm_add_pd (_mm_cvtps_pd (angle), two_pi)) ;
+  __m128 const hi = _mm_cvtpd_ps (_mm_add_pd
+    (_mm_cvtps_pd (_mm_movehl_ps (angle, angle)), two_pi)) ;
+  __m128 x = _mm_movelh_ps (lo, hi) ;
+  /* the angle is in the range [-pi, pi], hence one step suffices */
+  x = _mm_sub_ps (x, _mm_and_ps (_mm_cmpgt_ps (x, two_pi_f), two_pi_f)) ;
+  return x ;
+}
+
+void
+_vl_sift_dog_sse2 (float* dog,
+                   float const* src_a, float const* src_b,
+                   vl_size n)
+{
+  vl_size i = 0 ;
+  for ( ; i + 4 <= n ; i += 4) {
+    _mm_storeu_ps (dog + i, _mm_sub_ps (_mm_loadu_ps (src_b + i),
+                                        _mm_loadu_ps (src_a + i))) ;
+  }
+  for ( ; i < n ; ++i) {
+    dog [i] = src_b [i] - src_a [i] ;
+  }
+}
+
+vl_size
+_vl_sift_gradient_sse2 (float* grad, float const* src,
+                        vl_size n, vl_size yo)
+{
+  __m128 const half = _mm_set1_ps (0.5F) ;
+  vl_size i = 0 ;
+  for ( ; i + 4 <= n ; i += 4) {
+    float const* pt = src + i ;
+    __m128 const gx = _mm_mul_ps (half, _mm_sub_ps (_mm_loadu_ps (pt + 1),
+                                                    _mm_loadu_ps (pt - 1))) ;
+    __m128 const gy = _mm_mul_ps (half, _mm_sub_ps (_mm_loadu_ps (pt + yo),
+                                                    _mm_loadu_ps (pt - yo))) ;
+    __m128 const mod = _vl_fast_sqrt_sse2
+      (_mm_add_ps (_mm_mul_ps (gx, gx), _mm_mul_ps (gy, gy))) ;
+    __m128 const angle = _vl_angle_mod_2pi_sse2 (_vl_fast_atan2_sse2 (gy, gx)) ;
+    _mm_storeu_ps (grad + 2 * i,     _mm_unpacklo_ps (mod, angle)) ;
+    _mm_storeu_ps (grad + 2 * i + 4, _mm_unpackhi_ps (mod, angle)) ;
+  }
+  return i ;
+}
+
+/* ! VL_DISABLE_SSE2 */
+#endif
@@ -0,0 +1,32 @@
+/** @file sift_sse2.h
+ ** @brief Vectorized SIFT operations - SSE2
+ **/
+
+/*
+Copyright (C) 2007-12 Andrea Vedaldi and Brian Fulkerson.
+All rights reserved.
+
+This file is part of the VLFeat library and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef VL_SIFT_SSE2_H
+#define VL_SIFT_SSE2_H
+
+#include "generic.h"
+
+#ifndef VL_DISABLE_SSE2
+
+VL_EXPORT
+void _vl_sift_dog_sse2 (float* dog,
+                        float const* src_a, float const* src_b,
+                        vl_size n) ;
+
+VL_EXPORT
+vl_size _vl_sift_gradient_sse2 (float* grad, float const* src,
+                                vl_size n, vl_size yo) ;
+
+#endif
+
+/* VL_SIFT_SSE2_H */
+#endif
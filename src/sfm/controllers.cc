@@ -18,6 +18,7 @@
 
 #include <boost/filesystem.hpp>
 
+#include "base/feature_store.h"
 #include "util/misc.h"
 
 namespace colmap {
@@ -243,7 +244,13 @@ bool IncrementalMapperController::LoadDatabase() {
       static_cast<size_t>(options_->mapper_options->min_num_matches);
   database_cache_.Load(database, min_num_matches,
                        options_->mapper_options->ignore_watermarks,
-                       options_->mapper_options->image_names);
+                       options_->mapper_options->image_names,
+                       FeatureStore::DefaultPath(*options_->database_path),
+                       options_->mapper_options->num_threads,
+                       options_->mapper_options->scene_graph_snapshot
+                           ? DatabaseCache::DefaultSceneGraphPath(
+                                 *options_->database_path)
+                           : "");
   std::cout << std::endl;
   timer.PrintMinutes();
 
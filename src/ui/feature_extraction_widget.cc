@@ -90,6 +90,10 @@ SIFTExtractionWidget::SIFTExtractionWidget(QWidget* parent,
       options->extraction_options->cpu;
   AddOptionInt(&cpu_options.num_threads, "cpu_num_threads", -1);
   AddOptionInt(&cpu_options.batch_size_factor, "cpu_batch_size_factor");
+  AddOptionInt(&cpu_options.num_decode_threads, "cpu_num_decode_threads", -1);
+  AddOptionBool(&cpu_options.largest_first, "cpu_largest_first");
+  AddOptionInt(&sift_options.max_tile_memory, "cpu_max_tile_memory", -1);
+  AddOptionInt(&sift_options.num_tile_threads, "cpu_num_tile_threads", -1);
 }
 
 void SIFTExtractionWidget::Run() {
@@ -81,6 +81,8 @@ void FeatureMatchingTab::CreateGeneralOptions() {
   AddSpacer();
 
   AddOptionInt(&options_->match_options->num_threads, "num_threads", -1);
+  AddOptionInt(&options_->match_options->num_verification_threads,
+               "num_verification_threads", -1);
   AddOptionBool(&options_->match_options->use_gpu, "use_gpu");
   AddOptionInt(&options_->match_options->gpu_index, "gpu_index", -1);
   AddOptionDouble(&options_->match_options->max_ratio, "max_ratio");
@@ -96,6 +98,16 @@ void FeatureMatchingTab::CreateGeneralOptions() {
   AddOptionInt(&options_->match_options->min_num_inliers, "min_num_inliers");
   AddOptionBool(&options_->match_options->multiple_models, "multiple_models");
   AddOptionBool(&options_->match_options->guided_matching, "guided_matching");
+  AddOptionBool(&options_->match_options->cpu_kd_forest, "cpu_kd_forest");
+  AddOptionInt(&options_->match_options->cpu_kd_forest_num_trees,
+               "cpu_kd_forest_num_trees", 1);
+  AddOptionInt(&options_->match_options->cpu_kd_forest_checks,
+               "cpu_kd_forest_checks", 1);
+  AddOptionBool(&options_->match_options->cpu_cascade_hashing,
+                "cpu_cascade_hashing");
+  AddOptionInt(&options_->match_options->cpu_cascade_hashing_num_candidates,
+               "cpu_cascade_hashing_num_candidates", 1);
+  AddOptionInt(&options_->match_options->cache_size_mb, "cache_size_mb", 0);
 
   AddSpacer();
 
@@ -45,6 +45,8 @@ class GeneralTab : public OptionsWidget {
     AddSection("Other");
     AddOptionBool(&options->mapper_options->extract_colors, "extract_colors");
     AddOptionInt(&options->mapper_options->num_threads, "num_threads", -1);
+    AddOptionBool(&options->mapper_options->scene_graph_snapshot,
+                  "scene_graph_snapshot");
     AddOptionInt(&options->mapper_options->min_num_matches, "min_num_matches");
     AddOptionBool(&options->mapper_options->ignore_watermarks,
                   "ignore_watermarks");
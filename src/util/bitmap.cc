@@ -36,8 +36,23 @@ Bitmap::Bitmap(const Bitmap& other) : Bitmap() {
   SetPtr(FreeImage_Clone(data_.get()));
 }
 
+Bitmap::Bitmap(Bitmap&& other) : Bitmap() { *this = std::move(other); }
+
 Bitmap::Bitmap(FIBITMAP* data) : Bitmap() { SetPtr(data); }
 
+Bitmap& Bitmap::operator=(Bitmap&& other) {
+  if (this != &other) {
+    data_ = std::move(other.data_);
+    width_ = other.width_;
+    height_ = other.height_;
+    channels_ = other.channels_;
+    other.width_ = 0;
+    other.height_ = 0;
+    other.channels_ = 0;
+  }
+  return *this;
+}
+
 bool Bitmap::Allocate(const int width, const int height, const bool as_rgb) {
   FIBITMAP* data = nullptr;
   width_ = width;
@@ -352,7 +367,9 @@ bool Bitmap::ExifAltitude(double* altitude) {
   return false;
 }
 
-bool Bitmap::Read(const std::string& path, const bool as_rgb) {
+bool Bitmap::Read(const std::string& path, const bool as_rgb,
+                  const int max_image_size, int* original_width,
+                  int* original_height) {
   if (!boost::filesystem::exists(path)) {
     return false;
   }
@@ -363,9 +380,38 @@ bool Bitmap::Read(const std::string& path, const bool as_rgb) {
     return false;
   }
 
-  FIBITMAP* fi_bitmap = FreeImage_Load(format, path.c_str());
+  // Determine the original dimensions from the JPEG header and let the
+  // decoder down-sample the image by a power of two, such that it is still
+  // at least as large as the maximum dimension.
+  int width = -1;
+  int height = -1;
+  int load_flags = 0;
+  if (max_image_size > 0 && format == FIF_JPEG &&
+      FreeImage_FIFSupportsNoPixels(format)) {
+    FIBITMAP* header_bitmap =
+        FreeImage_Load(format, path.c_str(), FIF_LOAD_NOPIXELS);
+    if (header_bitmap != nullptr) {
+      width = FreeImage_GetWidth(header_bitmap);
+      height = FreeImage_GetHeight(header_bitmap);
+      FreeImage_Unload(header_bitmap);
+      if (std::max(width, height) > max_image_size) {
+        load_flags = max_image_size << 16;
+      }
+    }
+  }
+
+  FIBITMAP* fi_bitmap = FreeImage_Load(format, path.c_str(), load_flags);
+  if (fi_bitmap == nullptr) {
+    return false;
+  }
+
   data_ = FIBitmapPtr(fi_bitmap, &FreeImage_Unload);
 
+  if (load_flags == 0) {
+    width = FreeImage_GetWidth(fi_bitmap);
+    height = FreeImage_GetHeight(fi_bitmap);
+  }
+
   const FREE_IMAGE_COLOR_TYPE color_type = FreeImage_GetColorType(fi_bitmap);
 
   const bool is_grey =
@@ -375,9 +421,11 @@ bool Bitmap::Read(const std::string& path, const bool as_rgb) {
 
   if (!is_rgb && as_rgb) {
     FIBITMAP* converted_bitmap = FreeImage_ConvertTo24Bits(fi_bitmap);
+    FreeImage_CloneMetadata(converted_bitmap, fi_bitmap);
     data_ = FIBitmapPtr(converted_bitmap, &FreeImage_Unload);
   } else if (!is_grey && !as_rgb) {
     FIBITMAP* converted_bitmap = FreeImage_ConvertToGreyscale(fi_bitmap);
+    FreeImage_CloneMetadata(converted_bitmap, fi_bitmap);
     data_ = FIBitmapPtr(converted_bitmap, &FreeImage_Unload);
   }
 
@@ -385,6 +433,58 @@ bool Bitmap::Read(const std::string& path, const bool as_rgb) {
   height_ = FreeImage_GetHeight(data_.get());
   channels_ = as_rgb ? 3 : 1;
 
+  // Fit the down-sampled version exactly into the max dimensions, where the
+  // target dimensions are computed from the original dimensions, so that they
+  // do not depend on the reduction factor of the decoder.
+  if (max_image_size > 0 && std::max(width, height) > max_image_size) {
+    const double scale =
+        static_cast<double>(max_image_size) / std::max(width, height);
+    const int new_width = static_cast<int>(width * scale);
+    const int new_height = static_cast<int>(height * scale);
+    if (new_width != width_ || new_height != height_) {
+      FIBITMAP* rescaled_bitmap = FreeImage_Rescale(
+          data_.get(), new_width, new_height, FILTER_BILINEAR);
+      FreeImage_CloneMetadata(rescaled_bitmap, data_.get());
+      data_ = FIBitmapPtr(rescaled_bitmap, &FreeImage_Unload);
+      width_ = new_width;
+      height_ = new_height;
+    }
+  }
+
+  if (original_width != nullptr) {
+    *original_width = width;
+  }
+  if (original_height != nullptr) {
+    *original_height = height;
+  }
+
+  return true;
+}
+
+bool Bitmap::ReadDimensions(const std::string& path, int* width,
+                            int* height) {
+  CHECK_NOTNULL(width);
+  CHECK_NOTNULL(height);
+
+  if (!boost::filesystem::exists(path)) {
+    return false;
+  }
+
+  const FREE_IMAGE_FORMAT format = FreeImage_GetFileType(path.c_str(), 0);
+  if (format == FIF_UNKNOWN || !FreeImage_FIFSupportsNoPixels(format)) {
+    return false;
+  }
+
+  FIBITMAP* header_bitmap =
+      FreeImage_Load(format, path.c_str(), FIF_LOAD_NOPIXELS);
+  if (header_bitmap == nullptr) {
+    return false;
+  }
+
+  *width = FreeImage_GetWidth(header_bitmap);
+  *height = FreeImage_GetHeight(header_bitmap);
+  FreeImage_Unload(header_bitmap);
+
   return true;
 }
 
@@ -61,6 +61,9 @@ class Bitmap {
  public:
   Bitmap();
   Bitmap(const Bitmap& other);
+  Bitmap(Bitmap&& other);
+
+  Bitmap& operator=(Bitmap&& other);
 
   // Create bitmap object from existing FreeImage bitmap object. Note that
   // this class takes ownership of the object.
@@ -120,7 +123,22 @@ class Bitmap {
   bool ExifAltitude(double* altitude);
 
   // Read bitmap at given path and convert to grey- or colorscale.
-  bool Read(const std::string& path, const bool as_rgb = true);
+  //
+  // If `max_image_size` is positive, images that exceed this maximum
+  // dimension are down-sampled to exactly fit into it, while preserving the
+  // metadata. JPEG images are then already decoded at a reduced resolution,
+  // which is much faster and uses less memory than decoding the full image.
+  // The dimensions of the image before down-sampling are optionally returned
+  // in `original_width` and `original_height`.
+  bool Read(const std::string& path, const bool as_rgb = true,
+            const int max_image_size = -1, int* original_width = nullptr,
+            int* original_height = nullptr);
+
+  // Read only the dimensions of the image at the given path from its header,
+  // without decoding the pixels. Returns false if the image cannot be read or
+  // the format does not support reading the header only.
+  static bool ReadDimensions(const std::string& path, int* width,
+                             int* height);
 
   // Write image to file. Flags can be used to set e.g. the JPEG quality.
   // Consult the FreeImage documentation for all available flags.
@@ -21,6 +21,8 @@
 #include <iostream>
 #include <vector>
 
+#include <boost/filesystem.hpp>
+
 #include "util/bitmap.h"
 
 using namespace colmap;
@@ -326,6 +328,26 @@ BOOST_AUTO_TEST_CASE(TestClone) {
   BOOST_CHECK_NE(bitmap.Data(), cloned_bitmap.Data());
 }
 
+BOOST_AUTO_TEST_CASE(TestMove) {
+  Bitmap bitmap;
+  bitmap.Allocate(100, 80, true);
+  const FIBITMAP* data = bitmap.Data();
+
+  Bitmap moved_bitmap(std::move(bitmap));
+  BOOST_CHECK_EQUAL(moved_bitmap.Data(), data);
+  BOOST_CHECK_EQUAL(moved_bitmap.Width(), 100);
+  BOOST_CHECK_EQUAL(moved_bitmap.Height(), 80);
+  BOOST_CHECK_EQUAL(moved_bitmap.Channels(), 3);
+  BOOST_CHECK(bitmap.Data() == nullptr);
+  BOOST_CHECK_EQUAL(bitmap.Width(), 0);
+
+  Bitmap assigned_bitmap;
+  assigned_bitmap = std::move(moved_bitmap);
+  BOOST_CHECK_EQUAL(assigned_bitmap.Data(), data);
+  BOOST_CHECK_EQUAL(assigned_bitmap.Width(), 100);
+  BOOST_CHECK(moved_bitmap.Data() == nullptr);
+}
+
 BOOST_AUTO_TEST_CASE(TestCloneAsRGB) {
   Bitmap bitmap;
   bitmap.Allocate(100, 100, false);
@@ -345,3 +367,64 @@ BOOST_AUTO_TEST_CASE(TestCloneAsGrey) {
   BOOST_CHECK_EQUAL(cloned_bitmap.Channels(), 1);
   BOOST_CHECK_NE(bitmap.Data(), cloned_bitmap.Data());
 }
+
+BOOST_AUTO_TEST_CASE(TestReadMaxImageSize) {
+  const std::string path_prefix =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%"))
+          .string();
+  for (const std::string extension : {".jpg", ".png"}) {
+    const std::string path = path_prefix + extension;
+
+    Bitmap bitmap;
+    bitmap.Allocate(400, 300, false);
+    bitmap.Fill(BitmapColor<uint8_t>(128, 128, 128));
+    BOOST_CHECK(bitmap.Write(path));
+
+    Bitmap read_bitmap;
+    int original_width = 0;
+    int original_height = 0;
+    BOOST_CHECK(read_bitmap.Read(path, false, -1, &original_width,
+                                 &original_height));
+    BOOST_CHECK_EQUAL(read_bitmap.Width(), 400);
+    BOOST_CHECK_EQUAL(read_bitmap.Height(), 300);
+    BOOST_CHECK_EQUAL(original_width, 400);
+    BOOST_CHECK_EQUAL(original_height, 300);
+
+    BOOST_CHECK(read_bitmap.Read(path, false, 150, &original_width,
+                                 &original_height));
+    BOOST_CHECK_EQUAL(read_bitmap.Width(), 150);
+    BOOST_CHECK_EQUAL(read_bitmap.Height(), 112);
+    BOOST_CHECK(read_bitmap.IsGrey());
+    BOOST_CHECK_EQUAL(original_width, 400);
+    BOOST_CHECK_EQUAL(original_height, 300);
+
+    BOOST_CHECK(read_bitmap.Read(path, true, 1000));
+    BOOST_CHECK_EQUAL(read_bitmap.Width(), 400);
+    BOOST_CHECK_EQUAL(read_bitmap.Height(), 300);
+    BOOST_CHECK(read_bitmap.IsRGB());
+
+    boost::filesystem::remove(path);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestReadDimensions) {
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("%%%%-%%%%-%%%%.jpg"))
+          .string();
+
+  int width = 0;
+  int height = 0;
+  BOOST_CHECK(!Bitmap::ReadDimensions(path, &width, &height));
+
+  Bitmap bitmap;
+  bitmap.Allocate(400, 300, true);
+  BOOST_CHECK(bitmap.Write(path));
+
+  BOOST_CHECK(Bitmap::ReadDimensions(path, &width, &height));
+  BOOST_CHECK_EQUAL(width, 400);
+  BOOST_CHECK_EQUAL(height, 300);
+
+  boost::filesystem::remove(path);
+}
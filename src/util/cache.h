@@ -17,8 +17,13 @@
 #ifndef COLMAP_SRC_UTIL_CACHE_H_
 #define COLMAP_SRC_UTIL_CACHE_H_
 
+#include <functional>
+#include <future>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "util/logging.h"
 
@@ -59,6 +64,71 @@ class LRUCache {
   const std::function<value_t(const key_t&)> getter_func_;
 };
 
+// Thread-safe LRU cache of immutable values, which are handed out as shared
+// pointers that remain valid after their element is evicted. The elements are
+// distributed over multiple shards with separate locks and an even share of
+// the capacity, so that concurrent accesses of different keys rarely contend.
+// The capacity is bounded by the number of elements and by their total number
+// of bytes, as computed by the given function. Each shard keeps at least its
+// most recently used element. Concurrent requests of a missing element only
+// compute its value once.
+template <typename key_t, typename value_t>
+class SharedLRUCache {
+ public:
+  typedef std::shared_ptr<const value_t> value_ptr_t;
+
+  SharedLRUCache(const size_t max_num_elems, const size_t max_num_bytes,
+                 const size_t num_shards,
+                 const std::function<value_ptr_t(const key_t&)>& getter_func,
+                 const std::function<size_t(const value_t&)>& num_bytes_func);
+
+  // The number of elements in the cache.
+  size_t NumElems() const;
+
+  // The total number of bytes of the elements in the cache.
+  size_t NumBytes() const;
+
+  // Check whether the element with the given key exists.
+  bool Exists(const key_t& key) const;
+
+  // Manually set the value of an element.
+  void Set(const key_t& key, const value_ptr_t& value);
+
+  // Get the value of an element either from the cache or compute the new value.
+  // The value is computed without holding the lock of the shard, and callers
+  // requesting the same element in the meantime wait for its value.
+  value_ptr_t Get(const key_t& key);
+
+ private:
+  struct Elem {
+    key_t key;
+    value_ptr_t value;
+    size_t num_bytes;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    size_t num_bytes = 0;
+    std::list<Elem> elems_list;
+    std::unordered_map<key_t, typename std::list<Elem>::iterator> elems_map;
+    // Values that are currently computed by another caller.
+    std::unordered_map<key_t, std::shared_future<value_ptr_t>> pending_values;
+  };
+
+  Shard& GetShard(const key_t& key) const;
+
+  // Insert the element into the locked shard and evict the least-recently-used
+  // elements of the shard, while the shard exceeds its capacity.
+  void SetInShard(const key_t& key, const value_ptr_t& value,
+                  const size_t num_bytes, Shard* shard);
+
+  const size_t max_num_elems_per_shard_;
+  const size_t max_num_bytes_per_shard_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  const std::function<value_ptr_t(const key_t&)> getter_func_;
+  const std::function<size_t(const value_t&)> num_bytes_func_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -111,6 +181,143 @@ const value_t& LRUCache<key_t, value_t>::Get(const key_t& key) {
   }
 }
 
+template <typename key_t, typename value_t>
+SharedLRUCache<key_t, value_t>::SharedLRUCache(
+    const size_t max_num_elems, const size_t max_num_bytes,
+    const size_t num_shards,
+    const std::function<value_ptr_t(const key_t&)>& getter_func,
+    const std::function<size_t(const value_t&)>& num_bytes_func)
+    : max_num_elems_per_shard_((max_num_elems + num_shards - 1) / num_shards),
+      max_num_bytes_per_shard_(max_num_bytes / num_shards),
+      getter_func_(getter_func),
+      num_bytes_func_(num_bytes_func) {
+  CHECK_GT(num_shards, 0);
+  CHECK(getter_func);
+  CHECK(num_bytes_func);
+  shards_.reserve(num_shards);
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+template <typename key_t, typename value_t>
+size_t SharedLRUCache<key_t, value_t>::NumElems() const {
+  size_t num_elems = 0;
+  for (const auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    num_elems += shard->elems_map.size();
+  }
+  return num_elems;
+}
+
+template <typename key_t, typename value_t>
+size_t SharedLRUCache<key_t, value_t>::NumBytes() const {
+  size_t num_bytes = 0;
+  for (const auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    num_bytes += shard->num_bytes;
+  }
+  return num_bytes;
+}
+
+template <typename key_t, typename value_t>
+bool SharedLRUCache<key_t, value_t>::Exists(const key_t& key) const {
+  const Shard& shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  return shard.elems_map.find(key) != shard.elems_map.end();
+}
+
+template <typename key_t, typename value_t>
+void SharedLRUCache<key_t, value_t>::Set(const key_t& key,
+                                         const value_ptr_t& value) {
+  CHECK(value);
+  const size_t num_bytes = num_bytes_func_(*value);
+  Shard& shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  SetInShard(key, value, num_bytes, &shard);
+}
+
+template <typename key_t, typename value_t>
+typename SharedLRUCache<key_t, value_t>::value_ptr_t
+SharedLRUCache<key_t, value_t>::Get(const key_t& key) {
+  Shard& shard = GetShard(key);
+
+  std::promise<value_ptr_t> promise;
+  {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    const auto it = shard.elems_map.find(key);
+    if (it != shard.elems_map.end()) {
+      shard.elems_list.splice(shard.elems_list.begin(), shard.elems_list,
+                              it->second);
+      return it->second->value;
+    }
+
+    const auto pending_it = shard.pending_values.find(key);
+    if (pending_it != shard.pending_values.end()) {
+      const std::shared_future<value_ptr_t> pending_value = pending_it->second;
+      lock.unlock();
+      return pending_value.get();
+    }
+
+    shard.pending_values.emplace(key, promise.get_future().share());
+  }
+
+  value_ptr_t value;
+  try {
+    value = getter_func_(key);
+    CHECK(value);
+  } catch (...) {
+    {
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      shard.pending_values.erase(key);
+    }
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+
+  const size_t num_bytes = num_bytes_func_(*value);
+  {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    SetInShard(key, value, num_bytes, &shard);
+    shard.pending_values.erase(key);
+  }
+
+  promise.set_value(value);
+
+  return value;
+}
+
+template <typename key_t, typename value_t>
+typename SharedLRUCache<key_t, value_t>::Shard&
+SharedLRUCache<key_t, value_t>::GetShard(const key_t& key) const {
+  return *shards_[std::hash<key_t>()(key) % shards_.size()];
+}
+
+template <typename key_t, typename value_t>
+void SharedLRUCache<key_t, value_t>::SetInShard(const key_t& key,
+                                                const value_ptr_t& value,
+                                                const size_t num_bytes,
+                                                Shard* shard) {
+  const auto it = shard->elems_map.find(key);
+  if (it != shard->elems_map.end()) {
+    shard->num_bytes -= it->second->num_bytes;
+    shard->elems_list.erase(it->second);
+  }
+
+  shard->elems_list.push_front(Elem{key, value, num_bytes});
+  shard->elems_map[key] = shard->elems_list.begin();
+  shard->num_bytes += num_bytes;
+
+  while (shard->elems_list.size() > 1 &&
+         (shard->elems_list.size() > max_num_elems_per_shard_ ||
+          shard->num_bytes > max_num_bytes_per_shard_)) {
+    const Elem& last = shard->elems_list.back();
+    shard->num_bytes -= last.num_bytes;
+    shard->elems_map.erase(last.key);
+    shard->elems_list.pop_back();
+  }
+}
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_UTIL_CACHE_H_
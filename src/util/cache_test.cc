@@ -18,6 +18,10 @@
 #define BOOST_TEST_MODULE "util/cache"
 #include <boost/test/unit_test.hpp>
 
+#include <atomic>
+#include <limits>
+#include <thread>
+
 #include "util/cache.h"
 
 using namespace colmap;
@@ -73,3 +77,93 @@ BOOST_AUTO_TEST_CASE(TestSet) {
   BOOST_CHECK(!cache.Exists(1));
   BOOST_CHECK(cache.Exists(6));
 }
+
+BOOST_AUTO_TEST_CASE(TestSharedLRUCacheGet) {
+  SharedLRUCache<int, int> cache(
+      5, std::numeric_limits<size_t>::max(), 1,
+      [](const int key) { return std::make_shared<const int>(key); },
+      [](const int value) { return sizeof(int); });
+  BOOST_CHECK_EQUAL(cache.NumElems(), 0);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 0);
+  for (int i = 0; i < 5; ++i) {
+    BOOST_CHECK_EQUAL(*cache.Get(i), i);
+    BOOST_CHECK_EQUAL(cache.NumElems(), i + 1);
+    BOOST_CHECK_EQUAL(cache.NumBytes(), (i + 1) * sizeof(int));
+    BOOST_CHECK(cache.Exists(i));
+  }
+
+  const auto value0 = cache.Get(0);
+  BOOST_CHECK_EQUAL(*cache.Get(5), 5);
+  BOOST_CHECK_EQUAL(cache.NumElems(), 5);
+  BOOST_CHECK(cache.Exists(0));
+  BOOST_CHECK(!cache.Exists(1));
+  BOOST_CHECK(cache.Exists(5));
+
+  cache.Set(6, std::make_shared<const int>(-1));
+  BOOST_CHECK_EQUAL(*cache.Get(6), -1);
+  BOOST_CHECK_EQUAL(cache.NumElems(), 5);
+  BOOST_CHECK(!cache.Exists(2));
+
+  // Evicted values remain valid.
+  for (int i = 7; i < 12; ++i) {
+    cache.Get(i);
+  }
+  BOOST_CHECK(!cache.Exists(0));
+  BOOST_CHECK_EQUAL(*value0, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedLRUCacheNumBytes) {
+  SharedLRUCache<int, std::vector<char>> cache(
+      100, 10, 2,
+      [](const int key) {
+        return std::make_shared<const std::vector<char>>(key);
+      },
+      [](const std::vector<char>& value) { return value.size(); });
+
+  // Keys 2 and 4 are in the same shard with a capacity of 5 bytes.
+  cache.Get(2);
+  cache.Get(4);
+  BOOST_CHECK(!cache.Exists(2));
+  BOOST_CHECK(cache.Exists(4));
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 4);
+
+  // The most recently used element is kept, even if it exceeds the capacity.
+  cache.Get(1);
+  cache.Get(7);
+  BOOST_CHECK(!cache.Exists(1));
+  BOOST_CHECK(cache.Exists(7));
+  BOOST_CHECK(cache.Exists(4));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 2);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 11);
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedLRUCacheConcurrentGet) {
+  std::atomic<int> num_getter_calls(0);
+  SharedLRUCache<int, int> cache(
+      100, std::numeric_limits<size_t>::max(), 4,
+      [&num_getter_calls](const int key) {
+        num_getter_calls += 1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return std::make_shared<const int>(key);
+      },
+      [](const int value) { return sizeof(int); });
+
+  std::atomic<int> num_wrong_values(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&cache, &num_wrong_values]() {
+      for (int key = 0; key < 20; ++key) {
+        if (*cache.Get(key) != key) {
+          num_wrong_values += 1;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  BOOST_CHECK_EQUAL(num_wrong_values, 0);
+  BOOST_CHECK_EQUAL(num_getter_calls, 20);
+  BOOST_CHECK_EQUAL(cache.NumElems(), 20);
+}
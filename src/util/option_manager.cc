@@ -91,6 +91,15 @@ void BaseOptions::Reset() {}
 
 bool BaseOptions::Check() { return false; }
 
+DatabaseOptions::DatabaseOptions() { Reset(); }
+
+void DatabaseOptions::Reset() {
+  collect_stats = false;
+  quantize_keypoints = false;
+}
+
+bool DatabaseOptions::Check() { return true; }
+
 ExtractionOptions::ExtractionOptions() { Reset(); }
 
 void ExtractionOptions::Reset() {
@@ -103,6 +112,9 @@ bool ExtractionOptions::Check() {
   bool verified = true;
 
   CHECK_OPTION(ExtractionOptions, reader.default_focal_length_factor, > 0);
+  CHECK_OPTION(ExtractionOptions, reader.num_shards, > 0);
+  CHECK_OPTION(ExtractionOptions, reader.shard_index, >= 0);
+  CHECK_OPTION(ExtractionOptions, reader.shard_index, < reader.num_shards);
 
   if (!reader.camera_model.empty()) {
     const auto model_id = CameraModelNameToId(reader.camera_model);
@@ -124,6 +136,8 @@ bool ExtractionOptions::Check() {
   CHECK_OPTION(ExtractionOptions, sift.peak_threshold, > 0);
   CHECK_OPTION(ExtractionOptions, sift.edge_threshold, > 0);
   CHECK_OPTION(ExtractionOptions, sift.max_num_orientations, > 0);
+  CHECK_OPTION(ExtractionOptions, sift.num_tile_threads, >= -1);
+  CHECK_OPTION(ExtractionOptions, sift.num_tile_threads, != 0);
   CHECK_OPTION(ExtractionOptions, cpu.batch_size_factor, > 0);
 
   return verified;
@@ -134,6 +148,7 @@ MatchOptions::MatchOptions() { Reset(); }
 void MatchOptions::Reset() {
   SiftMatchOptions options;
   num_threads = options.num_threads;
+  num_verification_threads = options.num_verification_threads;
   use_gpu = options.use_gpu;
   gpu_index = options.gpu_index;
   max_ratio = options.max_ratio;
@@ -147,12 +162,22 @@ void MatchOptions::Reset() {
   min_num_inliers = options.min_num_inliers;
   multiple_models = options.multiple_models;
   guided_matching = options.guided_matching;
+  cpu_kd_forest = options.cpu_kd_forest;
+  cpu_kd_forest_num_trees = options.cpu_kd_forest_num_trees;
+  cpu_kd_forest_checks = options.cpu_kd_forest_checks;
+  cpu_cascade_hashing = options.cpu_cascade_hashing;
+  cpu_cascade_hashing_num_candidates =
+      options.cpu_cascade_hashing_num_candidates;
+  cache_size_mb = options.cache_size_mb;
+  num_shards = options.num_shards;
+  shard_index = options.shard_index;
 }
 
 bool MatchOptions::Check() {
   bool verified = true;
 
   CHECK_OPTION(MatchOptions, num_threads, >= -1);
+  CHECK_OPTION(MatchOptions, num_verification_threads, >= -1);
   CHECK_OPTION(MatchOptions, gpu_index, >= -1);
   CHECK_OPTION(MatchOptions, max_ratio, >= 0);
   CHECK_OPTION(MatchOptions, max_ratio, <= 1);
@@ -165,6 +190,13 @@ bool MatchOptions::Check() {
   CHECK_OPTION(MatchOptions, min_inlier_ratio, >= 0);
   CHECK_OPTION(MatchOptions, min_inlier_ratio, <= 1);
   CHECK_OPTION(MatchOptions, min_num_inliers, >= 0);
+  CHECK_OPTION(MatchOptions, num_shards, > 0);
+  CHECK_OPTION(MatchOptions, shard_index, >= 0);
+  CHECK_OPTION(MatchOptions, shard_index, < num_shards);
+  CHECK_OPTION(MatchOptions, cpu_kd_forest_num_trees, > 0);
+  CHECK_OPTION(MatchOptions, cpu_kd_forest_checks, > 0);
+  CHECK_OPTION(MatchOptions, cpu_cascade_hashing_num_candidates, > 0);
+  CHECK_OPTION(MatchOptions, cache_size_mb, >= 0);
 
   return verified;
 }
@@ -172,6 +204,7 @@ bool MatchOptions::Check() {
 SiftMatchOptions MatchOptions::Options() const {
   SiftMatchOptions options;
   options.num_threads = num_threads;
+  options.num_verification_threads = num_verification_threads;
   options.use_gpu = use_gpu;
   options.gpu_index = gpu_index;
   options.max_ratio = max_ratio;
@@ -185,6 +218,15 @@ SiftMatchOptions MatchOptions::Options() const {
   options.min_num_inliers = min_num_inliers;
   options.multiple_models = multiple_models;
   options.guided_matching = guided_matching;
+  options.cpu_kd_forest = cpu_kd_forest;
+  options.cpu_kd_forest_num_trees = cpu_kd_forest_num_trees;
+  options.cpu_kd_forest_checks = cpu_kd_forest_checks;
+  options.cpu_cascade_hashing = cpu_cascade_hashing;
+  options.cpu_cascade_hashing_num_candidates =
+      cpu_cascade_hashing_num_candidates;
+  options.cache_size_mb = cache_size_mb;
+  options.num_shards = num_shards;
+  options.shard_index = shard_index;
   return options;
 }
 
@@ -490,6 +532,8 @@ void MapperOptions::Reset() {
 
   num_threads = -1;
 
+  scene_graph_snapshot = false;
+
   min_focal_length_ratio = 0.1;   // Opening angle of ~130deg
   max_focal_length_ratio = 10.0;  // Opening angle of ~5deg
   max_extra_param = 1.0;
@@ -711,6 +755,7 @@ OptionManager::OptionManager() {
   database_path.reset(new std::string());
   image_path.reset(new std::string());
 
+  database_options.reset(new DatabaseOptions());
   extraction_options.reset(new ExtractionOptions());
   match_options.reset(new MatchOptions());
   exhaustive_match_options.reset(new ExhaustiveMatchOptions());
@@ -779,6 +824,9 @@ void OptionManager::AddDatabaseOptions() {
       "General.database_path",
       config::value<std::string>(database_path.get())->required());
   RegisterOption("General.database_path", database_path.get());
+
+  ADD_OPTION_DEFAULT(DatabaseOptions, database_options, collect_stats);
+  ADD_OPTION_DEFAULT(DatabaseOptions, database_options, quantize_keypoints);
 }
 
 void OptionManager::AddImageOptions() {
@@ -819,6 +867,8 @@ void OptionManager::AddExtractionOptions() {
                      reader.camera_params);
   ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
                      reader.default_focal_length_factor);
+  ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options, reader.num_shards);
+  ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options, reader.shard_index);
 
   ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
                      sift.max_image_size);
@@ -834,10 +884,19 @@ void OptionManager::AddExtractionOptions() {
   ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
                      sift.max_num_orientations);
   ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options, sift.upright);
+  ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
+                     sift.max_tile_memory);
+  ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
+                     sift.num_tile_threads);
 
   ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
                      cpu.batch_size_factor);
   ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options, cpu.num_threads);
+  ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
+                     cpu.num_decode_threads);
+  ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options, cpu.largest_first);
+  ADD_OPTION_DEFAULT(ExtractionOptions, extraction_options,
+                     cpu.image_log_path);
 }
 
 void OptionManager::AddMatchOptions() {
@@ -847,6 +906,7 @@ void OptionManager::AddMatchOptions() {
   added_match_options_ = true;
 
   ADD_OPTION_DEFAULT(MatchOptions, match_options, num_threads);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, num_verification_threads);
   ADD_OPTION_DEFAULT(MatchOptions, match_options, use_gpu);
   ADD_OPTION_DEFAULT(MatchOptions, match_options, gpu_index);
   ADD_OPTION_DEFAULT(MatchOptions, match_options, max_ratio);
@@ -860,6 +920,15 @@ void OptionManager::AddMatchOptions() {
   ADD_OPTION_DEFAULT(MatchOptions, match_options, min_num_inliers);
   ADD_OPTION_DEFAULT(MatchOptions, match_options, multiple_models);
   ADD_OPTION_DEFAULT(MatchOptions, match_options, guided_matching);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, cpu_kd_forest);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, cpu_kd_forest_num_trees);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, cpu_kd_forest_checks);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, cpu_cascade_hashing);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options,
+                     cpu_cascade_hashing_num_candidates);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, cache_size_mb);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, num_shards);
+  ADD_OPTION_DEFAULT(MatchOptions, match_options, shard_index);
 }
 
 void OptionManager::AddExhaustiveMatchOptions() {
@@ -960,6 +1029,7 @@ void OptionManager::AddMapperOptions() {
   ADD_OPTION_DEFAULT(MapperOptions, mapper_options, init_num_trials);
   ADD_OPTION_DEFAULT(MapperOptions, mapper_options, extract_colors);
   ADD_OPTION_DEFAULT(MapperOptions, mapper_options, num_threads);
+  ADD_OPTION_DEFAULT(MapperOptions, mapper_options, scene_graph_snapshot);
   ADD_OPTION_DEFAULT(MapperOptions, mapper_options, min_focal_length_ratio);
   ADD_OPTION_DEFAULT(MapperOptions, mapper_options, max_focal_length_ratio);
   ADD_OPTION_DEFAULT(MapperOptions, mapper_options, max_extra_param);
@@ -1127,6 +1197,7 @@ void OptionManager::Reset() {
   database_path->clear();
   image_path->clear();
 
+  database_options->Reset();
   extraction_options->Reset();
   match_options->Reset();
   exhaustive_match_options->Reset();
@@ -1176,6 +1247,9 @@ bool OptionManager::Parse(const int argc, char** argv) {
       return Read(*project_path);
     } else {
       vmap.notify();
+      Database::SetDefaultCollectStats(database_options->collect_stats);
+      Database::SetDefaultQuantizeKeypoints(
+          database_options->quantize_keypoints);
     }
   } catch (std::exception& e) {
     std::cout << "ERROR: Failed to parse options " << e.what() << "."
@@ -1208,6 +1282,9 @@ bool OptionManager::Read(const std::string& path) {
     CHECK(file.is_open());
     config::store(config::parse_config_file(file, *desc_), vmap);
     vmap.notify();
+    Database::SetDefaultCollectStats(database_options->collect_stats);
+    Database::SetDefaultQuantizeKeypoints(
+        database_options->quantize_keypoints);
   } catch (std::exception& e) {
     std::cout << "ERROR: Failed to parse options " << e.what() << "."
               << std::endl;
@@ -1257,6 +1334,7 @@ bool OptionManager::Check() {
                       boost::filesystem::path(*database_path).parent_path());
   verified = verified && boost::filesystem::is_directory(*image_path);
 
+  verified = verified && database_options->Check();
   verified = verified && extraction_options->Check();
   verified = verified && match_options->Check();
   verified = verified && exhaustive_match_options->Check();
@@ -42,6 +42,19 @@ struct BaseOptions {
   virtual bool Check() = 0;
 };
 
+struct DatabaseOptions : public BaseOptions {
+  DatabaseOptions();
+
+  void Reset() override;
+  bool Check() override;
+
+  // Whether to collect and print profiling statistics of the connections.
+  bool collect_stats;
+
+  // Whether to store newly written keypoints in the quantized encoding.
+  bool quantize_keypoints;
+};
+
 struct ExtractionOptions : public BaseOptions {
   ExtractionOptions();
 
@@ -62,6 +75,7 @@ struct MatchOptions : public BaseOptions {
   SiftMatchOptions Options() const;
 
   int num_threads;
+  int num_verification_threads;
   bool use_gpu;
   int gpu_index;
   double max_ratio;
@@ -75,6 +89,14 @@ struct MatchOptions : public BaseOptions {
   int min_num_inliers;
   bool multiple_models;
   bool guided_matching;
+  bool cpu_kd_forest;
+  int cpu_kd_forest_num_trees;
+  int cpu_kd_forest_checks;
+  bool cpu_cascade_hashing;
+  int cpu_cascade_hashing_num_candidates;
+  int cache_size_mb;
+  int num_shards;
+  int shard_index;
 };
 
 struct ExhaustiveMatchOptions : public BaseOptions {
@@ -237,6 +259,9 @@ struct MapperOptions : public BaseOptions {
 
   int num_threads;
 
+  // Whether to cache the scene graph in a snapshot next to the database.
+  bool scene_graph_snapshot;
+
   double min_focal_length_ratio;
   double max_focal_length_ratio;
   double max_extra_param;
@@ -337,6 +362,7 @@ class OptionManager {
   std::shared_ptr<std::string> database_path;
   std::shared_ptr<std::string> image_path;
 
+  std::shared_ptr<DatabaseOptions> database_options;
   std::shared_ptr<ExtractionOptions> extraction_options;
   std::shared_ptr<MatchOptions> match_options;
   std::shared_ptr<ExhaustiveMatchOptions> exhaustive_match_options;